@@ -0,0 +1,69 @@
+#include "tests.h"
+#include "../gta5-extended-video-export/bulk-copy.h"
+#include <cstring>
+#include <vector>
+
+namespace {
+	// Bytes around the destination that must not be touched.
+	const size_t GUARD = 64;
+	const uint8_t GUARD_VALUE = 0xA5;
+}
+
+int testBulkCopy() {
+	int failures = 0;
+
+	// Lengths around the threshold and the 64/128 byte blocks, with the
+	// source and destination at every offset within a 32 byte line.
+	const size_t lengths[] = {
+		0, 1, 63, 4099,
+		Encoder::BULK_COPY_THRESHOLD - 1,
+		Encoder::BULK_COPY_THRESHOLD,
+		Encoder::BULK_COPY_THRESHOLD + 1,
+		Encoder::BULK_COPY_THRESHOLD + 127,
+		3 * Encoder::BULK_COPY_THRESHOLD + 77,
+	};
+	const size_t maximum = 3 * Encoder::BULK_COPY_THRESHOLD + 77;
+	std::vector<uint8_t> source(maximum + 32);
+	for (size_t i = 0; i < source.size(); i++) {
+		source[i] = static_cast<uint8_t>(i * 131 + (i >> 8));
+	}
+	std::vector<uint8_t> expected(maximum + 32 + 2 * GUARD);
+	std::vector<uint8_t> result(expected.size());
+	for (size_t length : lengths) {
+		for (size_t sourceOffset : { 0, 1, 7, 16, 31 }) {
+			for (size_t destOffset : { 0, 3, 8, 17, 31 }) {
+				std::fill(expected.begin(), expected.end(), GUARD_VALUE);
+				std::fill(result.begin(), result.end(), GUARD_VALUE);
+				memcpy(&expected[GUARD + destOffset], &source[sourceOffset], length);
+				Encoder::bulkCopy(&result[GUARD + destOffset], &source[sourceOffset], length);
+				CHECK(result == expected);
+			}
+		}
+	}
+
+	// Counts below and above the threshold, with the destination aligned to 4
+	// but not to 16 bytes and the source at odd addresses.
+	const size_t counts[] = {
+		0, 1, 15, 17,
+		Encoder::BULK_COPY_THRESHOLD / 4 - 1,
+		Encoder::BULK_COPY_THRESHOLD / 4 + 13,
+		Encoder::BULK_COPY_THRESHOLD / 2 + 1,
+	};
+	const size_t maximumCount = Encoder::BULK_COPY_THRESHOLD / 2 + 1;
+	std::vector<uint32_t> expectedWide(maximumCount + 4 + 2 * GUARD);
+	std::vector<uint32_t> resultWide(expectedWide.size());
+	for (size_t count : counts) {
+		for (size_t sourceOffset : { 0, 1, 5, 15 }) {
+			for (size_t destOffset : { 0, 1, 2, 3 }) {
+				std::fill(expectedWide.begin(), expectedWide.end(), 0xA5A5A5A5);
+				std::fill(resultWide.begin(), resultWide.end(), 0xA5A5A5A5);
+				for (size_t i = 0; i < count; i++) {
+					expectedWide[GUARD + destOffset + i] = source[sourceOffset + i];
+				}
+				Encoder::bulkWiden(&resultWide[GUARD + destOffset], &source[sourceOffset], count);
+				CHECK(resultWide == expectedWide);
+			}
+		}
+	}
+	return failures;
+}
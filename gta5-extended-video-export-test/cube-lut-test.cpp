@@ -0,0 +1,49 @@
+#include "tests.h"
+#include "../gta5-extended-video-export/cube-lut.h"
+#include <fstream>
+#include <iomanip>
+#include <vector>
+
+namespace {
+	HRESULT openIdentity(Encoder::CubeLUT& lut, uint32_t size) {
+		std::string path = getTestPath("identity.cube");
+		{
+			std::ofstream file(path);
+			file << "TITLE \"identity\"" << std::endl << "LUT_3D_SIZE " << size << std::endl << std::setprecision(9);
+			for (uint32_t b = 0; b < size; b++) {
+				for (uint32_t g = 0; g < size; g++) {
+					for (uint32_t r = 0; r < size; r++) {
+						file << static_cast<double>(r) / (size - 1) << " " << static_cast<double>(g) / (size - 1) << " " << static_cast<double>(b) / (size - 1) << std::endl;
+					}
+				}
+			}
+		}
+		HRESULT result = lut.open(path);
+		DeleteFileA(path.c_str());
+		return result;
+	}
+}
+
+int testCubeLUT() {
+	int failures = 0;
+
+	// Every colour comes out of an identity cube as it went in, alpha included.
+	std::vector<uint32_t> pixels(256 * 256 * 256);
+	for (uint32_t size : { 2, 17, 33 }) {
+		Encoder::CubeLUT lut;
+		CHECK(SUCCEEDED(openIdentity(lut, size)));
+		if (lut.getSize() != size) {
+			continue;
+		}
+		for (uint32_t i = 0; i < pixels.size(); i++) {
+			pixels[i] = i | ((i * 7) << 24);
+		}
+		lut.apply(reinterpret_cast<uint8_t*>(pixels.data()), pixels.size());
+		uint32_t changed = 0;
+		for (uint32_t i = 0; i < pixels.size(); i++) {
+			changed += pixels[i] != (i | ((i * 7) << 24));
+		}
+		CHECK(changed == 0);
+	}
+	return failures;
+}
@@ -0,0 +1,98 @@
+#include "tests.h"
+#include "../gta5-extended-video-export/export-journal.h"
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+namespace {
+	const int PACKETS = 10;
+	const int PACKET_SIZE = 16 * 16;
+
+	// Writes a journal of a raw video stream, the way a session does.
+	bool writeJournal(std::string journalPath, std::string outputPath) {
+		int failures = 0;
+		AVFormatContext* fmtContext = NULL;
+		avformat_alloc_output_context2(&fmtContext, NULL, "nut", outputPath.c_str());
+		CHECK(fmtContext != nullptr);
+		AVStream* stream = fmtContext ? avformat_new_stream(fmtContext, NULL) : nullptr;
+		CHECK(stream != nullptr);
+		if (stream) {
+			stream->time_base = av_make_q(1, 30);
+			stream->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
+			stream->codecpar->codec_id = AV_CODEC_ID_RAWVIDEO;
+			stream->codecpar->format = AV_PIX_FMT_GRAY8;
+			stream->codecpar->width = 16;
+			stream->codecpar->height = 16;
+
+			Encoder::ExportJournal journal;
+			CHECK(SUCCEEDED(journal.open(journalPath, fmtContext, av_make_q(30, 1), "100-104, 200-")));
+			for (int i = 0; i < PACKETS; i++) {
+				AVPacket packet;
+				av_init_packet(&packet);
+				CHECK(av_new_packet(&packet, PACKET_SIZE) >= 0);
+				memset(packet.data, i, PACKET_SIZE);
+				packet.stream_index = 0;
+				packet.pts = i;
+				packet.dts = i;
+				packet.duration = 1;
+				packet.flags = AV_PKT_FLAG_KEY;
+				CHECK(SUCCEEDED(journal.append(&packet)));
+				av_packet_unref(&packet);
+			}
+			CHECK(SUCCEEDED(journal.close(true)));
+		}
+		avformat_free_context(fmtContext);
+		return failures == 0;
+	}
+
+	// Cuts the file short, as if the game crashed while it was written.
+	void truncate(std::string path, size_t removed) {
+		std::vector<char> contents;
+		{
+			std::ifstream file(path, std::ios::binary);
+			contents.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+		}
+		std::ofstream file(path, std::ios::binary | std::ios::trunc);
+		file.write(contents.data(), contents.size() > removed ? contents.size() - removed : 0);
+	}
+}
+
+int testExportJournal() {
+	int failures = 0;
+	std::string journalPath = getTestPath("journal.journal");
+	std::string outputPath = getTestPath("journal.nut");
+	CHECK(writeJournal(journalPath, outputPath));
+
+	// The packet that was cut in half is left out; the ones before it are recovered.
+	truncate(journalPath, PACKET_SIZE / 2);
+	{
+		Encoder::ExportJournalReader reader;
+		CHECK(SUCCEEDED(reader.open(journalPath)));
+		CHECK(reader.getOutputPath() == outputPath);
+		CHECK(SUCCEEDED(reader.recover(outputPath)));
+		CHECK(reader.getPacketCount() == PACKETS - 1);
+		CHECK(reader.getVideoFrameCount() == PACKETS - 1);
+		// 5 frames of 100-104 and 4 of 200-.
+		CHECK(reader.getResumeFrame() == 204);
+	}
+
+	AVFormatContext* input = NULL;
+	CHECK(avformat_open_input(&input, outputPath.c_str(), NULL, NULL) >= 0);
+	int packets = 0;
+	if (input) {
+		AVPacket packet;
+		av_init_packet(&packet);
+		while (av_read_frame(input, &packet) >= 0) {
+			CHECK((packet.size == PACKET_SIZE) && (packet.data[0] == packets) && (packet.data[PACKET_SIZE - 1] == packets));
+			packets++;
+			av_packet_unref(&packet);
+		}
+		avformat_close_input(&input);
+	}
+	CHECK(packets == PACKETS - 1);
+
+	DeleteFileA(journalPath.c_str());
+	DeleteFileA(outputPath.c_str());
+	return failures;
+}
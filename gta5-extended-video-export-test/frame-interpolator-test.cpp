@@ -0,0 +1,85 @@
+#include "tests.h"
+#include "../gta5-extended-video-export/frame-interpolator.h"
+#include <cmath>
+#include <vector>
+
+namespace {
+	const uint32_t WIDTH = 256;
+	const uint32_t HEIGHT = 160;
+
+	typedef std::vector<uint32_t> Pixels;
+
+	// A texture scrolling by (6, 2) pixels per frame.
+	void drawScene(Pixels& pixels, double time) {
+		for (uint32_t y = 0; y < HEIGHT; y++) {
+			for (uint32_t x = 0; x < WIDTH; x++) {
+				double u = x + time * 6;
+				double v = y + time * 2;
+				double shade = 0.5 + 0.25 * std::sin(u / 7) * std::cos(v / 11) + 0.25 * std::sin((u + v) / 23);
+				uint32_t red = static_cast<uint32_t>(255 * shade);
+				uint32_t green = static_cast<uint32_t>(200 * (1 - shade) + 40);
+				uint32_t blue = static_cast<uint32_t>(160 * shade + 60 * std::cos(v / 17) + 60);
+				pixels[y * WIDTH + x] = 0xFF000000 | (red << 16) | (green << 8) | blue;
+			}
+		}
+	}
+
+	double getPSNR(const Pixels& a, const Pixels& b) {
+		double sum = 0;
+		for (size_t i = 0; i < a.size(); i++) {
+			for (int shift = 0; shift < 24; shift += 8) {
+				double difference = static_cast<double>((a[i] >> shift) & 0xFF) - static_cast<double>((b[i] >> shift) & 0xFF);
+				sum += difference * difference;
+			}
+		}
+		double mse = sum / (a.size() * 3);
+		return mse > 0 ? 10 * std::log10(255 * 255 / mse) : 99;
+	}
+
+	const uint8_t* bytes(const Pixels& pixels) {
+		return reinterpret_cast<const uint8_t*>(pixels.data());
+	}
+}
+
+int testFrameInterpolator() {
+	int failures = 0;
+	Pixels previous(WIDTH * HEIGHT);
+	Pixels next(WIDTH * HEIGHT);
+	Pixels truth(WIDTH * HEIGHT);
+	Pixels result(WIDTH * HEIGHT);
+
+	// Between two equal frames there is nothing to move.
+	{
+		drawScene(previous, 0);
+		Encoder::FrameInterpolator interpolator(WIDTH, HEIGHT, 16);
+		interpolator.estimate(bytes(previous), bytes(previous));
+		interpolator.synthesize(bytes(previous), bytes(previous), 0.5f, reinterpret_cast<uint8_t*>(result.data()));
+		CHECK(result == previous);
+	}
+
+	// Synthesized sub-frames are closer to the rendered ones than a cross-fade,
+	// and nearly equal to them where the motion is a whole number of pixels.
+	drawScene(previous, 0);
+	drawScene(next, 1);
+	Encoder::FrameInterpolator interpolator(WIDTH, HEIGHT, 16);
+	interpolator.estimate(bytes(previous), bytes(next));
+	for (float position : { 0.25f, 0.5f, 0.75f }) {
+		drawScene(truth, position);
+		interpolator.synthesize(bytes(previous), bytes(next), position, reinterpret_cast<uint8_t*>(result.data()));
+		Pixels crossFade(WIDTH * HEIGHT);
+		for (size_t i = 0; i < crossFade.size(); i++) {
+			uint32_t color = 0;
+			for (int shift = 0; shift < 32; shift += 8) {
+				double value = ((previous[i] >> shift) & 0xFF) * (1 - position) + ((next[i] >> shift) & 0xFF) * position;
+				color |= static_cast<uint32_t>(value + 0.5) << shift;
+			}
+			crossFade[i] = color;
+		}
+		double psnr = getPSNR(result, truth);
+		CHECK(psnr > getPSNR(crossFade, truth) + 1);
+		if (position == 0.5f) {
+			CHECK(psnr > 45);
+		}
+	}
+	return failures;
+}
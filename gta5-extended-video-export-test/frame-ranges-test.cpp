@@ -0,0 +1,54 @@
+#include "tests.h"
+#include "../gta5-extended-video-export/frame-ranges.h"
+#include <vector>
+
+namespace {
+	typedef std::vector<Encoder::FrameRanges::Range> Ranges;
+}
+
+int testFrameRanges() {
+	int failures = 0;
+	const uint64_t OPEN_END = Encoder::FrameRanges::OPEN_END;
+
+	// Exported frames are counted through the ranges in order.
+	Encoder::FrameRanges ranges;
+	CHECK(SUCCEEDED(ranges.parse("200-, 100-104", 30, 1)));
+	CHECK(ranges.getRanges() == Ranges({ { 100, 104 }, { 200, OPEN_END } }));
+	CHECK(ranges.getFrameAt(0) == 100);
+	CHECK(ranges.getFrameAt(4) == 104);
+	CHECK(ranges.getFrameAt(5) == 200);
+	CHECK(ranges.getFrameAt(1000) == 1195);
+	CHECK(!ranges.contains(99) && ranges.contains(100) && ranges.contains(104) && !ranges.contains(105));
+	CHECK(!ranges.contains(199) && ranges.contains(200) && ranges.contains(OPEN_END - 1));
+
+	// Overlapping and adjacent ranges are merged; comments and blank lines are skipped.
+	CHECK(SUCCEEDED(ranges.parse("10-20; 15-30\n\n31-40 # last\n5", 30, 1)));
+	CHECK(ranges.getRanges() == Ranges({ { 5, 5 }, { 10, 40 } }));
+	CHECK(ranges.getFrameAt(0) == 5);
+	CHECK(ranges.getFrameAt(1) == 10);
+	CHECK(ranges.getFrameAt(31) == 40);
+	CHECK(ranges.getFrameAt(32) == OPEN_END);
+
+	// Timecodes count whole frames per second, clock times the exact rate.
+	// An out point in clock time leaves out the frame that starts at it.
+	CHECK(SUCCEEDED(ranges.parse("00:00:01:00-00:00:02:05", 30000, 1001)));
+	CHECK(ranges.getRanges() == Ranges({ { 30, 65 } }));
+	CHECK(SUCCEEDED(ranges.parse("0:01-0:02", 30, 1)));
+	CHECK(ranges.getRanges() == Ranges({ { 30, 59 } }));
+	CHECK(SUCCEEDED(ranges.parse("0:01-0:02", 24000, 1001)));
+	CHECK(ranges.getRanges() == Ranges({ { 24, 47 } }));
+	CHECK(SUCCEEDED(ranges.parse("0:00:00.5-", 30, 1)));
+	CHECK(ranges.getRanges() == Ranges({ { 15, OPEN_END } }));
+
+	// No ranges select every frame.
+	CHECK(SUCCEEDED(ranges.parse(" # nothing", 30, 1)));
+	CHECK(ranges.isEmpty() && ranges.contains(12345) && (ranges.getFrameAt(7) == 7));
+	CHECK(SUCCEEDED(ranges.parse("20-10", 30, 1)));
+	CHECK(ranges.isEmpty());
+
+	CHECK(FAILED(ranges.parse("1.5", 30, 1)));
+	CHECK(FAILED(ranges.parse("10-x", 30, 1)));
+	CHECK(FAILED(ranges.parse("0:00-0:00", 30, 1)));
+	CHECK(FAILED(ranges.parse("10-20", 0, 1)));
+	return failures;
+}
@@ -0,0 +1,173 @@
+#include "tests.h"
+#include "../gta5-extended-video-export/gif-quantizer.h"
+#include <cstring>
+#include <functional>
+#include <vector>
+
+extern "C" {
+#include <libavcodec\avcodec.h>
+#include <libswscale\swscale.h>
+}
+
+namespace {
+	const uint32_t WIDTH = 96;
+	const uint32_t HEIGHT = 64;
+	const size_t FRAMES = 12;
+
+	typedef std::vector<uint32_t> Pixels;
+
+	// A smooth gradient, which needs the whole palette.
+	void drawGradient(Pixels& pixels) {
+		for (uint32_t y = 0; y < HEIGHT; y++) {
+			for (uint32_t x = 0; x < WIDTH; x++) {
+				uint32_t red = x * 255 / WIDTH;
+				uint32_t green = y * 255 / HEIGHT;
+				uint32_t blue = 255 - (x + y) * 255 / (WIDTH + HEIGHT);
+				pixels[y * WIDTH + x] = 0xFF000000 | (red << 16) | (green << 8) | blue;
+			}
+		}
+	}
+
+	// Flat shapes in colours that are not on the 3-3-2 grid, with a ball moving across them.
+	void drawShapes(Pixels& pixels, size_t frame) {
+		const uint32_t colors[] = { 0xFFC87A3C, 0xFF3C8CB4, 0xFF6EB45A, 0xFFA05096, 0xFFDCC85A, 0xFF505A6E };
+		int64_t ballX = static_cast<int64_t>(frame * 6 % WIDTH);
+		int64_t ballY = HEIGHT / 2;
+		int64_t radius = HEIGHT / 6;
+		for (uint32_t y = 0; y < HEIGHT; y++) {
+			for (uint32_t x = 0; x < WIDTH; x++) {
+				uint32_t color = colors[(x / 32) + 3 * (y / 32)];
+				if ((x - ballX) * (x - ballX) + (y - ballY) * (y - ballY) < radius * radius) {
+					color = 0xFFF0F0F0;
+				}
+				pixels[y * WIDTH + x] = color;
+			}
+		}
+	}
+
+	std::vector<uint8_t> quantize(Encoder::GIFQuantizer& quantizer, const Pixels& pixels) {
+		std::vector<uint8_t> result(quantizer.getFrameSize());
+		quantizer.map(reinterpret_cast<const uint8_t*>(pixels.data()), result.data());
+		return result;
+	}
+
+	// Mean squared difference per channel between a frame and its quantized copy.
+	double getError(const Pixels& pixels, const std::vector<uint8_t>& result) {
+		const uint8_t* pPalette = result.data() + pixels.size();
+		double sum = 0;
+		for (size_t i = 0; i < pixels.size(); i++) {
+			uint32_t color;
+			memcpy(&color, pPalette + 4 * result[i], sizeof(color));
+			for (int shift = 0; shift < 24; shift += 8) {
+				double difference = static_cast<double>((pixels[i] >> shift) & 0xFF) - static_cast<double>((color >> shift) & 0xFF);
+				sum += difference * difference;
+			}
+		}
+		return sum / (pixels.size() * 3);
+	}
+
+	// Encodes frames with FFmpeg's GIF encoder and returns the number of bytes it wrote, or -1.
+	int64_t encodeGIF(AVPixelFormat format, const std::function<void(size_t, AVFrame*)>& fill) {
+		AVCodec* codec = avcodec_find_encoder(AV_CODEC_ID_GIF);
+		AVCodecContext* context = codec ? avcodec_alloc_context3(codec) : nullptr;
+		AVFrame* frame = av_frame_alloc();
+		int64_t bytes = -1;
+		if (context && frame) {
+			context->width = WIDTH;
+			context->height = HEIGHT;
+			context->pix_fmt = format;
+			context->time_base = av_make_q(1, 30);
+			frame->format = format;
+			frame->width = WIDTH;
+			frame->height = HEIGHT;
+			if ((avcodec_open2(context, codec, NULL) >= 0) && (av_frame_get_buffer(frame, 32) >= 0)) {
+				bytes = 0;
+				AVPacket packet;
+				av_init_packet(&packet);
+				packet.data = NULL;
+				packet.size = 0;
+				for (size_t i = 0; i <= FRAMES; i++) {
+					if (i < FRAMES) {
+						av_frame_make_writable(frame);
+						fill(i, frame);
+						frame->pts = i;
+					}
+					avcodec_send_frame(context, i < FRAMES ? frame : NULL);
+					while (avcodec_receive_packet(context, &packet) >= 0) {
+						bytes += packet.size;
+						av_packet_unref(&packet);
+					}
+				}
+			}
+		}
+		av_frame_free(&frame);
+		avcodec_free_context(&context);
+		return bytes;
+	}
+}
+
+int testGIFQuantizer() {
+	int failures = 0;
+
+	// Every colour of the gradient ends up close to a palette entry.
+	Pixels gradient(WIDTH * HEIGHT);
+	drawGradient(gradient);
+	{
+		Encoder::GIFQuantizer quantizer(WIDTH, HEIGHT, Encoder::GIF_DITHER_NONE);
+		quantizer.addToHistogram(reinterpret_cast<const uint8_t*>(gradient.data()));
+		quantizer.endSegment();
+		CHECK(getError(gradient, quantize(quantizer, gradient)) < 32);
+	}
+
+	// A segment of the same frames keeps the palette, and with error diffusion
+	// an unchanged frame keeps its indices.
+	{
+		Encoder::GIFQuantizer quantizer(WIDTH, HEIGHT, Encoder::GIF_DITHER_FLOYD_STEINBERG);
+		quantizer.addToHistogram(reinterpret_cast<const uint8_t*>(gradient.data()));
+		quantizer.endSegment();
+		std::vector<uint8_t> first = quantize(quantizer, gradient);
+		quantizer.addToHistogram(reinterpret_cast<const uint8_t*>(gradient.data()));
+		quantizer.endSegment();
+		std::vector<uint8_t> second = quantize(quantizer, gradient);
+		CHECK(first == second);
+		CHECK(getError(gradient, second) < 64);
+	}
+
+	// The shapes come out smaller than through swscale's fixed 3-3-2 palette,
+	// which was used before, and the quantized frames keep their colours.
+	std::vector<Pixels> clip(FRAMES, Pixels(WIDTH * HEIGHT));
+	for (size_t i = 0; i < FRAMES; i++) {
+		drawShapes(clip[i], i);
+	}
+	SwsContext* pSwsContext = sws_getContext(WIDTH, HEIGHT, AV_PIX_FMT_BGRA, WIDTH, HEIGHT, AV_PIX_FMT_RGB8, SWS_POINT, NULL, NULL, NULL);
+	CHECK(pSwsContext != nullptr);
+	if (!pSwsContext) {
+		return failures;
+	}
+	int64_t swscaleBytes = encodeGIF(AV_PIX_FMT_RGB8, [&](size_t i, AVFrame* frame) {
+		const uint8_t* source[4] = { reinterpret_cast<const uint8_t*>(clip[i].data()) };
+		int sourceLinesize[4] = { static_cast<int>(WIDTH * 4) };
+		sws_scale(pSwsContext, source, sourceLinesize, 0, HEIGHT, frame->data, frame->linesize);
+	});
+	sws_freeContext(pSwsContext);
+
+	Encoder::GIFQuantizer quantizer(WIDTH, HEIGHT, Encoder::GIF_DITHER_BAYER);
+	for (auto& pixels : clip) {
+		quantizer.addToHistogram(reinterpret_cast<const uint8_t*>(pixels.data()));
+	}
+	quantizer.endSegment();
+	double error = 0;
+	int64_t quantizerBytes = encodeGIF(AV_PIX_FMT_PAL8, [&](size_t i, AVFrame* frame) {
+		std::vector<uint8_t> result = quantize(quantizer, clip[i]);
+		error += getError(clip[i], result);
+		for (uint32_t y = 0; y < HEIGHT; y++) {
+			memcpy(frame->data[0] + y * frame->linesize[0], result.data() + y * WIDTH, WIDTH);
+		}
+		memcpy(frame->data[1], result.data() + WIDTH * HEIGHT, AVPALETTE_SIZE);
+	});
+	CHECK(swscaleBytes > 0);
+	CHECK(quantizerBytes > 0);
+	CHECK(quantizerBytes < swscaleBytes);
+	CHECK(error / FRAMES < 1);
+	return failures;
+}
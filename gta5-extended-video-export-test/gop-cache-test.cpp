@@ -0,0 +1,134 @@
+#include "tests.h"
+#include "../gta5-extended-video-export/gop-cache.h"
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <vector>
+
+namespace {
+	const uint32_t GOP_SIZE = 4;
+	const int REORDER_DELAY = 1;
+
+	struct Written {
+		int64_t pts;
+		int64_t dts;
+		bool isKey;
+		uint8_t value;
+		uint8_t run;
+	};
+
+	void removeCache(std::string directory) {
+		WIN32_FIND_DATAA data;
+		HANDLE hFind = FindFirstFileA((directory + "\\*.gop").c_str(), &data);
+		if (hFind != INVALID_HANDLE_VALUE) {
+			do {
+				DeleteFileA((directory + "\\" + data.cFileName).c_str());
+			} while (FindNextFileA(hFind, &data));
+			FindClose(hFind);
+		}
+		RemoveDirectoryA(directory.c_str());
+	}
+
+	// Exports one frame per value through the cache. The stand-in encoder holds back
+	// REORDER_DELAY frames, gives every packet a wrong dts and marks the packets with
+	// the run that encoded them. Returns the number of frames that were encoded.
+	int exportFrames(std::string directory, const std::vector<uint8_t>& values, uint8_t run, bool isKeyframeHonoured, std::vector<Written>& written) {
+		int failures = 0;
+		Encoder::GopCache cache(directory, GOP_SIZE);
+		CHECK(SUCCEEDED(cache.open(1234, REORDER_DELAY)));
+
+		Encoder::GopCache::Write write = [&](AVPacket* packet) {
+			written.push_back({ packet->pts, packet->dts, !!(packet->flags & AV_PKT_FLAG_KEY), packet->data[0], packet->data[1] });
+		};
+		std::deque<std::pair<int64_t, bool>> held;
+		int encoded = 0;
+		auto emit = [&]() {
+			AVPacket packet;
+			av_init_packet(&packet);
+			CHECK(av_new_packet(&packet, 2) >= 0);
+			packet.pts = held.front().first;
+			packet.dts = -100;
+			packet.duration = 1;
+			packet.flags = held.front().second ? AV_PKT_FLAG_KEY : 0;
+			packet.data[0] = values[static_cast<size_t>(packet.pts)];
+			packet.data[1] = run;
+			held.pop_front();
+			CHECK(SUCCEEDED(cache.pushPacket(&packet, write)));
+			av_packet_unref(&packet);
+		};
+		Encoder::GopCache::Encode encode = [&](AVFrame* frame) {
+			encoded++;
+			held.push_back(std::make_pair(frame->pts, isKeyframeHonoured && (frame->pict_type == AV_PICTURE_TYPE_I)));
+			if (held.size() > static_cast<size_t>(REORDER_DELAY)) {
+				emit();
+			}
+		};
+
+		for (size_t i = 0; i < values.size(); i++) {
+			std::shared_ptr<AVFrame> pFrame(av_frame_alloc(), [](AVFrame* p) { av_frame_free(&p); });
+			pFrame->format = AV_PIX_FMT_GRAY8;
+			pFrame->width = 16;
+			pFrame->height = 16;
+			CHECK(av_frame_get_buffer(pFrame.get(), 1) >= 0);
+			memset(pFrame->data[0], values[i], pFrame->linesize[0] * pFrame->height);
+			pFrame->pts = i;
+			CHECK(SUCCEEDED(cache.pushFrame(pFrame.get(), encode, write)));
+		}
+		CHECK(SUCCEEDED(cache.flushFrames(encode, write)));
+		while (!held.empty()) {
+			emit();
+		}
+		CHECK(SUCCEEDED(cache.finish(write)));
+		return failures ? -1 : encoded;
+	}
+
+	// Every frame is written once, in decoding order, with the dts an uninterrupted stream would have.
+	bool isInOrder(const std::vector<Written>& written, const std::vector<uint8_t>& values) {
+		if (written.size() != values.size()) {
+			return false;
+		}
+		for (size_t i = 0; i < written.size(); i++) {
+			if ((written[i].pts != static_cast<int64_t>(i)) || (written[i].dts != static_cast<int64_t>(i) - REORDER_DELAY) || (written[i].value != values[i])
+				|| (written[i].isKey != (i % GOP_SIZE == 0))) {
+				return false;
+			}
+		}
+		return true;
+	}
+}
+
+int testGopCache() {
+	int failures = 0;
+	std::string directory = getTestPath("gop-cache");
+	removeCache(directory);
+
+	std::vector<uint8_t> first = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12 };
+	std::vector<Written> written;
+	CHECK(exportFrames(directory, first, 1, true, written) == 12);
+	CHECK(isInOrder(written, first));
+
+	// Only the changed GOP in the middle is encoded again; the others are spliced in around it.
+	std::vector<uint8_t> second = { 1, 2, 3, 4, 50, 60, 70, 80, 9, 10, 11, 12 };
+	written.clear();
+	CHECK(exportFrames(directory, second, 2, true, written) == 4);
+	CHECK(isInOrder(written, second));
+	if (written.size() == second.size()) {
+		for (size_t i = 0; i < written.size(); i++) {
+			CHECK(written[i].run == ((i >= 4) && (i < 8) ? 2 : 1));
+		}
+	}
+
+	// A GOP whose first packet is not a keyframe is never stored.
+	std::vector<uint8_t> third = { 100, 101, 102, 103 };
+	written.clear();
+	CHECK(exportFrames(directory, third, 3, false, written) == 4);
+	written.clear();
+	CHECK(exportFrames(directory, third, 4, true, written) == 4);
+	CHECK(isInOrder(written, third));
+	written.clear();
+	CHECK(exportFrames(directory, third, 5, true, written) == 0);
+	CHECK(isInOrder(written, third) && (written[0].run == 4));
+
+	removeCache(directory);
+	return failures;
+}
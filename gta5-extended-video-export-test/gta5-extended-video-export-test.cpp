@@ -1,13 +1,49 @@
 // gta5-extended-video-export-test.cpp : Defines the entry point for the console application.
 //
 
+#include "tests.h"
 #include "../gta5-extended-video-export/encoder.h"
+#include <cstring>
 #include <iostream>
 
-int main()
+namespace {
+	const std::pair<const char*, int(*)()> tests[] = {
+		{ "bulk copy", testBulkCopy },
+		{ "cube lut", testCubeLUT },
+		{ "export journal", testExportJournal },
+		{ "frame interpolator", testFrameInterpolator },
+		{ "frame ranges", testFrameRanges },
+		{ "gif quantizer", testGIFQuantizer },
+		{ "gop cache", testGopCache },
+		{ "pipeline", testPipeline },
+		{ "spill file", testSpillFile },
+		{ "sub-frame accumulator", testSubFrameAccumulator },
+		{ "xxh64", testXXH64 },
+	};
+}
+
+std::string getTestPath(std::string name) {
+	char folder[MAX_PATH];
+	DWORD length = GetTempPathA(MAX_PATH, folder);
+	return std::string(folder, (length > 0) && (length < MAX_PATH) ? length : 0) + "EVE-test-" + name;
+}
+
+// Runs the checks, then exports a test clip unless "checks" is given.
+int main(int argc, char* argv[])
 {
 	av_register_all();
 	avcodec_register_all();
+
+	int failures = 0;
+	for (auto& test : tests) {
+		int testFailures = test.second();
+		std::cout << test.first << ": " << (testFailures ? "FAILED" : "ok") << std::endl;
+		failures += testFailures;
+	}
+	if (failures || ((argc > 1) && !strcmp(argv[1], "checks"))) {
+		return failures ? 1 : 0;
+	}
+
 	av_log_set_level(AV_LOG_TRACE);
 	for (int j = 0; j < 10; j++) {
 		std::shared_ptr<Encoder::Session> session(new Encoder::Session());
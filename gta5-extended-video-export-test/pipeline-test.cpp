@@ -0,0 +1,91 @@
+#include "tests.h"
+#include "../gta5-extended-video-export/pipeline.h"
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+namespace {
+	const uint32_t FRAMES = 300;
+
+	uint32_t getIndex(const Encoder::Frame& frame) {
+		uint32_t index;
+		memcpy(&index, std::begin(*frame.data), sizeof(index));
+		return index;
+	}
+
+	// Takes a different time for every frame on four threads, so frames are
+	// finished out of order. Every third frame is passed on twice and every
+	// fifth not at all.
+	class ShuffleStage : public Encoder::PipelineStage {
+	public:
+		ShuffleStage() :
+			PipelineStage("shuffle", Encoder::FRAME_TYPE_RAW, Encoder::FRAME_TYPE_RAW, 4)
+		{ }
+
+		void process(Encoder::Frame& frame, const Emit& emit) override {
+			uint32_t index = getIndex(frame);
+			std::this_thread::sleep_for(std::chrono::microseconds(index * 7919 % 13 * 200));
+			if (index % 5 == 4) {
+				return;
+			}
+			emit(frame);
+			if (index % 3 == 0) {
+				emit(frame);
+			}
+		}
+	};
+
+	class CollectStage : public Encoder::PipelineStage {
+	public:
+		CollectStage(std::vector<uint32_t>& indices) :
+			PipelineStage("collect", Encoder::FRAME_TYPE_RAW, Encoder::FRAME_TYPE_NONE, 1),
+			indices(indices)
+		{ }
+
+		void process(Encoder::Frame& frame, const Emit& emit) override {
+			this->indices.push_back(getIndex(frame));
+		}
+
+	private:
+		std::vector<uint32_t>& indices;
+	};
+}
+
+int testPipeline() {
+	int failures = 0;
+
+	// Stage names are matched whole, not as parts of other names.
+	std::vector<std::string> names = Encoder::Pipeline::parseDefinition(" motion_blur_x ,encode,, lut\t");
+	CHECK(names == std::vector<std::string>({ "motion_blur_x", "encode", "lut" }));
+	CHECK(Encoder::Pipeline::parseDefinition("").empty());
+
+	// A parallel stage passes its output on in input order.
+	std::vector<uint32_t> indices;
+	{
+		Encoder::Pipeline pipeline(8);
+		pipeline.addStage(std::make_shared<ShuffleStage>());
+		pipeline.addStage(std::make_shared<CollectStage>(indices));
+		CHECK(SUCCEEDED(pipeline.start(Encoder::ThreadPolicy())));
+		for (uint32_t i = 0; i < FRAMES; i++) {
+			auto pData = std::make_shared<std::valarray<uint8_t>>(sizeof(i));
+			memcpy(std::begin(*pData), &i, sizeof(i));
+			CHECK(SUCCEEDED(pipeline.push(Encoder::Frame(pData))));
+		}
+		pipeline.finish();
+		CHECK(!pipeline.hasFailed());
+	}
+
+	std::vector<uint32_t> expected;
+	for (uint32_t i = 0; i < FRAMES; i++) {
+		if (i % 5 == 4) {
+			continue;
+		}
+		expected.push_back(i);
+		if (i % 3 == 0) {
+			expected.push_back(i);
+		}
+	}
+	CHECK(indices == expected);
+	return failures;
+}
@@ -0,0 +1,73 @@
+#include "tests.h"
+#include "../gta5-extended-video-export/spill-file.h"
+#include <vector>
+
+namespace {
+	// Frame n is 1000 + 37 * n bytes long and filled with n.
+	std::vector<uint8_t> makeFrame(uint32_t n) {
+		return std::vector<uint8_t>(1000 + 37 * n, static_cast<uint8_t>(n));
+	}
+
+	bool isFrame(const std::valarray<uint8_t>& data, uint32_t n) {
+		std::vector<uint8_t> expected = makeFrame(n);
+		if (data.size() != expected.size()) {
+			return false;
+		}
+		for (size_t i = 0; i < expected.size(); i++) {
+			if (data[i] != expected[i]) {
+				return false;
+			}
+		}
+		return true;
+	}
+}
+
+int testSpillFile() {
+	int failures = 0;
+	std::string folder = getTestPath("spill");
+	CreateDirectoryA(folder.c_str(), NULL);
+
+	Encoder::SpillFile file;
+	std::valarray<uint8_t> data;
+	CHECK(FAILED(file.read(data)));
+	CHECK(SUCCEEDED(file.open(folder)));
+	CHECK(file.isOpen() && file.isEmpty());
+
+	// Writes and reads interleave as in the spill stage; frames come back in
+	// the order they were written, also after the file has been read empty.
+	const uint32_t pattern[][2] = { { 3, 1 }, { 2, 4 }, { 5, 2 }, { 1, 0 }, { 0, 4 }, { 6, 3 } };
+	uint32_t written = 0;
+	uint32_t read = 0;
+	uint64_t bytes = 0;
+	for (auto& step : pattern) {
+		for (uint32_t i = 0; i < step[0]; i++) {
+			std::vector<uint8_t> frame = makeFrame(written++);
+			CHECK(SUCCEEDED(file.write(frame.data(), frame.size())));
+			bytes += sizeof(uint64_t) + frame.size();
+		}
+		for (uint32_t i = 0; i < step[1]; i++) {
+			CHECK(SUCCEEDED(file.read(data)));
+			CHECK(isFrame(data, read));
+			bytes -= sizeof(uint64_t) + data.size();
+			read++;
+		}
+		CHECK(file.getFrames() == written - read);
+		CHECK(file.getBytes() == bytes);
+	}
+	while (!file.isEmpty()) {
+		CHECK(SUCCEEDED(file.read(data)));
+		CHECK(isFrame(data, read));
+		read++;
+	}
+	CHECK(read == written);
+	CHECK(file.getBytes() == 0);
+	CHECK(FAILED(file.read(data)));
+
+	// The file is gone once it is closed.
+	std::string path = file.getPath();
+	file.close();
+	CHECK(!file.isOpen());
+	CHECK(GetFileAttributesA(path.c_str()) == INVALID_FILE_ATTRIBUTES);
+	RemoveDirectoryA(folder.c_str());
+	return failures;
+}
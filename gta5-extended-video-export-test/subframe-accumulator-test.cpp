@@ -0,0 +1,65 @@
+#include "tests.h"
+#include "../gta5-extended-video-export/subframe-accumulator.h"
+#include <vector>
+
+namespace {
+	// How many sub-frames the motion blur of earlier versions blended into each frame.
+	uint32_t getBlendedCount(uint32_t motionBlurSamples, float shutterPosition) {
+		uint32_t count = 0;
+		for (uint32_t r = 0; r <= motionBlurSamples; r++) {
+			float currentShutterPosition = (float)r / ((float)motionBlurSamples + 1);
+			if ((r == motionBlurSamples) || (currentShutterPosition >= shutterPosition)) {
+				count++;
+			}
+		}
+		return count;
+	}
+}
+
+int testSubFrameAccumulator() {
+	int failures = 0;
+
+	// Without a shutter angle, projects blend as many sub-frames as before.
+	CHECK(Encoder::SubFrameAccumulator::getPositionWindow(5, 0.5f) == 2);
+	for (uint32_t samples : { 0, 1, 2, 3, 4, 7, 10, 15 }) {
+		for (float strength : { 0.0f, 0.1f, 0.25f, 0.3f, 0.5f, 0.7f, 0.75f, 1.0f }) {
+			uint32_t window = Encoder::SubFrameAccumulator::getPositionWindow(samples + 1, 1 - strength);
+			CHECK(window == getBlendedCount(samples, 1 - strength));
+		}
+	}
+	CHECK(Encoder::SubFrameAccumulator::getShutterWindow(5, 180) == 3);
+	CHECK(Encoder::SubFrameAccumulator::getShutterWindow(4, 720) == 8);
+	CHECK(Encoder::SubFrameAccumulator::getShutterWindow(4, 0) == 1);
+
+	// Every frame is the rounded mean of the last `window` sub-frames, also
+	// when the window reaches back into the previous frames.
+	const uint32_t PERIOD = 3;
+	for (uint32_t window : { 1, 2, 3, 5 }) {
+		Encoder::SubFrameAccumulator accumulator;
+		accumulator.addOutput(PERIOD, window);
+		std::vector<uint8_t> values;
+		std::vector<uint8_t> frames;
+		for (uint32_t i = 0; i < 8 * PERIOD; i++) {
+			values.push_back(static_cast<uint8_t>(i * 37 % 251));
+			std::valarray<uint8_t> subFrame(values.back(), 64);
+			accumulator.push(subFrame, [&](size_t output, std::shared_ptr<std::valarray<uint8_t>> pResult) {
+				CHECK((output == 0) && (pResult->size() == 64) && ((*pResult)[0] == (*pResult)[63]));
+				frames.push_back((*pResult)[0]);
+			});
+		}
+		CHECK(frames.size() == 8);
+		for (size_t f = 0; f < frames.size(); f++) {
+			size_t end = (f + 1) * PERIOD;
+			size_t start = end > window ? end - window : 0;
+			uint32_t sum = 0;
+			for (size_t i = start; i < end; i++) {
+				sum += values[i];
+			}
+			uint32_t count = static_cast<uint32_t>(end - start);
+			CHECK(frames[f] == (sum + count / 2) / count);
+		}
+		// Snapshots are only kept for windows still to come.
+		CHECK(accumulator.getSnapshotCount() <= (window + PERIOD - 1) / PERIOD);
+	}
+	return failures;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+
+// Reports a check that does not hold and counts it. Every test returns the
+// number of checks that failed.
+#define CHECK(condition) if (!(condition)) { std::cerr << __FILE__ << "(" << __LINE__ << "): check failed: " << #condition << std::endl; failures++; }
+
+// Path of a file in the temporary folder, for tests that need one.
+std::string getTestPath(std::string name);
+
+int testBulkCopy();
+int testCubeLUT();
+int testExportJournal();
+int testFrameInterpolator();
+int testFrameRanges();
+int testGIFQuantizer();
+int testGopCache();
+int testPipeline();
+int testSpillFile();
+int testSubFrameAccumulator();
+int testXXH64();
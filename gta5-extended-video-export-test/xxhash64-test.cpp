@@ -0,0 +1,57 @@
+#include "tests.h"
+#include "../gta5-extended-video-export/xxhash64.h"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace {
+	const uint64_t PRIME32 = 2654435761U;
+
+	// The sanity buffer of the reference implementation's self test.
+	std::vector<uint8_t> makeSanityBuffer(size_t length) {
+		std::vector<uint8_t> buffer(length);
+		uint32_t generator = static_cast<uint32_t>(PRIME32);
+		for (auto& value : buffer) {
+			value = static_cast<uint8_t>(generator >> 24);
+			generator *= generator;
+		}
+		return buffer;
+	}
+}
+
+int testXXH64() {
+	int failures = 0;
+
+	// Reference values of xxHash.
+	const struct {
+		const char* text;
+		uint64_t hash;
+	} strings[] = {
+		{ "", 0xEF46DB3751D8E999ULL },
+		{ "a", 0xD24EC4F1A98C6E5BULL },
+		{ "abc", 0x44BC2CF5AD770999ULL },
+		{ "Nobody inspects the spammish repetition", 0xFBCEA83C8A378BF1ULL },
+	};
+	for (auto& vector : strings) {
+		CHECK(Encoder::XXH64::hash(vector.text, strlen(vector.text)) == vector.hash);
+	}
+
+	std::vector<uint8_t> sanity = makeSanityBuffer(2367);
+	CHECK(Encoder::XXH64::hash(sanity.data(), 0, 0) == 0xEF46DB3751D8E999ULL);
+	CHECK(Encoder::XXH64::hash(sanity.data(), 0, PRIME32) == 0xAC75FDA2929B17EFULL);
+	CHECK(Encoder::XXH64::hash(sanity.data(), 1, 0) == 0x4FCE394CC88952D8ULL);
+	CHECK(Encoder::XXH64::hash(sanity.data(), 1, PRIME32) == 0x739840CB819FA723ULL);
+
+	// Hashing in pieces of any size gives the same result as hashing at once.
+	for (size_t length : { 31, 32, 33, 222, 2367 }) {
+		uint64_t expected = Encoder::XXH64::hash(sanity.data(), length, PRIME32);
+		for (size_t piece : { 1, 7, 32, 100 }) {
+			Encoder::XXH64 state(PRIME32);
+			for (size_t i = 0; i < length; i += piece) {
+				state.update(sanity.data() + i, (std::min)(piece, length - i));
+			}
+			CHECK(state.digest() == expected);
+		}
+	}
+	return failures;
+}
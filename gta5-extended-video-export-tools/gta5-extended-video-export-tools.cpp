@@ -0,0 +1,631 @@
+// gta5-extended-video-export-tools.cpp : Command line tools for files written by the mod.
+//
+
+#include "../gta5-extended-video-export/bulk-copy.h"
+#include "../gta5-extended-video-export/export-journal.h"
+#include "../gta5-extended-video-export/farm.h"
+#include "../gta5-extended-video-export/frame-interpolator.h"
+#include "../gta5-extended-video-export/gif-quantizer.h"
+#include "../gta5-extended-video-export/image-pack.h"
+#include "../gta5-extended-video-export/output-manifest.h"
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include <libswscale\swscale.h>
+}
+
+namespace {
+	typedef int(*Command)(const std::vector<std::string>& args);
+
+	int listPack(const std::vector<std::string>& args) {
+		if (args.size() != 1) {
+			std::cerr << "Usage: list <pack>" << std::endl;
+			return 1;
+		}
+
+		Encoder::ImagePackReader reader;
+		if (FAILED(reader.open(args[0]))) {
+			std::cerr << "Could not open " << args[0] << std::endl;
+			return 1;
+		}
+
+		uint64_t total = 0;
+		for (auto& entry : reader.getEntries()) {
+			std::cout << entry.name << "\t" << entry.size << std::endl;
+			total += entry.size;
+		}
+		std::cout << reader.getEntries().size() << " images, " << total << " bytes";
+		if (!reader.hasIndex()) {
+			std::cout << " (no index, the export did not finish)";
+		}
+		std::cout << std::endl;
+		return 0;
+	}
+
+	int unpack(const std::vector<std::string>& args) {
+		if ((args.size() < 1) || (args.size() > 2)) {
+			std::cerr << "Usage: unpack <pack> [directory]" << std::endl;
+			return 1;
+		}
+
+		Encoder::ImagePackReader reader;
+		if (FAILED(reader.open(args[0]))) {
+			std::cerr << "Could not open " << args[0] << std::endl;
+			return 1;
+		}
+
+		std::string directory = args.size() > 1 ? args[1] : ".";
+		if (!CreateDirectoryA(directory.c_str(), NULL) && (GetLastError() != ERROR_ALREADY_EXISTS)) {
+			std::cerr << "Could not create directory " << directory << std::endl;
+			return 1;
+		}
+
+		std::vector<uint8_t> data;
+		for (auto& entry : reader.getEntries()) {
+			std::string path = directory + "\\" + entry.name;
+			std::ofstream file(path, std::ios::binary | std::ios::trunc);
+			if (FAILED(reader.read(entry, data)) || !file.write(reinterpret_cast<const char*>(data.data()), data.size())) {
+				std::cerr << "Could not extract " << path << std::endl;
+				return 1;
+			}
+		}
+		std::cout << "Extracted " << reader.getEntries().size() << " images to " << directory << std::endl;
+		return 0;
+	}
+
+	int verify(const std::vector<std::string>& args) {
+		if (args.size() != 1) {
+			std::cerr << "Usage: verify <manifest>" << std::endl;
+			return 1;
+		}
+
+		std::vector<Encoder::OutputManifest::Entry> entries;
+		if (FAILED(Encoder::OutputManifest::read(args[0], entries))) {
+			std::cerr << "Could not open " << args[0] << std::endl;
+			return 1;
+		}
+
+		size_t failures = 0;
+		for (auto& entry : entries) {
+			uint64_t digest;
+			uint64_t size;
+			if (FAILED(Encoder::BlockHasher::hashFile(entry.path, digest, size))) {
+				std::cout << entry.path << ": MISSING" << std::endl;
+				failures++;
+			} else if ((digest != entry.digest) || (size != entry.size)) {
+				std::cout << entry.path << ": FAILED (" << std::hex << std::setw(16) << std::setfill('0') << digest << std::dec << ", " << size << " bytes)" << std::endl;
+				failures++;
+			} else {
+				std::cout << entry.path << ": OK" << std::endl;
+			}
+		}
+		std::cout << entries.size() - failures << " of " << entries.size() << " files verified" << std::endl;
+		return failures == 0 ? 0 : 1;
+	}
+
+	int recover(const std::vector<std::string>& args) {
+		if ((args.size() < 2) || (args.size() > 3)) {
+			std::cerr << "Usage: recover <journal> <output> [format]" << std::endl;
+			return 1;
+		}
+
+		Encoder::ExportJournalReader reader;
+		if (FAILED(reader.open(args[0]))) {
+			std::cerr << "Could not open " << args[0] << std::endl;
+			return 1;
+		}
+		if (FAILED(reader.recover(args[1], args.size() > 2 ? args[2] : ""))) {
+			std::cerr << "Could not write " << args[1] << std::endl;
+			return 1;
+		}
+
+		std::cout << "Recovered " << reader.getPacketCount() << " packets (" << reader.getVideoFrameCount() << " video frames) of " << reader.getOutputPath() << " to " << args[1] << std::endl;
+		if (reader.getVideoFrameCount() > 0) {
+			uint64_t resumeFrame = reader.getResumeFrame();
+			if (resumeFrame == Encoder::FrameRanges::OPEN_END) {
+				std::cout << "Every selected frame was recovered." << std::endl;
+			} else {
+				std::cout << "To export the rest, continue from frame " << resumeFrame << " (frame_ranges = " << resumeFrame << "-)" << std::endl;
+			}
+		}
+		return 0;
+	}
+
+	// The farm token is read from the environment so that it does not show up in process lists.
+	std::string getFarmToken() {
+		char token[256];
+		DWORD length = GetEnvironmentVariableA(Encoder::FARM_TOKEN_VARIABLE, token, sizeof(token));
+		return length < sizeof(token) ? std::string(token, length) : "";
+	}
+
+	int farmWorker(const std::vector<std::string>& args) {
+		if ((args.size() < 1) || (args.size() > 3)) {
+			std::cerr << "Usage: farm-worker <source folder> [address] [port]" << std::endl;
+			return 1;
+		}
+
+		std::string address = args.size() > 1 ? args[1] : "127.0.0.1";
+		uint16_t port = Encoder::FARM_DEFAULT_PORT;
+		try {
+			if (args.size() > 2) {
+				port = static_cast<uint16_t>(std::stoul(args[2]));
+			}
+		} catch (std::exception&) {
+			std::cerr << "Invalid port: " << args[2] << std::endl;
+			return 1;
+		}
+
+		std::string token = getFarmToken();
+		if (token.empty()) {
+			std::cerr << "Set a token shared with the coordinator in " << Encoder::FARM_TOKEN_VARIABLE << std::endl;
+			return 1;
+		}
+
+		Encoder::FarmWorker worker(token, args[0]);
+		if (FAILED(worker.serve(address, port))) {
+			std::cerr << "Could not listen on " << address << ":" << port << std::endl;
+			return 1;
+		}
+		return 0;
+	}
+
+	int farmEncode(const std::vector<std::string>& args) {
+		if ((args.size() < 5) || (args.size() > 7)) {
+			std::cerr << "Usage: farm-encode <source> <output> <host[:port],...> <video codec> <pixel format> [codec options] [frames per chunk]" << std::endl;
+			return 1;
+		}
+
+		std::vector<std::string> workers;
+		std::stringstream stream(args[2]);
+		std::string worker;
+		while (std::getline(stream, worker, ',')) {
+			if (!worker.empty()) {
+				workers.push_back(worker);
+			}
+		}
+
+		Encoder::FarmSettings settings;
+		settings.vcodec = args[3];
+		settings.outputPixelFormat = args[4];
+		settings.voptions = args.size() > 5 ? args[5] : "";
+		uint64_t chunkFrames = 600;
+		try {
+			if (args.size() > 6) {
+				chunkFrames = std::stoull(args[6]);
+			}
+		} catch (std::exception&) {
+			std::cerr << "Invalid number of frames per chunk: " << args[6] << std::endl;
+			return 1;
+		}
+		if (workers.empty() || (chunkFrames == 0)) {
+			std::cerr << "At least one worker and one frame per chunk are needed." << std::endl;
+			return 1;
+		}
+		std::string token = getFarmToken();
+		if (token.empty()) {
+			std::cerr << "Set the workers' token in " << Encoder::FARM_TOKEN_VARIABLE << std::endl;
+			return 1;
+		}
+
+		Encoder::FarmCoordinator coordinator(workers, chunkFrames, token);
+		if (FAILED(coordinator.encode(args[0], args[1], settings))) {
+			std::cerr << "Could not encode " << args[0] << " on the farm" << std::endl;
+			return 1;
+		}
+		std::cout << "Encoded " << args[0] << " to " << args[1] << std::endl;
+		return 0;
+	}
+
+	// Reads random words from a buffer that fits in L2/L3, like a game thread
+	// working on its own data, and returns the number of reads per second.
+	double runCacheWorkload(const std::vector<uint32_t>& data, const std::atomic<bool>& isRunning) {
+		auto start = std::chrono::steady_clock::now();
+		uint64_t reads = 0;
+		uint32_t index = 0;
+		uint32_t sum = 0;
+		while (isRunning) {
+			for (int i = 0; i < 4096; i++) {
+				index = index * 1664525 + 1013904223;
+				sum += data[(index ^ sum) % data.size()];
+			}
+			reads += 4096;
+		}
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		// Keeps the reads from being optimized away.
+		static volatile uint32_t result;
+		result = sum;
+		return reads / elapsed.count();
+	}
+
+	int benchCopy(const std::vector<std::string>& args) {
+		if (args.size() > 2) {
+			std::cerr << "Usage: bench-copy [frame size in MB] [frames]" << std::endl;
+			return 1;
+		}
+
+		size_t frameSize = 8;
+		size_t frames = 250;
+		try {
+			if (args.size() > 0) {
+				frameSize = std::stoul(args[0]);
+			}
+			if (args.size() > 1) {
+				frames = std::stoul(args[1]);
+			}
+		} catch (std::exception&) {
+			std::cerr << "Invalid frame size or number of frames" << std::endl;
+			return 1;
+		}
+		frameSize *= 1024 * 1024;
+		if ((frameSize == 0) || (frames == 0)) {
+			std::cerr << "Frame size and number of frames must not be zero" << std::endl;
+			return 1;
+		}
+
+		// Frames rotate through several buffers, as they do in the pipeline queues.
+		const size_t BUFFERS = 4;
+		std::vector<std::vector<uint8_t>> sources(BUFFERS, std::vector<uint8_t>(frameSize, 1));
+		std::vector<std::vector<uint8_t>> destinations(BUFFERS, std::vector<uint8_t>(frameSize));
+		std::vector<uint32_t> workload(2 * 1024 * 1024 / sizeof(uint32_t), 1);
+
+		std::cout << "Copying " << frames << " frames of " << frameSize / (1024 * 1024) << " MB, bulk copies use " << Encoder::getBulkCopyISA() << std::endl;
+		std::cout << std::setw(10) << "copy" << std::setw(14) << "GB/s" << std::setw(22) << "workload Mreads/s" << std::endl;
+
+		typedef void(*CopyFunction)(void*, const void*, size_t);
+		const std::pair<const char*, CopyFunction> modes[] = {
+			{ "none", nullptr },
+			{ "memcpy", [](void* pDest, const void* pSource, size_t length) { memcpy(pDest, pSource, length); } },
+			{ "bulk", Encoder::bulkCopy },
+		};
+		double baseline = 0;
+		for (auto& mode : modes) {
+			std::atomic<bool> isRunning(true);
+			double readsPerSecond = 0;
+			std::thread workloadThread([&]() {
+				readsPerSecond = runCacheWorkload(workload, isRunning);
+			});
+
+			auto start = std::chrono::steady_clock::now();
+			if (mode.second) {
+				for (size_t i = 0; i < frames; i++) {
+					mode.second(destinations[i % BUFFERS].data(), sources[i % BUFFERS].data(), frameSize);
+				}
+			} else {
+				std::this_thread::sleep_for(std::chrono::seconds(1));
+			}
+			std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+			isRunning = false;
+			workloadThread.join();
+
+			std::cout << std::setw(10) << mode.first << std::fixed << std::setprecision(2);
+			if (mode.second) {
+				std::cout << std::setw(14) << frames * frameSize / elapsed.count() / 1e9;
+			} else {
+				std::cout << std::setw(14) << "-";
+				baseline = readsPerSecond;
+			}
+			std::cout << std::setw(22) << readsPerSecond / 1e6 << " (" << std::setprecision(0) << 100 * readsPerSecond / baseline << "%)" << std::endl;
+		}
+		return 0;
+	}
+
+	// Draws a test clip: a still gradient with a ball moving across it.
+	void drawGIFTestFrame(std::vector<uint32_t>& pixels, uint32_t width, uint32_t height, size_t frame) {
+		int64_t ballX = static_cast<int64_t>(frame * 4 % width);
+		int64_t ballY = height / 2;
+		int64_t radius = height / 8;
+		for (uint32_t y = 0; y < height; y++) {
+			for (uint32_t x = 0; x < width; x++) {
+				uint32_t red = x * 255 / width;
+				uint32_t green = y * 255 / height;
+				uint32_t blue = 255 - (x + y) * 255 / (width + height);
+				if ((x - ballX) * (x - ballX) + (y - ballY) * (y - ballY) < radius * radius) {
+					red = 250;
+					green = 200;
+					blue = 40;
+				}
+				pixels[static_cast<size_t>(y) * width + x] = 0xFF000000 | (red << 16) | (green << 8) | blue;
+			}
+		}
+	}
+
+	// Encodes frames with FFmpeg's GIF encoder and returns the number of bytes it wrote, or -1.
+	int64_t encodeGIF(AVPixelFormat format, uint32_t width, uint32_t height, size_t frames, const std::function<void(size_t, AVFrame*)>& fill) {
+		AVCodec* codec = avcodec_find_encoder(AV_CODEC_ID_GIF);
+		AVCodecContext* context = codec ? avcodec_alloc_context3(codec) : nullptr;
+		AVFrame* frame = av_frame_alloc();
+		int64_t bytes = -1;
+		if (context && frame) {
+			context->width = width;
+			context->height = height;
+			context->pix_fmt = format;
+			context->time_base = av_make_q(1, 30);
+			frame->format = format;
+			frame->width = width;
+			frame->height = height;
+			if ((avcodec_open2(context, codec, NULL) >= 0) && (av_frame_get_buffer(frame, 32) >= 0)) {
+				bytes = 0;
+				AVPacket packet;
+				av_init_packet(&packet);
+				packet.data = NULL;
+				packet.size = 0;
+				for (size_t i = 0; i <= frames; i++) {
+					if (i < frames) {
+						av_frame_make_writable(frame);
+						fill(i, frame);
+						frame->pts = i;
+					}
+					avcodec_send_frame(context, i < frames ? frame : NULL);
+					while (avcodec_receive_packet(context, &packet) >= 0) {
+						bytes += packet.size;
+						av_packet_unref(&packet);
+					}
+				}
+			}
+		}
+		av_frame_free(&frame);
+		avcodec_free_context(&context);
+		return bytes;
+	}
+
+	int benchGIF(const std::vector<std::string>& args) {
+		if ((args.size() != 0) && (args.size() != 3)) {
+			std::cerr << "Usage: bench-gif [width height frames]" << std::endl;
+			return 1;
+		}
+
+		uint32_t width = 640;
+		uint32_t height = 360;
+		size_t frames = 90;
+		try {
+			if (args.size() == 3) {
+				width = std::stoul(args[0]);
+				height = std::stoul(args[1]);
+				frames = std::stoul(args[2]);
+			}
+		} catch (std::exception&) {
+			std::cerr << "Invalid size or number of frames" << std::endl;
+			return 1;
+		}
+		if ((width == 0) || (height == 0) || (frames == 0)) {
+			std::cerr << "Size and number of frames must not be zero" << std::endl;
+			return 1;
+		}
+
+		std::vector<std::vector<uint32_t>> clip(frames, std::vector<uint32_t>(static_cast<size_t>(width) * height));
+		for (size_t i = 0; i < frames; i++) {
+			drawGIFTestFrame(clip[i], width, height, i);
+		}
+		std::cout << "Encoding " << frames << " frames of " << width << "x" << height << std::endl;
+		std::cout << std::setw(24) << "method" << std::setw(12) << "ms" << std::setw(14) << "bytes" << std::endl;
+		auto report = [](const char* method, std::chrono::steady_clock::time_point start, int64_t bytes) {
+			std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+			std::cout << std::setw(24) << method << std::setw(12) << std::fixed << std::setprecision(0) << elapsed.count() << std::setw(14) << bytes << std::endl;
+			return bytes >= 0;
+		};
+
+		// What the GIF preset did before: swscale maps every frame to a fixed 3-3-2 palette.
+		auto start = std::chrono::steady_clock::now();
+		SwsContext* pSwsContext = sws_getContext(width, height, AV_PIX_FMT_BGRA, width, height, AV_PIX_FMT_RGB8, SWS_POINT, NULL, NULL, NULL);
+		if (!pSwsContext) {
+			std::cerr << "Could not create conversion context" << std::endl;
+			return 1;
+		}
+		int64_t bytes = encodeGIF(AV_PIX_FMT_RGB8, width, height, frames, [&](size_t i, AVFrame* frame) {
+			const uint8_t* source[4] = { reinterpret_cast<const uint8_t*>(clip[i].data()) };
+			int sourceLinesize[4] = { static_cast<int>(width * 4) };
+			sws_scale(pSwsContext, source, sourceLinesize, 0, height, frame->data, frame->linesize);
+		});
+		sws_freeContext(pSwsContext);
+		bool isSucceeded = report("swscale rgb8", start, bytes);
+
+		const std::pair<const char*, Encoder::GIFDither> dithers[] = {
+			{ "gif_quantize none", Encoder::GIF_DITHER_NONE },
+			{ "gif_quantize bayer", Encoder::GIF_DITHER_BAYER },
+			{ "gif_quantize fs", Encoder::GIF_DITHER_FLOYD_STEINBERG },
+		};
+		for (auto& dither : dithers) {
+			start = std::chrono::steady_clock::now();
+			// One palette for the clip, as with the default of 30 frames per segment on a still scene.
+			Encoder::GIFQuantizer quantizer(width, height, dither.second);
+			for (auto& pixels : clip) {
+				quantizer.addToHistogram(reinterpret_cast<const uint8_t*>(pixels.data()));
+			}
+			quantizer.endSegment();
+			std::vector<uint8_t> result(quantizer.getFrameSize());
+			bytes = encodeGIF(AV_PIX_FMT_PAL8, width, height, frames, [&](size_t i, AVFrame* frame) {
+				quantizer.map(reinterpret_cast<const uint8_t*>(clip[i].data()), result.data());
+				for (uint32_t y = 0; y < height; y++) {
+					memcpy(frame->data[0] + y * frame->linesize[0], result.data() + static_cast<size_t>(y) * width, width);
+				}
+				memcpy(frame->data[1], result.data() + static_cast<size_t>(width) * height, AVPALETTE_SIZE);
+			});
+			isSucceeded = report(dither.first, start, bytes) && isSucceeded;
+		}
+		return isSucceeded ? 0 : 1;
+	}
+
+	// Draws the interpolation test scene at a time in frames: a textured background
+	// scrolling diagonally with a ball crossing it faster, both moving by fractions of
+	// a pixel between the sub-frames.
+	void drawInterpolateTestFrame(std::vector<uint32_t>& pixels, uint32_t width, uint32_t height, double time) {
+		double scrollX = time * 6;
+		double scrollY = time * 2;
+		double ballX = width / 4.0 + time * 20;
+		double ballY = height / 2.0 + 20 * std::sin(time / 4);
+		double radius = height / 10.0;
+		for (uint32_t y = 0; y < height; y++) {
+			for (uint32_t x = 0; x < width; x++) {
+				double u = x + scrollX;
+				double v = y + scrollY;
+				double shade = 0.5 + 0.25 * std::sin(u / 7) * std::cos(v / 11) + 0.25 * std::sin((u + v) / 23);
+				uint32_t red = static_cast<uint32_t>(255 * shade);
+				uint32_t green = static_cast<uint32_t>(200 * (1 - shade) + 40);
+				uint32_t blue = static_cast<uint32_t>(160 * shade + 60 * std::cos(v / 17) + 60);
+				double distance = std::sqrt((x - ballX) * (x - ballX) + (y - ballY) * (y - ballY));
+				if (distance < radius) {
+					red = 250;
+					green = static_cast<uint32_t>(120 + 100 * distance / radius);
+					blue = 40;
+				}
+				pixels[static_cast<size_t>(y) * width + x] = 0xFF000000 | (red << 16) | (green << 8) | blue;
+			}
+		}
+	}
+
+	// Peak signal to noise ratio of the colour channels of two frames, in dB.
+	double getPSNR(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b) {
+		double sum = 0;
+		for (size_t i = 0; i < a.size(); i++) {
+			for (int shift = 0; shift < 24; shift += 8) {
+				double difference = static_cast<double>((a[i] >> shift) & 0xFF) - static_cast<double>((b[i] >> shift) & 0xFF);
+				sum += difference * difference;
+			}
+		}
+		double mse = sum / (a.size() * 3);
+		return mse > 0 ? 10 * std::log10(255 * 255 / mse) : 99;
+	}
+
+	int benchInterpolate(const std::vector<std::string>& args) {
+		if ((args.size() != 0) && (args.size() != 2)) {
+			std::cerr << "Usage: bench-interpolate [width height]" << std::endl;
+			return 1;
+		}
+
+		uint32_t width = 1280;
+		uint32_t height = 720;
+		try {
+			if (args.size() == 2) {
+				width = std::stoul(args[0]);
+				height = std::stoul(args[1]);
+			}
+		} catch (std::exception&) {
+			std::cerr << "Invalid size" << std::endl;
+			return 1;
+		}
+		if ((width < Encoder::FrameInterpolator::BLOCK_SIZE) || (height < Encoder::FrameInterpolator::BLOCK_SIZE)) {
+			std::cerr << "Size must be at least " << Encoder::FrameInterpolator::BLOCK_SIZE << "x" << Encoder::FrameInterpolator::BLOCK_SIZE << std::endl;
+			return 1;
+		}
+
+		// Each frame is blended from 16 sub-frames; the reference renders all of them,
+		// the others render 4 and either blend only those or interpolate 3 between each.
+		const size_t FRAMES = 8;
+		const uint32_t RENDERED = 4;
+		const uint32_t SYNTHESIZED = 3;
+		const uint32_t SUBFRAMES = RENDERED * (SYNTHESIZED + 1);
+		size_t pixelCount = static_cast<size_t>(width) * height;
+		std::vector<uint32_t> subFrame(pixelCount);
+		std::vector<std::vector<uint32_t>> interpolated(SYNTHESIZED, std::vector<uint32_t>(pixelCount));
+		std::vector<uint32_t> next(pixelCount);
+		std::vector<uint32_t> sums(pixelCount * 3);
+		auto clear = [&]() {
+			std::fill(sums.begin(), sums.end(), 0);
+		};
+		auto add = [&](const std::vector<uint32_t>& pixels) {
+			for (size_t i = 0; i < pixelCount; i++) {
+				sums[3 * i] += pixels[i] & 0xFF;
+				sums[3 * i + 1] += (pixels[i] >> 8) & 0xFF;
+				sums[3 * i + 2] += (pixels[i] >> 16) & 0xFF;
+			}
+		};
+		auto blend = [&](uint32_t count) {
+			std::vector<uint32_t> result(pixelCount);
+			for (size_t i = 0; i < pixelCount; i++) {
+				result[i] = 0xFF000000
+					| ((sums[3 * i + 2] + count / 2) / count << 16)
+					| ((sums[3 * i + 1] + count / 2) / count << 8)
+					| ((sums[3 * i] + count / 2) / count);
+			}
+			return result;
+		};
+
+		std::cout << "Blending " << FRAMES << " frames of " << width << "x" << height << " from " << SUBFRAMES << " sub-frames each" << std::endl;
+		std::cout << std::setw(24) << "method" << std::setw(12) << "ms/frame" << std::setw(12) << "PSNR dB" << std::endl;
+		double renderedPSNR = 0;
+		double interpolatedPSNR = 0;
+		std::chrono::duration<double, std::milli> interpolationTime(0);
+		Encoder::FrameInterpolator interpolator(width, height, 16);
+		for (size_t frame = 0; frame < FRAMES; frame++) {
+			clear();
+			for (uint32_t i = 0; i < SUBFRAMES; i++) {
+				drawInterpolateTestFrame(subFrame, width, height, frame + static_cast<double>(i) / SUBFRAMES);
+				add(subFrame);
+			}
+			std::vector<uint32_t> reference = blend(SUBFRAMES);
+
+			clear();
+			for (uint32_t i = 0; i < RENDERED; i++) {
+				drawInterpolateTestFrame(subFrame, width, height, frame + static_cast<double>(i) / RENDERED);
+				add(subFrame);
+			}
+			renderedPSNR += getPSNR(reference, blend(RENDERED));
+
+			// The last rendered sub-frame is interpolated towards the next frame's first.
+			clear();
+			drawInterpolateTestFrame(subFrame, width, height, static_cast<double>(frame));
+			for (uint32_t i = 0; i < RENDERED; i++) {
+				drawInterpolateTestFrame(next, width, height, frame + static_cast<double>(i + 1) / RENDERED);
+				add(subFrame);
+				auto start = std::chrono::steady_clock::now();
+				const uint8_t* pPrevious = reinterpret_cast<const uint8_t*>(subFrame.data());
+				const uint8_t* pNext = reinterpret_cast<const uint8_t*>(next.data());
+				interpolator.estimate(pPrevious, pNext);
+				for (uint32_t j = 0; j < SYNTHESIZED; j++) {
+					interpolator.synthesize(pPrevious, pNext, static_cast<float>(j + 1) / (SYNTHESIZED + 1), reinterpret_cast<uint8_t*>(interpolated[j].data()));
+				}
+				interpolationTime += std::chrono::steady_clock::now() - start;
+				for (auto& pixels : interpolated) {
+					add(pixels);
+				}
+				subFrame.swap(next);
+			}
+			interpolatedPSNR += getPSNR(reference, blend(SUBFRAMES));
+		}
+
+		std::cout << std::fixed << std::setprecision(2);
+		std::cout << std::setw(24) << "rendered only" << std::setw(12) << "-" << std::setw(12) << renderedPSNR / FRAMES << std::endl;
+		std::cout << std::setw(24) << "interpolated" << std::setw(12) << interpolationTime.count() / FRAMES << std::setw(12) << interpolatedPSNR / FRAMES << std::endl;
+		interpolator.logReport();
+		return 0;
+	}
+
+	const std::map<std::string, Command> commands = {
+		{ "bench-copy", benchCopy },
+		{ "bench-gif", benchGIF },
+		{ "bench-interpolate", benchInterpolate },
+		{ "farm-encode", farmEncode },
+		{ "farm-worker", farmWorker },
+		{ "list", listPack },
+		{ "recover", recover },
+		{ "unpack", unpack },
+		{ "verify", verify },
+	};
+}
+
+int main(int argc, char* argv[])
+{
+	av_register_all();
+	auto command = argc > 1 ? commands.find(argv[1]) : commands.end();
+	if (command == commands.end()) {
+		std::cerr << "Usage: " << argv[0] << " <command> [arguments]" << std::endl;
+		std::cerr << "Commands:" << std::endl;
+		for (auto& entry : commands) {
+			std::cerr << "  " << entry.first << std::endl;
+		}
+		return 1;
+	}
+
+	return command->second(std::vector<std::string>(argv + 2, argv + argc));
+}
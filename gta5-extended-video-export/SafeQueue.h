@@ -3,6 +3,7 @@
 #include <queue>
 #include <mutex>
 #include <condition_variable>
+#include <chrono>
 
 template <class T>
 class SafeQueue {
@@ -18,10 +19,34 @@ public:
 
 	void enqueue(T t) {
 		std::unique_lock<std::mutex> lock(m);
-		while (q.size() >= capacity) {
-			cv_full.wait(lock);
+		if (q.size() >= capacity) {
+			auto start = std::chrono::steady_clock::now();
+			while (q.size() >= capacity) {
+				cv_full.wait(lock);
+			}
+			blockedCount++;
+			blockedTime += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
 		}
 		q.push(t);
+		enqueueCount++;
+		if (q.size() > maxDepth) {
+			maxDepth = static_cast<uint32_t>(q.size());
+		}
+		cv_empty.notify_one();
+	}
+
+	// Adds an item even when the queue is full, for producers that must not wait here.
+	// They are held back with waitForDepth somewhere else instead.
+	void enqueueWithoutWaiting(T t) {
+		std::lock_guard<std::mutex> lock(m);
+		if (q.size() >= capacity) {
+			overflowCount++;
+		}
+		q.push(t);
+		enqueueCount++;
+		if (q.size() > maxDepth) {
+			maxDepth = static_cast<uint32_t>(q.size());
+		}
 		cv_empty.notify_one();
 	}
 
@@ -32,17 +57,59 @@ public:
 		}
 		T val = q.front();
 		q.pop();
-		if (q.size() < capacity) {
-			cv_full.notify_one();
-		}
+		// Both producers waiting for a free slot and waitForDepth callers are woken.
+		cv_full.notify_all();
 		return val;
 	}
 
+	// Waits until the queue holds at most `depth` items. Returns false if the deadline passed first.
+	bool waitForDepth(size_t depth, std::chrono::steady_clock::time_point deadline) {
+		std::unique_lock<std::mutex> lock(m);
+		return cv_full.wait_until(lock, deadline, [&]() { return q.size() <= depth; });
+	}
+
 	int getCapacity() {
 		return capacity;
 	}
+
+	size_t getDepth() {
+		std::lock_guard<std::mutex> lock(m);
+		return q.size();
+	}
+
+	uint64_t getEnqueueCount() {
+		std::lock_guard<std::mutex> lock(m);
+		return enqueueCount;
+	}
+
+	// Number of enqueue calls that had to wait for a free slot, and the total time spent waiting.
+	uint64_t getBlockedCount() {
+		std::lock_guard<std::mutex> lock(m);
+		return blockedCount;
+	}
+
+	uint64_t getBlockedMicroseconds() {
+		std::lock_guard<std::mutex> lock(m);
+		return blockedTime;
+	}
+
+	uint32_t getMaxDepth() {
+		std::lock_guard<std::mutex> lock(m);
+		return maxDepth;
+	}
+
+	// Number of items added with enqueueWithoutWaiting while the queue was full.
+	uint64_t getOverflowCount() {
+		std::lock_guard<std::mutex> lock(m);
+		return overflowCount;
+	}
 private:
 	uint32_t capacity;
+	uint64_t enqueueCount = 0;
+	uint64_t overflowCount = 0;
+	uint64_t blockedCount = 0;
+	uint64_t blockedTime = 0;
+	uint32_t maxDepth = 0;
 	std::queue<T> q;
 	mutable std::mutex m;
 	std::condition_variable cv_empty;
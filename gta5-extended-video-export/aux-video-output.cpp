@@ -0,0 +1,231 @@
+#include "aux-video-output.h"
+#include "logger.h"
+
+extern "C" {
+#include <libavutil\imgutils.h>
+}
+
+namespace Encoder {
+
+	// Number of frames that may wait for the encoding thread before the producer blocks.
+	const uint32_t AUX_FRAME_QUEUE_CAPACITY = 8;
+
+	AuxVideoOutput::AuxVideoOutput(AVRational frameRate, float shutterAngle) :
+		frameRate(frameRate),
+		shutterAngle(shutterAngle),
+		frameQueue(AUX_FRAME_QUEUE_CAPACITY)
+	{
+	}
+
+	AuxVideoOutput::~AuxVideoOutput() {
+		PRE();
+		LOG_CALL(LL_DBG, this->finish());
+		if (this->fmtContext) {
+			LOG_CALL(LL_DBG, avformat_free_context(this->fmtContext));
+		}
+		LOG_CALL(LL_DBG, avcodec_free_context(&this->codecContext));
+		LOG_CALL(LL_DBG, sws_freeContext(this->pSwsContext));
+		if (this->options) {
+			LOG_CALL(LL_DBG, av_dict_free(&this->options));
+		}
+		POST();
+	}
+
+	HRESULT AuxVideoOutput::open(std::string filename, AVOutputFormat* oformat, uint32_t width, uint32_t height, AVPixelFormat outputPixelFormat, std::string vcodec, std::string voptions, int threadCount) {
+		PRE();
+		this->filename = filename;
+		this->width = width;
+		this->height = height;
+		this->outputPixelFormat = outputPixelFormat;
+
+		AVCodec* codec = avcodec_find_encoder_by_name(vcodec.c_str());
+		RET_IF_NULL(codec, "Could not find video codec:" + vcodec, E_FAIL);
+
+		this->codecContext = avcodec_alloc_context3(codec);
+		RET_IF_NULL(this->codecContext, "Could not allocate context for the video codec", E_FAIL);
+
+		av_dict_parse_string(&this->options, voptions.c_str(), "=", "/", 0);
+
+		this->codecContext->codec_id = codec->id;
+		this->codecContext->pix_fmt = outputPixelFormat;
+		this->codecContext->width = width;
+		this->codecContext->height = height;
+		this->codecContext->time_base = av_inv_q(this->frameRate);
+		this->codecContext->framerate = this->frameRate;
+		this->codecContext->codec_type = AVMEDIA_TYPE_VIDEO;
+
+		if (oformat->flags & AVFMT_GLOBALHEADER) {
+			this->codecContext->flags |= CODEC_FLAG_GLOBAL_HEADER;
+		}
+
+		if (!av_dict_get(this->options, "threads", NULL, 0)) {
+			this->codecContext->thread_count = threadCount;
+		}
+
+		RET_IF_FAILED_AV(avcodec_open2(this->codecContext, codec, &this->options), "Could not open video codec", E_FAIL);
+
+		RET_IF_FAILED_AV(avformat_alloc_output_context2(&this->fmtContext, oformat, NULL, filename.c_str()), "Could not allocate format context", E_FAIL);
+		RET_IF_NULL(this->fmtContext, "Could not allocate format context", E_FAIL);
+
+		this->stream = avformat_new_stream(this->fmtContext, codec);
+		RET_IF_NULL(this->stream, "Could not create video stream", E_FAIL);
+		avcodec_parameters_from_context(this->stream->codecpar, this->codecContext);
+		this->stream->time_base = this->codecContext->time_base;
+
+		if (this->manifest) {
+			this->outputFile.reset(new HashingFile());
+			RET_IF_FAILED(this->outputFile->open(filename, &this->fmtContext->pb), "Could not open output file", E_FAIL);
+		} else {
+			RET_IF_FAILED_AV(avio_open(&this->fmtContext->pb, filename.c_str(), AVIO_FLAG_WRITE), "Could not open output file", E_FAIL);
+		}
+		int result = avformat_write_header(this->fmtContext, NULL);
+		if (result < 0) {
+			av_err2str2(result);
+			LOG(LL_ERR, "Could not write header of ", filename, ": ", __av_error);
+			// finish() only closes outputs that were opened completely.
+			if (this->outputFile) {
+				this->outputFile->close(&this->fmtContext->pb, nullptr);
+				this->outputFile.reset();
+			} else {
+				avio_closep(&this->fmtContext->pb);
+			}
+			avformat_free_context(this->fmtContext);
+			this->fmtContext = nullptr;
+			POST();
+			return E_FAIL;
+		}
+
+		LOG(LL_NFO, "Exporting extra output to file: ", filename, " (", this->frameRate.num, "/", this->frameRate.den, " fps, ", this->shutterAngle, " degree shutter)");
+		this->isOpen = true;
+		POST();
+		return S_OK;
+	}
+
+	HRESULT AuxVideoOutput::writeFrame(const uint8_t* pData, size_t length, AVPixelFormat inputPixelFormat) {
+		PRE();
+		if (!this->isOpen) {
+			POST();
+			return E_FAIL;
+		}
+
+		int bufferLength = av_image_get_buffer_size(inputPixelFormat, this->width, this->height, 1);
+		if (length != bufferLength) {
+			LOG(LL_ERR, "Extra output frame size != av_image_get_buffer_size: ", length, " vs ", bufferLength);
+			POST();
+			return E_FAIL;
+		}
+
+		if (!this->pSwsContext || (this->swsInputFormat != inputPixelFormat)) {
+			sws_freeContext(this->pSwsContext);
+			this->pSwsContext = sws_getContext(this->width, this->height, inputPixelFormat, this->width, this->height, this->outputPixelFormat, SWS_POINT, NULL, NULL, NULL);
+			RET_IF_NULL(this->pSwsContext, "Could not create conversion context", E_FAIL);
+			this->swsInputFormat = inputPixelFormat;
+		}
+
+		std::shared_ptr<AVFrame> inputFrame(av_frame_alloc(), [](AVFrame* p) { av_frame_free(&p); });
+		RET_IF_NULL(inputFrame.get(), "Could not allocate video frame", E_FAIL);
+		RET_IF_FAILED(av_image_fill_arrays(inputFrame->data, inputFrame->linesize, pData, inputPixelFormat, this->width, this->height, 1), "Could not fill the frame with data from the buffer", E_FAIL);
+
+		std::shared_ptr<AVFrame> outputFrame(av_frame_alloc(), [](AVFrame* p) { av_frame_free(&p); });
+		RET_IF_NULL(outputFrame.get(), "Could not allocate video frame", E_FAIL);
+		outputFrame->format = this->outputPixelFormat;
+		outputFrame->width = this->width;
+		outputFrame->height = this->height;
+		RET_IF_FAILED_AV(av_frame_get_buffer(outputFrame.get(), 1), "Could not allocate video frame buffer", E_FAIL);
+
+		sws_scale(this->pSwsContext, inputFrame->data, inputFrame->linesize, 0, this->height, outputFrame->data, outputFrame->linesize);
+		outputFrame->pts = this->pts++;
+
+		HRESULT result = this->sendFrame(outputFrame.get());
+		POST();
+		return result;
+	}
+
+	HRESULT AuxVideoOutput::startThread(const ThreadPolicy& policy) {
+		PRE();
+		if (!this->isOpen) {
+			POST();
+			return E_FAIL;
+		}
+		this->thread_encoder = std::thread(&AuxVideoOutput::encodingThread, this);
+		policy.applyToEncoderThread(this->thread_encoder);
+		POST();
+		return S_OK;
+	}
+
+	HRESULT AuxVideoOutput::queueFrame(std::shared_ptr<std::valarray<uint8_t>> pData, AVPixelFormat inputPixelFormat) {
+		if (!this->thread_encoder.joinable() || this->isFailed) {
+			return E_FAIL;
+		}
+		this->frameQueue.enqueue(QueuedFrame(pData, inputPixelFormat));
+		return S_OK;
+	}
+
+	void AuxVideoOutput::encodingThread() {
+		PRE();
+		QueuedFrame frame = this->frameQueue.dequeue();
+		while (frame.pData) {
+			// Frames after a failure are still taken, so that the producer never waits for nothing.
+			if (!this->isFailed && FAILED(this->writeFrame(std::begin(*frame.pData), frame.pData->size(), frame.inputPixelFormat))) {
+				LOG(LL_ERR, "Could not encode extra output frame of ", this->filename);
+				this->isFailed = true;
+			}
+			frame = this->frameQueue.dequeue();
+		}
+		POST();
+	}
+
+	HRESULT AuxVideoOutput::writeFrame(AVFrame* frame) {
+		if (!this->isOpen) {
+			return E_FAIL;
+		}
+		frame->pts = this->pts++;
+		return this->sendFrame(frame);
+	}
+
+	HRESULT AuxVideoOutput::sendFrame(AVFrame* frame) {
+		RET_IF_FAILED_AV(avcodec_send_frame(this->codecContext, frame), "Could not send frame to the encoder", E_FAIL);
+
+		AVPacket pkt;
+		av_init_packet(&pkt);
+		pkt.data = NULL;
+		pkt.size = 0;
+		while (SUCCEEDED(avcodec_receive_packet(this->codecContext, &pkt))) {
+			av_packet_rescale_ts(&pkt, this->codecContext->time_base, this->stream->time_base);
+			pkt.stream_index = this->stream->index;
+			int result = av_interleaved_write_frame(this->fmtContext, &pkt);
+			if (result < 0) {
+				av_err2str2(result);
+				LOG(LL_ERR, "Could not write packet to ", this->filename, ": ", __av_error);
+				av_packet_unref(&pkt);
+				return E_FAIL;
+			}
+		}
+		av_packet_unref(&pkt);
+		return S_OK;
+	}
+
+	HRESULT AuxVideoOutput::finish() {
+		PRE();
+		if (this->thread_encoder.joinable()) {
+			this->frameQueue.enqueue(QueuedFrame());
+			this->thread_encoder.join();
+		}
+		if (!this->isOpen) {
+			POST();
+			return S_OK;
+		}
+		this->isOpen = false;
+
+		// Write delayed frames
+		LOG_IF_FAILED(this->sendFrame(NULL), "Could not flush the encoder.");
+		LOG_IF_FAILED_AV(av_write_trailer(this->fmtContext), "Could not finalize the output file.");
+		if (this->outputFile) {
+			LOG_IF_FAILED(this->outputFile->close(&this->fmtContext->pb, this->manifest.get()), "Could not close the output file.");
+		} else {
+			LOG_IF_FAILED_AV(avio_closep(&this->fmtContext->pb), "Could not close the output file.");
+		}
+		POST();
+		return S_OK;
+	}
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <Windows.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <valarray>
+#include "output-manifest.h"
+#include "SafeQueue.h"
+#include "thread-policy.h"
+
+extern "C" {
+#include <libavcodec\avcodec.h>
+#include <libavformat\avformat.h>
+#include <libswscale\swscale.h>
+}
+
+namespace Encoder {
+	// Video-only file that receives a second stream of frames made from the same
+	// sub-frames as the main export, at its own frame rate and shutter angle.
+	class AuxVideoOutput {
+	public:
+		AuxVideoOutput(AVRational frameRate, float shutterAngle);
+		~AuxVideoOutput();
+
+		HRESULT open(std::string filename, AVOutputFormat* oformat, uint32_t width, uint32_t height, AVPixelFormat outputPixelFormat, std::string vcodec, std::string voptions, int threadCount);
+		HRESULT writeFrame(const uint8_t* pData, size_t length, AVPixelFormat inputPixelFormat);
+		// Encodes a frame that already has the size and pixel format of the output.
+		HRESULT writeFrame(AVFrame* frame);
+		HRESULT finish();
+
+		// Starts a thread that encodes the frames passed to queueFrame, so that a slow
+		// output does not hold up the stage that makes its frames.
+		HRESULT startThread(const ThreadPolicy& policy);
+		// Hands a frame to the encoding thread; blocks while it is too far behind.
+		HRESULT queueFrame(std::shared_ptr<std::valarray<uint8_t>> pData, AVPixelFormat inputPixelFormat);
+
+		// Hashes the file while it is written and adds its digest to the manifest when it is finished.
+		void setManifest(std::shared_ptr<OutputManifest> manifest) { this->manifest = manifest; }
+
+		AVRational getFrameRate() const { return this->frameRate; }
+		float getShutterAngle() const { return this->shutterAngle; }
+		const std::string& getFilename() const { return this->filename; }
+
+	private:
+		struct QueuedFrame {
+			QueuedFrame() :
+				inputPixelFormat(AV_PIX_FMT_NONE)
+			{ }
+
+			QueuedFrame(std::shared_ptr<std::valarray<uint8_t>> pData, AVPixelFormat inputPixelFormat) :
+				pData(pData),
+				inputPixelFormat(inputPixelFormat)
+			{ }
+
+			// No data marks the end of the stream.
+			std::shared_ptr<std::valarray<uint8_t>> pData;
+			AVPixelFormat inputPixelFormat;
+		};
+
+		HRESULT sendFrame(AVFrame* frame);
+		void encodingThread();
+
+		AVRational frameRate;
+		float shutterAngle;
+		std::string filename;
+		uint32_t width = 0;
+		uint32_t height = 0;
+		AVPixelFormat outputPixelFormat = AV_PIX_FMT_NONE;
+
+		AVFormatContext* fmtContext = NULL;
+		AVCodecContext* codecContext = NULL;
+		AVStream* stream = NULL;
+		AVDictionary* options = NULL;
+		SwsContext* pSwsContext = NULL;
+		AVPixelFormat swsInputFormat = AV_PIX_FMT_NONE;
+		std::shared_ptr<OutputManifest> manifest;
+		std::unique_ptr<HashingFile> outputFile;
+		int64_t pts = 0;
+		bool isOpen = false;
+
+		SafeQueue<QueuedFrame> frameQueue;
+		std::thread thread_encoder;
+		std::atomic<bool> isFailed{ false };
+	};
+}
@@ -0,0 +1,118 @@
+#include "block-hasher.h"
+#include "logger.h"
+#include <algorithm>
+
+namespace Encoder {
+
+	const uint64_t BlockHasher::BLOCK_SIZE;
+
+	void BlockHasher::write(uint64_t offset, const void* pData, size_t length) {
+		if (offset != this->position) {
+			// The writer seeked: everything it touches is hashed again in finish(),
+			// and so is the rest of a block that the sequential hash was skipped into.
+			this->markDirty(offset, offset + length);
+			if (offset + length > this->position) {
+				this->markDirty(this->position, offset + length);
+				this->position = offset + length;
+				this->isInSync = (this->position % BLOCK_SIZE) == 0;
+				this->current.reset();
+			}
+			return;
+		}
+
+		const uint8_t* p = static_cast<const uint8_t*>(pData);
+		while (length > 0) {
+			size_t chunk = static_cast<size_t>((std::min)(static_cast<uint64_t>(length), BLOCK_SIZE - this->position % BLOCK_SIZE));
+			if (this->isInSync) {
+				this->current.update(p, chunk);
+			}
+			this->position += chunk;
+			p += chunk;
+			length -= chunk;
+			if (this->position % BLOCK_SIZE == 0) {
+				this->completeBlock(this->position / BLOCK_SIZE - 1);
+			}
+		}
+	}
+
+	void BlockHasher::completeBlock(uint64_t block) {
+		if (this->blockDigests.size() <= block) {
+			this->blockDigests.resize(static_cast<size_t>(block + 1));
+		}
+		if (this->isInSync) {
+			this->blockDigests[static_cast<size_t>(block)] = this->current.digest();
+		} else {
+			this->dirtyBlocks.insert(block);
+		}
+		this->current.reset();
+		this->isInSync = true;
+	}
+
+	void BlockHasher::markDirty(uint64_t begin, uint64_t end) {
+		for (uint64_t block = begin / BLOCK_SIZE; block * BLOCK_SIZE < end; block++) {
+			this->dirtyBlocks.insert(block);
+		}
+	}
+
+	HRESULT BlockHasher::finish(const std::string& path, uint64_t& digest) {
+		if (this->position % BLOCK_SIZE != 0) {
+			this->completeBlock(this->position / BLOCK_SIZE);
+		}
+		this->blockDigests.resize(static_cast<size_t>((this->position + BLOCK_SIZE - 1) / BLOCK_SIZE));
+
+		if (!this->dirtyBlocks.empty()) {
+			std::ifstream file(path, std::ios::binary);
+			std::vector<char> buffer(static_cast<size_t>(BLOCK_SIZE));
+			for (uint64_t block : this->dirtyBlocks) {
+				if (block >= this->blockDigests.size()) {
+					break;
+				}
+				size_t length = static_cast<size_t>((std::min)(BLOCK_SIZE, this->position - block * BLOCK_SIZE));
+				file.seekg(block * BLOCK_SIZE);
+				if (!file.read(buffer.data(), length)) {
+					LOG(LL_ERR, "Could not read back ", path, " to hash it.");
+					return E_FAIL;
+				}
+				this->blockDigests[static_cast<size_t>(block)] = XXH64::hash(buffer.data(), length);
+			}
+			LOG(LL_DBG, "Re-read ", this->dirtyBlocks.size(), " of ", this->blockDigests.size(), " blocks of ", path, " to hash it.");
+			this->dirtyBlocks.clear();
+		}
+
+		digest = combine(this->blockDigests, this->position);
+		return S_OK;
+	}
+
+	HRESULT BlockHasher::hashFile(const std::string& path, uint64_t& digest, uint64_t& size) {
+		std::ifstream file(path, std::ios::binary);
+		if (!file) {
+			return E_FAIL;
+		}
+
+		std::vector<char> buffer(static_cast<size_t>(BLOCK_SIZE));
+		std::vector<uint64_t> blockDigests;
+		size = 0;
+		while (file) {
+			file.read(buffer.data(), buffer.size());
+			size_t length = static_cast<size_t>(file.gcount());
+			if (length == 0) {
+				break;
+			}
+			blockDigests.push_back(XXH64::hash(buffer.data(), length));
+			size += length;
+		}
+		if (file.bad()) {
+			return E_FAIL;
+		}
+
+		digest = combine(blockDigests, size);
+		return S_OK;
+	}
+
+	uint64_t BlockHasher::combine(const std::vector<uint64_t>& blockDigests, uint64_t size) {
+		XXH64 state;
+		state.update(blockDigests.data(), blockDigests.size() * sizeof(uint64_t));
+		state.update(&size, sizeof(size));
+		return state.digest();
+	}
+}
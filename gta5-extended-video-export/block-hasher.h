@@ -0,0 +1,42 @@
+#pragma once
+
+#include <Windows.h>
+#include <cstdint>
+#include <set>
+#include <string>
+#include <vector>
+#include "xxhash64.h"
+
+namespace Encoder {
+	// Digest of a file that is hashed while it is written. The file is split into
+	// blocks of BLOCK_SIZE bytes, and every block is hashed with XXH64 as the
+	// writer passes through it. Blocks the writer goes back to (a muxer patching
+	// its header, for example) are re-read once when the file is finished. The
+	// digest of the file is the XXH64 of its block digests followed by its size.
+	class BlockHasher {
+	public:
+		static const uint64_t BLOCK_SIZE = 4 << 20;
+
+		void write(uint64_t offset, const void* pData, size_t length);
+
+		// Re-reads the blocks that were written out of order from path and returns the digest of the file.
+		HRESULT finish(const std::string& path, uint64_t& digest);
+
+		uint64_t getSize() const { return this->position; }
+		size_t getRewrittenBlockCount() const { return this->dirtyBlocks.size(); }
+
+		// Hashes a complete file in a single pass.
+		static HRESULT hashFile(const std::string& path, uint64_t& digest, uint64_t& size);
+
+	private:
+		static uint64_t combine(const std::vector<uint64_t>& blockDigests, uint64_t size);
+		void markDirty(uint64_t begin, uint64_t end);
+		void completeBlock(uint64_t block);
+
+		XXH64 current;
+		bool isInSync = true;
+		uint64_t position = 0;
+		std::vector<uint64_t> blockDigests;
+		std::set<uint64_t> dirtyBlocks;
+	};
+}
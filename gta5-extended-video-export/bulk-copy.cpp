@@ -0,0 +1,109 @@
+#include "bulk-copy.h"
+#include <cstring>
+#include <immintrin.h>
+#include <intrin.h>
+
+namespace Encoder {
+
+	namespace {
+		// How far ahead of the loads the source is prefetched.
+		const size_t PREFETCH_DISTANCE = 512;
+
+		typedef void(*CopyFunction)(uint8_t* pDest, const uint8_t* pSource, size_t length);
+
+		// Copies up to the first destination address aligned to `alignment` and
+		// returns the number of bytes copied.
+		size_t copyHead(uint8_t* pDest, const uint8_t* pSource, size_t alignment) {
+			size_t head = (alignment - (reinterpret_cast<uintptr_t>(pDest) & (alignment - 1))) & (alignment - 1);
+			memcpy(pDest, pSource, head);
+			return head;
+		}
+
+		void copySSE2(uint8_t* pDest, const uint8_t* pSource, size_t length) {
+			size_t i = copyHead(pDest, pSource, 16);
+			for (; i + 64 <= length; i += 64) {
+				_mm_prefetch(reinterpret_cast<const char*>(pSource + i + PREFETCH_DISTANCE), _MM_HINT_NTA);
+				__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pSource + i));
+				__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pSource + i + 16));
+				__m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pSource + i + 32));
+				__m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pSource + i + 48));
+				_mm_stream_si128(reinterpret_cast<__m128i*>(pDest + i), a);
+				_mm_stream_si128(reinterpret_cast<__m128i*>(pDest + i + 16), b);
+				_mm_stream_si128(reinterpret_cast<__m128i*>(pDest + i + 32), c);
+				_mm_stream_si128(reinterpret_cast<__m128i*>(pDest + i + 48), d);
+			}
+			_mm_sfence();
+			memcpy(pDest + i, pSource + i, length - i);
+		}
+
+		void copyAVX(uint8_t* pDest, const uint8_t* pSource, size_t length) {
+			size_t i = copyHead(pDest, pSource, 32);
+			for (; i + 128 <= length; i += 128) {
+				_mm_prefetch(reinterpret_cast<const char*>(pSource + i + PREFETCH_DISTANCE), _MM_HINT_NTA);
+				_mm_prefetch(reinterpret_cast<const char*>(pSource + i + PREFETCH_DISTANCE + 64), _MM_HINT_NTA);
+				__m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pSource + i));
+				__m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pSource + i + 32));
+				__m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pSource + i + 64));
+				__m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pSource + i + 96));
+				_mm256_stream_si256(reinterpret_cast<__m256i*>(pDest + i), a);
+				_mm256_stream_si256(reinterpret_cast<__m256i*>(pDest + i + 32), b);
+				_mm256_stream_si256(reinterpret_cast<__m256i*>(pDest + i + 64), c);
+				_mm256_stream_si256(reinterpret_cast<__m256i*>(pDest + i + 96), d);
+			}
+			_mm256_zeroupper();
+			_mm_sfence();
+			memcpy(pDest + i, pSource + i, length - i);
+		}
+
+		// AVX needs the CPU to support it and the OS to save the YMM registers.
+		bool isAVXSupported() {
+			int info[4];
+			__cpuid(info, 1);
+			const int OSXSAVE = 1 << 27;
+			const int AVX = 1 << 28;
+			if ((info[2] & (OSXSAVE | AVX)) != (OSXSAVE | AVX)) {
+				return false;
+			}
+			return (_xgetbv(0) & 6) == 6;
+		}
+
+		const bool useAVX = isAVXSupported();
+		const CopyFunction copyFunction = useAVX ? copyAVX : copySSE2;
+	}
+
+	void bulkCopy(void* pDest, const void* pSource, size_t length) {
+		if (length < BULK_COPY_THRESHOLD) {
+			memcpy(pDest, pSource, length);
+			return;
+		}
+		copyFunction(static_cast<uint8_t*>(pDest), static_cast<const uint8_t*>(pSource), length);
+	}
+
+	void bulkWiden(uint32_t* pDest, const uint8_t* pSource, size_t count) {
+		size_t i = 0;
+		if (count * sizeof(uint32_t) >= BULK_COPY_THRESHOLD) {
+			for (; (i < count) && ((reinterpret_cast<uintptr_t>(pDest + i) & 15) != 0); i++) {
+				pDest[i] = pSource[i];
+			}
+			const __m128i zero = _mm_setzero_si128();
+			for (; i + 16 <= count; i += 16) {
+				_mm_prefetch(reinterpret_cast<const char*>(pSource + i + PREFETCH_DISTANCE), _MM_HINT_NTA);
+				__m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pSource + i));
+				__m128i low = _mm_unpacklo_epi8(bytes, zero);
+				__m128i high = _mm_unpackhi_epi8(bytes, zero);
+				_mm_stream_si128(reinterpret_cast<__m128i*>(pDest + i), _mm_unpacklo_epi16(low, zero));
+				_mm_stream_si128(reinterpret_cast<__m128i*>(pDest + i + 4), _mm_unpackhi_epi16(low, zero));
+				_mm_stream_si128(reinterpret_cast<__m128i*>(pDest + i + 8), _mm_unpacklo_epi16(high, zero));
+				_mm_stream_si128(reinterpret_cast<__m128i*>(pDest + i + 12), _mm_unpackhi_epi16(high, zero));
+			}
+			_mm_sfence();
+		}
+		for (; i < count; i++) {
+			pDest[i] = pSource[i];
+		}
+	}
+
+	const char* getBulkCopyISA() {
+		return useAVX ? "AVX" : "SSE2";
+	}
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Encoder {
+	// Buffers at least this large are copied with non-temporal stores. Smaller
+	// copies are likely to be read again soon and go through memcpy.
+	const size_t BULK_COPY_THRESHOLD = 1024 * 1024;
+
+	// Copies a frame sized buffer without pulling the destination into the cache,
+	// so the game keeps its working set in L2/L3 while the export moves frames.
+	// The source is prefetched ahead of the loads. AVX is used when the CPU and
+	// the OS support it, SSE2 otherwise.
+	void bulkCopy(void* pDest, const void* pSource, size_t length);
+
+	// Widens bytes to 32 bit integers with non-temporal stores.
+	void bulkWiden(uint32_t* pDest, const uint8_t* pSource, size_t count);
+
+	// Name of the instruction set bulkCopy uses on this CPU.
+	const char* getBulkCopyISA();
+}
@@ -21,4 +21,34 @@ std::pair<uint32_t, uint32_t>   config::fps;
 uint8_t                         config::motion_blur_samples;
 float							config::motion_blur_strength;
 std::string                     config::container_format;
-bool                            config::export_openexr;
\ No newline at end of file
+bool                            config::export_openexr;
+std::string                     config::video_pipeline;
+std::string                     config::frame_ranges;
+float                           config::shutter_angle;
+std::string                     config::extra_outputs;
+std::string                     config::image_sequence_layout;
+bool                            config::output_manifest;
+bool                            config::export_journal;
+std::string                     config::gop_cache;
+uint32_t                        config::gop_cache_length;
+std::string                     config::resolution_ladder;
+uint32_t                        config::quality_probe_interval;
+std::string                     config::openexr_shutter;
+std::string                     config::openexr_channels;
+std::string                     config::hdr_video;
+float                           config::hdr_reference_white;
+std::string                     config::gif_dither;
+uint32_t                        config::gif_palette_frames;
+std::string                     config::lut_file;
+std::string                     config::live_url;
+uint32_t                        config::motion_blur_interpolation;
+uint32_t                        config::motion_blur_search_range;
+uint32_t                        config::reserved_cores;
+uint64_t                        config::encoder_thread_affinity;
+int                             config::encoder_thread_priority;
+uint64_t                        config::exr_thread_affinity;
+int                             config::exr_thread_priority;
+uint32_t                        config::codec_threads;
+uint32_t                        config::frame_pacing_budget;
+std::string                     config::spill_folder;
+uint32_t                        config::spill_after;
\ No newline at end of file
@@ -9,6 +9,7 @@
 #include <sstream>
 #include <ShlObj.h>
 #include <regex>
+#include <fstream>
 #include "logger.h"
 
 #define CFG_XVX_SECTION "XVX"
@@ -21,6 +22,39 @@
 #define CFG_EXPORT_MB_STRENGTH "motion_blur_strength"
 #define CFG_EXPORT_FPS "fps"
 #define CFG_EXPORT_OPENEXR "export_openexr"
+#define CFG_EXPORT_VIDEO_PIPELINE "video_pipeline"
+#define CFG_EXPORT_FRAME_RANGES "frame_ranges"
+#define CFG_EXPORT_FRAME_RANGES_FILE "frame_ranges_file"
+#define CFG_EXPORT_SHUTTER_ANGLE "shutter_angle"
+#define CFG_EXPORT_EXTRA_OUTPUTS "extra_outputs"
+#define CFG_EXPORT_IMAGE_LAYOUT "image_sequence_layout"
+#define CFG_EXPORT_OUTPUT_MANIFEST "output_manifest"
+#define CFG_EXPORT_JOURNAL "export_journal"
+#define CFG_EXPORT_GOP_CACHE "gop_cache"
+#define CFG_EXPORT_GOP_CACHE_LENGTH "gop_cache_length"
+#define CFG_EXPORT_RESOLUTION_LADDER "resolution_ladder"
+#define CFG_EXPORT_QUALITY_PROBE_INTERVAL "quality_probe_interval"
+#define CFG_EXPORT_OPENEXR_SHUTTER "openexr_shutter"
+#define CFG_EXPORT_OPENEXR_CHANNELS "openexr_channels"
+#define CFG_EXPORT_HDR_VIDEO "hdr_video"
+#define CFG_EXPORT_HDR_REFERENCE_WHITE "hdr_reference_white"
+#define CFG_EXPORT_GIF_DITHER "gif_dither"
+#define CFG_EXPORT_GIF_PALETTE_FRAMES "gif_palette_frames"
+#define CFG_EXPORT_LUT_FILE "lut_file"
+#define CFG_EXPORT_LIVE_URL "live_url"
+#define CFG_EXPORT_MB_INTERPOLATION "motion_blur_interpolation"
+#define CFG_EXPORT_MB_SEARCH_RANGE "motion_blur_search_range"
+
+#define CFG_PERFORMANCE_SECTION "PERFORMANCE"
+#define CFG_PERF_RESERVED_CORES "reserved_cores"
+#define CFG_PERF_ENCODER_AFFINITY "encoder_thread_affinity"
+#define CFG_PERF_ENCODER_PRIORITY "encoder_thread_priority"
+#define CFG_PERF_EXR_AFFINITY "exr_thread_affinity"
+#define CFG_PERF_EXR_PRIORITY "exr_thread_priority"
+#define CFG_PERF_CODEC_THREADS "codec_threads"
+#define CFG_PERF_FRAME_PACING_BUDGET "frame_pacing_budget"
+#define CFG_PERF_SPILL_FOLDER "spill_folder"
+#define CFG_PERF_SPILL_AFTER "spill_after"
 
 #define CFG_FORMAT_SECTION "FORMAT"
 #define CFG_EXPORT_FORMAT "format"
@@ -47,6 +81,27 @@ public:
 	static bool                            is_mod_enabled;
 	static bool							   auto_reload_config;
 	static bool                            export_openexr;
+	static std::string                     video_pipeline;
+	static std::string                     frame_ranges;
+	static float                           shutter_angle;
+	static std::string                     extra_outputs;
+	static std::string                     image_sequence_layout;
+	static bool                            output_manifest;
+	static bool                            export_journal;
+	static std::string                     gop_cache;
+	static uint32_t                        gop_cache_length;
+	static std::string                     resolution_ladder;
+	static uint32_t                        quality_probe_interval;
+	static std::string                     openexr_shutter;
+	static std::string                     openexr_channels;
+	static std::string                     hdr_video;
+	static float                           hdr_reference_white;
+	static std::string                     gif_dither;
+	static uint32_t                        gif_palette_frames;
+	static std::string                     lut_file;
+	static std::string                     live_url;
+	static uint32_t                        motion_blur_interpolation;
+	static uint32_t                        motion_blur_search_range;
 	static std::pair<uint32_t, uint32_t>   resolution;
 	static std::string                     output_dir;
 	static std::string                     format_cfg;
@@ -62,6 +117,15 @@ public:
 	static uint8_t                         motion_blur_samples;
 	static float                           motion_blur_strength;
 	static std::string                     container_format;
+	static uint32_t                        reserved_cores;
+	static uint64_t                        encoder_thread_affinity;
+	static int                             encoder_thread_priority;
+	static uint64_t                        exr_thread_affinity;
+	static int                             exr_thread_priority;
+	static uint32_t                        codec_threads;
+	static uint32_t                        frame_pacing_budget;
+	static std::string                     spill_folder;
+	static uint32_t                        spill_after;
 
 	static void reload() {
 		config_parser.reset(new INI::Parser(INI_FILE_NAME));
@@ -84,6 +148,36 @@ public:
 		motion_blur_samples = parse_motion_blur_samples();
 		motion_blur_strength = parse_motion_blur_strength();
 		export_openexr = parse_export_openexr();
+		video_pipeline = parse_video_pipeline();
+		frame_ranges = parse_frame_ranges();
+		shutter_angle = parse_shutter_angle();
+		extra_outputs = parse_extra_outputs();
+		image_sequence_layout = parse_image_sequence_layout();
+		output_manifest = parse_output_manifest();
+		export_journal = parse_export_journal();
+		gop_cache = parse_gop_cache();
+		gop_cache_length = parse_gop_cache_length();
+		resolution_ladder = parse_resolution_ladder();
+		quality_probe_interval = parse_quality_probe_interval();
+		openexr_shutter = parse_openexr_shutter();
+		openexr_channels = parse_openexr_channels();
+		hdr_video = parse_hdr_video();
+		hdr_reference_white = parse_hdr_reference_white();
+		gif_dither = parse_gif_dither();
+		gif_palette_frames = parse_gif_palette_frames();
+		lut_file = parse_lut_file();
+		live_url = parse_live_url();
+		motion_blur_interpolation = parse_motion_blur_interpolation();
+		motion_blur_search_range = parse_motion_blur_search_range();
+		reserved_cores = parse_reserved_cores();
+		encoder_thread_affinity = parse_affinity(CFG_PERF_ENCODER_AFFINITY);
+		encoder_thread_priority = parse_priority(CFG_PERF_ENCODER_PRIORITY, THREAD_PRIORITY_BELOW_NORMAL);
+		exr_thread_affinity = parse_affinity(CFG_PERF_EXR_AFFINITY);
+		exr_thread_priority = parse_priority(CFG_PERF_EXR_PRIORITY, THREAD_PRIORITY_BELOW_NORMAL);
+		codec_threads = parse_codec_threads();
+		frame_pacing_budget = parse_frame_pacing_budget();
+		spill_folder = parse_spill_folder();
+		spill_after = parse_spill_after();
 	}
 
 private:
@@ -200,6 +294,220 @@ private:
 		return failed(CFG_EXPORT_OPENEXR, string, false);
 	}
 
+	static std::string parse_video_pipeline() {
+		std::string string = getTrimmed(config_parser, CFG_EXPORT_VIDEO_PIPELINE, CFG_EXPORT_SECTION);
+		if (!string.empty()) {
+			return succeeded(CFG_EXPORT_VIDEO_PIPELINE, string);
+		}
+
+		return failed(CFG_EXPORT_VIDEO_PIPELINE, string, std::string("motion_blur, encode"));
+	}
+
+	static std::string parse_frame_ranges() {
+		std::string string = getTrimmed(config_parser, CFG_EXPORT_FRAME_RANGES, CFG_EXPORT_SECTION);
+		std::string filename = getTrimmed(config_parser, CFG_EXPORT_FRAME_RANGES_FILE, CFG_EXPORT_SECTION);
+
+		if (!filename.empty()) {
+			std::ifstream file(filename);
+			if (file) {
+				std::stringstream content;
+				content << file.rdbuf();
+				string += "\n" + content.str();
+				succeeded(CFG_EXPORT_FRAME_RANGES_FILE, filename);
+			} else {
+				failed(CFG_EXPORT_FRAME_RANGES_FILE, filename, std::string(""));
+			}
+		}
+
+		return succeeded(CFG_EXPORT_FRAME_RANGES, string);
+	}
+
+	static float parse_shutter_angle() {
+		std::string string = getTrimmed(config_parser, CFG_EXPORT_SHUTTER_ANGLE, CFG_EXPORT_SECTION);
+		if (string.empty()) {
+			return succeeded(CFG_EXPORT_SHUTTER_ANGLE, -1.0f);
+		}
+
+		try {
+			float value = std::stof(string);
+			if (value >= 0) {
+				return succeeded(CFG_EXPORT_SHUTTER_ANGLE, value);
+			}
+		} catch (std::exception& ex) {
+			LOG(LL_ERR, ex.what());
+		}
+
+		return failed(CFG_EXPORT_SHUTTER_ANGLE, string, -1.0f);
+	}
+
+	static std::string parse_extra_outputs() {
+		std::string string = getTrimmed(config_parser, CFG_EXPORT_EXTRA_OUTPUTS, CFG_EXPORT_SECTION);
+		return succeeded(CFG_EXPORT_EXTRA_OUTPUTS, string);
+	}
+
+	static std::string parse_image_sequence_layout() {
+		std::string string = getTrimmed(config_parser, CFG_EXPORT_IMAGE_LAYOUT, CFG_EXPORT_SECTION);
+		if (!string.empty()) {
+			return succeeded(CFG_EXPORT_IMAGE_LAYOUT, string);
+		}
+
+		return failed(CFG_EXPORT_IMAGE_LAYOUT, string, std::string("flat"));
+	}
+
+	static bool parse_output_manifest() {
+		std::string string = config_parser->top()(CFG_EXPORT_SECTION)[CFG_EXPORT_OUTPUT_MANIFEST];
+
+		try {
+			return succeeded(CFG_EXPORT_OUTPUT_MANIFEST, stringToBoolean(string));
+		} catch (std::exception& ex) {
+			LOG(LL_ERR, ex.what());
+		}
+
+		return failed(CFG_EXPORT_OUTPUT_MANIFEST, string, false);
+	}
+
+	static bool parse_export_journal() {
+		std::string string = config_parser->top()(CFG_EXPORT_SECTION)[CFG_EXPORT_JOURNAL];
+
+		try {
+			return succeeded(CFG_EXPORT_JOURNAL, stringToBoolean(string));
+		} catch (std::exception& ex) {
+			LOG(LL_ERR, ex.what());
+		}
+
+		return failed(CFG_EXPORT_JOURNAL, string, false);
+	}
+
+	static std::string parse_gop_cache() {
+		std::string string = getTrimmed(config_parser, CFG_EXPORT_GOP_CACHE, CFG_EXPORT_SECTION);
+		return succeeded(CFG_EXPORT_GOP_CACHE, string);
+	}
+
+	static uint32_t parse_gop_cache_length() {
+		std::string string = getTrimmed(config_parser, CFG_EXPORT_GOP_CACHE_LENGTH, CFG_EXPORT_SECTION);
+		try {
+			uint32_t value = (uint32_t)std::stoul(string);
+			if (value > 0) {
+				return succeeded(CFG_EXPORT_GOP_CACHE_LENGTH, value);
+			}
+		} catch (std::exception& ex) {
+			LOG(LL_NON, ex.what());
+		}
+
+		return failed(CFG_EXPORT_GOP_CACHE_LENGTH, string, 120u);
+	}
+
+	static std::string parse_resolution_ladder() {
+		std::string string = getTrimmed(config_parser, CFG_EXPORT_RESOLUTION_LADDER, CFG_EXPORT_SECTION);
+		return succeeded(CFG_EXPORT_RESOLUTION_LADDER, string);
+	}
+
+	static uint32_t parse_quality_probe_interval() {
+		std::string string = getTrimmed(config_parser, CFG_EXPORT_QUALITY_PROBE_INTERVAL, CFG_EXPORT_SECTION);
+		if (string.empty()) {
+			return succeeded(CFG_EXPORT_QUALITY_PROBE_INTERVAL, 0u);
+		}
+
+		try {
+			return succeeded(CFG_EXPORT_QUALITY_PROBE_INTERVAL, (uint32_t)std::stoul(string));
+		} catch (std::exception& ex) {
+			LOG(LL_NON, ex.what());
+		}
+
+		return failed(CFG_EXPORT_QUALITY_PROBE_INTERVAL, string, 0u);
+	}
+
+	static std::string parse_openexr_shutter() {
+		std::string string = getTrimmed(config_parser, CFG_EXPORT_OPENEXR_SHUTTER, CFG_EXPORT_SECTION);
+		if (!string.empty()) {
+			return succeeded(CFG_EXPORT_OPENEXR_SHUTTER, string);
+		}
+
+		return failed(CFG_EXPORT_OPENEXR_SHUTTER, string, std::string("blur"));
+	}
+
+	static std::string parse_openexr_channels() {
+		std::string string = getTrimmed(config_parser, CFG_EXPORT_OPENEXR_CHANNELS, CFG_EXPORT_SECTION);
+		return succeeded(CFG_EXPORT_OPENEXR_CHANNELS, string);
+	}
+
+	static std::string parse_hdr_video() {
+		std::string string = getTrimmed(config_parser, CFG_EXPORT_HDR_VIDEO, CFG_EXPORT_SECTION);
+		return succeeded(CFG_EXPORT_HDR_VIDEO, string);
+	}
+
+	static float parse_hdr_reference_white() {
+		std::string string = getTrimmed(config_parser, CFG_EXPORT_HDR_REFERENCE_WHITE, CFG_EXPORT_SECTION);
+		try {
+			float value = std::stof(string);
+			if (value > 0) {
+				return succeeded(CFG_EXPORT_HDR_REFERENCE_WHITE, value);
+			}
+		} catch (std::exception& ex) {
+			LOG(LL_NON, ex.what());
+		}
+
+		return failed(CFG_EXPORT_HDR_REFERENCE_WHITE, string, 203.0f);
+	}
+
+	static std::string parse_gif_dither() {
+		std::string string = getTrimmed(config_parser, CFG_EXPORT_GIF_DITHER, CFG_EXPORT_SECTION);
+		if (!string.empty()) {
+			return succeeded(CFG_EXPORT_GIF_DITHER, string);
+		}
+
+		return failed(CFG_EXPORT_GIF_DITHER, string, std::string("bayer"));
+	}
+
+	static uint32_t parse_gif_palette_frames() {
+		std::string string = getTrimmed(config_parser, CFG_EXPORT_GIF_PALETTE_FRAMES, CFG_EXPORT_SECTION);
+		try {
+			uint32_t value = (uint32_t)std::stoul(string);
+			if (value > 0) {
+				return succeeded(CFG_EXPORT_GIF_PALETTE_FRAMES, value);
+			}
+		} catch (std::exception& ex) {
+			LOG(LL_NON, ex.what());
+		}
+
+		return failed(CFG_EXPORT_GIF_PALETTE_FRAMES, string, 30u);
+	}
+
+	static std::string parse_lut_file() {
+		std::string string = getTrimmed(config_parser, CFG_EXPORT_LUT_FILE, CFG_EXPORT_SECTION);
+		return succeeded(CFG_EXPORT_LUT_FILE, string);
+	}
+
+	static std::string parse_live_url() {
+		std::string string = getTrimmed(config_parser, CFG_EXPORT_LIVE_URL, CFG_EXPORT_SECTION);
+		return succeeded(CFG_EXPORT_LIVE_URL, string);
+	}
+
+	static uint32_t parse_motion_blur_interpolation() {
+		std::string string = getTrimmed(config_parser, CFG_EXPORT_MB_INTERPOLATION, CFG_EXPORT_SECTION);
+		try {
+			return succeeded(CFG_EXPORT_MB_INTERPOLATION, (uint32_t)std::stoul(string));
+		} catch (std::exception& ex) {
+			LOG(LL_NON, ex.what());
+		}
+
+		return failed(CFG_EXPORT_MB_INTERPOLATION, string, 0u);
+	}
+
+	static uint32_t parse_motion_blur_search_range() {
+		std::string string = getTrimmed(config_parser, CFG_EXPORT_MB_SEARCH_RANGE, CFG_EXPORT_SECTION);
+		try {
+			uint32_t value = (uint32_t)std::stoul(string);
+			if ((value >= 4) && (value <= 128)) {
+				return succeeded(CFG_EXPORT_MB_SEARCH_RANGE, value);
+			}
+		} catch (std::exception& ex) {
+			LOG(LL_NON, ex.what());
+		}
+
+		return failed(CFG_EXPORT_MB_SEARCH_RANGE, string, 16u);
+	}
+
 	static std::string parse_output_dir() {
 		try {
 			std::string string = config_parser->top()[CFG_OUTPUT_DIR];
@@ -418,6 +726,93 @@ private:
 		}
 		return failed(CFG_EXPORT_MB_STRENGTH, string, 0.5);
 	}
+
+	static uint32_t parse_reserved_cores() {
+		std::string string = getTrimmed(config_parser, CFG_PERF_RESERVED_CORES, CFG_PERFORMANCE_SECTION);
+		try {
+			return succeeded(CFG_PERF_RESERVED_CORES, (uint32_t)std::stoul(string));
+		} catch (std::exception& ex) {
+			LOG(LL_NON, ex.what());
+		}
+
+		return failed(CFG_PERF_RESERVED_CORES, string, 1u);
+	}
+
+	static uint64_t parse_affinity(std::string key) {
+		std::string string = getTrimmed(config_parser, key, CFG_PERFORMANCE_SECTION);
+		if (string.empty()) {
+			return succeeded(key, 0ULL);
+		}
+
+		try {
+			return succeeded(key, (uint64_t)std::stoull(string, nullptr, 16));
+		} catch (std::exception& ex) {
+			LOG(LL_NON, ex.what());
+		}
+
+		return failed(key, string, 0ULL);
+	}
+
+	static int parse_priority(std::string key, int def) {
+		std::string string = toLower(getTrimmed(config_parser, key, CFG_PERFORMANCE_SECTION));
+		if (string == "idle") {
+			return succeeded(key, THREAD_PRIORITY_IDLE);
+		} else if (string == "lowest") {
+			return succeeded(key, THREAD_PRIORITY_LOWEST);
+		} else if (string == "below_normal") {
+			return succeeded(key, THREAD_PRIORITY_BELOW_NORMAL);
+		} else if (string == "normal") {
+			return succeeded(key, THREAD_PRIORITY_NORMAL);
+		} else if (string == "above_normal") {
+			return succeeded(key, THREAD_PRIORITY_ABOVE_NORMAL);
+		} else if (string == "highest") {
+			return succeeded(key, THREAD_PRIORITY_HIGHEST);
+		}
+
+		return failed(key, string, def);
+	}
+
+	static uint32_t parse_codec_threads() {
+		std::string string = toLower(getTrimmed(config_parser, CFG_PERF_CODEC_THREADS, CFG_PERFORMANCE_SECTION));
+		if (string.empty() || string == "auto") {
+			return succeeded(CFG_PERF_CODEC_THREADS, 0u);
+		}
+
+		try {
+			return succeeded(CFG_PERF_CODEC_THREADS, (uint32_t)std::stoul(string));
+		} catch (std::exception& ex) {
+			LOG(LL_NON, ex.what());
+		}
+
+		return failed(CFG_PERF_CODEC_THREADS, string, 0u);
+	}
+
+	static uint32_t parse_frame_pacing_budget() {
+		std::string string = getTrimmed(config_parser, CFG_PERF_FRAME_PACING_BUDGET, CFG_PERFORMANCE_SECTION);
+		try {
+			return succeeded(CFG_PERF_FRAME_PACING_BUDGET, (uint32_t)std::stoul(string));
+		} catch (std::exception& ex) {
+			LOG(LL_NON, ex.what());
+		}
+
+		return failed(CFG_PERF_FRAME_PACING_BUDGET, string, 50u);
+	}
+
+	static std::string parse_spill_folder() {
+		std::string string = getTrimmed(config_parser, CFG_PERF_SPILL_FOLDER, CFG_PERFORMANCE_SECTION);
+		return succeeded(CFG_PERF_SPILL_FOLDER, string);
+	}
+
+	static uint32_t parse_spill_after() {
+		std::string string = getTrimmed(config_parser, CFG_PERF_SPILL_AFTER, CFG_PERFORMANCE_SECTION);
+		try {
+			return succeeded(CFG_PERF_SPILL_AFTER, (uint32_t)std::stoul(string));
+		} catch (std::exception& ex) {
+			LOG(LL_NON, ex.what());
+		}
+
+		return failed(CFG_PERF_SPILL_AFTER, string, 1000u);
+	}
 };
 
 #endif _MY_CONFIG_H_
\ No newline at end of file
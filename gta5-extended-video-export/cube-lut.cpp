@@ -0,0 +1,161 @@
+#include "cube-lut.h"
+#include "logger.h"
+#include "task-scheduler.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <emmintrin.h>
+#include <fstream>
+#include <sstream>
+#include <utility>
+
+namespace Encoder {
+
+	namespace {
+		const uint32_t MAX_LUT_SIZE = 256;
+		// Minimum number of pixels per grading task.
+		const size_t LUT_GRAIN = 16 * 1024;
+	}
+
+	HRESULT CubeLUT::open(std::string path) {
+		PRE();
+		std::ifstream file(path);
+		if (!file) {
+			LOG(LL_ERR, "Could not open LUT: ", path);
+			POST();
+			return E_FAIL;
+		}
+
+		uint32_t size = 0;
+		float domainMin[3] = { 0, 0, 0 };
+		float domainMax[3] = { 1, 1, 1 };
+		std::vector<float> values;
+		std::string line;
+		while (std::getline(file, line)) {
+			line = line.substr(0, line.find('#'));
+			size_t first = line.find_first_not_of(" \t\r");
+			if (first == std::string::npos) {
+				continue;
+			}
+
+			std::stringstream stream(line.substr(first));
+			if (isdigit(static_cast<unsigned char>(line[first])) || (line[first] == '-') || (line[first] == '.')) {
+				float value[3];
+				if (!(stream >> value[0] >> value[1] >> value[2])) {
+					LOG(LL_ERR, "Invalid LUT entry: ", line);
+					POST();
+					return E_FAIL;
+				}
+				values.insert(values.end(), value, value + 3);
+				continue;
+			}
+
+			std::string keyword;
+			stream >> keyword;
+			bool isValid = true;
+			if (keyword == "TITLE") {
+				continue;
+			} else if (keyword == "LUT_3D_SIZE") {
+				isValid = !!(stream >> size);
+			} else if (keyword == "DOMAIN_MIN") {
+				isValid = !!(stream >> domainMin[0] >> domainMin[1] >> domainMin[2]);
+			} else if (keyword == "DOMAIN_MAX") {
+				isValid = !!(stream >> domainMax[0] >> domainMax[1] >> domainMax[2]);
+			} else if (keyword == "LUT_3D_INPUT_RANGE") {
+				isValid = !!(stream >> domainMin[0] >> domainMax[0]);
+				std::fill(domainMin + 1, domainMin + 3, domainMin[0]);
+				std::fill(domainMax + 1, domainMax + 3, domainMax[0]);
+			} else if (keyword == "LUT_1D_SIZE") {
+				LOG(LL_ERR, "1D LUTs are not supported: ", path);
+				POST();
+				return E_FAIL;
+			} else {
+				LOG(LL_DBG, "Ignoring LUT line: ", line);
+			}
+			if (!isValid) {
+				LOG(LL_ERR, "Invalid LUT line: ", line);
+				POST();
+				return E_FAIL;
+			}
+		}
+
+		if ((size < 2) || (size > MAX_LUT_SIZE) || (values.size() != static_cast<size_t>(size) * size * size * 3)) {
+			LOG(LL_ERR, "LUT has ", values.size() / 3, " entries, expected LUT_3D_SIZE^3 with a size from 2 to ", MAX_LUT_SIZE, ": ", path);
+			POST();
+			return E_FAIL;
+		}
+
+		this->size = size;
+		this->lattice.resize(values.size() / 3 * 4);
+		for (size_t i = 0; i < values.size() / 3; i++) {
+			this->lattice[4 * i] = values[3 * i + 2] * 255;
+			this->lattice[4 * i + 1] = values[3 * i + 1] * 255;
+			this->lattice[4 * i + 2] = values[3 * i] * 255;
+			this->lattice[4 * i + 3] = 0;
+		}
+
+		// Channels are indexed red, green, blue; red varies fastest in the file.
+		uint32_t stride = 1;
+		for (int c = 0; c < 3; c++) {
+			if (domainMax[c] <= domainMin[c]) {
+				LOG(LL_ERR, "Invalid LUT domain: ", path);
+				POST();
+				return E_FAIL;
+			}
+			for (int value = 0; value < 256; value++) {
+				float position = (value / 255.0f - domainMin[c]) / (domainMax[c] - domainMin[c]) * (size - 1);
+				position = (std::min)((std::max)(position, 0.0f), static_cast<float>(size - 1));
+				uint32_t cell = (std::min)(static_cast<uint32_t>(position), size - 2);
+				this->cells[c][value] = cell * stride;
+				this->fractions[c][value] = position - cell;
+			}
+			stride *= size;
+		}
+		LOG(LL_NFO, "Loaded ", size, "x", size, "x", size, " LUT: ", path);
+		POST();
+		return S_OK;
+	}
+
+	void CubeLUT::apply(uint8_t* pBGRA, size_t pixels) const {
+		uint32_t* pPixels = reinterpret_cast<uint32_t*>(pBGRA);
+		const float* pLattice = this->lattice.data();
+		const uint32_t (*cells)[256] = this->cells;
+		const float (*fractions)[256] = this->fractions;
+		const uint32_t strides[3] = { 1, this->size, this->size * this->size };
+		TaskScheduler::instance().parallelFor(0, pixels, LUT_GRAIN, [=](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++) {
+				uint32_t pixel = pPixels[i];
+				uint32_t value[3] = { (pixel >> 16) & 0xFF, (pixel >> 8) & 0xFF, pixel & 0xFF };
+				uint32_t base = cells[0][value[0]] + cells[1][value[1]] + cells[2][value[2]];
+				float f[3] = { fractions[0][value[0]], fractions[1][value[1]], fractions[2][value[2]] };
+				uint32_t s[3] = { strides[0], strides[1], strides[2] };
+
+				// The tetrahedron that holds the colour runs from the cell's first corner
+				// to its last along the axes in order of their fraction, largest first.
+				if (f[0] < f[1]) {
+					std::swap(f[0], f[1]);
+					std::swap(s[0], s[1]);
+				}
+				if (f[1] < f[2]) {
+					std::swap(f[1], f[2]);
+					std::swap(s[1], s[2]);
+				}
+				if (f[0] < f[1]) {
+					std::swap(f[0], f[1]);
+					std::swap(s[0], s[1]);
+				}
+
+				const float* pCorner = pLattice + 4 * static_cast<size_t>(base);
+				__m128 result = _mm_mul_ps(_mm_loadu_ps(pCorner), _mm_set1_ps(1 - f[0]));
+				result = _mm_add_ps(result, _mm_mul_ps(_mm_loadu_ps(pCorner + 4 * s[0]), _mm_set1_ps(f[0] - f[1])));
+				result = _mm_add_ps(result, _mm_mul_ps(_mm_loadu_ps(pCorner + 4 * (s[0] + s[1])), _mm_set1_ps(f[1] - f[2])));
+				result = _mm_add_ps(result, _mm_mul_ps(_mm_loadu_ps(pCorner + 4 * (s[0] + s[1] + s[2])), _mm_set1_ps(f[2])));
+
+				__m128i packed = _mm_cvtps_epi32(result);
+				packed = _mm_packs_epi32(packed, packed);
+				packed = _mm_packus_epi16(packed, packed);
+				pPixels[i] = (static_cast<uint32_t>(_mm_cvtsi128_si32(packed)) & 0xFFFFFF) | (pixel & 0xFF000000);
+			}
+		});
+	}
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <Windows.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Encoder {
+	// A 3D colour lookup table read from an Adobe/Resolve .cube file, applied to
+	// BGRA frames with tetrahedral interpolation. Alpha is left as it is.
+	class CubeLUT {
+	public:
+		HRESULT open(std::string path);
+
+		// Grades the pixels in place, in parallel bands on the task scheduler.
+		void apply(uint8_t* pBGRA, size_t pixels) const;
+
+		uint32_t getSize() const { return this->size; }
+
+	private:
+		uint32_t size = 0;
+		// Lattice points as B, G, R, 0 floats scaled to 0..255, red varying fastest.
+		std::vector<float> lattice;
+		// Lattice cell and position inside it of every 8 bit input value, per channel.
+		uint32_t cells[3][256];
+		float fractions[3][256];
+	};
+}
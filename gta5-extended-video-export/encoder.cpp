@@ -1,5 +1,9 @@
 #include "encoder.h"
+#include "bulk-copy.h"
 #include "logger.h"
+#include "pipeline-stages.h"
+#include "subframe-accumulator.h"
+#include "xxhash64.h"
 #include <ImfHeader.h>
 #include <ImfFloatAttribute.h>
 #include <ImfChannelList.h>
@@ -7,17 +11,29 @@
 #include <ImfOutputFile.h>
 #include <ImfRgbaFile.h>
 #include <ImfRgba.h>
+#include <ImfStdIO.h>
 #include <fstream>
+#include <algorithm>
 
 
 namespace Encoder {
 	
 	const AVRational MF_TIME_BASE = { 1, 10000000 };
 
+	// Conversion slices start on multiples of this many rows so that
+	// subsampled chroma planes are split on whole rows as well.
+	const uint32_t SLICE_ALIGNMENT = 16;
+
+	namespace {
+		// The HDR transfer writes full range BT.2020 RGB; the video is limited range BT.2020 YUV.
+		void setBT2020Colorspace(SwsContext* pContext) {
+			sws_setColorspaceDetails(pContext, sws_getCoefficients(SWS_CS_BT2020), 1, sws_getCoefficients(SWS_CS_BT2020), 0, 0, 1 << 16, 1 << 16);
+		}
+	}
+
 	Session::Session() :
-		thread_video_encoder(),
-		videoFrameQueue(16),
-		exrImageQueue(16)
+		exrImageQueue(16),
+		audioStrand(TaskScheduler::PRIORITY_NORMAL)
 	{
 		PRE();
 		LOG(LL_NFO, "Opening session: ", (uint64_t)this);
@@ -28,10 +44,9 @@ namespace Encoder {
 		PRE();
 		LOG(LL_NFO, "Closing session: ", (uint64_t)this);
 		this->isCapturing = false;
-		LOG_CALL(LL_DBG, this->videoFrameQueue.enqueue(Encoder::Session::frameQueueItem(nullptr)));
-
-		if (thread_video_encoder.joinable()) {
-			thread_video_encoder.join();
+		LOG_CALL(LL_DBG, this->audioStrand.wait());
+		if (this->videoPipeline) {
+			LOG_CALL(LL_DBG, this->videoPipeline->finish());
 		}
 
 		LOG_CALL(LL_DBG, this->exrImageQueue.enqueue(Encoder::Session::exr_queue_item()));
@@ -53,6 +68,9 @@ namespace Encoder {
 		LOG_CALL(LL_DBG, av_free(this->inputFrame));
 		LOG_CALL(LL_DBG, av_free(this->outputFrame));
 		LOG_CALL(LL_DBG, sws_freeContext(this->pSwsContext));
+		for (auto pSliceContext : this->swsSliceContexts) {
+			LOG_CALL(LL_DBG, sws_freeContext(pSliceContext));
+		}
 		LOG_CALL(LL_DBG, swr_free(&this->pSwrContext));
 		if (this->videoOptions) {
 			LOG_CALL(LL_DBG, av_dict_free(&this->videoOptions));
@@ -73,10 +91,65 @@ namespace Encoder {
 
 	HRESULT Session::createContext(std::string format, std::string filename, std::string exrOutputPath, std::string fmtOptions, uint64_t width, uint64_t height, std::string inputPixelFmt, uint32_t fps_num, uint32_t fps_den, uint8_t motionBlurSamples, float shutterPosition, std::string outputPixelFmt, std::string vcodec_str, std::string voptions, uint32_t inputChannels, uint32_t inputSampleRate, uint32_t inputBitsPerSample, std::string inputSampleFmt, uint32_t inputAlign, std::string outputSampleFmt, std::string acodec_str, std::string aoptions)
 	{
+		this->threadPolicy.log();
+		TaskScheduler::instance().configure(this->threadPolicy);
+
+		this->frameRate = av_make_q(fps_num, fps_den);
+		this->motionBlurSamples = motionBlurSamples;
+		REQUIRE(this->frameRanges.parse(this->frameRangeDefinition, fps_num, fps_den), "Failed to parse frame ranges.");
+		this->frameRanges.log();
+		this->pipelineStages = Pipeline::parseDefinition(this->pipelineDefinition);
+		REQUIRE(ImageSequenceWriter::parseLayout(this->imageSequenceLayout, this->imageLayout, this->imageShardSize), "Failed to parse image sequence layout.");
+		if (this->writeManifest) {
+			this->manifest = std::make_shared<OutputManifest>();
+		}
+		if (this->exportEXR) {
+			REQUIRE(this->exrChannels.parse(this->exrChannelDefinition), "Failed to parse OpenEXR channels.");
+			this->exrChannels.log();
+			REQUIRE(this->configureEXRShutter(width, height, shutterPosition), "Failed to configure the OpenEXR shutter.");
+			this->exrWriter.reset(new ImageSequenceWriter(exrOutputPath, "frames.evepack", this->imageLayout, this->imageShardSize));
+			this->exrWriter->setManifest(this->manifest);
+			REQUIRE(this->exrWriter->open(this->threadPolicy), "Failed to create the OpenEXR output.");
+		}
+
+		if (!this->liveURL.empty()) {
+			this->liveStream.reset(new LiveStream(this->liveURL));
+			format = LiveStream::getFormat(this->liveURL, format);
+			// Without a motion_blur stage every sub-frame is encoded, so a dropped frame leaves a gap of as many.
+			if (!this->hasPipelineStage("motion_blur")) {
+				this->liveDropLength = motionBlurSamples + 1;
+			}
+		}
+
 		this->oformat = av_guess_format(format.c_str(), NULL, NULL);
 		RET_IF_NULL(this->oformat, "Could find format: " + format, E_FAIL);
 
+		REQUIRE(HDRTransfer::parse(this->hdrDefinition, this->hdrTransferFunction), "Failed to parse the HDR video mode.");
+		REQUIRE(GIFQuantizer::parseDither(this->gifDitherDefinition, this->gifDither), "Failed to parse the GIF dither.");
+		if (this->hdrTransferFunction != HDR_TRANSFER_NONE) {
+			// The HDR buffer is encoded to RGB48 before it enters the video pipeline.
+			inputPixelFmt = "rgb48le";
+		}
 		REQUIRE(this->createVideoContext(width, height, inputPixelFmt, fps_num, fps_den, motionBlurSamples, shutterPosition, outputPixelFmt, vcodec_str, voptions), "Failed to create video codec context.");
+		if (this->videoCodecContext) {
+			this->filename = filename;
+			REQUIRE(this->createExtraOutputs(this->extraOutputDefinition, vcodec_str, voptions), "Failed to create extra video outputs.");
+			REQUIRE(this->createPipeline(), "Failed to create video pipeline.");
+		}
+		// A live stream drops frames instead of holding the game back.
+		if ((this->pacingBudget > 0) && !this->liveStream) {
+			this->pacingController.reset(new PacingController(this->pacingBudget));
+			if (this->videoPipeline) {
+				this->pacingController->addQueue("video pipeline", this->videoPipeline->getEdgeCapacity(), [this](uint32_t depth, std::chrono::steady_clock::time_point deadline) {
+					return this->isBeingDeleted || this->videoPipeline->hasFailed() || this->videoPipeline->waitForInputDepth(depth, deadline);
+				});
+			}
+			if (this->exportEXR) {
+				this->pacingController->addQueue("OpenEXR", this->exrImageQueue.getCapacity(), [this](uint32_t depth, std::chrono::steady_clock::time_point deadline) {
+					return this->isBeingDeleted || this->exrImageQueue.waitForDepth(depth, deadline);
+				});
+			}
+		}
 		REQUIRE(this->createAudioContext(inputChannels, inputSampleRate, inputBitsPerSample, inputSampleFmt, inputAlign, outputSampleFmt, acodec_str, aoptions), "Failed to create audio codec context.");
 		REQUIRE(this->createFormatContext(format, filename, exrOutputPath, fmtOptions), "Failed to create format context.");
 		return S_OK;
@@ -90,8 +163,18 @@ namespace Encoder {
 			return E_FAIL;
 		}
 
+		this->width = width;
+		this->height = height;
+		this->motionBlurSamples = motionBlurSamples;
+		this->shutterPosition = shutterPosition;
+
 		if (vcodec.empty()) {
 			this->videoCodecContext = nullptr;
+			if (this->exportEXR) {
+				LOG(LL_NFO, "Video encoding is disabled, only OpenEXR images will be exported.");
+				this->thread_exr_encoder = std::thread(&Session::exrEncodingThread, this);
+				this->threadPolicy.applyToEXRThread(this->thread_exr_encoder);
+			}
 			this->isVideoContextCreated = true;
 			POST();
 			return S_OK;
@@ -100,6 +183,7 @@ namespace Encoder {
 		LOG(LL_NFO, "Creating video context:");
 		LOG(LL_NFO, "  encoder: ", vcodec);
 		LOG(LL_NFO, "  options: ", preset);
+		LOG(LL_NFO, "  frame copies: ", getBulkCopyISA());
 
 		this->inputPixelFormat = av_get_pix_fmt(inputPixelFormatString.c_str());
 		if (this->inputPixelFormat == AV_PIX_FMT_NONE) {
@@ -115,16 +199,22 @@ namespace Encoder {
 			return E_FAIL;
 		}
 
-		this->width = width;
-		this->height = height;
-		this->motionBlurSamples = motionBlurSamples;
-		this->motionBlurAccBuffer = std::valarray<uint16_t>(width * height * 4);
-		this->motionBlurTempBuffer = std::valarray<uint16_t>(width * height * 4);
-		this->motionBlurDestBuffer = std::valarray<uint8_t>(width * height * 4);
-		this->shutterPosition = shutterPosition;
-
 		//this->audioSampleRateMultiplier = ((float)fps_num * ((float)motionBlurSamples + 1)) / ((float)fps_den * 60.0f);
 
+		if (this->hdrTransferFunction != HDR_TRANSFER_NONE) {
+			const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(this->outputPixelFormat);
+			if (desc && (desc->comp[0].depth < 10)) {
+				LOG(LL_WRN, "HDR video is encoded with only ", desc->comp[0].depth, " bits per component in ", outputPixelFormatString, ", use a 10 bit format such as yuv420p10le.");
+			}
+			this->hdrTransfer.reset(new HDRTransfer(this->hdrTransferFunction, this->hdrReferenceWhite));
+			this->hdrAccumulator.reset(new EXRAccumulator(width, height));
+			if (this->hasPipelineStage("motion_blur")) {
+				this->hdrPeriod = motionBlurSamples + 1;
+				this->hdrWindow = (std::min)(this->getShutterWindow(this->hdrPeriod), this->hdrPeriod);
+			}
+			LOG(LL_NFO, "HDR video: ", this->hdrDefinition, " with reference white at ", this->hdrReferenceWhite, " nits, ", this->hdrWindow, " of every ", this->hdrPeriod, " sub-frames");
+		}
+
 
 		this->videoCodec = avcodec_find_encoder_by_name(vcodec.c_str());
 		RET_IF_NULL(this->videoCodec, "Could not find video codec:" + vcodec, E_FAIL);
@@ -144,16 +234,65 @@ namespace Encoder {
 		this->videoCodecContext->time_base = av_make_q(fps_den, fps_num);
 		this->videoCodecContext->framerate = av_make_q(fps_num, fps_den);
 		this->videoCodecContext->codec_type = AVMEDIA_TYPE_VIDEO;
+		if (this->hdrTransfer) {
+			this->videoCodecContext->color_primaries = AVCOL_PRI_BT2020;
+			this->videoCodecContext->color_trc = this->hdrTransfer->getColorTransfer();
+			this->videoCodecContext->colorspace = AVCOL_SPC_BT2020_NCL;
+			this->videoCodecContext->color_range = AVCOL_RANGE_MPEG;
+		}
 
 		if (this->oformat->flags & AVFMT_GLOBALHEADER)
 		{
 			this->videoCodecContext->flags |= CODEC_FLAG_GLOBAL_HEADER;
 		}
+
+		if (!av_dict_get(this->videoOptions, "threads", NULL, 0)) {
+			this->videoCodecContext->thread_count = this->threadPolicy.getCodecThreadCount();
+		}
+
+		bool isIDRForced = false;
+		if (!this->gopCacheDirectory.empty()) {
+			// Cached GOPs can only be spliced between others if none of them refers to frames outside of it.
+			this->gopCache.reset(new GopCache(this->gopCacheDirectory, this->gopCacheLength));
+			this->videoCodecContext->gop_size = this->gopCache->getGopSize();
+			this->videoCodecContext->flags |= AV_CODEC_FLAG_CLOSED_GOP;
+			// x264 and x265 only turn the keyframe forced at the start of a GOP into an IDR frame with forced-idr.
+			const AVClass* privateClass = this->videoCodec->priv_class;
+			if (privateClass && av_opt_find(&privateClass, "forced-idr", NULL, 0, AV_OPT_SEARCH_FAKE_OBJ)) {
+				av_dict_set(&this->videoOptions, "forced-idr", "1", 0);
+				isIDRForced = true;
+			}
+		}
 		
+		if (this->liveStream) {
+			this->liveStream->tuneEncoder(this->videoCodecContext, &this->videoOptions, this->gopCache != nullptr);
+		}
+
 		RET_IF_FAILED_AV(avcodec_open2(this->videoCodecContext, this->videoCodec, &this->videoOptions), "Could not open video codec", E_FAIL);
+
+		if (this->gopCache) {
+			// GOPs are only reused with the exact same encoder settings and stream headers.
+			std::stringstream settings;
+			settings << vcodec << "|" << preset << "|" << outputPixelFormatString << "|" << width << "x" << height << "|" << fps_num << "/" << fps_den << "|" << this->gopCache->getGopSize() << "|" << this->videoCodecContext->has_b_frames << "|" << (isIDRForced ? "forced-idr" : "");
+			XXH64 settingsHash;
+			settingsHash.update(settings.str().data(), settings.str().size());
+			settingsHash.update(this->videoCodecContext->extradata, this->videoCodecContext->extradata_size);
+			if (FAILED(this->gopCache->open(settingsHash.digest(), this->videoCodecContext->has_b_frames))) {
+				LOG(LL_WRN, "Exporting without the GOP cache.");
+				this->gopCache.reset();
+			}
+		}
+
+		if (this->qualityProbeInterval > 0) {
+			this->qualityProbe.reset(new QualityProbe(this->qualityProbeInterval));
+			if (FAILED(this->qualityProbe->open(this->videoCodecContext))) {
+				LOG(LL_WRN, "Exporting without the quality probe.");
+				this->qualityProbe.reset();
+			}
+		}
 		
-		this->thread_video_encoder = std::thread(&Session::videoEncodingThread, this);
 		this->thread_exr_encoder = std::thread(&Session::exrEncodingThread, this);
+		this->threadPolicy.applyToEXRThread(this->thread_exr_encoder);
 
 		LOG(LL_NFO, "Video context was created successfully.");
 		this->isVideoContextCreated = true;
@@ -281,7 +420,10 @@ namespace Encoder {
 		av_dict_parse_string(&this->fmtOptions, fmtPreset.c_str(), "=", "/", 0);
 
 		//av_opt_set(this->fmtContext->priv_data, "path", filename, 0);
-		strcpy_s(this->fmtContext->filename, this->filename.c_str());
+		strcpy_s(this->fmtContext->filename, this->liveStream ? this->liveURL.c_str() : this->filename.c_str());
+		if (this->liveStream) {
+			this->liveStream->tuneMuxer(this->fmtContext);
+		}
 		//av_opt_set(this->fmtContext, "filename", this->filename.c_str(), 0);
 
 		bool hasVideo = false;
@@ -316,9 +458,32 @@ namespace Encoder {
 			return E_FAIL;
 		}
 
-		RET_IF_FAILED_AV(avio_open(&this->fmtContext->pb, filename.c_str(), AVIO_FLAG_WRITE), "Could not open output file", E_FAIL);
-		RET_IF_NULL(this->fmtContext->pb, "Could not open output file", E_FAIL);
+		if (this->liveStream) {
+			RET_IF_FAILED(this->liveStream->open(&this->fmtContext->pb), "Could not open live stream", E_FAIL);
+		} else if (((this->imageLayout != IMAGE_SEQUENCE_FLAT) || this->manifest) && (this->oformat->flags & AVFMT_NOFILE)) {
+			// Image sequence muxers open a file per frame; those go through the writer instead.
+			size_t separator = filename.find_last_of("\\/");
+			std::string directory = separator == std::string::npos ? "." : filename.substr(0, separator);
+			std::string name = filename.substr(separator == std::string::npos ? 0 : separator + 1);
+			this->imageWriter.reset(new ImageSequenceWriter(directory, name.substr(0, name.find('.')) + ".evepack", this->imageLayout, this->imageShardSize));
+			RET_IF_FAILED(this->imageWriter->open(this->threadPolicy), "Could not create image sequence writer", E_FAIL);
+			this->imageWriter->setManifest(this->manifest);
+			this->imageWriter->attach(this->fmtContext);
+		} else if (this->manifest) {
+			this->outputFile.reset(new HashingFile());
+			RET_IF_FAILED(this->outputFile->open(filename, &this->fmtContext->pb), "Could not open output file", E_FAIL);
+		} else {
+			RET_IF_FAILED_AV(avio_open(&this->fmtContext->pb, filename.c_str(), AVIO_FLAG_WRITE), "Could not open output file", E_FAIL);
+			RET_IF_NULL(this->fmtContext->pb, "Could not open output file", E_FAIL);
+		}
 		RET_IF_FAILED_AV(avformat_write_header(this->fmtContext, &this->fmtOptions), "Could not write header", E_FAIL);
+		if (this->writeJournal && !this->liveStream && !(this->oformat->flags & AVFMT_NOFILE)) {
+			this->journal.reset(new ExportJournal());
+			if (FAILED(this->journal->open(this->getOutputStem() + ".journal", this->fmtContext, this->frameRate, this->frameRangeDefinition))) {
+				LOG(LL_WRN, "Exporting without a journal.");
+				this->journal.reset();
+			}
+		}
 		LOG(LL_NFO, "Format context was created successfully.");
 		this->isCapturing = true;
 		this->isFormatContextCreated = true;
@@ -328,14 +493,61 @@ namespace Encoder {
 		return S_OK;
 	}
 
+	HRESULT Session::enqueueHDRVideoFrame(ComPtr<ID3D11DeviceContext> pDeviceContext, ComPtr<ID3D11Texture2D> cRGB) {
+		PRE();
+		std::lock_guard<std::mutex> videoLock(this->mxVideo);
+
+		if (!this->videoCodecContext || this->isVideoFinished) {
+			POST();
+			return S_OK;
+		}
+
+		if (this->isBeingDeleted) {
+			POST();
+			return E_FAIL;
+		}
+
+		D3D11_MAPPED_SUBRESOURCE mHDR = { 0 };
+		REQUIRE(pDeviceContext->Map(cRGB.Get(), 0, D3D11_MAP::D3D11_MAP_READ, 0, &mHDR), "Failed to map HDR texture");
+		this->hdrAccumulator->add(mHDR.pData, mHDR.RowPitch);
+		pDeviceContext->Unmap(cRGB.Get(), 0);
+
+		// The frame is complete with the sub-frame that closes the shutter.
+		if (this->capturePosition % this->hdrPeriod != 0) {
+			POST();
+			return S_OK;
+		}
+
+		size_t pixels = static_cast<size_t>(this->width) * this->height;
+		auto pVector = std::make_shared<std::valarray<uint8_t>>(pixels * 3 * sizeof(uint16_t));
+		std::shared_ptr<std::vector<float>> pLinear = this->hdrAccumulator->take();
+		this->hdrTransfer->encode(pLinear->data(), reinterpret_cast<uint16_t*>(std::begin(*pVector)), pixels);
+
+		Frame frame(pVector);
+		frame.captureTime = std::chrono::steady_clock::now();
+		frame.droppedBefore = this->liveDroppedFrames;
+		this->liveDroppedFrames = 0;
+		// A live stream never waits here: selectNextFrame drops whole frames while the pipeline is backlogged,
+		// so the queue only goes past its capacity by the sub-frames of the frame already started.
+		RET_IF_FAILED(this->videoPipeline->push(frame, !this->pacingController && !this->liveStream), "Video pipeline has stopped", E_FAIL);
+		POST();
+		return S_OK;
+	}
+
 	HRESULT Session::enqueueEXRImage(ComPtr<ID3D11DeviceContext> pDeviceContext, ComPtr<ID3D11Texture2D> cRGB, ComPtr<ID3D11Texture2D> cDepth, ComPtr<ID3D11Texture2D> cStencil) {
 		PRE();
+		std::lock_guard<std::mutex> videoLock(this->mxVideo);
 
 		if (this->isBeingDeleted) {
 			POST();
 			return E_FAIL;
 		}
 
+		if (this->isVideoFinished) {
+			POST();
+			return S_OK;
+		}
+
 		D3D11_MAPPED_SUBRESOURCE mHDR = { 0 };
 		D3D11_MAPPED_SUBRESOURCE mDepth = { 0 };
 		D3D11_MAPPED_SUBRESOURCE mStencil = { 0 };
@@ -352,16 +564,119 @@ namespace Encoder {
 			REQUIRE(pDeviceContext->Map(cStencil.Get(), 0, D3D11_MAP::D3D11_MAP_READ, 0, &mStencil), "Failed to map stencil texture");
 		}
 
-		this->exrImageQueue.enqueue(exr_queue_item(cRGB, mHDR.pData, cDepth, mDepth.pData, cStencil, mStencil));
+		exr_queue_item item(cRGB, mHDR.pData, cDepth, mDepth.pData, cStencil, mStencil);
+		item.subFrame = this->capturePosition - 1;
+		item.rgbRowPitch = mHDR.RowPitch;
+		if (this->pacingController) {
+			this->exrImageQueue.enqueueWithoutWaiting(item);
+		} else {
+			this->exrImageQueue.enqueue(item);
+		}
+
+		POST();
+		return S_OK;
+	}
+
+	bool Session::isVideoConsumed() const {
+		return this->videoCodecContext != NULL;
+	}
+
+	bool Session::isEXRConsumed() const {
+		return this->exportEXR && this->isVideoContextCreated;
+	}
+
+	bool Session::isHDRVideo() const {
+		return this->hdrTransfer != nullptr;
+	}
+
+	bool Session::isHDRSubFrameUsed() {
+		std::lock_guard<std::mutex> videoLock(this->mxVideo);
+		uint64_t offset = (this->capturePosition - 1) % this->hdrPeriod;
+		return offset >= this->hdrPeriod - this->hdrWindow;
+	}
+
+	bool Session::isEXRSubFrameUsed() {
+		std::lock_guard<std::mutex> videoLock(this->mxVideo);
+		uint64_t offset = (this->capturePosition - 1) % this->exrPeriod;
+		return offset >= this->exrPeriod - this->exrWindow;
+	}
 
+	HRESULT Session::configureEXRShutter(uint64_t width, uint64_t height, float shutterPosition) {
+		PRE();
+		RET_IF_FAILED(EXRAccumulator::parseShutter(this->exrShutterDefinition, this->exrShutter), "Could not parse the OpenEXR shutter", E_FAIL);
+		this->shutterPosition = shutterPosition;
+		// Without a motion_blur stage the video gets every sub-frame, and so do the images.
+		bool isBlurred = this->hasPipelineStage("motion_blur");
+		if ((this->exrShutter == EXR_SHUTTER_SUB_FRAMES) || !isBlurred) {
+			this->exrPeriod = 1;
+			this->exrWindow = 1;
+		} else {
+			this->exrPeriod = this->motionBlurSamples + 1;
+			// Shutters above 360 degrees would need overlapping sums, the images stop at one frame.
+			this->exrWindow = this->exrShutter == EXR_SHUTTER_BLUR ? (std::min)(this->getShutterWindow(this->exrPeriod), this->exrPeriod) : 1;
+		}
+		if (!this->exrChannels.hasColor()) {
+			// Depth and object IDs are never averaged, so only the last sub-frame is needed.
+			this->exrWindow = 1;
+		}
+		if (this->exrWindow > 1) {
+			this->exrAccumulator.reset(new EXRAccumulator(static_cast<uint32_t>(width), static_cast<uint32_t>(height)));
+		}
+		LOG(LL_NFO, "OpenEXR images: ", this->exrWindow, " of every ", this->exrPeriod, " sub-frames");
 		POST();
 		return S_OK;
 	}
 
+	float Session::getShutterAngle() const {
+		return this->shutterAngle >= 0 ? this->shutterAngle : (1 - this->shutterPosition) * 360.0f;
+	}
+
+	uint32_t Session::getShutterWindow(uint32_t period) const {
+		if (this->shutterAngle >= 0) {
+			return SubFrameAccumulator::getShutterWindow(period, this->shutterAngle);
+		}
+		return SubFrameAccumulator::getPositionWindow(period, this->shutterPosition);
+	}
+
+	uint32_t Session::getSubFramePeriod(AVRational rate) const {
+		int64_t num = (int64_t)this->frameRate.num * (this->motionBlurSamples + 1) * rate.den;
+		int64_t den = (int64_t)this->frameRate.den * rate.num;
+		if ((den <= 0) || (num % den != 0)) {
+			return 0;
+		}
+		return static_cast<uint32_t>(num / den);
+	}
+
+	bool Session::selectNextFrame() {
+		std::lock_guard<std::mutex> videoLock(this->mxVideo);
+		if (this->isVideoFinished) {
+			return false;
+		}
+		// Every output frame is made of motionBlurSamples + 1 game frames.
+		uint64_t position = this->capturePosition++;
+		uint64_t frame = position / (this->motionBlurSamples + 1);
+		if (!this->frameRanges.contains(frame)) {
+			return false;
+		}
+		if (this->liveStream && this->videoPipeline) {
+			// Whole frames are dropped, so the sub-frames of the others still line up.
+			if (position % (this->motionBlurSamples + 1) == 0) {
+				this->isDroppingFrame = this->videoPipeline->isBacklogged();
+				if (this->isDroppingFrame) {
+					this->liveDroppedFrames += this->liveDropLength;
+					this->liveStream->dropFrame();
+				}
+			}
+			return !this->isDroppingFrame;
+		}
+		return true;
+	}
+
 	HRESULT Session::enqueueVideoFrame(BYTE *pData, int length) {
 		PRE();
+		std::lock_guard<std::mutex> videoLock(this->mxVideo);
 
-		if (!this->videoCodecContext) {
+		if (!this->videoCodecContext || this->isVideoFinished) {
 			POST();
 			return S_OK;
 		}
@@ -372,176 +687,355 @@ namespace Encoder {
 		}
 		auto pVector = std::shared_ptr<std::valarray<uint8_t>>(new std::valarray<uint8_t>(length));
 
-		std::copy(pData, pData + length, std::begin(*pVector));
+		bulkCopy(std::begin(*pVector), pData, length);
 
-		frameQueueItem item(pVector);
-		this->videoFrameQueue.enqueue(item);
+		Frame frame(pVector);
+		frame.captureTime = std::chrono::steady_clock::now();
+		frame.droppedBefore = this->liveDroppedFrames;
+		this->liveDroppedFrames = 0;
+		// A live stream never waits here: selectNextFrame drops whole frames while the pipeline is backlogged,
+		// so the queue only goes past its capacity by the sub-frames of the frame already started.
+		RET_IF_FAILED(this->videoPipeline->push(frame, !this->pacingController && !this->liveStream), "Video pipeline has stopped", E_FAIL);
 		POST();
 		return S_OK;
 	}
 
-	void Session::videoEncodingThread() {
+	bool Session::hasPipelineStage(const std::string& name) const {
+		return std::find(this->pipelineStages.begin(), this->pipelineStages.end(), name) != this->pipelineStages.end();
+	}
+
+	HRESULT Session::createPipeline()
+	{
 		PRE();
-		std::lock_guard<std::mutex> lock(this->mxEncodingThread);
-		int k=0;
-		bool firstFrame;
-		try {
-			frameQueueItem item = this->videoFrameQueue.dequeue();
-			while (item.data != nullptr) {
-				auto& data = *(item.data);
-				if (this->motionBlurSamples == 0) {
-					LOG(LL_NFO, "Encoding frame: ", this->videoPTS);
-					REQUIRE(this->writeVideoFrame(std::begin(data), item.data->size(), this->videoPTS++), "Failed to write video frame.");
-				} else {
-					int frameRemainder = this->motionBlurPTS++ % (this->motionBlurSamples + 1);
-					float currentShutterPosition = (float)frameRemainder / ((float)this->motionBlurSamples + 1);
-					std::copy(std::begin(data), std::end(data), std::begin(this->motionBlurTempBuffer));
-					if (frameRemainder == this->motionBlurSamples) {
-						// Flush motion blur buffer
-						this->motionBlurAccBuffer += this->motionBlurTempBuffer;
-						this->motionBlurAccBuffer /= ++k;
-						std::copy(std::begin(this->motionBlurAccBuffer), std::end(this->motionBlurAccBuffer), std::begin(this->motionBlurDestBuffer));
-						REQUIRE(this->writeVideoFrame(std::begin(this->motionBlurDestBuffer), this->motionBlurDestBuffer.size(), this->videoPTS++), "Failed to write video frame");
-						k = 0;
-						firstFrame = true;
-					} else if (currentShutterPosition >= this->shutterPosition) {
-						if (firstFrame) {
-							// Reset accumulation buffer
-							this->motionBlurAccBuffer = this->motionBlurTempBuffer;
-							firstFrame = false;
-						} else {
-							this->motionBlurAccBuffer += this->motionBlurTempBuffer;
-						}
-						k++;
-					}
+		registerBuiltinStages();
+		this->videoPipeline.reset(new Pipeline(16));
+
+		// swscale cannot make palettes, so pal8 frames always come from the GIF quantizer.
+		bool needsQuantizer = (this->outputPixelFormat == AV_PIX_FMT_PAL8) && !this->hasPipelineStage("gif_quantize");
+		bool needsInterpolation = (this->motionBlurInterpolation > 0) && !this->hdrTransfer && !this->hasPipelineStage("interpolate");
+		bool isInterpolated = false;
+		// A live stream drops frames instead of falling behind.
+		bool needsSpill = !this->spillFolder.empty() && !this->liveStream && !this->hasPipelineStage("spill");
+		for (auto& name : this->pipelineStages) {
+			if (this->hdrTransfer && ((name == "motion_blur") || (name == "interpolate"))) {
+				continue;
+			}
+			if (name == "spill") {
+				if (this->spillFolder.empty()) {
+					LOG(LL_ERR, "The spill stage needs a folder in spill_folder.");
+					POST();
+					return E_FAIL;
+				}
+				if (this->liveStream) {
+					continue;
+				}
+			}
+			if (name == "interpolate") {
+				if (this->motionBlurInterpolation == 0) {
+					LOG(LL_ERR, "The interpolate stage needs motion_blur_interpolation to be above 0.");
+					POST();
+					return E_FAIL;
+				}
+				isInterpolated = true;
+				this->subFrameScale = this->motionBlurInterpolation + 1;
+			} else if (isInterpolated && (name != "motion_blur")) {
+				// Later stages may change frames in place, and the stage still reads the last one.
+				LOG(LL_ERR, "The interpolate stage has to come right before motion_blur.");
+				POST();
+				return E_FAIL;
+			} else if (needsInterpolation && (name == "motion_blur")) {
+				this->subFrameScale = this->motionBlurInterpolation + 1;
+				this->videoPipeline->addStage(PipelineRegistry::create("interpolate", this));
+				needsInterpolation = false;
+			}
+			isInterpolated = isInterpolated && (name == "interpolate");
+			if ((name == "lut") && !this->lut) {
+				if (this->lutFile.empty()) {
+					LOG(LL_ERR, "The lut stage needs a .cube file in lut_file.");
+					POST();
+					return E_FAIL;
+				}
+				this->lut.reset(new CubeLUT());
+				RET_IF_FAILED(this->lut->open(this->lutFile), "Could not load LUT", E_FAIL);
+			}
+			if (needsQuantizer && ((name == "convert") || (name == "encode"))) {
+				this->videoPipeline->addStage(PipelineRegistry::create("gif_quantize", this));
+				needsQuantizer = false;
+				if (name == "convert") {
+					continue;
+				}
+			}
+			if (needsSpill && (name == "encode")) {
+				this->videoPipeline->addStage(PipelineRegistry::create("spill", this));
+				needsSpill = false;
+			}
+			auto stage = PipelineRegistry::create(name, this);
+			RET_IF_NULL(stage, "Unknown video pipeline stage: " + name, E_FAIL);
+			this->videoPipeline->addStage(stage);
+		}
+
+		if (!this->lutFile.empty() && !this->lut) {
+			LOG(LL_WRN, "lut_file is set, but the video pipeline has no lut stage.");
+		}
+
+		if (!this->spillFolder.empty() && this->liveStream) {
+			LOG(LL_WRN, "spill_folder is not used for live streams.");
+		}
+
+		if (isInterpolated) {
+			LOG(LL_ERR, "The interpolate stage has to come right before motion_blur.");
+			POST();
+			return E_FAIL;
+		}
+		if (this->subFrameScale > 1) {
+			LOG(LL_NFO, "Motion blur: ", this->motionBlurSamples + 1, " captured and ", (this->motionBlurSamples + 1) * this->motionBlurInterpolation, " synthesized sub-frames per frame");
+		} else if (needsInterpolation) {
+			LOG(LL_WRN, "motion_blur_interpolation is set, but the video pipeline has no motion_blur stage.");
+		}
+
+		if (!this->extraOutputs.empty() && this->hdrTransfer) {
+			LOG(LL_ERR, "Extra video outputs cannot be made from HDR video.");
+			POST();
+			return E_FAIL;
+		}
+
+		if (!this->extraOutputs.empty() && !this->hasPipelineStage("motion_blur")) {
+			LOG(LL_ERR, "Extra video outputs are made by the motion_blur stage, which is missing from the video pipeline.");
+			POST();
+			return E_FAIL;
+		}
+
+		RET_IF_FAILED(this->videoPipeline->start(this->threadPolicy), "Could not start video pipeline", E_FAIL);
+		POST();
+		return S_OK;
+	}
+
+	HRESULT Session::createExtraOutputs(std::string definition, std::string vcodec, std::string voptions)
+	{
+		PRE();
+		std::string stem = this->getOutputStem();
+		std::string extension = this->filename.substr(stem.size());
+
+		std::stringstream stream(definition);
+		std::string entry;
+		while (std::getline(stream, entry, ',')) {
+			entry.erase(std::remove_if(entry.begin(), entry.end(), ::isspace), entry.end());
+			if (entry.empty()) {
+				continue;
+			}
+
+			std::string rateString = entry.substr(0, entry.find('@'));
+			float angle = this->getShutterAngle();
+			AVRational rate;
+			try {
+				if (entry.find('@') != std::string::npos) {
+					angle = std::stof(entry.substr(entry.find('@') + 1));
 				}
-				item = this->videoFrameQueue.dequeue();
+			} catch (std::exception&) {
+				angle = -1;
 			}
-		} catch (...) {
-			// Do nothing
+			if ((angle < 0) || (av_parse_video_rate(&rate, rateString.c_str()) < 0)) {
+				LOG(LL_ERR, "Invalid extra video output: ", entry);
+				POST();
+				return E_FAIL;
+			}
+
+			if (!this->getSubFramePeriod(rate)) {
+				LOG(LL_ERR, "Extra video output ", entry, " does not divide the capture rate of ",
+					this->frameRate.num * (this->motionBlurSamples + 1), "/", this->frameRate.den, " frames per second.");
+				POST();
+				return E_FAIL;
+			}
+
+			std::string suffix = rate.den == 1 ? std::to_string(rate.num) : std::to_string(rate.num) + "-" + std::to_string(rate.den);
+			std::string filename = stem + "." + suffix + "fps" + extension;
+			auto pOutput = std::make_shared<AuxVideoOutput>(rate, angle);
+			pOutput->setManifest(this->manifest);
+			RET_IF_FAILED(pOutput->open(filename, this->oformat, this->width, this->height, this->outputPixelFormat, vcodec, voptions, this->threadPolicy.getCodecThreadCount()), "Could not create extra video output " + entry, E_FAIL);
+			RET_IF_FAILED(pOutput->startThread(this->threadPolicy), "Could not start the encoding thread of extra video output " + entry, E_FAIL);
+			this->extraOutputs.push_back(pOutput);
+		}
+
+		if (!this->ladderDefinition.empty()) {
+			this->ladder.reset(new ResolutionLadder(this->frameRate, this->getShutterAngle()));
+			RET_IF_FAILED(this->ladder->open(this->ladderDefinition, stem, extension, this->oformat, this->width, this->height, this->outputPixelFormat, vcodec, voptions, this->threadPolicy.getCodecThreadCount(), this->manifest), "Could not create the resolution ladder", E_FAIL);
 		}
-		this->isEncodingThreadFinished = true;
-		this->cvEncodingThreadFinished.notify_all();
+
 		POST();
+		return S_OK;
 	}
 
 	void Session::exrEncodingThread()
 	{
 		PRE();
 		std::lock_guard<std::mutex> lock(this->mxEXREncodingThread);
-		Imf::setGlobalThreadCount(8);
+		// Images are compressed in parallel on the shared scheduler instead of OpenEXR's own pool.
+		// The tasks only compress; this thread hands the images to the writer, which may block
+		// while its I/O thread is behind, so that no scheduler worker waits for the disk.
+		Imf::setGlobalThreadCount(0);
+		struct PendingImage {
+			uint64_t pts;
+			std::shared_ptr<std::vector<uint8_t>> pData;
+			std::future<void> compressed;
+		};
+		std::deque<PendingImage> pendingImages;
+		size_t maxPendingImages = TaskScheduler::instance().getWorkerCount();
+		auto writeFront = [&]() {
+			try {
+				pendingImages.front().compressed.get();
+				if (this->exrWriter && !pendingImages.front().pData->empty()) {
+					std::stringstream sstream;
+					sstream << std::setw(5) << std::setfill('0') << pendingImages.front().pts;
+					this->exrWriter->write(pendingImages.front().pts, "frame" + sstream.str() + ".exr", pendingImages.front().pData);
+				}
+			} catch (std::exception& ex) {
+				LOG(LL_ERR, ex.what());
+			}
+			pendingImages.pop_front();
+		};
 		try {
 			exr_queue_item item = this->exrImageQueue.dequeue();
 			while (!item.isEndOfStream) {
-				struct RGBA {
-					half R;
-					half G;
-					half B;
-					half A;
-				};
-
-				struct Depth {
-					float depth;
-				};
-
-				Imf::Header header(this->width, this->height);
-				Imf::FrameBuffer framebuffer;
-
-				if (item.cRGB != nullptr) {
-					LOG_CALL(LL_DBG, header.channels().insert("R", Imf::Channel(Imf::HALF)));
-					LOG_CALL(LL_DBG, header.channels().insert("G", Imf::Channel(Imf::HALF)));
-					LOG_CALL(LL_DBG, header.channels().insert("B", Imf::Channel(Imf::HALF)));
-					LOG_CALL(LL_DBG, header.channels().insert("SSS", Imf::Channel(Imf::HALF)));
-					RGBA* mHDRArray = (RGBA*)item.pRGBData;
-
-					LOG_CALL(LL_DBG, framebuffer.insert("R",
-						Imf::Slice(
-							Imf::HALF,
-							(char*)&mHDRArray[0].R,
-							sizeof(RGBA),
-							sizeof(RGBA) * this->width
-							)));
-
-					LOG_CALL(LL_DBG, framebuffer.insert("G",
-						Imf::Slice(
-							Imf::HALF,
-							(char*)&mHDRArray[0].G,
-							sizeof(RGBA),
-							sizeof(RGBA) * this->width
-							)));
-
-					LOG_CALL(LL_DBG, framebuffer.insert("B",
-						Imf::Slice(
-							Imf::HALF,
-							(char*)&mHDRArray[0].B,
-							sizeof(RGBA),
-							sizeof(RGBA) * this->width
-							)));
-
-					LOG_CALL(LL_DBG, framebuffer.insert("SSS",
-						Imf::Slice(
-							Imf::HALF,
-							(char*)&mHDRArray[0].A,
-							sizeof(RGBA),
-							sizeof(RGBA) * this->width
-							)));
-				}
-				
-				if (item.cDepth != nullptr) {
-					LOG_CALL(LL_DBG, header.channels().insert("depth.Z", Imf::Channel(Imf::FLOAT)));
-					//header.channels().insert("objectID", Imf::Channel(Imf::UINT));
-					Depth* mDSArray = (Depth*)item.pDepthData;
-
-					LOG_CALL(LL_DBG, framebuffer.insert("depth.Z",
-						Imf::Slice(
-							Imf::FLOAT,
-							(char*)&mDSArray[0].depth,
-							sizeof(Depth),
-							sizeof(Depth) * this->width
-							)));
-				}
-
-				std::vector<uint32_t> stencilBuffer;
-				if (item.cStencil != nullptr) {
-					stencilBuffer = std::vector<uint32_t>(item.mStencilData.RowPitch * this->height);
-					uint8_t* mSArray = (uint8_t*)item.mStencilData.pData;
-
-					for (uint32_t i = 0; i < item.mStencilData.RowPitch * this->height; i++) {
-						stencilBuffer[i] = static_cast<uint32_t>(mSArray[i]);
+				if (this->exrAccumulator && item.pRGBData) {
+					this->exrAccumulator->add(item.pRGBData, item.rgbRowPitch);
+					// Depth and stencil are not averaged; they come from the sub-frame that closes the shutter.
+					if ((item.subFrame + 1) % this->exrPeriod != 0) {
+						item = this->exrImageQueue.dequeue();
+						continue;
 					}
-
-					LOG_CALL(LL_DBG, header.channels().insert("objectID", Imf::Channel(Imf::UINT)));
-
-					LOG_CALL(LL_DBG, framebuffer.insert("objectID",
-						Imf::Slice(
-							Imf::UINT,
-							(char*)stencilBuffer.data(),
-							sizeof(uint32_t),
-							item.mStencilData.RowPitch * 4
-							)));
+					item.pBlurredRGB = this->exrAccumulator->take();
 				}
 
-				if (CreateDirectoryA(this->exrOutputPath.c_str(), NULL) || ERROR_ALREADY_EXISTS == GetLastError()) {
+				auto pData = std::make_shared<std::vector<uint8_t>>();
+				pendingImages.push_back({ this->exrPTS++, pData, TaskScheduler::instance().submit(TaskScheduler::PRIORITY_LOW, [this, item, pData]() {
+					this->compressEXRImage(item, *pData);
+				}) });
 
-
-					std::stringstream sstream;
-					sstream << std::setw(5) << std::setfill('0') << this->exrPTS++;
-					Imf::OutputFile file((this->exrOutputPath + "\\frame" +  sstream.str() + ".exr").c_str(), header);
-					LOG_CALL(LL_DBG, file.setFrameBuffer(framebuffer));
-					LOG_CALL(LL_DBG, file.writePixels(this->height));
+				while (pendingImages.size() >= maxPendingImages) {
+					writeFront();
 				}
 
-
 				item = this->exrImageQueue.dequeue();
 			}
 		} catch (std::exception& ex) {
 			LOG(LL_ERR, ex.what());
 		}
+
+		while (!pendingImages.empty()) {
+			writeFront();
+		}
+
 		this->isEXREncodingThreadFinished = true;
 		this->cvEXREncodingThreadFinished.notify_all();
 		POST();
 	}
 
+	void Session::compressEXRImage(exr_queue_item item, std::vector<uint8_t>& image)
+	{
+		PRE();
+		struct Depth {
+			float depth;
+		};
+
+		Imf::Header header(this->width, this->height);
+		Imf::FrameBuffer framebuffer;
+
+		if (item.cRGB != nullptr) {
+			// OpenEXR converts the averaged floats back to half when it writes the channels.
+			Imf::PixelType rgbType = item.pBlurredRGB ? Imf::FLOAT : Imf::HALF;
+			char* pRGB = item.pBlurredRGB ? (char*)item.pBlurredRGB->data() : (char*)item.pRGBData;
+			size_t sampleSize = item.pBlurredRGB ? sizeof(float) : sizeof(half);
+			size_t pixelSize = 4 * sampleSize;
+			// The averaged image is packed; the mapped texture may pad its rows.
+			size_t rowPitch = item.pBlurredRGB ? pixelSize * this->width : item.rgbRowPitch;
+
+			if (this->exrChannels.rgb) {
+				LOG_CALL(LL_DBG, header.channels().insert("R", Imf::Channel(Imf::HALF)));
+				LOG_CALL(LL_DBG, header.channels().insert("G", Imf::Channel(Imf::HALF)));
+				LOG_CALL(LL_DBG, header.channels().insert("B", Imf::Channel(Imf::HALF)));
+
+				LOG_CALL(LL_DBG, framebuffer.insert("R",
+					Imf::Slice(
+						rgbType,
+						pRGB,
+						pixelSize,
+						rowPitch
+						)));
+
+				LOG_CALL(LL_DBG, framebuffer.insert("G",
+					Imf::Slice(
+						rgbType,
+						pRGB + sampleSize,
+						pixelSize,
+						rowPitch
+						)));
+
+				LOG_CALL(LL_DBG, framebuffer.insert("B",
+					Imf::Slice(
+						rgbType,
+						pRGB + 2 * sampleSize,
+						pixelSize,
+						rowPitch
+						)));
+			}
+
+			if (this->exrChannels.sss) {
+				LOG_CALL(LL_DBG, header.channels().insert("SSS", Imf::Channel(Imf::HALF)));
+
+				LOG_CALL(LL_DBG, framebuffer.insert("SSS",
+					Imf::Slice(
+						rgbType,
+						pRGB + 3 * sampleSize,
+						pixelSize,
+						rowPitch
+						)));
+			}
+		}
+		
+		if (item.cDepth != nullptr) {
+			// The slices stay in the captured format, OpenEXR converts them to the channel precision.
+			LOG_CALL(LL_DBG, header.channels().insert("depth.Z", Imf::Channel(this->exrChannels.depthType)));
+			//header.channels().insert("objectID", Imf::Channel(Imf::UINT));
+			Depth* mDSArray = (Depth*)item.pDepthData;
+
+			LOG_CALL(LL_DBG, framebuffer.insert("depth.Z",
+				Imf::Slice(
+					Imf::FLOAT,
+					(char*)&mDSArray[0].depth,
+					sizeof(Depth),
+					sizeof(Depth) * this->width
+					)));
+		}
+
+		std::unique_ptr<uint32_t[]> stencilBuffer;
+		if (item.cStencil != nullptr) {
+			size_t stencilLength = static_cast<size_t>(item.mStencilData.RowPitch) * this->height;
+			stencilBuffer.reset(new uint32_t[stencilLength]);
+			bulkWiden(stencilBuffer.get(), (uint8_t*)item.mStencilData.pData, stencilLength);
+
+			LOG_CALL(LL_DBG, header.channels().insert("objectID", Imf::Channel(this->exrChannels.objectIDType)));
+
+			LOG_CALL(LL_DBG, framebuffer.insert("objectID",
+				Imf::Slice(
+					Imf::UINT,
+					(char*)stencilBuffer.get(),
+					sizeof(uint32_t),
+					item.mStencilData.RowPitch * 4
+					)));
+		}
+
+		// The image is compressed in memory; the writer creates the file on its I/O thread.
+		Imf::StdOSStream stream;
+		{
+			Imf::OutputFile file(stream, header);
+			LOG_CALL(LL_DBG, file.setFrameBuffer(framebuffer));
+			LOG_CALL(LL_DBG, file.writePixels(this->height));
+		}
+		std::string content = stream.str();
+		image.assign(content.begin(), content.end());
+		POST();
+	}
+
 	HRESULT Session::writeVideoFrame(BYTE *pData, size_t length, LONGLONG sampleTime) {
 		PRE();
 		if (this->isBeingDeleted) {
@@ -549,14 +1043,7 @@ namespace Encoder {
 			return E_FAIL;
 		}
 
-		// Wait until format context is created
-		{
-			std::unique_lock<std::mutex> lk(this->mxFormatContext);
-			while (!isFormatContextCreated) {
-				this->cvFormatContext.wait_for(lk, std::chrono::milliseconds(1));
-			}
-		}
-
+		this->waitForFormatContext();
 
 		int bufferLength = av_image_get_buffer_size(this->inputPixelFormat, this->width, this->height, 1);
 		if (length != bufferLength) {
@@ -583,13 +1070,113 @@ namespace Encoder {
 
 		//RET_IF_FAILED(av_frame_make_writable(outputFrame), "outputFrame is not writable", E_FAIL);
 
-		sws_scale(pSwsContext, inputFrame->data, inputFrame->linesize, 0, this->height, outputFrame->data, outputFrame->linesize);
+		this->convertVideoFrame(inputFrame, outputFrame);
 
 		av_frame_unref(inputFrame);
 		av_frame_free(&inputFrame);
 		//outputFrame->pts = av_rescale_q(sampleTime, this->videoCodecContext->time_base, this->videoStream->time_base);
 		outputFrame->pts = sampleTime;
 
+		this->sendVideoFrame(outputFrame);
+
+		//av_frame_unref()
+		av_frame_unref(outputFrame);
+		av_frame_free(&outputFrame);
+		//av_frame_free(&inputFrame);
+
+
+		POST();
+		return S_OK;
+	}
+
+	HRESULT Session::writePlanarVideoFrame(BYTE *pData, size_t length, LONGLONG sampleTime) {
+		PRE();
+		if (this->isBeingDeleted) {
+			POST();
+			return E_FAIL;
+		}
+
+		this->waitForFormatContext();
+
+		int bufferLength = av_image_get_buffer_size(this->outputPixelFormat, this->width, this->height, 1);
+		if (length != bufferLength) {
+			LOG(LL_ERR, "Planar frame size != av_image_get_buffer_size: ", length, " vs ", bufferLength);
+			POST();
+			return E_FAIL;
+		}
+
+		AVFrame* outputFrame = av_frame_alloc();
+		RET_IF_NULL(outputFrame, "Could not allocate video frame", E_FAIL);
+		outputFrame->format = this->outputPixelFormat;
+		outputFrame->width = this->width;
+		outputFrame->height = this->height;
+		RET_IF_FAILED(av_image_fill_arrays(outputFrame->data, outputFrame->linesize, pData, this->outputPixelFormat, this->width, this->height, 1), "Could not fill the frame with data from the buffer", E_FAIL);
+		outputFrame->pts = sampleTime;
+
+		// The frame is already in the output format, so it goes to the encoder as is.
+		this->sendVideoFrame(outputFrame);
+
+		av_frame_free(&outputFrame);
+		POST();
+		return S_OK;
+	}
+
+	HRESULT Session::convertToOutputFormat(BYTE *pData, size_t length, std::shared_ptr<std::valarray<uint8_t>>& pResult) {
+		PRE();
+		if (this->isBeingDeleted) {
+			POST();
+			return E_FAIL;
+		}
+
+		int bufferLength = av_image_get_buffer_size(this->inputPixelFormat, this->width, this->height, 1);
+		if (length != bufferLength) {
+			LOG(LL_ERR, "IMFSample buffer size != av_image_get_buffer_size: ", length, " vs ", bufferLength);
+			POST();
+			return E_FAIL;
+		}
+
+		AVFrame* inputFrame = av_frame_alloc();
+		RET_IF_NULL(inputFrame, "Could not allocate video frame", E_FAIL);
+		AVFrame* outputFrame = av_frame_alloc();
+		RET_IF_NULL(outputFrame, "Could not allocate video frame", E_FAIL);
+
+		// sws_scale writes straight into the buffer that is queued.
+		pResult = std::make_shared<std::valarray<uint8_t>>(av_image_get_buffer_size(this->outputPixelFormat, this->width, this->height, 1));
+		RET_IF_FAILED(av_image_fill_arrays(inputFrame->data, inputFrame->linesize, pData, this->inputPixelFormat, this->width, this->height, 1), "Could not fill the frame with data from the buffer", E_FAIL);
+		RET_IF_FAILED(av_image_fill_arrays(outputFrame->data, outputFrame->linesize, std::begin(*pResult), this->outputPixelFormat, this->width, this->height, 1), "Could not fill the frame with data from the buffer", E_FAIL);
+
+		this->convertVideoFrame(inputFrame, outputFrame);
+
+		av_frame_free(&inputFrame);
+		av_frame_free(&outputFrame);
+		POST();
+		return S_OK;
+	}
+
+	void Session::waitForFormatContext() {
+		std::unique_lock<std::mutex> lk(this->mxFormatContext);
+		while (!isFormatContextCreated) {
+			this->cvFormatContext.wait_for(lk, std::chrono::milliseconds(1));
+		}
+	}
+
+	void Session::sendVideoFrame(AVFrame* outputFrame) {
+		if (this->ladder) {
+			LOG_IF_FAILED(this->ladder->pushFrame(outputFrame), "Could not write the resolution ladder frame.");
+		}
+		if (this->qualityProbe) {
+			this->qualityProbe->pushReference(outputFrame);
+		}
+		if (this->gopCache) {
+			LOG_IF_FAILED(this->gopCache->pushFrame(outputFrame,
+				[this](AVFrame* frame) { this->encodeVideoFrame(frame); },
+				[this](AVPacket* packet) { this->muxVideoPacket(packet); }), "Could not pass the frame to the GOP cache.");
+			return;
+		}
+		this->encodeVideoFrame(outputFrame);
+	}
+
+	void Session::encodeVideoFrame(AVFrame* outputFrame) {
 		std::shared_ptr<AVPacket> pPkt(new AVPacket(), av_packet_unref);
 
 		av_init_packet(pPkt.get());
@@ -602,22 +1189,149 @@ namespace Encoder {
 		avcodec_send_frame(this->videoCodecContext, outputFrame);
 		
 		if (SUCCEEDED(avcodec_receive_packet(this->videoCodecContext, pPkt.get()))) {
-			std::lock_guard<std::mutex> guard(this->mxWriteFrame);
-			av_packet_rescale_ts(pPkt.get(), this->videoCodecContext->time_base, this->videoStream->time_base);
-			pPkt->stream_index = this->videoStream->index;
-			av_interleaved_write_frame(this->fmtContext, pPkt.get());
+			if (this->gopCache) {
+				LOG_IF_FAILED(this->gopCache->pushPacket(pPkt.get(), [this](AVPacket* packet) { this->muxVideoPacket(packet); }),
+					"Could not write a packet through the GOP cache.");
+			} else {
+				this->muxVideoPacket(pPkt.get());
+			}
 		}
+	}
 
-		//av_frame_unref()
-		av_frame_unref(outputFrame);
-		av_frame_free(&outputFrame);
-		//av_frame_free(&inputFrame);
+	void Session::muxVideoPacket(AVPacket* pPacket) {
+		std::lock_guard<std::mutex> guard(this->mxWriteFrame);
+		if (this->qualityProbe) {
+			this->qualityProbe->pushPacket(pPacket);
+		}
+		int64_t pts = pPacket->pts;
+		av_packet_rescale_ts(pPacket, this->videoCodecContext->time_base, this->videoStream->time_base);
+		pPacket->stream_index = this->videoStream->index;
+		int result = this->writePacket(pPacket);
+		if (this->liveStream) {
+			this->liveStream->sentPacket(pts, result >= 0);
+		}
+	}
+
+	int Session::writePacket(AVPacket* pPacket) {
+		// Called with mxWriteFrame held. The muxer takes the packet's data, so it is journaled first.
+		if (this->journal) {
+			LOG_IF_FAILED(this->journal->append(pPacket), "Could not write packet to the export journal.");
+		}
+		int result = av_interleaved_write_frame(this->fmtContext, pPacket);
+		if (this->liveStream) {
+			avio_flush(this->fmtContext->pb);
+		}
+		return result;
+	}
 
+	std::string Session::getOutputStem() const {
+		size_t dot = this->filename.find_last_of('.');
+		if ((dot == std::string::npos) || (this->filename.find_last_of("\\/") > dot)) {
+			dot = this->filename.size();
+		}
+		return this->filename.substr(0, dot);
+	}
 
+	void Session::convertVideoFrame(AVFrame* input, AVFrame* output)
+	{
+		if (this->swsSliceContexts.empty()) {
+			sws_scale(this->pSwsContext, input->data, input->linesize, 0, this->height, output->data, output->linesize);
+			return;
+		}
+
+		const AVPixFmtDescriptor* srcDesc = av_pix_fmt_desc_get(this->inputPixelFormat);
+		const AVPixFmtDescriptor* dstDesc = av_pix_fmt_desc_get(this->outputPixelFormat);
+		int srcPlanes = av_pix_fmt_count_planes(this->inputPixelFormat);
+		int dstPlanes = av_pix_fmt_count_planes(this->outputPixelFormat);
+
+		TaskScheduler::instance().parallelFor(0, this->swsSliceContexts.size(), 1, [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++) {
+				uint32_t top = this->swsSliceRows[i];
+				uint32_t rows = this->swsSliceRows[i + 1] - top;
+				uint8_t* src[4] = { NULL, NULL, NULL, NULL };
+				uint8_t* dst[4] = { NULL, NULL, NULL, NULL };
+				for (int p = 0; p < srcPlanes; p++) {
+					int shift = (p == 1 || p == 2) ? srcDesc->log2_chroma_h : 0;
+					src[p] = input->data[p] + (top >> shift) * input->linesize[p];
+				}
+				for (int p = 0; p < dstPlanes; p++) {
+					int shift = (p == 1 || p == 2) ? dstDesc->log2_chroma_h : 0;
+					dst[p] = output->data[p] + (top >> shift) * output->linesize[p];
+				}
+				sws_scale(this->swsSliceContexts[i], src, input->linesize, 0, rows, dst, output->linesize);
+			}
+		});
+	}
+
+	void Session::setVideoStartTime(LONGLONG sampleTime) {
+		LONGLONG unset = AV_NOPTS_VALUE;
+		this->videoStartTime.compare_exchange_strong(unset, sampleTime);
+	}
+
+	HRESULT Session::enqueueAudioFrame(BYTE * pData, size_t length, LONGLONG sampleTime)
+	{
+		PRE();
+		std::lock_guard<std::mutex> audioLock(this->mxAudio);
+		if (this->isBeingDeleted) {
+			POST();
+			return E_FAIL;
+		}
+		if (this->isAudioFinished) {
+			POST();
+			return S_OK;
+		}
+		auto pBuffer = std::make_shared<std::vector<BYTE>>();
+		if (this->frameRanges.isEmpty() || !this->audioBlockAlign) {
+			pBuffer->assign(pData, pData + length);
+		} else {
+			// Keep only the samples that play during the selected frames. Sample times are in
+			// 100 ns units and count from the first video frame, or from the first audio buffer
+			// if no video frame has been seen yet.
+			if (this->audioStartTime == AV_NOPTS_VALUE) {
+				this->audioStartTime = this->videoStartTime != AV_NOPTS_VALUE ? this->videoStartTime.load() : sampleTime;
+			}
+			int64_t first = av_rescale(sampleTime - this->audioStartTime, this->inputAudioSampleRate, 10000000);
+			int64_t last = first + static_cast<int64_t>(length / this->audioBlockAlign);
+			for (auto& range : this->frameRanges.getRanges()) {
+				int64_t begin = av_rescale(range.first, (int64_t)this->inputAudioSampleRate * this->frameRate.den, this->frameRate.num);
+				int64_t end = range.second == FrameRanges::OPEN_END ? last : av_rescale(range.second + 1, (int64_t)this->inputAudioSampleRate * this->frameRate.den, this->frameRate.num);
+				begin = (std::max)(begin, first);
+				end = (std::min)(end, last);
+				if (begin < end) {
+					pBuffer->insert(pBuffer->end(), pData + (begin - first) * this->audioBlockAlign, pData + (end - first) * this->audioBlockAlign);
+				}
+			}
+			if (pBuffer->empty()) {
+				POST();
+				return S_OK;
+			}
+		}
+		// Audio that arrives before the first video frame is held here until the format context
+		// exists, so that the strand never waits for it on a scheduler worker.
+		this->pendingAudioBuffers.push_back(std::make_pair(pBuffer, sampleTime));
+		{
+			std::lock_guard<std::mutex> guard(this->mxFormatContext);
+			if (!this->isFormatContextCreated) {
+				POST();
+				return S_OK;
+			}
+		}
+		this->postPendingAudio();
 		POST();
 		return S_OK;
 	}
 
+	void Session::postPendingAudio() {
+		for (auto& pending : this->pendingAudioBuffers) {
+			auto pBuffer = pending.first;
+			LONGLONG sampleTime = pending.second;
+			this->audioStrand.post([this, pBuffer, sampleTime]() {
+				LOG_IF_FAILED(this->writeAudioFrame(pBuffer->data(), pBuffer->size(), sampleTime), "Failed to write audio frame.");
+			});
+		}
+		this->pendingAudioBuffers.clear();
+	}
+
 	HRESULT Session::writeAudioFrame(BYTE *pData, size_t length, LONGLONG sampleTime)
 	{
 		PRE();
@@ -632,14 +1346,6 @@ namespace Encoder {
 			return E_FAIL;
 		}
 
-		// Wait until format context is created
-		{
-			std::unique_lock<std::mutex> lk(this->mxFormatContext);
-			while (!isFormatContextCreated) {
-				this->cvFormatContext.wait_for(lk, std::chrono::milliseconds(1));
-			}
-		}
-		
 		int64_t numSamples = length / av_samples_get_buffer_size(NULL, this->inputAudioFrame->channels, 1, (AVSampleFormat)this->inputAudioFrame->format, this->audioBlockAlign);
 
 		this->inputAudioFrame->nb_samples = static_cast<int>(numSamples);
@@ -704,7 +1410,7 @@ namespace Encoder {
 			std::lock_guard<std::mutex> guard(this->mxWriteFrame);
 			av_packet_rescale_ts(pPkt.get(), this->audioCodecContext->time_base, this->audioStream->time_base);
 			pPkt->stream_index = this->audioStream->index;
-			av_interleaved_write_frame(this->fmtContext, pPkt.get());
+			this->writePacket(pPkt.get());
 		}
 
 		POST();
@@ -714,25 +1420,27 @@ namespace Encoder {
 	HRESULT Session::finishVideo()
 	{
 		PRE();
+		std::lock_guard<std::mutex> videoLock(this->mxVideo);
 		std::lock_guard<std::mutex> guard(this->mxFinish);
-		if (!this->videoCodecContext || this->isVideoFinished || !this->isVideoContextCreated || this->isBeingDeleted) {
+		if (this->isVideoFinished || !this->isVideoContextCreated || this->isBeingDeleted) {
 			this->isVideoFinished = true;
 			POST();
 			return S_OK;
 		}
 
-		// Wait until the video encoding thread is finished.
-		{
-			// Write end of the stream object with a nullptr
-			this->videoFrameQueue.enqueue(frameQueueItem(nullptr));
-			std::unique_lock<std::mutex> lock(this->mxEncodingThread);
-			while (!this->isEncodingThreadFinished) {
-				this->cvEncodingThreadFinished.wait(lock);
-			}
+		// Wait until every frame has left the video pipeline.
+		if (this->videoPipeline) {
+			LOG_CALL(LL_DBG, this->videoPipeline->finish());
+		}
+		for (auto& pOutput : this->extraOutputs) {
+			LOG_CALL(LL_DBG, pOutput->finish());
+		}
+		if (this->ladder) {
+			LOG_CALL(LL_DBG, this->ladder->finish());
 		}
 
 		// Wait until the depth encoding thread is finished
-		{
+		if (this->thread_exr_encoder.joinable()) {
 			// Write end of the stream object with a nullptr
 			this->exrImageQueue.enqueue(exr_queue_item());
 			std::unique_lock<std::mutex> lock(this->mxEXREncodingThread);
@@ -742,35 +1450,50 @@ namespace Encoder {
 		}
 
 
-		if (thread_video_encoder.joinable()) {
-			thread_video_encoder.join();
-		}
-
 		if (thread_exr_encoder.joinable()) {
 			thread_exr_encoder.join();
 		}
 
+		if (this->exrWriter) {
+			LOG_CALL(LL_DBG, this->exrWriter->finish());
+		}
+
 		// Write delayed frames
-		{
+		if (this->videoCodecContext) {
 			AVPacket pkt;
 
 			av_init_packet(&pkt);
 			pkt.data = NULL;
 			pkt.size = 0;
 
+			GopCache::Write write = [this](AVPacket* packet) { this->muxVideoPacket(packet); };
+			if (this->gopCache) {
+				LOG_IF_FAILED(this->gopCache->flushFrames([this](AVFrame* frame) { this->encodeVideoFrame(frame); }, write),
+					"Could not pass the last frames to the GOP cache.");
+			}
+
 			//int got_packet;
 			//avcodec_encode_video2(this->videoCodecContext, &pkt, NULL, &got_packet);
 			avcodec_send_frame(this->videoCodecContext, NULL);
 			while (SUCCEEDED(avcodec_receive_packet(this->videoCodecContext, &pkt))) {
-				std::lock_guard<std::mutex> guard(this->mxWriteFrame);
-				av_packet_rescale_ts(&pkt, this->videoCodecContext->time_base, this->videoStream->time_base);
 				//pkt.dts = outputFrame->pts;
-				pkt.stream_index = this->videoStream->index;
-				av_interleaved_write_frame(this->fmtContext, &pkt);
+				if (this->gopCache) {
+					LOG_IF_FAILED(this->gopCache->pushPacket(&pkt, write), "Could not write a packet through the GOP cache.");
+				} else {
+					write(&pkt);
+				}
 				//avcodec_encode_video2(this->videoCodecContext, &pkt, NULL, &got_packet);
 			}
 
 			av_packet_unref(&pkt);
+
+			if (this->gopCache) {
+				LOG_IF_FAILED(this->gopCache->finish(write), "Could not write the remaining cached GOPs.");
+			}
+
+			if (this->qualityProbe) {
+				LOG_CALL(LL_DBG, this->qualityProbe->finish());
+			}
 		}
 
 		this->isVideoFinished = true;
@@ -782,6 +1505,15 @@ namespace Encoder {
 	HRESULT Session::finishAudio()
 	{
 		PRE();
+		std::lock_guard<std::mutex> audioLock(this->mxAudio);
+		{
+			std::lock_guard<std::mutex> guard(this->mxFormatContext);
+			if (!this->isFormatContextCreated) {
+				this->pendingAudioBuffers.clear();
+			}
+		}
+		this->postPendingAudio();
+		this->audioStrand.wait();
 		std::lock_guard<std::mutex> guard(this->mxFinish);
 		if (!this->audioCodecContext || this->isAudioFinished || !this->isAudioContextCreated || this->isBeingDeleted) {
 			this->isAudioFinished = true;
@@ -841,20 +1573,66 @@ namespace Encoder {
 		LOG(LL_NFO, "Ending session...");
 
 		LOG(LL_NFO, "Closing files...");
-		LOG_IF_FAILED_AV(av_write_trailer(this->fmtContext), "Could not finalize the output file.");
+		int trailerResult = av_write_trailer(this->fmtContext);
+		LOG_IF_FAILED_AV(trailerResult, "Could not finalize the output file.");
 		LOG_IF_FAILED_AV(avcodec_close(this->videoCodecContext), "Could not close the video codec.");
 		LOG_IF_FAILED_AV(avcodec_close(this->audioCodecContext), "Could not close the audio codec.");
-		LOG_IF_FAILED_AV(avio_close(this->fmtContext->pb), "Could not close the output file.");
+		if (this->outputFile) {
+			LOG_IF_FAILED(this->outputFile->close(&this->fmtContext->pb, this->manifest.get()), "Could not close the output file.");
+		} else {
+			LOG_IF_FAILED_AV(avio_close(this->fmtContext->pb), "Could not close the output file.");
+		}
+		if (this->imageWriter) {
+			LOG_IF_FAILED(this->imageWriter->finish(), "Could not finish the image sequence.");
+		}
+		if (this->journal) {
+			// The journal is only needed until the container has been finalized.
+			LOG_CALL(LL_DBG, this->journal->close(trailerResult < 0));
+		}
+		if (this->manifest) {
+			LOG_IF_FAILED(this->manifest->write(this->getOutputStem() + ".manifest"), "Could not write the output manifest.");
+		}
 		/*av_free(this->videoCodecContext.get());
 		av_free(this->audioCodecContext.get());*/
 		
 		this->isSessionFinished = true;
 		this->cvEndSession.notify_all();
+		this->logReport();
 		LOG(LL_NFO, "Done.");
 
 		POST();
 		return S_OK;
 	}
+	void Session::pace() {
+		if (this->pacingController) {
+			this->pacingController->pace();
+		}
+	}
+
+	void Session::logReport() {
+		if (this->videoPipeline) {
+			this->videoPipeline->logReport();
+		}
+		if (this->pacingController) {
+			this->pacingController->logReport();
+		}
+		if (this->liveStream) {
+			this->liveStream->logReport();
+		}
+		if (this->gopCache) {
+			this->gopCache->logReport();
+		}
+		if (this->qualityProbe) {
+			this->qualityProbe->logReport();
+		}
+		LOG(LL_NFO, "OpenEXR queue: ",
+			this->exrImageQueue.getEnqueueCount(), " enqueued, ",
+			this->exrImageQueue.getBlockedCount(), " blocked for ",
+			this->exrImageQueue.getBlockedMicroseconds() / 1000, " ms, max depth ",
+			this->exrImageQueue.getMaxDepth(), "/", this->exrImageQueue.getCapacity(), ", ",
+			this->exrImageQueue.getOverflowCount(), " over capacity");
+	}
+
 	HRESULT Session::createVideoFrames(uint32_t srcWidth, uint32_t srcHeight, AVPixelFormat srcFmt, uint32_t dstWidth, uint32_t dstHeight, AVPixelFormat dstFmt)
 	{
 		PRE();
@@ -877,7 +1655,42 @@ namespace Encoder {
 		//av_image_alloc(outputFrame->data, outputFrame->linesize, dstWidth, dstHeight, dstFmt, 1);
 		//av_alloc_buff
 
+		if (dstFmt == AV_PIX_FMT_PAL8) {
+			// Paletted frames are made by the gif_quantize stage, swscale cannot write them.
+			POST();
+			return S_OK;
+		}
+
 		this->pSwsContext = sws_getContext(srcWidth, srcHeight, srcFmt, dstWidth, dstHeight, dstFmt, SWS_POINT, NULL, NULL, NULL);
+		RET_IF_NULL(this->pSwsContext, "Could not create conversion context", E_FAIL);
+		if (this->hdrTransfer) {
+			setBT2020Colorspace(this->pSwsContext);
+		}
+
+		// Unscaled conversions are split into horizontal bands that run on the task scheduler.
+		// Palette and bitstream formats cannot be addressed per row, so they keep the single context.
+		const AVPixFmtDescriptor* srcDesc = av_pix_fmt_desc_get(srcFmt);
+		const AVPixFmtDescriptor* dstDesc = av_pix_fmt_desc_get(dstFmt);
+		const uint64_t unsliceableFlags = AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_PSEUDOPAL | AV_PIX_FMT_FLAG_BITSTREAM | AV_PIX_FMT_FLAG_HWACCEL;
+		uint32_t sliceCount = (std::min)(TaskScheduler::instance().getWorkerCount(), dstHeight / SLICE_ALIGNMENT);
+		if (srcDesc && dstDesc && (srcWidth == dstWidth) && (srcHeight == dstHeight) && (sliceCount > 1)
+			&& !(srcDesc->flags & unsliceableFlags) && !(dstDesc->flags & unsliceableFlags)) {
+			for (uint32_t i = 0; i < sliceCount; i++) {
+				this->swsSliceRows.push_back((dstHeight * i / sliceCount) & ~(SLICE_ALIGNMENT - 1));
+			}
+			this->swsSliceRows.push_back(dstHeight);
+
+			for (uint32_t i = 0; i < sliceCount; i++) {
+				uint32_t rows = this->swsSliceRows[i + 1] - this->swsSliceRows[i];
+				SwsContext* pSliceContext = sws_getContext(srcWidth, rows, srcFmt, dstWidth, rows, dstFmt, SWS_POINT, NULL, NULL, NULL);
+				RET_IF_NULL(pSliceContext, "Could not create conversion slice context", E_FAIL);
+				if (this->hdrTransfer) {
+					setBT2020Colorspace(pSliceContext);
+				}
+				this->swsSliceContexts.push_back(pSliceContext);
+			}
+			LOG(LL_NFO, "Converting video frames in ", sliceCount, " slices");
+		}
 		POST();
 		return S_OK;
 	}
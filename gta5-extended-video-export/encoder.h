@@ -3,10 +3,29 @@
 #include <Windows.h>
 #include <mfidl.h>
 #include <mutex>
+#include <atomic>
+#include <deque>
 #include <future>
 #include <vector>
 #include <valarray>
 #include "SafeQueue.h"
+#include "thread-policy.h"
+#include "task-scheduler.h"
+#include "pipeline.h"
+#include "frame-ranges.h"
+#include "aux-video-output.h"
+#include "image-sequence-writer.h"
+#include "export-journal.h"
+#include "gop-cache.h"
+#include "resolution-ladder.h"
+#include "quality-probe.h"
+#include "exr-accumulator.h"
+#include "exr-channels.h"
+#include "hdr-transfer.h"
+#include "gif-quantizer.h"
+#include "cube-lut.h"
+#include "pacing-controller.h"
+#include "live-stream.h"
 #include <d3d11.h>
 #include <dxgi.h>
 #include <wrl.h>
@@ -18,6 +37,9 @@ extern "C" {
 #include <libavcodec\avcodec.h>
 #include <libavformat\avformat.h>
 #include <libavutil\imgutils.h>
+#include <libavutil\opt.h>
+#include <libavutil\parseutils.h>
+#include <libavutil\pixdesc.h>
 #include <libswresample\swresample.h>
 #include <libswscale\swscale.h>
 }
@@ -38,9 +60,10 @@ namespace Encoder {
 		AVFrame *outputFrame = NULL;
 		AVStream *videoStream = NULL;
 		SwsContext *pSwsContext = NULL;
+		std::vector<SwsContext*> swsSliceContexts;
+		std::vector<uint32_t> swsSliceRows;
 		AVDictionary *videoOptions = NULL;
 		uint64_t videoPTS = 0;
-		uint64_t motionBlurPTS = 0;
 
 		AVCodec *audioCodec = NULL;
 		AVCodecContext *audioCodecContext = NULL;
@@ -51,13 +74,21 @@ namespace Encoder {
 		AVDictionary *audioOptions = NULL;
 		AVAudioFifo *audioSampleBuffer = NULL;
 		uint64_t audioPTS = 0;
+		// Sample times of the first video frame and of the sample that audio positions count from.
+		std::atomic<LONGLONG> videoStartTime{ AV_NOPTS_VALUE };
+		LONGLONG audioStartTime = AV_NOPTS_VALUE;
 
 
 		bool isVideoFinished = false;
 		bool isAudioFinished = false;
 		bool isSessionFinished = false;
-		bool isCapturing = false;
-		bool isBeingDeleted = false;
+		std::atomic<bool> isCapturing{ false };
+		std::atomic<bool> isBeingDeleted{ false };
+
+		// The capture hook and the audio hook feed the session from different threads.
+		// Each stream is serialized on its own, and against finishing that stream.
+		std::mutex mxVideo;
+		std::mutex mxAudio;
 
 		std::mutex mxFormatContext;
 		std::condition_variable cvFormatContext;
@@ -65,19 +96,6 @@ namespace Encoder {
 		std::mutex mxEndSession;
 		std::condition_variable cvEndSession;
 
-		struct frameQueueItem {
-			frameQueueItem():
-				data(nullptr)
-			{
-				
-			}
-			frameQueueItem(std::shared_ptr<std::valarray<uint8_t>> bytes) :
-				data(bytes)
-			{}
-
-			std::shared_ptr<std::valarray<uint8_t>> data;
-		};
-
 		struct exr_queue_item {
 			exr_queue_item() :
 				cRGB(nullptr),
@@ -105,27 +123,100 @@ namespace Encoder {
 			ComPtr<ID3D11Texture2D> cStencil;
 			D3D11_MAPPED_SUBRESOURCE mStencilData;
 			//void* pStencilData;
+			// Capture position of the sub-frame.
+			uint64_t subFrame = 0;
+			// Bytes between the rows of pRGBData in the mapped texture.
+			UINT rgbRowPitch = 0;
+			// Set instead of pRGBData for images averaged over the shutter.
+			std::shared_ptr<std::vector<float>> pBlurredRGB;
 		};
 
-		SafeQueue<frameQueueItem> videoFrameQueue;
 		SafeQueue<exr_queue_item> exrImageQueue;
 
 		bool isVideoContextCreated = false;
 		bool isAudioContextCreated = false;
 		bool isFormatContextCreated = false;
-		bool isEncodingThreadFinished = false;
-		std::condition_variable cvEncodingThreadFinished;
-		std::mutex mxEncodingThread;
-		std::thread thread_video_encoder;
-		std::valarray<uint16_t> motionBlurAccBuffer;
-		std::valarray<uint16_t> motionBlurTempBuffer;
-		std::valarray<uint8_t> motionBlurDestBuffer;
+		bool exportEXR = false;
+		std::string exrShutterDefinition = "blur";
+		EXRShutter exrShutter = EXR_SHUTTER_BLUR;
+		// Sub-frames per OpenEXR image, and how many of the last ones go into it.
+		uint32_t exrPeriod = 1;
+		uint32_t exrWindow = 1;
+		std::unique_ptr<EXRAccumulator> exrAccumulator;
+		std::string exrChannelDefinition;
+		EXRChannels exrChannels;
+		std::string hdrDefinition;
+		float hdrReferenceWhite = 203;
+		HDRTransferFunction hdrTransferFunction = HDR_TRANSFER_NONE;
+		std::unique_ptr<HDRTransfer> hdrTransfer;
+		// Sub-frames are averaged in linear light before the transfer, instead of by the motion_blur stage.
+		std::unique_ptr<EXRAccumulator> hdrAccumulator;
+		uint32_t hdrPeriod = 1;
+		uint32_t hdrWindow = 1;
+		std::string pipelineDefinition = "motion_blur, encode";
+		// Stage names of pipelineDefinition, as parsed by createContext.
+		std::vector<std::string> pipelineStages;
+		std::string lutFile;
+		std::unique_ptr<CubeLUT> lut;
+		std::string gifDitherDefinition = "bayer";
+		GIFDither gifDither = GIF_DITHER_BAYER;
+		// Frames that share a GIF palette.
+		uint32_t gifPaletteFrames = 30;
+		std::string frameRangeDefinition;
+		FrameRanges frameRanges;
+		AVRational frameRate = { 0, 1 };
+		uint64_t capturePosition = 0;
+		std::unique_ptr<Pipeline> videoPipeline;
+		// Milliseconds the game may be held per frame while the export catches up; 0 blocks inside the capture instead.
+		// Only the game calls pace(), so it is off unless set from frame_pacing_budget.
+		uint32_t pacingBudget = 0;
+		std::unique_ptr<PacingController> pacingController;
+		// Folder of the spill stage's file; empty leaves the stage out.
+		std::string spillFolder;
+		uint32_t spillAfter = 1000;
+		// Set to stream the export instead of writing it to a file.
+		std::string liveURL;
+		std::unique_ptr<LiveStream> liveStream;
+		// Encoder frames lost with every output frame a live stream drops.
+		uint32_t liveDropLength = 1;
+		uint32_t liveDroppedFrames = 0;
+		bool isDroppingFrame = false;
+		// Negative values derive the angle from shutterPosition.
+		float shutterAngle = -1;
+		// Sub-frames synthesized between every two captured ones by the interpolate stage.
+		uint32_t motionBlurInterpolation = 0;
+		uint32_t motionBlurSearchRange = 16;
+		// Sub-frames the motion_blur stage gets for every captured one.
+		uint32_t subFrameScale = 1;
+		std::string extraOutputDefinition;
+		std::vector<std::shared_ptr<AuxVideoOutput>> extraOutputs;
+		std::string ladderDefinition;
+		std::unique_ptr<ResolutionLadder> ladder;
+		std::string imageSequenceLayout = "flat";
+		ImageSequenceLayout imageLayout = IMAGE_SEQUENCE_FLAT;
+		uint32_t imageShardSize = 0;
+		std::unique_ptr<ImageSequenceWriter> exrWriter;
+		std::unique_ptr<ImageSequenceWriter> imageWriter;
+		bool writeManifest = false;
+		std::shared_ptr<OutputManifest> manifest;
+		std::unique_ptr<HashingFile> outputFile;
+		bool writeJournal = false;
+		std::unique_ptr<ExportJournal> journal;
+		std::string gopCacheDirectory;
+		uint32_t gopCacheLength = 120;
+		std::unique_ptr<GopCache> gopCache;
+		uint32_t qualityProbeInterval = 0;
+		std::unique_ptr<QualityProbe> qualityProbe;
 
 		bool isEXREncodingThreadFinished = false;
 		std::condition_variable cvEXREncodingThreadFinished;
 		std::mutex mxEXREncodingThread;
 		std::thread thread_exr_encoder;
 
+		TaskScheduler::Strand audioStrand;
+		// Audio buffers and their sample times, held until the format context is created.
+		std::deque<std::pair<std::shared_ptr<std::vector<BYTE>>, LONGLONG>> pendingAudioBuffers;
+
 
 		//std::condition_variable cvFormatContext;
 
@@ -136,8 +227,8 @@ namespace Encoder {
 		UINT height;
 		UINT framerate;
 		//float audioSampleRateMultiplier;
-		uint32_t motionBlurSamples;
-		UINT audioBlockAlign;
+		uint32_t motionBlurSamples = 0;
+		UINT audioBlockAlign = 0;
 		AVPixelFormat outputPixelFormat;
 		AVPixelFormat inputPixelFormat;
 		AVSampleFormat inputAudioSampleFormat;
@@ -150,6 +241,7 @@ namespace Encoder {
 		std::string exrOutputPath;
 		uint64_t exrPTS=0;
 		float shutterPosition;
+		ThreadPolicy threadPolicy;
 		//LPWSTR *outputDir;
 		//LPWSTR *outputFile;
 		//FILE *file;
@@ -183,25 +275,63 @@ namespace Encoder {
 			std::string aoptions
 			);
 
+		// What the capture hook has to read back for this session.
+		bool isVideoConsumed() const;
+		bool isEXRConsumed() const;
+		// Whether the sub-frame selected last goes into an OpenEXR image.
+		bool isEXRSubFrameUsed();
+		// HDR video is read from the game's HDR buffer instead of the swap chain.
+		bool isHDRVideo() const;
+		bool isHDRSubFrameUsed();
+		bool selectNextFrame();
+		float getShutterAngle() const;
+		// Sub-frames blended out of `period`: by shutter_angle if it is set, by motion_blur_strength otherwise.
+		uint32_t getShutterWindow(uint32_t period) const;
+		// Number of captured sub-frames per frame at the given rate, or 0 if it is not a whole number.
+		uint32_t getSubFramePeriod(AVRational rate) const;
 		HRESULT enqueueVideoFrame(BYTE * pData, int length);
+		// Remembers the sample time of the first video frame the game writes.
+		void setVideoStartTime(LONGLONG sampleTime);
+		HRESULT enqueueAudioFrame(BYTE * pData, size_t length, LONGLONG sampleTime);
+		HRESULT enqueueHDRVideoFrame(ComPtr<ID3D11DeviceContext> pDeviceContext, ComPtr<ID3D11Texture2D> cRGB);
+		// Holds the game until the export queues have room again.
+		void pace();
 		HRESULT enqueueEXRImage(ComPtr<ID3D11DeviceContext> pDeviceContext, ComPtr<ID3D11Texture2D> cRGB, ComPtr<ID3D11Texture2D> cDepth, ComPtr<ID3D11Texture2D> cStencil);
 
-		void videoEncodingThread();
 		void exrEncodingThread();
+		void compressEXRImage(exr_queue_item item, std::vector<uint8_t>& image);
 
 		HRESULT writeVideoFrame(BYTE *pData, size_t length, LONGLONG sampleTime);
+		HRESULT writePlanarVideoFrame(BYTE *pData, size_t length, LONGLONG sampleTime);
+		HRESULT convertToOutputFormat(BYTE *pData, size_t length, std::shared_ptr<std::valarray<uint8_t>>& pResult);
 		HRESULT writeAudioFrame(BYTE *pData, size_t length, LONGLONG sampleTime);
+		// Posts the held audio buffers to the audio strand; mxAudio must be held.
+		void postPendingAudio();
 
 		HRESULT finishVideo();
 		HRESULT finishAudio();
 
 		HRESULT endSession();
 
+		void logReport();
+
 	private:
 		HRESULT createVideoContext(UINT width, UINT height, std::string inputPixelFormatString, UINT fps_num, UINT fps_den, uint8_t motionBlurSamples, float shutterPosition, std::string outputPixelFormatString, std::string vcodec, std::string preset);
 		HRESULT createAudioContext(uint32_t inputChannels, uint32_t inputSampleRate, uint32_t inputBitsPerSample, std::string inputSampleFormat, uint32_t inputAlignment, std::string outputSampleFormatString, std::string acodec, std::string preset);
 		HRESULT createFormatContext(std::string format, std::string filename, std::string exrOutputPath, std::string fmtOptions);
+		HRESULT createPipeline();
+		bool hasPipelineStage(const std::string& name) const;
+		HRESULT createExtraOutputs(std::string definition, std::string vcodec, std::string voptions);
+		HRESULT configureEXRShutter(uint64_t width, uint64_t height, float shutterPosition);
 		HRESULT createVideoFrames(uint32_t srcWidth, uint32_t srcHeight, AVPixelFormat srcFmt, uint32_t dstWidth, uint32_t dstHeight, AVPixelFormat dstFmt);
 		HRESULT createAudioFrames(uint32_t inputChannels, AVSampleFormat inputSampleFmt, uint32_t inputSampleRate, uint32_t outputChannels, AVSampleFormat outputSampleFmt, uint32_t outputSampleRate);
+		void convertVideoFrame(AVFrame* input, AVFrame* output);
+		void waitForFormatContext();
+		void sendVideoFrame(AVFrame* outputFrame);
+		void encodeVideoFrame(AVFrame* outputFrame);
+		void muxVideoPacket(AVPacket* pPacket);
+		int writePacket(AVPacket* pPacket);
+		// Output file name without its extension, for the files written next to it.
+		std::string getOutputStem() const;
 	};
 }
\ No newline at end of file
@@ -0,0 +1,310 @@
+#include "export-journal.h"
+#include "logger.h"
+#include <algorithm>
+#include <cstring>
+#include <memory>
+
+namespace Encoder {
+
+	namespace {
+		const char JOURNAL_MAGIC[4] = { 'E', 'V', 'E', 'J' };
+		const char PACKET_MAGIC[4] = { 'E', 'V', 'E', 'K' };
+		const uint32_t JOURNAL_VERSION = 1;
+		// Without a video stream to flush on keyframes, the journal is flushed every this many packets.
+		const uint32_t FLUSH_INTERVAL = 64;
+		const uint32_t MAX_PACKET_SIZE = 256 * 1024 * 1024;
+	}
+
+	ExportJournal::~ExportJournal() {
+		if (this->file.is_open()) {
+			this->file.close();
+		}
+	}
+
+	void ExportJournal::writeString(const std::string& value) {
+		this->writeValue(static_cast<uint32_t>(value.size()));
+		this->file.write(value.data(), value.size());
+	}
+
+	HRESULT ExportJournal::open(std::string path, AVFormatContext* fmtContext, AVRational frameRate, std::string frameRanges) {
+		PRE();
+		this->path = path;
+		this->file.open(path, std::ios::binary | std::ios::trunc);
+		if (!this->file) {
+			LOG(LL_ERR, "Could not create export journal: ", path);
+			POST();
+			return E_FAIL;
+		}
+
+		this->file.write(JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+		this->writeValue(JOURNAL_VERSION);
+		this->writeString(fmtContext->oformat->name);
+		this->writeString(fmtContext->filename);
+		this->writeValue(frameRate.num);
+		this->writeValue(frameRate.den);
+		this->writeString(frameRanges);
+
+		this->writeValue(fmtContext->nb_streams);
+		for (unsigned int i = 0; i < fmtContext->nb_streams; i++) {
+			AVStream* stream = fmtContext->streams[i];
+			AVCodecParameters* par = stream->codecpar;
+			if ((par->codec_type == AVMEDIA_TYPE_VIDEO) && (this->videoStreamIndex < 0)) {
+				this->videoStreamIndex = stream->index;
+			}
+			this->writeValue(stream->time_base.num);
+			this->writeValue(stream->time_base.den);
+			this->writeValue(static_cast<int32_t>(par->codec_type));
+			this->writeValue(static_cast<int32_t>(par->codec_id));
+			this->writeValue(par->codec_tag);
+			this->writeValue(par->format);
+			this->writeValue(par->bit_rate);
+			this->writeValue(par->bits_per_coded_sample);
+			this->writeValue(par->bits_per_raw_sample);
+			this->writeValue(par->profile);
+			this->writeValue(par->level);
+			this->writeValue(par->width);
+			this->writeValue(par->height);
+			this->writeValue(par->sample_aspect_ratio.num);
+			this->writeValue(par->sample_aspect_ratio.den);
+			this->writeValue(static_cast<int32_t>(par->field_order));
+			this->writeValue(static_cast<int32_t>(par->color_range));
+			this->writeValue(static_cast<int32_t>(par->color_primaries));
+			this->writeValue(static_cast<int32_t>(par->color_trc));
+			this->writeValue(static_cast<int32_t>(par->color_space));
+			this->writeValue(static_cast<int32_t>(par->chroma_location));
+			this->writeValue(par->channel_layout);
+			this->writeValue(par->channels);
+			this->writeValue(par->sample_rate);
+			this->writeValue(par->block_align);
+			this->writeValue(par->frame_size);
+			this->writeValue(par->initial_padding);
+			this->writeValue(par->trailing_padding);
+			this->writeValue(par->seek_preroll);
+			this->writeValue(static_cast<uint32_t>(par->extradata_size));
+			this->file.write(reinterpret_cast<const char*>(par->extradata), par->extradata_size);
+		}
+		this->file.flush();
+
+		if (!this->file) {
+			LOG(LL_ERR, "Could not write export journal: ", path);
+			POST();
+			return E_FAIL;
+		}
+		LOG(LL_NFO, "Writing export journal to ", path);
+		POST();
+		return S_OK;
+	}
+
+	HRESULT ExportJournal::append(const AVPacket* pPacket) {
+		if (!this->file.is_open()) {
+			return E_FAIL;
+		}
+
+		this->file.write(PACKET_MAGIC, sizeof(PACKET_MAGIC));
+		this->writeValue(static_cast<uint32_t>(pPacket->stream_index));
+		this->writeValue(pPacket->pts);
+		this->writeValue(pPacket->dts);
+		this->writeValue(pPacket->duration);
+		this->writeValue(static_cast<uint32_t>(pPacket->flags));
+		this->writeValue(static_cast<uint32_t>(pPacket->size));
+		this->file.write(reinterpret_cast<const char*>(pPacket->data), pPacket->size);
+
+		// Everything up to the last video keyframe survives the game crashing.
+		bool isVideoKeyFrame = (pPacket->stream_index == this->videoStreamIndex) && (pPacket->flags & AV_PKT_FLAG_KEY);
+		if (isVideoKeyFrame || ((this->videoStreamIndex < 0) && (++this->unflushedPackets >= FLUSH_INTERVAL))) {
+			this->file.flush();
+			this->unflushedPackets = 0;
+		}
+
+		return this->file ? S_OK : E_FAIL;
+	}
+
+	HRESULT ExportJournal::close(bool keep) {
+		PRE();
+		if (!this->file.is_open()) {
+			POST();
+			return S_OK;
+		}
+		this->file.close();
+		if (!keep && !DeleteFileA(this->path.c_str())) {
+			LOG(LL_WRN, "Could not delete export journal: ", this->path);
+		}
+		POST();
+		return S_OK;
+	}
+
+	ExportJournalReader::~ExportJournalReader() {
+		for (auto& par : this->parameters) {
+			avcodec_parameters_free(&par);
+		}
+	}
+
+	bool ExportJournalReader::readString(std::string& value) {
+		uint32_t length;
+		if (!this->readValue(length) || (length > MAX_PACKET_SIZE)) {
+			return false;
+		}
+		value.resize(length);
+		return (length == 0) || !!this->file.read(&value[0], length);
+	}
+
+	HRESULT ExportJournalReader::open(std::string path) {
+		PRE();
+		this->file.open(path, std::ios::binary);
+		if (!this->file) {
+			LOG(LL_ERR, "Could not open export journal: ", path);
+			POST();
+			return E_FAIL;
+		}
+
+		char magic[sizeof(JOURNAL_MAGIC)];
+		uint32_t version;
+		std::string frameRanges;
+		uint32_t streamCount;
+		if (!this->file.read(magic, sizeof(magic)) || memcmp(magic, JOURNAL_MAGIC, sizeof(magic))
+			|| !this->readValue(version) || (version != JOURNAL_VERSION)
+			|| !this->readString(this->formatName) || !this->readString(this->outputPath)
+			|| !this->readValue(this->frameRate.num) || !this->readValue(this->frameRate.den)
+			|| !this->readString(frameRanges) || !this->readValue(streamCount)) {
+			LOG(LL_ERR, "Not an export journal: ", path);
+			POST();
+			return E_FAIL;
+		}
+
+		if (FAILED(this->frameRanges.parse(frameRanges, this->frameRate.num, this->frameRate.den))) {
+			LOG(LL_WRN, "Could not parse the frame ranges of the export; frames are counted from 0.");
+		}
+
+		for (uint32_t i = 0; i < streamCount; i++) {
+			AVRational timeBase;
+			int32_t codecType, codecId, fieldOrder, colorRange, colorPrimaries, colorTrc, colorSpace, chromaLocation;
+			uint32_t extradataSize;
+			AVCodecParameters* par = avcodec_parameters_alloc();
+			RET_IF_NULL(par, "Could not allocate codec parameters", E_FAIL);
+			this->parameters.push_back(par);
+
+			bool isRead = this->readValue(timeBase.num) && this->readValue(timeBase.den)
+				&& this->readValue(codecType) && this->readValue(codecId)
+				&& this->readValue(par->codec_tag) && this->readValue(par->format) && this->readValue(par->bit_rate)
+				&& this->readValue(par->bits_per_coded_sample) && this->readValue(par->bits_per_raw_sample)
+				&& this->readValue(par->profile) && this->readValue(par->level)
+				&& this->readValue(par->width) && this->readValue(par->height)
+				&& this->readValue(par->sample_aspect_ratio.num) && this->readValue(par->sample_aspect_ratio.den)
+				&& this->readValue(fieldOrder) && this->readValue(colorRange) && this->readValue(colorPrimaries)
+				&& this->readValue(colorTrc) && this->readValue(colorSpace) && this->readValue(chromaLocation)
+				&& this->readValue(par->channel_layout) && this->readValue(par->channels) && this->readValue(par->sample_rate)
+				&& this->readValue(par->block_align) && this->readValue(par->frame_size)
+				&& this->readValue(par->initial_padding) && this->readValue(par->trailing_padding) && this->readValue(par->seek_preroll)
+				&& this->readValue(extradataSize) && (extradataSize <= MAX_PACKET_SIZE);
+			if (!isRead) {
+				LOG(LL_ERR, "Export journal ends in its header: ", path);
+				POST();
+				return E_FAIL;
+			}
+
+			par->codec_type = static_cast<AVMediaType>(codecType);
+			par->codec_id = static_cast<AVCodecID>(codecId);
+			par->field_order = static_cast<AVFieldOrder>(fieldOrder);
+			par->color_range = static_cast<AVColorRange>(colorRange);
+			par->color_primaries = static_cast<AVColorPrimaries>(colorPrimaries);
+			par->color_trc = static_cast<AVColorTransferCharacteristic>(colorTrc);
+			par->color_space = static_cast<AVColorSpace>(colorSpace);
+			par->chroma_location = static_cast<AVChromaLocation>(chromaLocation);
+			if (extradataSize > 0) {
+				par->extradata = static_cast<uint8_t*>(av_mallocz(extradataSize + AV_INPUT_BUFFER_PADDING_SIZE));
+				RET_IF_NULL(par->extradata, "Could not allocate extradata", E_FAIL);
+				par->extradata_size = extradataSize;
+				if (!this->file.read(reinterpret_cast<char*>(par->extradata), extradataSize)) {
+					LOG(LL_ERR, "Export journal ends in its header: ", path);
+					POST();
+					return E_FAIL;
+				}
+			}
+			if ((par->codec_type == AVMEDIA_TYPE_VIDEO) && (this->videoStreamIndex < 0)) {
+				this->videoStreamIndex = i;
+			}
+			this->timeBases.push_back(timeBase);
+		}
+
+		this->packetsStart = this->file.tellg();
+		POST();
+		return S_OK;
+	}
+
+	bool ExportJournalReader::readPacket(AVPacket* pPacket) {
+		char magic[sizeof(PACKET_MAGIC)];
+		uint32_t streamIndex, flags, size;
+		int64_t pts, dts, duration;
+		if (!this->file.read(magic, sizeof(magic)) || memcmp(magic, PACKET_MAGIC, sizeof(magic))
+			|| !this->readValue(streamIndex) || !this->readValue(pts) || !this->readValue(dts) || !this->readValue(duration)
+			|| !this->readValue(flags) || !this->readValue(size)
+			|| (streamIndex >= this->parameters.size()) || (size > MAX_PACKET_SIZE)) {
+			return false;
+		}
+
+		if (av_new_packet(pPacket, size) < 0) {
+			return false;
+		}
+		if (!this->file.read(reinterpret_cast<char*>(pPacket->data), size)) {
+			av_packet_unref(pPacket);
+			return false;
+		}
+		pPacket->stream_index = streamIndex;
+		pPacket->pts = pts;
+		pPacket->dts = dts;
+		pPacket->duration = duration;
+		pPacket->flags = flags;
+		return true;
+	}
+
+	HRESULT ExportJournalReader::recover(std::string outputPath, std::string formatName) {
+		PRE();
+		AVFormatContext* fmtContext = NULL;
+		RET_IF_FAILED_AV(avformat_alloc_output_context2(&fmtContext, NULL, formatName.empty() ? this->formatName.c_str() : formatName.c_str(), outputPath.c_str()), "Could not allocate format context", E_FAIL);
+		RET_IF_NULL(fmtContext, "Could not allocate format context", E_FAIL);
+		std::shared_ptr<AVFormatContext> pContext(fmtContext, avformat_free_context);
+
+		for (size_t i = 0; i < this->parameters.size(); i++) {
+			AVStream* stream = avformat_new_stream(fmtContext, NULL);
+			RET_IF_NULL(stream, "Could not create stream", E_FAIL);
+			RET_IF_FAILED_AV(avcodec_parameters_copy(stream->codecpar, this->parameters[i]), "Could not copy codec parameters", E_FAIL);
+			stream->time_base = this->timeBases[i];
+		}
+
+		if (!(fmtContext->oformat->flags & AVFMT_NOFILE)) {
+			RET_IF_FAILED_AV(avio_open(&fmtContext->pb, outputPath.c_str(), AVIO_FLAG_WRITE), "Could not open output file", E_FAIL);
+		}
+		RET_IF_FAILED_AV(avformat_write_header(fmtContext, NULL), "Could not write header", E_FAIL);
+
+		this->file.clear();
+		this->file.seekg(this->packetsStart);
+		this->packetCount = 0;
+		this->videoFrameCount = 0;
+		AVPacket packet;
+		av_init_packet(&packet);
+		while (this->readPacket(&packet)) {
+			AVRational journalTimeBase = this->timeBases[packet.stream_index];
+			if (packet.stream_index == this->videoStreamIndex) {
+				this->videoFrameCount++;
+			}
+			av_packet_rescale_ts(&packet, journalTimeBase, fmtContext->streams[packet.stream_index]->time_base);
+			if (av_interleaved_write_frame(fmtContext, &packet) < 0) {
+				LOG(LL_WRN, "Could not write packet ", this->packetCount, " of the journal.");
+			}
+			av_packet_unref(&packet);
+			this->packetCount++;
+		}
+
+		LOG_IF_FAILED_AV(av_write_trailer(fmtContext), "Could not finalize the output file.");
+		if (!(fmtContext->oformat->flags & AVFMT_NOFILE)) {
+			LOG_IF_FAILED_AV(avio_closep(&fmtContext->pb), "Could not close the output file.");
+		}
+		LOG(LL_NFO, "Recovered ", this->packetCount, " packets (", this->videoFrameCount, " video frames) to ", outputPath);
+		POST();
+		return S_OK;
+	}
+
+	uint64_t ExportJournalReader::getResumeFrame() const {
+		return this->frameRanges.getFrameAt(this->videoFrameCount);
+	}
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <Windows.h>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "frame-ranges.h"
+
+extern "C" {
+#include <libavformat\avformat.h>
+}
+
+namespace Encoder {
+	// Append-only copy of the packets a session sends to the muxer, from which
+	// the export can be muxed again without re-encoding if the game crashes
+	// before the container is finalized. The journal starts with
+	//   "EVEJ" | uint32 version | format name | output file | frame rate | frame ranges | streams
+	// and continues with one record per packet:
+	//   "EVEK" | uint32 stream | int64 pts | int64 dts | int64 duration | uint32 flags | uint32 size | data
+	// Strings are stored as uint32 length | characters. A record that was cut
+	// short by a crash ends the journal.
+	class ExportJournal {
+	public:
+		~ExportJournal();
+
+		// Opens the journal once the muxer has written its header and fixed the stream time bases.
+		HRESULT open(std::string path, AVFormatContext* fmtContext, AVRational frameRate, std::string frameRanges);
+		HRESULT append(const AVPacket* pPacket);
+		// Closes the journal and deletes it unless it should be kept.
+		HRESULT close(bool keep);
+
+	private:
+		template<typename T>
+		void writeValue(T value) {
+			this->file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+		}
+		void writeString(const std::string& value);
+
+		std::string path;
+		std::ofstream file;
+		int videoStreamIndex = -1;
+		uint32_t unflushedPackets = 0;
+	};
+
+	class ExportJournalReader {
+	public:
+		~ExportJournalReader();
+
+		HRESULT open(std::string path);
+
+		// Muxes every packet in the journal into a new file. The format of the
+		// original export is used unless another one is given.
+		HRESULT recover(std::string outputPath, std::string formatName = "");
+
+		const std::string& getOutputPath() const { return this->outputPath; }
+		uint64_t getPacketCount() const { return this->packetCount; }
+		// Number of video frames that were recovered, and the first frame of the project that was not.
+		uint64_t getVideoFrameCount() const { return this->videoFrameCount; }
+		uint64_t getResumeFrame() const;
+
+	private:
+		template<typename T>
+		bool readValue(T& value) {
+			return !!this->file.read(reinterpret_cast<char*>(&value), sizeof(T));
+		}
+		bool readString(std::string& value);
+		bool readPacket(AVPacket* pPacket);
+
+		std::ifstream file;
+		std::string formatName;
+		std::string outputPath;
+		AVRational frameRate = { 0, 1 };
+		FrameRanges frameRanges;
+		std::vector<AVCodecParameters*> parameters;
+		std::vector<AVRational> timeBases;
+		int videoStreamIndex = -1;
+		std::streampos packetsStart;
+		uint64_t packetCount = 0;
+		uint64_t videoFrameCount = 0;
+	};
+}
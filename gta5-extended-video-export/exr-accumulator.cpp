@@ -0,0 +1,100 @@
+#include "exr-accumulator.h"
+#include "logger.h"
+#include "task-scheduler.h"
+#include <algorithm>
+#include <emmintrin.h>
+
+namespace Encoder {
+
+	namespace {
+		// Minimum number of floats per accumulation task.
+		const size_t ACCUMULATE_GRAIN = 64 * 1024;
+		const size_t CHANNELS = 4;
+
+		// Widens half floats held in the low 16 bits of each lane. The exponent is
+		// rebased by multiplying with 2^112, which also normalizes denormals;
+		// infinities and NaNs get the full float exponent afterwards.
+		__m128 convertHalves(__m128i halves) {
+			const __m128 rebase = _mm_castsi128_ps(_mm_set1_epi32(0x77800000));
+			const __m128 infinity = _mm_castsi128_ps(_mm_set1_epi32(0x47800000));
+			const __m128 exponent = _mm_castsi128_ps(_mm_set1_epi32(0x7F800000));
+			__m128i sign = _mm_slli_epi32(_mm_and_si128(halves, _mm_set1_epi32(0x8000)), 16);
+			__m128i magnitude = _mm_slli_epi32(_mm_and_si128(halves, _mm_set1_epi32(0x7FFF)), 13);
+			__m128 value = _mm_mul_ps(_mm_castsi128_ps(magnitude), rebase);
+			value = _mm_or_ps(value, _mm_and_ps(_mm_cmpge_ps(value, infinity), exponent));
+			return _mm_or_ps(value, _mm_castsi128_ps(sign));
+		}
+
+		void accumulateHalves(const uint16_t* pSource, float* pSum, size_t begin, size_t end) {
+			const __m128i zero = _mm_setzero_si128();
+			size_t i = begin;
+			for (; i + 8 <= end; i += 8) {
+				__m128i halves = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pSource + i));
+				_mm_storeu_ps(pSum + i, _mm_add_ps(_mm_loadu_ps(pSum + i), convertHalves(_mm_unpacklo_epi16(halves, zero))));
+				_mm_storeu_ps(pSum + i + 4, _mm_add_ps(_mm_loadu_ps(pSum + i + 4), convertHalves(_mm_unpackhi_epi16(halves, zero))));
+			}
+			for (; i < end; i++) {
+				pSum[i] += _mm_cvtss_f32(convertHalves(_mm_cvtsi32_si128(pSource[i])));
+			}
+		}
+	}
+
+	EXRAccumulator::EXRAccumulator(uint32_t width, uint32_t height) :
+		width(width),
+		height(height),
+		length(static_cast<size_t>(width) * height * CHANNELS),
+		pSum(std::make_shared<std::vector<float>>(static_cast<size_t>(width) * height * CHANNELS))
+	{
+	}
+
+	HRESULT EXRAccumulator::parseShutter(std::string definition, EXRShutter& shutter) {
+		definition.erase(std::remove_if(definition.begin(), definition.end(), ::isspace), definition.end());
+		std::transform(definition.begin(), definition.end(), definition.begin(), ::tolower);
+		if (definition == "sub_frames") {
+			shutter = EXR_SHUTTER_SUB_FRAMES;
+			return S_OK;
+		}
+		if (definition == "frame") {
+			shutter = EXR_SHUTTER_FRAME;
+			return S_OK;
+		}
+		if (definition.empty() || (definition == "blur")) {
+			shutter = EXR_SHUTTER_BLUR;
+			return S_OK;
+		}
+		LOG(LL_ERR, "Invalid OpenEXR shutter: ", definition);
+		return E_FAIL;
+	}
+
+	void EXRAccumulator::add(const void* pHalfRGBA, size_t rowPitch) {
+		const uint8_t* pSource = static_cast<const uint8_t*>(pHalfRGBA);
+		float* pSum = this->pSum->data();
+		size_t rowLength = this->width * CHANNELS;
+		TaskScheduler::instance().parallelFor(0, this->height, (std::max)(ACCUMULATE_GRAIN / rowLength, size_t(1)), [=](size_t begin, size_t end) {
+			for (size_t y = begin; y < end; y++) {
+				accumulateHalves(reinterpret_cast<const uint16_t*>(pSource + y * rowPitch), pSum + y * rowLength, 0, rowLength);
+			}
+		});
+		this->count++;
+	}
+
+	std::shared_ptr<std::vector<float>> EXRAccumulator::take() {
+		std::shared_ptr<std::vector<float>> pResult = this->pSum;
+		if (this->count > 1) {
+			float* pData = pResult->data();
+			__m128 scale = _mm_set1_ps(1.0f / this->count);
+			TaskScheduler::instance().parallelFor(0, this->length, ACCUMULATE_GRAIN, [=](size_t begin, size_t end) {
+				size_t i = begin;
+				for (; i + 4 <= end; i += 4) {
+					_mm_storeu_ps(pData + i, _mm_mul_ps(_mm_loadu_ps(pData + i), scale));
+				}
+				for (; i < end; i++) {
+					pData[i] *= _mm_cvtss_f32(scale);
+				}
+			});
+		}
+		this->pSum = std::make_shared<std::vector<float>>(this->length);
+		this->count = 0;
+		return pResult;
+	}
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <Windows.h>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace Encoder {
+	enum EXRShutter {
+		// Every captured sub-frame as its own image.
+		EXR_SHUTTER_SUB_FRAMES,
+		// The last sub-frame of each output frame, as the video sees it with a closed shutter.
+		EXR_SHUTTER_FRAME,
+		// The sub-frames inside the shutter averaged into one image per output frame.
+		EXR_SHUTTER_BLUR
+	};
+
+	// Averages RGBA half float images in a float accumulator, so that motion
+	// blurred OpenEXR images and HDR video keep the full range of the HDR buffer.
+	class EXRAccumulator {
+	public:
+		EXRAccumulator(uint32_t width, uint32_t height);
+
+		static HRESULT parseShutter(std::string definition, EXRShutter& shutter);
+
+		// Adds an image of RGBA half floats with rows rowPitch bytes apart.
+		void add(const void* pHalfRGBA, size_t rowPitch);
+		// Returns the average of the images added since the last call as RGBA floats.
+		std::shared_ptr<std::vector<float>> take();
+
+	private:
+		uint32_t width;
+		uint32_t height;
+		size_t length;
+		uint32_t count = 0;
+		std::shared_ptr<std::vector<float>> pSum;
+	};
+}
@@ -0,0 +1,98 @@
+#include "exr-channels.h"
+#include "logger.h"
+#include <algorithm>
+#include <sstream>
+
+namespace Encoder {
+
+	namespace {
+		bool parseType(const std::string& name, Imf::PixelType& type) {
+			if (name == "half") {
+				type = Imf::HALF;
+			} else if (name == "float") {
+				type = Imf::FLOAT;
+			} else if (name == "uint") {
+				type = Imf::UINT;
+			} else {
+				return false;
+			}
+			return true;
+		}
+
+		const char* typeToString(Imf::PixelType type) {
+			switch (type) {
+			case Imf::HALF:
+				return "half";
+			case Imf::FLOAT:
+				return "float";
+			default:
+				return "uint";
+			}
+		}
+	}
+
+	HRESULT EXRChannels::parse(std::string definition) {
+		definition.erase(std::remove_if(definition.begin(), definition.end(), ::isspace), definition.end());
+		std::transform(definition.begin(), definition.end(), definition.begin(), ::tolower);
+		*this = EXRChannels();
+		if (definition.empty()) {
+			return S_OK;
+		}
+
+		this->rgb = false;
+		this->sss = false;
+		this->depth = false;
+		this->objectID = false;
+		std::stringstream stream(definition);
+		std::string entry;
+		while (std::getline(stream, entry, ',')) {
+			if (entry.empty()) {
+				continue;
+			}
+			size_t colon = entry.find(':');
+			std::string name = entry.substr(0, colon);
+			std::string precision = colon == std::string::npos ? "" : entry.substr(colon + 1);
+			Imf::PixelType type = Imf::NUM_PIXELTYPES;
+			if (!precision.empty() && !parseType(precision, type)) {
+				LOG(LL_ERR, "Invalid OpenEXR channel precision: ", entry);
+				return E_FAIL;
+			}
+
+			if ((name == "rgb") && precision.empty()) {
+				this->rgb = true;
+			} else if ((name == "sss") && precision.empty()) {
+				this->sss = true;
+			} else if ((name == "depth") && (type != Imf::UINT)) {
+				this->depth = true;
+				this->depthType = precision.empty() ? Imf::FLOAT : type;
+			} else if ((name == "object_id") && (type != Imf::FLOAT)) {
+				this->objectID = true;
+				this->objectIDType = precision.empty() ? Imf::UINT : type;
+			} else {
+				LOG(LL_ERR, "Invalid OpenEXR channel: ", entry);
+				return E_FAIL;
+			}
+		}
+		if (this->isEmpty()) {
+			LOG(LL_ERR, "No OpenEXR channels selected: ", definition);
+			return E_FAIL;
+		}
+		return S_OK;
+	}
+
+	bool EXRChannels::hasColor() const {
+		return this->rgb || this->sss;
+	}
+
+	bool EXRChannels::isEmpty() const {
+		return !this->hasColor() && !this->depth && !this->objectID;
+	}
+
+	void EXRChannels::log() const {
+		LOG(LL_NFO, "OpenEXR channels:",
+			this->rgb ? " RGB (half)" : "",
+			this->sss ? " SSS (half)" : "",
+			this->depth ? std::string(" depth.Z (") + typeToString(this->depthType) + ")" : "",
+			this->objectID ? std::string(" objectID (") + typeToString(this->objectIDType) + ")" : "");
+	}
+}
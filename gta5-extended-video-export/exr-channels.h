@@ -0,0 +1,28 @@
+#pragma once
+
+#include <Windows.h>
+#include <string>
+#include <ImfPixelType.h>
+
+namespace Encoder {
+	// The channels written to OpenEXR images and the precision they are stored in.
+	// Buffers behind disabled channels are not read back from the GPU.
+	struct EXRChannels {
+		bool rgb = true;
+		bool sss = true;
+		bool depth = true;
+		Imf::PixelType depthType = Imf::FLOAT;
+		bool objectID = true;
+		Imf::PixelType objectIDType = Imf::UINT;
+
+		// Channels are separated by commas: "rgb", "sss", "depth[:half|float]" and
+		// "object_id[:half|uint]". An empty definition selects every channel.
+		HRESULT parse(std::string definition);
+
+		// RGB and SSS both come from the HDR colour buffer.
+		bool hasColor() const;
+		bool isEmpty() const;
+
+		void log() const;
+	};
+}
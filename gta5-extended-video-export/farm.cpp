@@ -0,0 +1,692 @@
+// Winsock 2 has to be included before Windows.h pulls in the old Winsock header.
+#include <WinSock2.h>
+#include <WS2tcpip.h>
+#include "farm.h"
+#include "encoder.h"
+#include "logger.h"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <thread>
+
+extern "C" {
+#include <libavutil\imgutils.h>
+#include <libavutil\pixdesc.h>
+}
+
+#pragma comment(lib, "Ws2_32.lib")
+
+namespace Encoder {
+
+	namespace {
+		const char FARM_MAGIC[4] = { 'E', 'V', 'E', 'F' };
+		const uint32_t FARM_VERSION = 2;
+		const uint32_t FARM_STATUS_OK = 0;
+		const uint32_t FARM_STATUS_FAILED = 1;
+		const uint32_t MAX_STRING_LENGTH = 64 * 1024;
+		const uint32_t MAX_CHUNK_ATTEMPTS = 3;
+		const size_t TRANSFER_BUFFER_SIZE = 1024 * 1024;
+		// Chunks are kept in NUT, which stores decoding timestamps as they are.
+		const char* CHUNK_FORMAT = "nut";
+
+		class WinsockScope {
+		public:
+			WinsockScope() {
+				WSADATA data;
+				this->isStarted = WSAStartup(MAKEWORD(2, 2), &data) == 0;
+			}
+
+			~WinsockScope() {
+				if (this->isStarted) {
+					WSACleanup();
+				}
+			}
+
+			bool isStarted;
+		};
+
+		class Connection {
+		public:
+			explicit Connection(SOCKET socket) :
+				socket(socket)
+			{ }
+
+			~Connection() {
+				if (this->socket != INVALID_SOCKET) {
+					closesocket(this->socket);
+				}
+			}
+
+			bool isOpen() const { return this->socket != INVALID_SOCKET; }
+			SOCKET get() const { return this->socket; }
+
+			bool send(const void* pData, size_t size) {
+				const char* pBytes = static_cast<const char*>(pData);
+				while (size > 0) {
+					int sent = ::send(this->socket, pBytes, static_cast<int>((std::min)(size, TRANSFER_BUFFER_SIZE)), 0);
+					if (sent <= 0) {
+						return false;
+					}
+					pBytes += sent;
+					size -= sent;
+				}
+				return true;
+			}
+
+			bool receive(void* pData, size_t size) {
+				char* pBytes = static_cast<char*>(pData);
+				while (size > 0) {
+					int received = ::recv(this->socket, pBytes, static_cast<int>((std::min)(size, TRANSFER_BUFFER_SIZE)), 0);
+					if (received <= 0) {
+						return false;
+					}
+					pBytes += received;
+					size -= received;
+				}
+				return true;
+			}
+
+			template<typename T>
+			bool sendValue(T value) {
+				return this->send(&value, sizeof(T));
+			}
+
+			template<typename T>
+			bool receiveValue(T& value) {
+				return this->receive(&value, sizeof(T));
+			}
+
+			bool sendString(const std::string& value) {
+				return this->sendValue(static_cast<uint32_t>(value.size())) && this->send(value.data(), value.size());
+			}
+
+			bool receiveString(std::string& value) {
+				uint32_t length;
+				if (!this->receiveValue(length) || (length > MAX_STRING_LENGTH)) {
+					return false;
+				}
+				value.resize(length);
+				return (length == 0) || this->receive(&value[0], length);
+			}
+
+			bool sendHeader() {
+				return this->send(FARM_MAGIC, sizeof(FARM_MAGIC)) && this->sendValue(FARM_VERSION);
+			}
+
+			bool receiveHeader() {
+				char magic[sizeof(FARM_MAGIC)];
+				uint32_t version;
+				return this->receive(magic, sizeof(magic)) && (memcmp(magic, FARM_MAGIC, sizeof(magic)) == 0)
+					&& this->receiveValue(version) && (version == FARM_VERSION);
+			}
+
+			bool sendFile(const std::string& path, uint64_t size) {
+				std::ifstream file(path, std::ios::binary);
+				std::vector<char> buffer(TRANSFER_BUFFER_SIZE);
+				while (size > 0) {
+					size_t length = static_cast<size_t>((std::min)(size, static_cast<uint64_t>(buffer.size())));
+					if (!file.read(buffer.data(), length) || !this->send(buffer.data(), length)) {
+						return false;
+					}
+					size -= length;
+				}
+				return true;
+			}
+
+			bool receiveFile(const std::string& path, uint64_t size) {
+				std::ofstream file(path, std::ios::binary | std::ios::trunc);
+				std::vector<char> buffer(TRANSFER_BUFFER_SIZE);
+				while (size > 0) {
+					size_t length = static_cast<size_t>((std::min)(size, static_cast<uint64_t>(buffer.size())));
+					if (!this->receive(buffer.data(), length) || !file.write(buffer.data(), length)) {
+						return false;
+					}
+					size -= length;
+				}
+				return !!file.flush();
+			}
+
+		private:
+			SOCKET socket;
+		};
+
+		SOCKET connectTo(const std::string& worker) {
+			size_t separator = worker.find_last_of(':');
+			std::string host = worker.substr(0, separator);
+			std::string port = separator == std::string::npos ? std::to_string(FARM_DEFAULT_PORT) : worker.substr(separator + 1);
+
+			addrinfo hints = {};
+			hints.ai_family = AF_UNSPEC;
+			hints.ai_socktype = SOCK_STREAM;
+			hints.ai_protocol = IPPROTO_TCP;
+			addrinfo* addresses = NULL;
+			if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses) != 0) {
+				LOG(LL_WRN, "Could not resolve worker: ", worker);
+				return INVALID_SOCKET;
+			}
+
+			SOCKET result = INVALID_SOCKET;
+			for (addrinfo* address = addresses; address && (result == INVALID_SOCKET); address = address->ai_next) {
+				result = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+				if ((result != INVALID_SOCKET) && (connect(result, address->ai_addr, static_cast<int>(address->ai_addrlen)) != 0)) {
+					closesocket(result);
+					result = INVALID_SOCKET;
+				}
+			}
+			freeaddrinfo(addresses);
+			return result;
+		}
+
+		uint64_t getFileSize(const std::string& path) {
+			std::ifstream file(path, std::ios::binary | std::ios::ate);
+			return file ? static_cast<uint64_t>(file.tellg()) : 0;
+		}
+
+		std::string describeChunk(const FarmChunk& chunk) {
+			if (chunk.frameCount == (std::numeric_limits<uint64_t>::max)()) {
+				return std::to_string(chunk.firstFrame) + "-";
+			}
+			return std::to_string(chunk.firstFrame) + "-" + std::to_string(chunk.firstFrame + chunk.frameCount - 1);
+		}
+
+		// Takes the same time for every token of the same length, so the token cannot be guessed byte by byte.
+		bool isSameToken(const std::string& a, const std::string& b) {
+			if (a.size() != b.size()) {
+				return false;
+			}
+			uint8_t difference = 0;
+			for (size_t i = 0; i < a.size(); i++) {
+				difference |= static_cast<uint8_t>(a[i] ^ b[i]);
+			}
+			return difference == 0;
+		}
+
+		std::string getFullPath(const std::string& path) {
+			char fullPath[MAX_PATH];
+			DWORD length = GetFullPathNameA(path.c_str(), MAX_PATH, fullPath, NULL);
+			return (length > 0) && (length < MAX_PATH) ? std::string(fullPath, length) : "";
+		}
+
+		// Resolves the source of a job to a file inside the folder (a full path ending in a separator).
+		// URLs and paths that lead out of the folder are refused.
+		bool resolveSource(const std::string& folder, const std::string& source, std::string& fullPath) {
+			if ((source.find("://") != std::string::npos) || (source.compare(0, 5, "file:") == 0)) {
+				return false;
+			}
+			fullPath = getFullPath(source);
+			if ((fullPath.size() <= folder.size()) || (_strnicmp(fullPath.c_str(), folder.c_str(), folder.size()) != 0)) {
+				return false;
+			}
+			DWORD attributes = GetFileAttributesA(fullPath.c_str());
+			return (attributes != INVALID_FILE_ATTRIBUTES) && !(attributes & FILE_ATTRIBUTE_DIRECTORY);
+		}
+
+		void handleJob(Connection& connection, const std::string& token, const std::string& sourceFolder, const std::string& chunkPath) {
+			std::string jobToken;
+			std::string source;
+			FarmChunk chunk;
+			FarmSettings settings;
+			if (!connection.receiveHeader() || !connection.receiveString(jobToken) || !connection.receiveString(source)
+				|| !connection.receiveValue(chunk.firstFrame) || !connection.receiveValue(chunk.frameCount)
+				|| !connection.receiveString(settings.vcodec) || !connection.receiveString(settings.voptions)
+				|| !connection.receiveString(settings.outputPixelFormat)) {
+				LOG(LL_WRN, "Received an invalid farm job.");
+				return;
+			}
+
+			std::string fullPath;
+			if (!isSameToken(jobToken, token) || !resolveSource(sourceFolder, source, fullPath)) {
+				LOG(LL_WRN, "Refused a farm job for ", source, (isSameToken(jobToken, token) ? ": not a file in the source folder" : ": wrong token"));
+				bool isSent = connection.sendHeader()
+					&& connection.sendValue(FARM_STATUS_FAILED)
+					&& connection.sendString("The worker refused the job, see the worker log.")
+					&& connection.sendValue(static_cast<uint64_t>(0));
+				if (!isSent) {
+					LOG(LL_WRN, "Could not answer the refused job.");
+				}
+				return;
+			}
+
+			std::cout << "Encoding frames " << describeChunk(chunk) << " of " << fullPath << std::endl;
+			// The file protocol keeps FFmpeg from reading anything but the file.
+			HRESULT result = FarmWorker::encodeChunk("file:" + fullPath, chunk, settings, chunkPath);
+			uint64_t size = SUCCEEDED(result) ? getFileSize(chunkPath) : 0;
+			bool isSent = connection.sendHeader()
+				&& connection.sendValue(SUCCEEDED(result) ? FARM_STATUS_OK : FARM_STATUS_FAILED)
+				&& connection.sendString(SUCCEEDED(result) ? "" : "Could not encode the chunk, see the worker log.")
+				&& connection.sendValue(size)
+				&& connection.sendFile(chunkPath, size);
+			if (!isSent) {
+				LOG(LL_WRN, "Could not send frames ", describeChunk(chunk), " back to the coordinator.");
+			}
+			DeleteFileA(chunkPath.c_str());
+		}
+
+		// Returns E_FAIL if the worker could not encode the chunk and E_ABORT if it could not be reached.
+		HRESULT requestChunk(const std::string& worker, const std::string& token, const std::string& source, const FarmChunk& chunk, const FarmSettings& settings, const std::string& path) {
+			Connection connection(connectTo(worker));
+			if (!connection.isOpen()) {
+				LOG(LL_WRN, "Could not connect to worker ", worker);
+				return E_ABORT;
+			}
+
+			bool isSent = connection.sendHeader() && connection.sendString(token) && connection.sendString(source)
+				&& connection.sendValue(chunk.firstFrame) && connection.sendValue(chunk.frameCount)
+				&& connection.sendString(settings.vcodec) && connection.sendString(settings.voptions)
+				&& connection.sendString(settings.outputPixelFormat);
+			uint32_t status;
+			std::string message;
+			uint64_t size;
+			if (!isSent || !connection.receiveHeader() || !connection.receiveValue(status)
+				|| !connection.receiveString(message) || !connection.receiveValue(size)) {
+				LOG(LL_WRN, "Lost the connection to worker ", worker);
+				return E_ABORT;
+			}
+			if (status != FARM_STATUS_OK) {
+				LOG(LL_WRN, "Worker ", worker, " failed to encode frames ", describeChunk(chunk), ": ", message);
+				return E_FAIL;
+			}
+			if (!connection.receiveFile(path, size)) {
+				LOG(LL_WRN, "Could not receive frames ", describeChunk(chunk), " from worker ", worker);
+				return E_ABORT;
+			}
+			return S_OK;
+		}
+
+		void closeInput(AVFormatContext* fmtContext) {
+			avformat_close_input(&fmtContext);
+		}
+	}
+
+	FarmWorker::FarmWorker(std::string token, std::string sourceFolder) :
+		token(token),
+		sourceFolder(sourceFolder)
+	{
+	}
+
+	HRESULT FarmWorker::serve(std::string address, uint16_t port) {
+		PRE();
+		if (this->token.empty()) {
+			LOG(LL_ERR, "The farm worker needs a token in ", FARM_TOKEN_VARIABLE, ".");
+			POST();
+			return E_FAIL;
+		}
+		std::string folder = getFullPath(this->sourceFolder);
+		DWORD attributes = folder.empty() ? INVALID_FILE_ATTRIBUTES : GetFileAttributesA(folder.c_str());
+		if ((attributes == INVALID_FILE_ATTRIBUTES) || !(attributes & FILE_ATTRIBUTE_DIRECTORY)) {
+			LOG(LL_ERR, "The farm worker's source folder does not exist: ", this->sourceFolder);
+			POST();
+			return E_FAIL;
+		}
+		if ((folder.back() != '\\') && (folder.back() != '/')) {
+			folder += '\\';
+		}
+
+		WinsockScope winsock;
+		if (!winsock.isStarted) {
+			LOG(LL_ERR, "Could not initialize Winsock.");
+			POST();
+			return E_FAIL;
+		}
+
+		Connection listener(socket(AF_INET, SOCK_STREAM, IPPROTO_TCP));
+		if (!listener.isOpen()) {
+			LOG(LL_ERR, "Could not create the listening socket.");
+			POST();
+			return E_FAIL;
+		}
+
+		sockaddr_in socketAddress = {};
+		socketAddress.sin_family = AF_INET;
+		socketAddress.sin_port = htons(port);
+		if (inet_pton(AF_INET, address.c_str(), &socketAddress.sin_addr) != 1) {
+			LOG(LL_ERR, "Invalid address to listen on: ", address);
+			POST();
+			return E_FAIL;
+		}
+		if (socketAddress.sin_addr.s_addr != htonl(INADDR_LOOPBACK)) {
+			LOG(LL_WRN, "Farm worker is reachable from other machines on ", address, "; jobs are only accepted with the token.");
+		}
+		if ((bind(listener.get(), reinterpret_cast<sockaddr*>(&socketAddress), sizeof(socketAddress)) != 0) || (listen(listener.get(), SOMAXCONN) != 0)) {
+			LOG(LL_ERR, "Could not listen on port ", port, " ### error code: ", WSAGetLastError());
+			POST();
+			return E_FAIL;
+		}
+
+		char tempPath[MAX_PATH];
+		DWORD tempPathLength = GetTempPathA(MAX_PATH, tempPath);
+		std::string chunkPath = std::string(tempPath, tempPathLength) + "eve-farm-" + std::to_string(GetCurrentProcessId()) + "." + CHUNK_FORMAT;
+
+		LOG(LL_NFO, "Farm worker listening on ", address, ":", port, " for sources in ", folder);
+		std::cout << "Listening on " << address << ":" << port << std::endl;
+		while (true) {
+			Connection connection(accept(listener.get(), NULL, NULL));
+			if (!connection.isOpen()) {
+				LOG(LL_WRN, "Could not accept a connection ### error code: ", WSAGetLastError());
+				continue;
+			}
+			handleJob(connection, this->token, folder, chunkPath);
+		}
+	}
+
+	HRESULT FarmWorker::encodeChunk(const std::string& source, const FarmChunk& chunk, const FarmSettings& settings, const std::string& outputPath) {
+		PRE();
+		AVFormatContext* fmtContext = NULL;
+		RET_IF_FAILED_AV(avformat_open_input(&fmtContext, source.c_str(), NULL, NULL), "Could not open source: " + source, E_FAIL);
+		std::shared_ptr<AVFormatContext> pInput(fmtContext, closeInput);
+		RET_IF_FAILED_AV(avformat_find_stream_info(fmtContext, NULL), "Could not read stream information", E_FAIL);
+
+		AVCodec* decoder = NULL;
+		int streamIndex = av_find_best_stream(fmtContext, AVMEDIA_TYPE_VIDEO, -1, -1, &decoder, 0);
+		RET_IF_FAILED_AV(streamIndex, "Could not find a video stream in " + source, E_FAIL);
+		AVStream* stream = fmtContext->streams[streamIndex];
+
+		std::shared_ptr<AVCodecContext> pDecoder(avcodec_alloc_context3(decoder), [](AVCodecContext* p) { avcodec_free_context(&p); });
+		RET_IF_NULL(pDecoder.get(), "Could not allocate decoder context", E_FAIL);
+		RET_IF_FAILED_AV(avcodec_parameters_to_context(pDecoder.get(), stream->codecpar), "Could not copy codec parameters", E_FAIL);
+		RET_IF_FAILED_AV(avcodec_open2(pDecoder.get(), decoder, NULL), "Could not open decoder", E_FAIL);
+
+		AVRational frameRate = av_guess_frame_rate(fmtContext, stream, NULL);
+		const char* pixelFormat = av_get_pix_fmt_name(pDecoder->pix_fmt);
+		if ((frameRate.num <= 0) || !pixelFormat) {
+			LOG(LL_ERR, "Could not determine the frame rate and pixel format of ", source);
+			POST();
+			return E_FAIL;
+		}
+		AVRational frameTimeBase = av_inv_q(frameRate);
+		int64_t startTime = stream->start_time == AV_NOPTS_VALUE ? 0 : stream->start_time;
+		if (chunk.firstFrame > 0) {
+			LOG_IF_FAILED_AV(av_seek_frame(fmtContext, streamIndex, startTime + av_rescale_q(chunk.firstFrame, frameTimeBase, stream->time_base), AVSEEK_FLAG_BACKWARD), "Could not seek, decoding from the start.");
+		}
+
+		std::shared_ptr<AVFrame> pFrame(av_frame_alloc(), [](AVFrame* p) { av_frame_free(&p); });
+		RET_IF_NULL(pFrame.get(), "Could not allocate video frame", E_FAIL);
+		std::vector<uint8_t> buffer(av_image_get_buffer_size(pDecoder->pix_fmt, pDecoder->width, pDecoder->height, 1));
+		uint64_t encodedFrames = 0;
+
+		try {
+			// The chunk goes through a headless session, exactly like the frames of a game export.
+			std::shared_ptr<Session> session(new Session());
+			// Nothing calls pace() here, so frames have to wait for room in the pipeline.
+			session->pacingBudget = 0;
+			REQUIRE(session->createContext(CHUNK_FORMAT, outputPath, "", "", pDecoder->width, pDecoder->height, pixelFormat,
+				frameRate.num, frameRate.den, 0, 0.0f, settings.outputPixelFormat, settings.vcodec, settings.voptions,
+				0, 0, 0, "", 0, "", "", ""), "Failed to create the chunk session.");
+
+			AVPacket packet;
+			av_init_packet(&packet);
+			packet.data = NULL;
+			packet.size = 0;
+			bool isEndOfFile = false;
+			while (encodedFrames < chunk.frameCount) {
+				int result = avcodec_receive_frame(pDecoder.get(), pFrame.get());
+				if ((result == AVERROR(EAGAIN)) && !isEndOfFile) {
+					if (av_read_frame(fmtContext, &packet) < 0) {
+						isEndOfFile = true;
+						LOG_IF_FAILED_AV(avcodec_send_packet(pDecoder.get(), NULL), "Could not drain the decoder.");
+					} else {
+						if (packet.stream_index == streamIndex) {
+							LOG_IF_FAILED_AV(avcodec_send_packet(pDecoder.get(), &packet), "Could not decode packet.");
+						}
+						av_packet_unref(&packet);
+					}
+					continue;
+				}
+				if (result < 0) {
+					break;
+				}
+
+				int64_t timestamp = av_frame_get_best_effort_timestamp(pFrame.get());
+				int64_t index = timestamp == AV_NOPTS_VALUE ? static_cast<int64_t>(chunk.firstFrame + encodedFrames) : av_rescale_q(timestamp - startTime, stream->time_base, frameTimeBase);
+				if (index >= static_cast<int64_t>(chunk.firstFrame)) {
+					RET_IF_FAILED_AV(av_image_copy_to_buffer(buffer.data(), static_cast<int>(buffer.size()), pFrame->data, pFrame->linesize,
+						pDecoder->pix_fmt, pDecoder->width, pDecoder->height, 1), "Could not copy decoded frame", E_FAIL);
+					REQUIRE(session->enqueueVideoFrame(buffer.data(), static_cast<int>(buffer.size())), "Failed to encode frame.");
+					encodedFrames++;
+				}
+				av_frame_unref(pFrame.get());
+			}
+
+			LOG_CALL(LL_DBG, session->finishAudio());
+			LOG_CALL(LL_DBG, session->finishVideo());
+			LOG_CALL(LL_DBG, session->endSession());
+		} catch (std::exception& ex) {
+			LOG(LL_ERR, ex.what());
+			POST();
+			return E_FAIL;
+		}
+
+		if ((encodedFrames < chunk.frameCount) && (chunk.frameCount != (std::numeric_limits<uint64_t>::max)())) {
+			LOG(LL_WRN, "Source ended after ", encodedFrames, " frames of chunk ", describeChunk(chunk));
+		}
+		LOG(LL_NFO, "Encoded ", encodedFrames, " frames starting at frame ", chunk.firstFrame, " to ", outputPath);
+		POST();
+		return encodedFrames > 0 ? S_OK : E_FAIL;
+	}
+
+	FarmCoordinator::FarmCoordinator(std::vector<std::string> workers, uint64_t chunkFrames, std::string token) :
+		workers(workers),
+		chunkFrames((std::max)(chunkFrames, static_cast<uint64_t>(1))),
+		token(token)
+	{
+	}
+
+	HRESULT FarmCoordinator::encode(std::string source, std::string output, const FarmSettings& settings) {
+		PRE();
+		this->source = source;
+		this->settings = settings;
+
+		AVFormatContext* fmtContext = NULL;
+		RET_IF_FAILED_AV(avformat_open_input(&fmtContext, source.c_str(), NULL, NULL), "Could not open source: " + source, E_FAIL);
+		std::shared_ptr<AVFormatContext> pInput(fmtContext, closeInput);
+		RET_IF_FAILED_AV(avformat_find_stream_info(fmtContext, NULL), "Could not read stream information", E_FAIL);
+		int streamIndex = av_find_best_stream(fmtContext, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+		RET_IF_FAILED_AV(streamIndex, "Could not find a video stream in " + source, E_FAIL);
+		AVStream* stream = fmtContext->streams[streamIndex];
+		this->frameRate = av_guess_frame_rate(fmtContext, stream, NULL);
+		if (this->frameRate.num <= 0) {
+			LOG(LL_ERR, "Could not determine the frame rate of ", source);
+			POST();
+			return E_FAIL;
+		}
+
+		uint64_t frameCount = stream->nb_frames;
+		if ((frameCount == 0) && (stream->duration != AV_NOPTS_VALUE)) {
+			frameCount = av_rescale_q(stream->duration, stream->time_base, av_inv_q(this->frameRate));
+		} else if ((frameCount == 0) && (fmtContext->duration != AV_NOPTS_VALUE)) {
+			frameCount = av_rescale_q(fmtContext->duration, av_make_q(1, AV_TIME_BASE), av_inv_q(this->frameRate));
+		}
+		pInput.reset();
+
+		this->chunks.clear();
+		this->pendingChunks.clear();
+		this->runningChunks = 0;
+		for (uint64_t first = 0; (first < frameCount) || this->chunks.empty(); first += this->chunkFrames) {
+			ChunkState state;
+			state.chunk.firstFrame = first;
+			state.chunk.frameCount = this->chunkFrames;
+			state.path = output + ".chunk" + std::to_string(this->chunks.size()) + "." + CHUNK_FORMAT;
+			this->pendingChunks.push_back(this->chunks.size());
+			this->chunks.push_back(state);
+		}
+		// The frame count in the header may be an estimate, so the last chunk runs until the source ends.
+		this->chunks.back().chunk.frameCount = (std::numeric_limits<uint64_t>::max)();
+		LOG(LL_NFO, "Splitting ", frameCount, " frames of ", source, " into ", this->chunks.size(), " chunks for ", this->workers.size(), " workers");
+		std::cout << "Encoding " << this->chunks.size() << " chunks on " << this->workers.size() << " workers" << std::endl;
+
+		{
+			WinsockScope winsock;
+			if (!winsock.isStarted) {
+				LOG(LL_ERR, "Could not initialize Winsock.");
+				POST();
+				return E_FAIL;
+			}
+			std::vector<std::thread> threads;
+			for (auto& worker : this->workers) {
+				threads.push_back(std::thread(&FarmCoordinator::dispatchThread, this, worker));
+			}
+			for (auto& thread : threads) {
+				thread.join();
+			}
+		}
+
+		HRESULT result = S_OK;
+		for (auto& state : this->chunks) {
+			if (!state.isDone) {
+				LOG(LL_ERR, "Frames ", describeChunk(state.chunk), " could not be encoded by any worker.");
+				result = E_FAIL;
+			}
+		}
+		if (SUCCEEDED(result)) {
+			result = this->concatenate(output);
+		}
+		for (auto& state : this->chunks) {
+			DeleteFileA(state.path.c_str());
+		}
+		POST();
+		return result;
+	}
+
+	void FarmCoordinator::dispatchThread(std::string worker) {
+		PRE();
+		while (true) {
+			size_t index;
+			{
+				// Chunks in flight on other workers may still come back.
+				std::unique_lock<std::mutex> lock(this->mxChunks);
+				this->cvChunks.wait(lock, [this] { return !this->pendingChunks.empty() || (this->runningChunks == 0); });
+				if (this->pendingChunks.empty()) {
+					break;
+				}
+				index = this->pendingChunks.front();
+				this->pendingChunks.pop_front();
+				this->runningChunks++;
+			}
+
+			const ChunkState& state = this->chunks[index];
+			HRESULT result = requestChunk(worker, this->token, this->source, state.chunk, this->settings, state.path);
+
+			std::lock_guard<std::mutex> lock(this->mxChunks);
+			this->runningChunks--;
+			this->cvChunks.notify_all();
+			if (SUCCEEDED(result)) {
+				this->chunks[index].isDone = true;
+				std::cout << "Frames " << describeChunk(state.chunk) << " encoded by " << worker << std::endl;
+				continue;
+			}
+			if (++this->chunks[index].attempts < MAX_CHUNK_ATTEMPTS) {
+				this->pendingChunks.push_back(index);
+			}
+			if (result == E_ABORT) {
+				// The worker is gone; its chunk is left to the others.
+				std::cout << "Worker " << worker << " is not responding" << std::endl;
+				break;
+			}
+		}
+		POST();
+	}
+
+	HRESULT FarmCoordinator::concatenate(std::string output) {
+		PRE();
+		AVFormatContext* outputContext = NULL;
+		RET_IF_FAILED_AV(avformat_alloc_output_context2(&outputContext, NULL, NULL, output.c_str()), "Could not allocate format context", E_FAIL);
+		RET_IF_NULL(outputContext, "Could not allocate format context", E_FAIL);
+		std::shared_ptr<AVFormatContext> pOutput(outputContext, avformat_free_context);
+
+		AVStream* outputStream = NULL;
+		AVRational frameTimeBase = av_inv_q(this->frameRate);
+		int64_t lastDts = AV_NOPTS_VALUE;
+		int64_t streamDelay = AV_NOPTS_VALUE;
+		uint64_t packetCount = 0;
+		for (auto& state : this->chunks) {
+			AVFormatContext* inputContext = NULL;
+			RET_IF_FAILED_AV(avformat_open_input(&inputContext, state.path.c_str(), NULL, NULL), "Could not open chunk: " + state.path, E_FAIL);
+			std::shared_ptr<AVFormatContext> pInput(inputContext, closeInput);
+			RET_IF_FAILED_AV(avformat_find_stream_info(inputContext, NULL), "Could not read stream information", E_FAIL);
+			int streamIndex = av_find_best_stream(inputContext, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+			RET_IF_FAILED_AV(streamIndex, "Could not find a video stream in " + state.path, E_FAIL);
+			AVStream* inputStream = inputContext->streams[streamIndex];
+
+			if (!outputStream) {
+				outputStream = avformat_new_stream(outputContext, NULL);
+				RET_IF_NULL(outputStream, "Could not create stream", E_FAIL);
+				RET_IF_FAILED_AV(avcodec_parameters_copy(outputStream->codecpar, inputStream->codecpar), "Could not copy codec parameters", E_FAIL);
+				outputStream->codecpar->codec_tag = 0;
+				outputStream->time_base = inputStream->time_base;
+				outputStream->avg_frame_rate = this->frameRate;
+				if (!(outputContext->oformat->flags & AVFMT_NOFILE)) {
+					RET_IF_FAILED_AV(avio_open(&outputContext->pb, output.c_str(), AVIO_FLAG_WRITE), "Could not open output file", E_FAIL);
+				}
+				RET_IF_FAILED_AV(avformat_write_header(outputContext, NULL), "Could not write header", E_FAIL);
+			} else if ((inputStream->codecpar->extradata_size != outputStream->codecpar->extradata_size)
+				|| ((inputStream->codecpar->extradata_size > 0) && memcmp(inputStream->codecpar->extradata, outputStream->codecpar->extradata, inputStream->codecpar->extradata_size))) {
+				LOG(LL_WRN, "Stream headers of ", state.path, " differ from the first chunk, the workers may not use the same encoder build.");
+			}
+
+			// Every chunk starts at zero and is moved to where its first frame is in the clip.
+			int64_t start = inputStream->start_time == AV_NOPTS_VALUE ? 0 : av_rescale_q(inputStream->start_time, inputStream->time_base, outputStream->time_base);
+			int64_t offset = av_rescale_q(state.chunk.firstFrame, frameTimeBase, outputStream->time_base) - start;
+			// Every chunk is a closed GOP sequence, so its first packet in decoding order is the keyframe
+			// of its first frame, held back by the encoder delay. The delay is the same in every chunk
+			// made with the same settings, which keeps the decoding timestamps increasing across them.
+			bool isFirstPacket = true;
+			HRESULT result = S_OK;
+			AVPacket packet;
+			av_init_packet(&packet);
+			while (SUCCEEDED(result) && (av_read_frame(inputContext, &packet) >= 0)) {
+				if (packet.stream_index == streamIndex) {
+					av_packet_rescale_ts(&packet, inputStream->time_base, outputStream->time_base);
+					if (packet.pts != AV_NOPTS_VALUE) {
+						packet.pts += offset;
+					}
+					if (packet.dts != AV_NOPTS_VALUE) {
+						packet.dts += offset;
+					}
+					if (isFirstPacket && (packet.pts != AV_NOPTS_VALUE) && (packet.dts != AV_NOPTS_VALUE)) {
+						int64_t delay = packet.pts - packet.dts;
+						if (streamDelay == AV_NOPTS_VALUE) {
+							streamDelay = delay;
+						} else if (delay != streamDelay) {
+							LOG(LL_ERR, "The encoder delay of ", state.path, " (", delay, ") differs from the first chunk (", streamDelay, "), the workers may not use the same encoder settings.");
+							result = E_FAIL;
+						}
+					}
+					isFirstPacket = false;
+					if (SUCCEEDED(result) && (packet.dts != AV_NOPTS_VALUE)) {
+						if ((lastDts != AV_NOPTS_VALUE) && (packet.dts <= lastDts)) {
+							LOG(LL_ERR, "Packet ", packetCount, " from ", state.path, " does not follow the previous one in decoding order.");
+							result = E_FAIL;
+						}
+						lastDts = packet.dts;
+					}
+					if (SUCCEEDED(result)) {
+						packet.stream_index = outputStream->index;
+						packet.pos = -1;
+						if (av_interleaved_write_frame(outputContext, &packet) < 0) {
+							LOG(LL_WRN, "Could not write packet ", packetCount, " of the output.");
+						}
+						packetCount++;
+					}
+				}
+				av_packet_unref(&packet);
+			}
+			if (FAILED(result)) {
+				if (!(outputContext->oformat->flags & AVFMT_NOFILE)) {
+					avio_closep(&outputContext->pb);
+				}
+				DeleteFileA(output.c_str());
+				POST();
+				return result;
+			}
+		}
+
+		LOG_IF_FAILED_AV(av_write_trailer(outputContext), "Could not finalize the output file.");
+		if (!(outputContext->oformat->flags & AVFMT_NOFILE)) {
+			LOG_IF_FAILED_AV(avio_closep(&outputContext->pb), "Could not close the output file.");
+		}
+		LOG(LL_NFO, "Concatenated ", this->chunks.size(), " chunks (", packetCount, " packets) to ", output);
+		POST();
+		return S_OK;
+	}
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <Windows.h>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <libavformat\avformat.h>
+}
+
+namespace Encoder {
+	const uint16_t FARM_DEFAULT_PORT = 40480;
+
+	// Settings that every chunk of a farm encode is encoded with.
+	struct FarmSettings {
+		std::string vcodec;
+		std::string voptions;
+		std::string outputPixelFormat;
+	};
+
+	// A range of frames of the source clip that one worker encodes on its own.
+	struct FarmChunk {
+		uint64_t firstFrame = 0;
+		uint64_t frameCount = 0;
+	};
+
+	// Environment variable that holds the token shared by the coordinator and its workers.
+	const char* const FARM_TOKEN_VARIABLE = "EVE_FARM_TOKEN";
+
+	// Encodes chunks for a coordinator. Every connection carries one job:
+	//   "EVEF" | uint32 version | token | source path | uint64 first frame | uint64 frame count | vcodec | voptions | pixel format
+	// and is answered with:
+	//   "EVEF" | uint32 version | uint32 status | message | uint64 size | encoded chunk (NUT)
+	// Strings are stored as uint32 length | characters. The worker opens the
+	// source itself, so workers on other machines need it on a shared path.
+	// Jobs are refused unless they carry the worker's token and their source is a
+	// file inside the worker's source folder; the codec options are used as sent.
+	class FarmWorker {
+	public:
+		FarmWorker(std::string token, std::string sourceFolder);
+
+		// Encodes one chunk at a time until the process is stopped. Only the
+		// loopback address is listened on unless another address is given.
+		HRESULT serve(std::string address, uint16_t port);
+
+		// Decodes the frames of the chunk from the source and encodes them to a NUT file.
+		static HRESULT encodeChunk(const std::string& source, const FarmChunk& chunk, const FarmSettings& settings, const std::string& outputPath);
+
+	private:
+		std::string token;
+		std::string sourceFolder;
+	};
+
+	// Splits a clip into chunks, has them encoded by the workers and concatenates
+	// the results into a single file without encoding them again. Chunks of a
+	// worker that fails are handed to the others.
+	class FarmCoordinator {
+	public:
+		// Workers are given as host:port.
+		FarmCoordinator(std::vector<std::string> workers, uint64_t chunkFrames, std::string token);
+
+		HRESULT encode(std::string source, std::string output, const FarmSettings& settings);
+
+	private:
+		struct ChunkState {
+			FarmChunk chunk;
+			std::string path;
+			uint32_t attempts = 0;
+			bool isDone = false;
+		};
+
+		void dispatchThread(std::string worker);
+		HRESULT concatenate(std::string output);
+
+		std::vector<std::string> workers;
+		uint64_t chunkFrames;
+		std::string token;
+		std::string source;
+		FarmSettings settings;
+		AVRational frameRate = { 0, 1 };
+
+		std::mutex mxChunks;
+		std::condition_variable cvChunks;
+		uint32_t runningChunks = 0;
+		std::vector<ChunkState> chunks;
+		std::deque<size_t> pendingChunks;
+	};
+}
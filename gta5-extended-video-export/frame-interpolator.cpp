@@ -0,0 +1,335 @@
+#include "frame-interpolator.h"
+#include "logger.h"
+#include "task-scheduler.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <emmintrin.h>
+
+namespace Encoder {
+
+	namespace {
+		// Blocks whose best match differs by more than this per pixel, summed over
+		// the channels, are cross-faded instead of shifted.
+		const uint32_t MAX_PIXEL_ERROR = 40;
+		const uint32_t COARSE_SCALE = 4;
+
+		inline __m128i loadRow(const uint8_t* pRow, size_t stride) {
+			uint32_t rows[4];
+			for (int i = 0; i < 4; i++) {
+				memcpy(&rows[i], pRow + i * stride, sizeof(uint32_t));
+			}
+			return _mm_set_epi32(rows[3], rows[2], rows[1], rows[0]);
+		}
+
+		inline uint32_t sumSAD(__m128i sad) {
+			return _mm_cvtsi128_si32(sad) + _mm_cvtsi128_si32(_mm_srli_si128(sad, 8));
+		}
+
+		// Sum of absolute differences of two 16x16 BGRA blocks.
+		uint32_t sumBlockSAD(const uint8_t* pA, const uint8_t* pB, size_t stride) {
+			__m128i sum = _mm_setzero_si128();
+			for (uint32_t row = 0; row < FrameInterpolator::BLOCK_SIZE; row++, pA += stride, pB += stride) {
+				for (uint32_t i = 0; i < FrameInterpolator::BLOCK_SIZE * 4; i += 16) {
+					__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pA + i));
+					__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pB + i));
+					sum = _mm_add_epi64(sum, _mm_sad_epu8(a, b));
+				}
+			}
+			return sumSAD(sum);
+		}
+
+		inline __m128i blendPixels(__m128i previous, __m128i next, __m128i previousWeight, __m128i nextWeight) {
+			const __m128i zero = _mm_setzero_si128();
+			const __m128i rounding = _mm_set1_epi16(128);
+			__m128i low = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(previous, zero), previousWeight), _mm_mullo_epi16(_mm_unpacklo_epi8(next, zero), nextWeight));
+			__m128i high = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(previous, zero), previousWeight), _mm_mullo_epi16(_mm_unpackhi_epi8(next, zero), nextWeight));
+			low = _mm_srli_epi16(_mm_add_epi16(low, rounding), 8);
+			high = _mm_srli_epi16(_mm_add_epi16(high, rounding), 8);
+			return _mm_packus_epi16(low, high);
+		}
+	}
+
+	FrameInterpolator::FrameInterpolator(uint32_t width, uint32_t height, uint32_t searchRange) :
+		width(width),
+		height(height),
+		searchRange(static_cast<int32_t>(searchRange)),
+		blocksX((width + BLOCK_SIZE - 1) / BLOCK_SIZE),
+		blocksY((height + BLOCK_SIZE - 1) / BLOCK_SIZE)
+	{
+		Vector zero = { 0, 0, true };
+		this->field.assign(static_cast<size_t>(this->blocksX) * this->blocksY, zero);
+	}
+
+	void FrameInterpolator::makeCoarse(const uint8_t* pBGRA, std::vector<uint8_t>& coarse) const {
+		uint32_t coarseWidth = this->width / COARSE_SCALE;
+		uint32_t coarseHeight = this->height / COARSE_SCALE;
+		coarse.resize(static_cast<size_t>(coarseWidth) * coarseHeight);
+		uint8_t* pCoarse = coarse.data();
+		uint32_t width = this->width;
+		TaskScheduler::instance().parallelFor(0, coarseHeight, 16, [=](size_t begin, size_t end) {
+			for (size_t cy = begin; cy < end; cy++) {
+				for (uint32_t cx = 0; cx < coarseWidth; cx++) {
+					uint32_t sum = 0;
+					for (uint32_t y = 0; y < COARSE_SCALE; y++) {
+						const uint8_t* pPixel = pBGRA + ((cy * COARSE_SCALE + y) * width + cx * COARSE_SCALE) * 4;
+						for (uint32_t x = 0; x < COARSE_SCALE; x++, pPixel += 4) {
+							sum += pPixel[0] + 2 * pPixel[1] + pPixel[2];
+						}
+					}
+					pCoarse[cy * coarseWidth + cx] = static_cast<uint8_t>(sum / (4 * COARSE_SCALE * COARSE_SCALE));
+				}
+			}
+		});
+	}
+
+	FrameInterpolator::Vector FrameInterpolator::searchCoarse(uint32_t x, uint32_t y) const {
+		const size_t stride = this->width / COARSE_SCALE;
+		const int32_t maxX = static_cast<int32_t>(stride) - 4;
+		const int32_t maxY = static_cast<int32_t>(this->height / COARSE_SCALE) - 4;
+		const int32_t cx = (std::min)(static_cast<int32_t>(x / COARSE_SCALE), maxX);
+		const int32_t cy = (std::min)(static_cast<int32_t>(y / COARSE_SCALE), maxY);
+		const int32_t range = (std::max)(1, this->searchRange / static_cast<int32_t>(COARSE_SCALE));
+
+		// The 16x16 block is 4x4 at this scale, so a row of it fits in 32 bits and the block in one register.
+		__m128i block = loadRow(this->nextCoarse.data() + cy * stride + cx, stride);
+		Vector best = { 0, 0, true };
+		uint32_t bestCost = sumSAD(_mm_sad_epu8(block, loadRow(this->previousCoarse.data() + cy * stride + cx, stride)));
+		for (int32_t dy = (std::max)(-range, -cy); dy <= (std::min)(range, maxY - cy); dy++) {
+			for (int32_t dx = (std::max)(-range, -cx); dx <= (std::min)(range, maxX - cx); dx++) {
+				uint32_t cost = sumSAD(_mm_sad_epu8(block, loadRow(this->previousCoarse.data() + (cy + dy) * stride + cx + dx, stride)));
+				if (cost < bestCost) {
+					bestCost = cost;
+					best.x = dx * COARSE_SCALE;
+					best.y = dy * COARSE_SCALE;
+				}
+			}
+		}
+		return best;
+	}
+
+	uint32_t FrameInterpolator::measure(const uint8_t* pPrevious, const uint8_t* pNext, uint32_t x, uint32_t y, int32_t vx, int32_t vy) const {
+		int32_t px = static_cast<int32_t>(x) + vx;
+		int32_t py = static_cast<int32_t>(y) + vy;
+		if ((std::abs(vx) > this->searchRange) || (std::abs(vy) > this->searchRange) || (px < 0) || (py < 0) ||
+			(px > static_cast<int32_t>(this->width - BLOCK_SIZE)) || (py > static_cast<int32_t>(this->height - BLOCK_SIZE))) {
+			return UINT32_MAX;
+		}
+
+		const size_t stride = static_cast<size_t>(this->width) * 4;
+		return sumBlockSAD(pNext + y * stride + x * 4, pPrevious + py * stride + px * 4, stride);
+	}
+
+	void FrameInterpolator::estimate(const uint8_t* pPrevious, const uint8_t* pNext) {
+		if ((this->width < BLOCK_SIZE) || (this->height < BLOCK_SIZE)) {
+			return;
+		}
+		if (pPrevious == this->pLastNext) {
+			this->previousCoarse.swap(this->nextCoarse);
+		} else {
+			this->makeCoarse(pPrevious, this->previousCoarse);
+		}
+		this->makeCoarse(pNext, this->nextCoarse);
+		this->pLastNext = pNext;
+
+		// Vectors of the previous pair are candidates, so they are read from a copy.
+		std::vector<Vector> previousField = this->field;
+		TaskScheduler::instance().parallelFor(0, this->blocksY, 1, [&](size_t begin, size_t end) {
+			for (size_t by = begin; by < end; by++) {
+				for (uint32_t bx = 0; bx < this->blocksX; bx++) {
+					size_t index = by * this->blocksX + bx;
+					uint32_t x = (std::min)(bx * BLOCK_SIZE, this->width - BLOCK_SIZE);
+					uint32_t y = (std::min)(static_cast<uint32_t>(by) * BLOCK_SIZE, this->height - BLOCK_SIZE);
+
+					Vector candidates[4] = { { 0, 0, true }, this->searchCoarse(x, y), previousField[index], bx > 0 ? this->field[index - 1] : previousField[index] };
+					Vector best = candidates[0];
+					uint32_t bestCost = this->measure(pPrevious, pNext, x, y, 0, 0);
+					for (int i = 1; i < 4; i++) {
+						uint32_t cost = this->measure(pPrevious, pNext, x, y, candidates[i].x, candidates[i].y);
+						if (cost < bestCost) {
+							bestCost = cost;
+							best = candidates[i];
+						}
+					}
+
+					for (int32_t step = 0; step < this->searchRange; step++) {
+						const int32_t offsets[4][2] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+						Vector center = best;
+						for (auto& offset : offsets) {
+							uint32_t cost = this->measure(pPrevious, pNext, x, y, center.x + offset[0], center.y + offset[1]);
+							if (cost < bestCost) {
+								bestCost = cost;
+								best.x = center.x + offset[0];
+								best.y = center.y + offset[1];
+							}
+						}
+						if ((best.x == center.x) && (best.y == center.y)) {
+							break;
+						}
+					}
+					best.isReliable = bestCost <= MAX_PIXEL_ERROR * BLOCK_SIZE * BLOCK_SIZE;
+					this->field[index] = best;
+				}
+			}
+		});
+
+		// Blocks at the border cannot be matched when the scene moves out of the
+		// frame, and whatever they matched instead is a guess. When the block next
+		// to them moves out of the frame they follow it, as they do in a camera pan.
+		if ((this->blocksX > 2) && (this->blocksY > 2)) {
+			for (uint32_t by = 0; by < this->blocksY; by++) {
+				for (uint32_t bx = 0; bx < this->blocksX; bx++) {
+					uint32_t innerX = (std::min)((std::max)(bx, 1u), this->blocksX - 2);
+					uint32_t innerY = (std::min)((std::max)(by, 1u), this->blocksY - 2);
+					if ((innerX == bx) && (innerY == by)) {
+						continue;
+					}
+					Vector& vector = this->field[by * this->blocksX + bx];
+					const Vector& inner = this->field[innerY * this->blocksX + innerX];
+					uint32_t x = (std::min)(bx * BLOCK_SIZE, this->width - BLOCK_SIZE);
+					uint32_t y = (std::min)(by * BLOCK_SIZE, this->height - BLOCK_SIZE);
+					if (inner.isReliable && (!vector.isReliable || (this->measure(pPrevious, pNext, x, y, inner.x, inner.y) == UINT32_MAX))) {
+						vector = inner;
+					}
+				}
+			}
+		}
+
+		this->pairs++;
+		for (auto& vector : this->field) {
+			this->blocks++;
+			if (vector.isReliable) {
+				this->totalMotion += std::sqrt(static_cast<double>(vector.x * vector.x + vector.y * vector.y));
+			} else {
+				this->unreliableBlocks++;
+			}
+		}
+	}
+
+	void FrameInterpolator::shiftBlock(const uint8_t* pPrevious, const uint8_t* pNext, uint32_t blockX, uint32_t blockY, const Vector& vector, float position, uint8_t* pResult) const {
+		// Next(p) matches Previous(p + v), so at the position the block has moved
+		// position * v away from where it is in the previous frame.
+		int32_t vx = vector.isReliable ? vector.x : 0;
+		int32_t vy = vector.isReliable ? vector.y : 0;
+		int32_t previousX = static_cast<int32_t>(std::lround(position * vx));
+		int32_t previousY = static_cast<int32_t>(std::lround(position * vy));
+		int32_t nextX = previousX - vx;
+		int32_t nextY = previousY - vy;
+		uint16_t nextWeight = static_cast<uint16_t>(std::lround(position * 256));
+		uint16_t previousWeight = 256 - nextWeight;
+
+		int32_t x0 = blockX * BLOCK_SIZE;
+		int32_t y0 = blockY * BLOCK_SIZE;
+		int32_t x1 = (std::min)(x0 + static_cast<int32_t>(BLOCK_SIZE), static_cast<int32_t>(this->width));
+		int32_t y1 = (std::min)(y0 + static_cast<int32_t>(BLOCK_SIZE), static_cast<int32_t>(this->height));
+		const int32_t width = this->width;
+		const int32_t height = this->height;
+		const size_t stride = static_cast<size_t>(width) * 4;
+		bool isInside = ((std::min)(previousX, nextX) + x0 >= 0) && ((std::max)(previousX, nextX) + x1 <= width) &&
+			((std::min)(previousY, nextY) + y0 >= 0) && ((std::max)(previousY, nextY) + y1 <= height);
+
+		__m128i previousWeights = _mm_set1_epi16(previousWeight);
+		__m128i nextWeights = _mm_set1_epi16(nextWeight);
+		for (int32_t y = y0; y < y1; y++) {
+			uint8_t* pOut = pResult + y * stride;
+			int32_t x = x0;
+			if (isInside) {
+				const uint8_t* pA = pPrevious + (y + previousY) * stride + previousX * 4;
+				const uint8_t* pB = pNext + (y + nextY) * stride + nextX * 4;
+				for (; x + 4 <= x1; x += 4) {
+					__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pA + x * 4));
+					__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pB + x * 4));
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(pOut + x * 4), blendPixels(a, b, previousWeights, nextWeights));
+				}
+			}
+			for (; x < x1; x++) {
+				// Where the path leaves the frame on one side, the pixel comes from the other frame only.
+				int32_t ax = x + previousX;
+				int32_t ay = y + previousY;
+				int32_t bx = x + nextX;
+				int32_t by = y + nextY;
+				bool isPreviousInside = (ax >= 0) && (ax < width) && (ay >= 0) && (ay < height);
+				bool isNextInside = (bx >= 0) && (bx < width) && (by >= 0) && (by < height);
+				uint32_t weight = nextWeight;
+				if (isPreviousInside != isNextInside) {
+					weight = isNextInside ? 256 : 0;
+				}
+				ax = (std::min)((std::max)(ax, 0), width - 1);
+				ay = (std::min)((std::max)(ay, 0), height - 1);
+				bx = (std::min)((std::max)(bx, 0), width - 1);
+				by = (std::min)((std::max)(by, 0), height - 1);
+				const uint8_t* pA = pPrevious + ay * stride + ax * 4;
+				const uint8_t* pB = pNext + by * stride + bx * 4;
+				for (int c = 0; c < 4; c++) {
+					pOut[x * 4 + c] = static_cast<uint8_t>((pA[c] * (256 - weight) + pB[c] * weight + 128) >> 8);
+				}
+			}
+		}
+	}
+
+	uint32_t FrameInterpolator::measureAt(const uint8_t* pPrevious, const uint8_t* pNext, uint32_t x, uint32_t y, const Vector& vector, float position) const {
+		int32_t previousX = static_cast<int32_t>(x) + static_cast<int32_t>(std::lround(position * vector.x));
+		int32_t previousY = static_cast<int32_t>(y) + static_cast<int32_t>(std::lround(position * vector.y));
+		int32_t nextX = previousX - vector.x;
+		int32_t nextY = previousY - vector.y;
+		const int32_t maxX = static_cast<int32_t>(this->width - BLOCK_SIZE);
+		const int32_t maxY = static_cast<int32_t>(this->height - BLOCK_SIZE);
+		if (((std::min)(previousX, nextX) < 0) || ((std::max)(previousX, nextX) > maxX) || ((std::min)(previousY, nextY) < 0) || ((std::max)(previousY, nextY) > maxY)) {
+			return UINT32_MAX;
+		}
+		return sumBlockSAD(pPrevious + (previousY * this->width + previousX) * 4, pNext + (nextY * this->width + nextX) * 4, static_cast<size_t>(this->width) * 4);
+	}
+
+	void FrameInterpolator::synthesize(const uint8_t* pPrevious, const uint8_t* pNext, float position, uint8_t* pResult) const {
+		TaskScheduler::instance().parallelFor(0, this->blocksY, 1, [&](size_t begin, size_t end) {
+			for (size_t by = begin; by < end; by++) {
+				for (uint32_t bx = 0; bx < this->blocksX; bx++) {
+					// The vectors belong to blocks of the next frame, which are somewhere else
+					// at this position. Of the vectors around the block, the one that matches
+					// both frames best along its path is used, so moving objects keep their
+					// own motion instead of taking the background's.
+					uint32_t x = (std::min)(bx * BLOCK_SIZE, this->width - BLOCK_SIZE);
+					uint32_t y = (std::min)(static_cast<uint32_t>(by) * BLOCK_SIZE, this->height - BLOCK_SIZE);
+					const Vector& own = this->field[by * this->blocksX + bx];
+					uint32_t ownCost = this->measureAt(pPrevious, pNext, x, y, own, position);
+					Vector best = { 0, 0, true };
+					uint32_t bestCost = this->measureAt(pPrevious, pNext, x, y, best, position);
+					for (int32_t dy = -1; dy <= 1; dy++) {
+						for (int32_t dx = -1; dx <= 1; dx++) {
+							int32_t nx = static_cast<int32_t>(bx) + dx;
+							int32_t ny = static_cast<int32_t>(by) + dy;
+							if ((nx < 0) || (ny < 0) || (nx >= static_cast<int32_t>(this->blocksX)) || (ny >= static_cast<int32_t>(this->blocksY))) {
+								continue;
+							}
+							const Vector& candidate = this->field[ny * this->blocksX + nx];
+							if (!candidate.isReliable) {
+								continue;
+							}
+							uint32_t cost = this->measureAt(pPrevious, pNext, x, y, candidate, position);
+							if (cost < bestCost) {
+								bestCost = cost;
+								best = candidate;
+							}
+						}
+					}
+					if ((ownCost == UINT32_MAX) && own.isReliable) {
+						// At the border the path leaves the frame, so the block cannot be compared.
+						best = own;
+					} else if (bestCost <= MAX_PIXEL_ERROR * BLOCK_SIZE * BLOCK_SIZE) {
+						best.isReliable = true;
+					} else {
+						best.isReliable = false;
+					}
+					this->shiftBlock(pPrevious, pNext, bx, static_cast<uint32_t>(by), best, position, pResult);
+				}
+			}
+		});
+	}
+
+	void FrameInterpolator::logReport() const {
+		uint64_t reliableBlocks = this->blocks - this->unreliableBlocks;
+		LOG(LL_NFO, "Frame interpolation: ", this->pairs, " frame pairs, ",
+			this->blocks ? this->unreliableBlocks * 100 / this->blocks : 0, "% of the blocks cross-faded, ",
+			reliableBlocks ? this->totalMotion / reliableBlocks : 0, " pixels of motion per block on average");
+	}
+}
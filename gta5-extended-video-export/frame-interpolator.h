@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace Encoder {
+	// Synthesizes BGRA frames between two captured ones, so motion blur can be
+	// blended from more sub-frames than the game renders. Motion is estimated
+	// for 16x16 blocks of the next frame: a full search on a quarter resolution
+	// grey image, then the best of that, the block's vector from the previous
+	// pair and its left neighbour's vector is refined at full resolution. Each
+	// block of a synthesized frame takes the neighbouring vector that matches
+	// both frames best at its position, and is shifted along it and cross-faded.
+	// Blocks that match poorly (occlusions, lighting changes) are only cross-faded.
+	class FrameInterpolator {
+	public:
+		// Vectors are searched up to searchRange pixels in each direction.
+		FrameInterpolator(uint32_t width, uint32_t height, uint32_t searchRange);
+
+		// Estimates the motion between two frames. The next frame of one call is
+		// usually the previous frame of the next call; its grey image is reused.
+		void estimate(const uint8_t* pPrevious, const uint8_t* pNext);
+		// Writes the frame at 0 < position < 1 between the frames given to estimate.
+		void synthesize(const uint8_t* pPrevious, const uint8_t* pNext, float position, uint8_t* pResult) const;
+
+		void logReport() const;
+
+		static const uint32_t BLOCK_SIZE = 16;
+
+	private:
+		struct Vector {
+			int32_t x;
+			int32_t y;
+			bool isReliable;
+		};
+
+		void makeCoarse(const uint8_t* pBGRA, std::vector<uint8_t>& coarse) const;
+		Vector searchCoarse(uint32_t blockX, uint32_t blockY) const;
+		uint32_t measure(const uint8_t* pPrevious, const uint8_t* pNext, uint32_t x, uint32_t y, int32_t vx, int32_t vy) const;
+		// Difference between the two frames along the vector's path through the block at the position.
+		uint32_t measureAt(const uint8_t* pPrevious, const uint8_t* pNext, uint32_t x, uint32_t y, const Vector& vector, float position) const;
+		void shiftBlock(const uint8_t* pPrevious, const uint8_t* pNext, uint32_t blockX, uint32_t blockY, const Vector& vector, float position, uint8_t* pResult) const;
+
+		uint32_t width;
+		uint32_t height;
+		int32_t searchRange;
+		uint32_t blocksX;
+		uint32_t blocksY;
+		std::vector<Vector> field;
+		std::vector<uint8_t> previousCoarse;
+		std::vector<uint8_t> nextCoarse;
+		const uint8_t* pLastNext = nullptr;
+
+		uint64_t pairs = 0;
+		uint64_t blocks = 0;
+		uint64_t unreliableBlocks = 0;
+		double totalMotion = 0;
+	};
+}
@@ -0,0 +1,188 @@
+#include "frame-ranges.h"
+#include "logger.h"
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
+namespace Encoder {
+
+	namespace {
+		std::string trim(const std::string& value) {
+			size_t first = value.find_first_not_of(" \t\r");
+			if (first == std::string::npos) {
+				return "";
+			}
+			return value.substr(first, value.find_last_not_of(" \t\r") - first + 1);
+		}
+
+		bool parseNumber(const std::string& value, uint64_t& result) {
+			if (value.empty() || (value.find_first_not_of("0123456789") != std::string::npos)) {
+				return false;
+			}
+			result = std::stoull(value);
+			return true;
+		}
+	}
+
+	HRESULT FrameRanges::parse(std::string definition, uint32_t fps_num, uint32_t fps_den) {
+		PRE();
+		this->ranges.clear();
+
+		if (!fps_num || !fps_den) {
+			LOG(LL_ERR, "Cannot parse frame ranges without a frame rate.");
+			POST();
+			return E_FAIL;
+		}
+
+		std::replace(definition.begin(), definition.end(), ';', '\n');
+		std::replace(definition.begin(), definition.end(), ',', '\n');
+
+		std::istringstream stream(definition);
+		std::string line;
+		while (std::getline(stream, line)) {
+			line = trim(line.substr(0, line.find('#')));
+			if (line.empty()) {
+				continue;
+			}
+
+			std::string inString = line;
+			std::string outString = line;
+			bool isOpenEnded = false;
+			size_t dash = line.find('-');
+			if (dash != std::string::npos) {
+				inString = trim(line.substr(0, dash));
+				outString = trim(line.substr(dash + 1));
+				isOpenEnded = outString.empty();
+			}
+
+			Range range(0, OPEN_END);
+			if (FAILED(parsePoint(inString, fps_num, fps_den, false, range.first))
+				|| (!isOpenEnded && FAILED(parsePoint(outString, fps_num, fps_den, dash != std::string::npos, range.second)))) {
+				LOG(LL_ERR, "Invalid frame range: ", line);
+				POST();
+				return E_FAIL;
+			}
+
+			if (range.second < range.first) {
+				LOG(LL_WRN, "Ignoring empty frame range: ", line);
+				continue;
+			}
+			this->ranges.push_back(range);
+		}
+
+		std::sort(this->ranges.begin(), this->ranges.end());
+
+		std::vector<Range> merged;
+		for (auto& range : this->ranges) {
+			if (!merged.empty() && ((merged.back().second == OPEN_END) || (range.first <= merged.back().second + 1))) {
+				merged.back().second = (std::max)(merged.back().second, range.second);
+			} else {
+				merged.push_back(range);
+			}
+		}
+		this->ranges = merged;
+
+		POST();
+		return S_OK;
+	}
+
+	HRESULT FrameRanges::parsePoint(std::string value, uint32_t fps_num, uint32_t fps_den, bool isOutPoint, uint64_t& frame) {
+		if (parseNumber(value, frame)) {
+			return S_OK;
+		}
+
+		std::vector<std::string> parts;
+		std::istringstream stream(value);
+		std::string part;
+		while (std::getline(stream, part, ':')) {
+			parts.push_back(trim(part));
+		}
+
+		try {
+			if (parts.size() == 4) {
+				// HH:MM:SS:FF timecode, counted in whole frames per second.
+				uint64_t hours, minutes, seconds, frames;
+				if (!parseNumber(parts[0], hours) || !parseNumber(parts[1], minutes) || !parseNumber(parts[2], seconds) || !parseNumber(parts[3], frames)) {
+					return E_FAIL;
+				}
+				uint64_t timebase = (fps_num + fps_den / 2) / fps_den;
+				frame = ((hours * 60 + minutes) * 60 + seconds) * timebase + frames;
+				return S_OK;
+			}
+
+			if ((parts.size() == 2) || (parts.size() == 3)) {
+				// Clock time. An out point excludes the frame that starts at that time.
+				uint64_t hours = 0, minutes;
+				if (((parts.size() == 3) && !parseNumber(parts[0], hours)) || !parseNumber(parts[parts.size() - 2], minutes)) {
+					return E_FAIL;
+				}
+				size_t consumed = 0;
+				double seconds = std::stod(parts.back(), &consumed);
+				if ((consumed != parts.back().size()) || (seconds < 0)) {
+					return E_FAIL;
+				}
+				seconds += (hours * 60.0 + minutes) * 60.0;
+				double position = std::ceil(seconds * fps_num / fps_den - 1e-6);
+				if (isOutPoint) {
+					if (position < 1) {
+						return E_FAIL;
+					}
+					position -= 1;
+				}
+				frame = static_cast<uint64_t>(position);
+				return S_OK;
+			}
+		} catch (std::exception&) {
+			// Fall through
+		}
+
+		return E_FAIL;
+	}
+
+	bool FrameRanges::isEmpty() const {
+		return this->ranges.empty();
+	}
+
+	bool FrameRanges::contains(uint64_t frame) const {
+		if (this->ranges.empty()) {
+			return true;
+		}
+
+		auto it = std::upper_bound(this->ranges.begin(), this->ranges.end(), Range(frame, OPEN_END));
+		if (it == this->ranges.begin()) {
+			return false;
+		}
+		--it;
+		return frame <= it->second;
+	}
+
+	const std::vector<FrameRanges::Range>& FrameRanges::getRanges() const {
+		return this->ranges;
+	}
+
+	uint64_t FrameRanges::getFrameAt(uint64_t exportedIndex) const {
+		for (auto& range : this->ranges) {
+			if (exportedIndex <= range.second - range.first) {
+				return range.first + exportedIndex;
+			}
+			exportedIndex -= range.second - range.first + 1;
+		}
+		return this->ranges.empty() ? exportedIndex : OPEN_END;
+	}
+
+	void FrameRanges::log() const {
+		if (this->ranges.empty()) {
+			LOG(LL_NFO, "Frame ranges: all frames");
+			return;
+		}
+
+		LOG(LL_NFO, "Frame ranges:");
+		for (auto& range : this->ranges) {
+			if (range.second == OPEN_END) {
+				LOG(LL_NFO, "  ", range.first, " - end");
+			} else {
+				LOG(LL_NFO, "  ", range.first, " - ", range.second);
+			}
+		}
+	}
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <Windows.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace Encoder {
+	// Sorted, non-overlapping, inclusive ranges of output frames selected for export.
+	// An empty set selects every frame.
+	class FrameRanges {
+	public:
+		static const uint64_t OPEN_END = UINT64_MAX;
+
+		typedef std::pair<uint64_t, uint64_t> Range;
+
+		// Ranges are separated by commas, semicolons or new lines; '#' starts a comment.
+		// Each range is "in-out", "in-" or a single point. Points are frame numbers,
+		// HH:MM:SS:FF timecodes or [HH:]MM:SS[.fff] clock times.
+		HRESULT parse(std::string definition, uint32_t fps_num, uint32_t fps_den);
+
+		bool isEmpty() const;
+		bool contains(uint64_t frame) const;
+		const std::vector<Range>& getRanges() const;
+		// Returns the frame that the exported frame with the given index was taken from.
+		uint64_t getFrameAt(uint64_t exportedIndex) const;
+
+		void log() const;
+
+	private:
+		static HRESULT parsePoint(std::string value, uint32_t fps_num, uint32_t fps_den, bool isOutPoint, uint64_t& frame);
+
+		std::vector<Range> ranges;
+	};
+}
@@ -0,0 +1,434 @@
+#include "gif-quantizer.h"
+#include "logger.h"
+#include <algorithm>
+#include <cfloat>
+#include <cstring>
+#include <emmintrin.h>
+
+namespace Encoder {
+
+	namespace {
+		const size_t PALETTE_SIZE = 256;
+		const size_t HISTOGRAM_SIZE = 1 << 15;
+		const size_t LOOKUP_SIZE = 1 << 18;
+		const int KMEANS_ITERATIONS = 4;
+		// The first palette is kept unless the new one has less than 1/1.25 of its error.
+		const double PALETTE_REUSE_RATIO = 1.25;
+		// Peak to peak amplitude of the ordered dither, in 8 bit steps.
+		const int BAYER_SPREAD = 24;
+
+		const uint8_t BAYER[8][8] = {
+			{ 0, 32, 8, 40, 2, 34, 10, 42 },
+			{ 48, 16, 56, 24, 50, 18, 58, 26 },
+			{ 12, 44, 4, 36, 14, 46, 6, 38 },
+			{ 60, 28, 52, 20, 62, 30, 54, 22 },
+			{ 3, 35, 11, 43, 1, 33, 9, 41 },
+			{ 51, 19, 59, 27, 49, 17, 57, 25 },
+			{ 15, 47, 7, 39, 13, 45, 5, 37 },
+			{ 63, 31, 55, 23, 61, 29, 53, 21 }
+		};
+
+		// 5 bits of red, green and blue out of a BGRA pixel.
+		uint32_t getHistogramKey(uint32_t pixel) {
+			return ((pixel >> 9) & 0x7C00) | ((pixel >> 6) & 0x3E0) | ((pixel >> 3) & 0x1F);
+		}
+
+		__m128i getHistogramKeys(__m128i pixels) {
+			return _mm_or_si128(_mm_or_si128(
+				_mm_and_si128(_mm_srli_epi32(pixels, 9), _mm_set1_epi32(0x7C00)),
+				_mm_and_si128(_mm_srli_epi32(pixels, 6), _mm_set1_epi32(0x3E0))),
+				_mm_and_si128(_mm_srli_epi32(pixels, 3), _mm_set1_epi32(0x1F)));
+		}
+
+		// 6 bits of red, green and blue out of a BGRA pixel.
+		uint32_t getLookupKey(uint32_t pixel) {
+			return ((pixel >> 6) & 0x3F000) | ((pixel >> 4) & 0xFC0) | ((pixel >> 2) & 0x3F);
+		}
+
+		__m128i getLookupKeys(__m128i pixels) {
+			return _mm_or_si128(_mm_or_si128(
+				_mm_and_si128(_mm_srli_epi32(pixels, 6), _mm_set1_epi32(0x3F000)),
+				_mm_and_si128(_mm_srli_epi32(pixels, 4), _mm_set1_epi32(0xFC0))),
+				_mm_and_si128(_mm_srli_epi32(pixels, 2), _mm_set1_epi32(0x3F)));
+		}
+
+		int getChannel(uint32_t pixel, int channel) {
+			return (pixel >> (16 - 8 * channel)) & 0xFF;
+		}
+	}
+
+	GIFQuantizer::GIFQuantizer(uint32_t width, uint32_t height, GIFDither dither) :
+		width(width),
+		height(height),
+		dither(dither),
+		counts(HISTOGRAM_SIZE),
+		sums(HISTOGRAM_SIZE * 3),
+		lookupTable(LOOKUP_SIZE, -1),
+		bayerPositive(8 * 8 * 4),
+		bayerNegative(8 * 8 * 4)
+	{
+		for (int y = 0; y < 8; y++) {
+			for (int x = 0; x < 8; x++) {
+				int offset = (2 * BAYER[y][x] + 1 - 64) * BAYER_SPREAD / 128;
+				for (int c = 0; c < 3; c++) {
+					this->bayerPositive[(y * 8 + x) * 4 + c] = static_cast<uint8_t>((std::max)(offset, 0));
+					this->bayerNegative[(y * 8 + x) * 4 + c] = static_cast<uint8_t>((std::max)(-offset, 0));
+				}
+			}
+		}
+	}
+
+	HRESULT GIFQuantizer::parseDither(std::string definition, GIFDither& dither) {
+		definition.erase(std::remove_if(definition.begin(), definition.end(), ::isspace), definition.end());
+		std::transform(definition.begin(), definition.end(), definition.begin(), ::tolower);
+		if (definition == "none") {
+			dither = GIF_DITHER_NONE;
+			return S_OK;
+		}
+		if (definition.empty() || (definition == "bayer")) {
+			dither = GIF_DITHER_BAYER;
+			return S_OK;
+		}
+		if (definition == "floyd_steinberg") {
+			dither = GIF_DITHER_FLOYD_STEINBERG;
+			return S_OK;
+		}
+		LOG(LL_ERR, "Invalid GIF dither: ", definition);
+		return E_FAIL;
+	}
+
+	void GIFQuantizer::addToHistogram(const uint8_t* pBGRA) {
+		const uint32_t* pPixels = reinterpret_cast<const uint32_t*>(pBGRA);
+		uint32_t* pCounts = this->counts.data();
+		uint64_t* pSums = this->sums.data();
+		size_t count = static_cast<size_t>(this->width) * this->height;
+		auto add = [=](uint32_t key, uint32_t pixel) {
+			pCounts[key]++;
+			pSums[3 * key] += getChannel(pixel, 0);
+			pSums[3 * key + 1] += getChannel(pixel, 1);
+			pSums[3 * key + 2] += getChannel(pixel, 2);
+		};
+
+		alignas(16) uint32_t keys[4];
+		size_t i = 0;
+		for (; i + 4 <= count; i += 4) {
+			_mm_store_si128(reinterpret_cast<__m128i*>(keys), getHistogramKeys(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pPixels + i))));
+			add(keys[0], pPixels[i]);
+			add(keys[1], pPixels[i + 1]);
+			add(keys[2], pPixels[i + 2]);
+			add(keys[3], pPixels[i + 3]);
+		}
+		for (; i < count; i++) {
+			add(getHistogramKey(pPixels[i]), pPixels[i]);
+		}
+	}
+
+	void GIFQuantizer::endSegment() {
+		std::vector<Bin> bins;
+		for (size_t key = 0; key < HISTOGRAM_SIZE; key++) {
+			uint32_t count = this->counts[key];
+			if (count > 0) {
+				Bin bin;
+				for (int c = 0; c < 3; c++) {
+					bin.color[c] = static_cast<float>(this->sums[3 * key + c]) / count;
+				}
+				bin.count = count;
+				bins.push_back(bin);
+			}
+		}
+		std::fill(this->counts.begin(), this->counts.end(), 0);
+		std::fill(this->sums.begin(), this->sums.end(), 0);
+		if (bins.empty()) {
+			return;
+		}
+
+		this->segments++;
+		Palette candidate = this->buildPalette(bins);
+		if (this->firstPalette.colors.empty()) {
+			this->firstPalette = candidate;
+		} else if (this->firstPalette.measureError(bins) > candidate.measureError(bins) * PALETTE_REUSE_RATIO) {
+			this->newPalettes++;
+		} else {
+			candidate = this->firstPalette;
+		}
+
+		if (candidate.colors != this->palette.colors) {
+			this->palette = candidate;
+			this->isPaletteChanged = true;
+			std::fill(this->lookupTable.begin(), this->lookupTable.end(), -1);
+			LOG(LL_DBG, "GIF palette changed at segment ", this->segments);
+		}
+	}
+
+	GIFQuantizer::Palette GIFQuantizer::buildPalette(std::vector<Bin>& bins) const {
+		struct Box {
+			size_t begin;
+			size_t end;
+			uint64_t count;
+			int channel;
+			float range;
+		};
+
+		auto describe = [&](size_t begin, size_t end) {
+			Box box = { begin, end, 0, 0, 0 };
+			float minimum[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+			float maximum[3] = { 0, 0, 0 };
+			for (size_t i = begin; i < end; i++) {
+				box.count += bins[i].count;
+				for (int c = 0; c < 3; c++) {
+					minimum[c] = (std::min)(minimum[c], bins[i].color[c]);
+					maximum[c] = (std::max)(maximum[c], bins[i].color[c]);
+				}
+			}
+			for (int c = 0; c < 3; c++) {
+				if (maximum[c] - minimum[c] > box.range) {
+					box.range = maximum[c] - minimum[c];
+					box.channel = c;
+				}
+			}
+			return box;
+		};
+
+		// Median cut: the box with the most pixels times its widest side is split
+		// at the median of that side until there are enough boxes.
+		std::vector<Box> boxes(1, describe(0, bins.size()));
+		while (boxes.size() < PALETTE_SIZE) {
+			auto largest = std::max_element(boxes.begin(), boxes.end(), [](const Box& a, const Box& b) {
+				return a.count * a.range < b.count * b.range;
+			});
+			if (largest->range <= 0) {
+				break;
+			}
+
+			Box box = *largest;
+			std::sort(bins.begin() + box.begin, bins.begin() + box.end, [&](const Bin& a, const Bin& b) {
+				return a.color[box.channel] < b.color[box.channel];
+			});
+			size_t split = box.begin;
+			uint64_t below = 0;
+			while ((split < box.end - 1) && (below + bins[split].count <= box.count / 2)) {
+				below += bins[split++].count;
+			}
+			split = (std::max)(split, box.begin + 1);
+			*largest = describe(box.begin, split);
+			boxes.push_back(describe(split, box.end));
+		}
+
+		std::vector<Bin> entries;
+		for (auto& box : boxes) {
+			Bin entry = { { 0, 0, 0 }, 0 };
+			double sum[3] = { 0, 0, 0 };
+			for (size_t i = box.begin; i < box.end; i++) {
+				for (int c = 0; c < 3; c++) {
+					sum[c] += static_cast<double>(bins[i].color[c]) * bins[i].count;
+				}
+			}
+			for (int c = 0; c < 3; c++) {
+				entry.color[c] = static_cast<float>(sum[c] / box.count);
+			}
+			entries.push_back(entry);
+		}
+
+		// K-means moves every entry to the mean of the colours nearest to it.
+		Palette result;
+		result.set(entries);
+		for (int iteration = 0; iteration < KMEANS_ITERATIONS; iteration++) {
+			std::vector<double> sums(entries.size() * 3);
+			std::vector<uint64_t> weights(entries.size());
+			for (auto& bin : bins) {
+				float distance;
+				size_t nearest = result.findNearest(bin.color, distance);
+				weights[nearest] += bin.count;
+				for (int c = 0; c < 3; c++) {
+					sums[3 * nearest + c] += static_cast<double>(bin.color[c]) * bin.count;
+				}
+			}
+			for (size_t i = 0; i < entries.size(); i++) {
+				if (weights[i] > 0) {
+					for (int c = 0; c < 3; c++) {
+						entries[i].color[c] = static_cast<float>(sums[3 * i + c] / weights[i]);
+					}
+				}
+			}
+			result.set(entries);
+		}
+		return result;
+	}
+
+	void GIFQuantizer::Palette::set(const std::vector<Bin>& entries) {
+		this->colors.assign(PALETTE_SIZE, 0xFF000000);
+		size_t padded = (entries.size() + 3) & ~size_t(3);
+		for (int c = 0; c < 3; c++) {
+			this->channels[c].resize(padded);
+		}
+		for (size_t i = 0; i < padded; i++) {
+			const Bin& entry = entries[(std::min)(i, entries.size() - 1)];
+			uint32_t color = 0xFF000000;
+			for (int c = 0; c < 3; c++) {
+				int value = static_cast<int>(entry.color[c] + 0.5f);
+				value = (std::min)((std::max)(value, 0), 255);
+				// Searches use the rounded colours that end up in the image.
+				this->channels[c][i] = static_cast<float>(value);
+				color |= value << (16 - 8 * c);
+			}
+			if (i < entries.size()) {
+				this->colors[i] = color;
+			}
+		}
+	}
+
+	size_t GIFQuantizer::Palette::findNearest(const float* color, float& distance) const {
+		const __m128 red = _mm_set1_ps(color[0]);
+		const __m128 green = _mm_set1_ps(color[1]);
+		const __m128 blue = _mm_set1_ps(color[2]);
+		__m128 best = _mm_set1_ps(FLT_MAX);
+		__m128i bestIndex = _mm_setzero_si128();
+		__m128i index = _mm_setr_epi32(0, 1, 2, 3);
+		for (size_t i = 0; i < this->channels[0].size(); i += 4) {
+			__m128 dr = _mm_sub_ps(_mm_loadu_ps(&this->channels[0][i]), red);
+			__m128 dg = _mm_sub_ps(_mm_loadu_ps(&this->channels[1][i]), green);
+			__m128 db = _mm_sub_ps(_mm_loadu_ps(&this->channels[2][i]), blue);
+			__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dr, dr), _mm_mul_ps(dg, dg)), _mm_mul_ps(db, db));
+			__m128i closer = _mm_castps_si128(_mm_cmplt_ps(d, best));
+			best = _mm_min_ps(d, best);
+			bestIndex = _mm_or_si128(_mm_and_si128(closer, index), _mm_andnot_si128(closer, bestIndex));
+			index = _mm_add_epi32(index, _mm_set1_epi32(4));
+		}
+
+		alignas(16) float distances[4];
+		alignas(16) uint32_t indices[4];
+		_mm_store_ps(distances, best);
+		_mm_store_si128(reinterpret_cast<__m128i*>(indices), bestIndex);
+		size_t lane = 0;
+		for (size_t i = 1; i < 4; i++) {
+			if ((distances[i] < distances[lane]) || ((distances[i] == distances[lane]) && (indices[i] < indices[lane]))) {
+				lane = i;
+			}
+		}
+		distance = distances[lane];
+		return indices[lane];
+	}
+
+	double GIFQuantizer::Palette::measureError(const std::vector<Bin>& bins) const {
+		double error = 0;
+		for (auto& bin : bins) {
+			float distance;
+			this->findNearest(bin.color, distance);
+			error += static_cast<double>(distance) * bin.count;
+		}
+		return error;
+	}
+
+	uint8_t GIFQuantizer::lookup(uint32_t key) {
+		int16_t& entry = this->lookupTable[key];
+		if (entry < 0) {
+			// The middle of the colours that share this key.
+			float color[3] = {
+				static_cast<float>(((key >> 12) & 0x3F) * 4 + 2),
+				static_cast<float>(((key >> 6) & 0x3F) * 4 + 2),
+				static_cast<float>((key & 0x3F) * 4 + 2)
+			};
+			float distance;
+			entry = static_cast<int16_t>(this->palette.findNearest(color, distance));
+		}
+		return static_cast<uint8_t>(entry);
+	}
+
+	void GIFQuantizer::map(const uint8_t* pBGRA, uint8_t* pResult) {
+		const uint32_t* pPixels = reinterpret_cast<const uint32_t*>(pBGRA);
+		if (this->dither == GIF_DITHER_FLOYD_STEINBERG) {
+			this->mapErrorDiffusion(pPixels, pResult);
+		} else {
+			this->mapOrdered(pPixels, pResult);
+		}
+		size_t count = static_cast<size_t>(this->width) * this->height;
+		memcpy(pResult + count, this->palette.colors.data(), PALETTE_SIZE * sizeof(uint32_t));
+		this->isPaletteChanged = false;
+	}
+
+	void GIFQuantizer::mapOrdered(const uint32_t* pPixels, uint8_t* pIndices) {
+		bool isDithered = this->dither == GIF_DITHER_BAYER;
+		alignas(16) uint32_t keys[4];
+		for (uint32_t y = 0; y < this->height; y++) {
+			const uint32_t* pRow = pPixels + static_cast<size_t>(y) * this->width;
+			uint8_t* pRowIndices = pIndices + static_cast<size_t>(y) * this->width;
+			const uint8_t* pPositive = &this->bayerPositive[(y & 7) * 32];
+			const uint8_t* pNegative = &this->bayerNegative[(y & 7) * 32];
+			uint32_t x = 0;
+			for (; x + 4 <= this->width; x += 4) {
+				__m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pRow + x));
+				if (isDithered) {
+					pixels = _mm_adds_epu8(pixels, _mm_loadu_si128(reinterpret_cast<const __m128i*>(pPositive + (x & 4) * 4)));
+					pixels = _mm_subs_epu8(pixels, _mm_loadu_si128(reinterpret_cast<const __m128i*>(pNegative + (x & 4) * 4)));
+				}
+				_mm_store_si128(reinterpret_cast<__m128i*>(keys), getLookupKeys(pixels));
+				pRowIndices[x] = this->lookup(keys[0]);
+				pRowIndices[x + 1] = this->lookup(keys[1]);
+				pRowIndices[x + 2] = this->lookup(keys[2]);
+				pRowIndices[x + 3] = this->lookup(keys[3]);
+			}
+			for (; x < this->width; x++) {
+				uint32_t pixel = pRow[x];
+				if (isDithered) {
+					uint32_t dithered = 0;
+					for (int c = 0; c < 3; c++) {
+						int value = getChannel(pixel, c) + pPositive[(x & 7) * 4] - pNegative[(x & 7) * 4];
+						dithered |= (std::min)((std::max)(value, 0), 255) << (16 - 8 * c);
+					}
+					pixel = dithered;
+				}
+				pRowIndices[x] = this->lookup(getLookupKey(pixel));
+			}
+		}
+	}
+
+	void GIFQuantizer::mapErrorDiffusion(const uint32_t* pPixels, uint8_t* pIndices) {
+		size_t count = static_cast<size_t>(this->width) * this->height;
+		bool canReuse = this->hasPrevious && !this->isPaletteChanged;
+		// Errors in 1/16 steps for the current and the next row, with a column of margin on both sides.
+		size_t rowLength = (this->width + 2) * 3;
+		std::vector<int32_t> errors(2 * rowLength);
+		for (uint32_t y = 0; y < this->height; y++) {
+			int32_t* pCurrent = &errors[(y & 1) * rowLength];
+			int32_t* pNext = &errors[((y + 1) & 1) * rowLength];
+			std::fill(pNext, pNext + rowLength, 0);
+			for (uint32_t x = 0; x < this->width; x++) {
+				size_t i = static_cast<size_t>(y) * this->width + x;
+				uint32_t pixel = pPixels[i];
+				int value[3];
+				for (int c = 0; c < 3; c++) {
+					value[c] = (std::min)((std::max)(getChannel(pixel, c) + ((pCurrent[(x + 1) * 3 + c] + 8) >> 4), 0), 255);
+				}
+				// An unchanged pixel keeps its index, but the error of that index still
+				// goes to its neighbours, so changed pixels next to it are dithered as usual.
+				uint8_t index;
+				if (canReuse && (((pixel ^ this->previousPixels[i]) & 0xFFFFFF) == 0)) {
+					index = this->previousIndices[i];
+				} else {
+					index = this->lookup(((value[0] >> 2) << 12) | ((value[1] >> 2) << 6) | (value[2] >> 2));
+				}
+				pIndices[i] = index;
+				uint32_t color = this->palette.colors[index];
+				for (int c = 0; c < 3; c++) {
+					int error = value[c] - getChannel(color, c);
+					pCurrent[(x + 2) * 3 + c] += error * 7;
+					pNext[x * 3 + c] += error * 3;
+					pNext[(x + 1) * 3 + c] += error * 5;
+					pNext[(x + 2) * 3 + c] += error;
+				}
+			}
+		}
+
+		this->previousPixels.assign(pPixels, pPixels + count);
+		this->previousIndices.assign(pIndices, pIndices + count);
+		this->hasPrevious = true;
+	}
+
+	size_t GIFQuantizer::getFrameSize() const {
+		return static_cast<size_t>(this->width) * this->height + PALETTE_SIZE * sizeof(uint32_t);
+	}
+
+	void GIFQuantizer::logReport() const {
+		LOG(LL_NFO, "GIF palettes: ", this->segments, " segments, ", this->newPalettes, " needed a palette of their own");
+	}
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <Windows.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Encoder {
+	enum GIFDither {
+		GIF_DITHER_NONE,
+		// 8x8 Bayer matrix; the same pixels always map to the same indices.
+		GIF_DITHER_BAYER,
+		// Floyd-Steinberg error diffusion. Pixels that did not change since the
+		// previous frame keep their indices, so the noise does not crawl; their
+		// error is diffused all the same.
+		GIF_DITHER_FLOYD_STEINBERG
+	};
+
+	// Reduces BGRA frames to 256 colours for the GIF encoder. Frames come in
+	// segments; each segment gets a palette made by median cut over a 15 bit
+	// histogram of its frames and refined with k-means. FFmpeg's GIF encoder
+	// only crops frames to the rectangle that changed while they use the
+	// palette of the first frame, so a segment keeps that palette unless its
+	// own one is clearly better.
+	class GIFQuantizer {
+	public:
+		GIFQuantizer(uint32_t width, uint32_t height, GIFDither dither);
+
+		static HRESULT parseDither(std::string definition, GIFDither& dither);
+
+		// Adds a frame to the histogram of the current segment.
+		void addToHistogram(const uint8_t* pBGRA);
+		// Chooses the palette for the frames of the current segment and clears the histogram.
+		void endSegment();
+		// Writes the palette indices of a frame followed by the palette, the layout of AV_PIX_FMT_PAL8.
+		void map(const uint8_t* pBGRA, uint8_t* pResult);
+
+		size_t getFrameSize() const;
+		void logReport() const;
+
+	private:
+		struct Bin {
+			float color[3];
+			uint32_t count;
+		};
+
+		struct Palette {
+			// Opaque ARGB entries, as FFmpeg expects them.
+			std::vector<uint32_t> colors;
+			// Channels of the used entries, padded to a multiple of four for the nearest colour search.
+			std::vector<float> channels[3];
+
+			void set(const std::vector<Bin>& entries);
+			size_t findNearest(const float* color, float& distance) const;
+			double measureError(const std::vector<Bin>& bins) const;
+		};
+
+		Palette buildPalette(std::vector<Bin>& bins) const;
+		uint8_t lookup(uint32_t key);
+		void mapOrdered(const uint32_t* pPixels, uint8_t* pIndices);
+		void mapErrorDiffusion(const uint32_t* pPixels, uint8_t* pIndices);
+
+		uint32_t width;
+		uint32_t height;
+		GIFDither dither;
+		std::vector<uint32_t> counts;
+		std::vector<uint64_t> sums;
+		Palette firstPalette;
+		Palette palette;
+		bool isPaletteChanged = false;
+		// Nearest palette index for every colour at 6 bits per channel, filled as colours show up.
+		std::vector<int16_t> lookupTable;
+		std::vector<uint8_t> bayerPositive;
+		std::vector<uint8_t> bayerNegative;
+		std::vector<uint32_t> previousPixels;
+		std::vector<uint8_t> previousIndices;
+		bool hasPrevious = false;
+		uint32_t segments = 0;
+		uint32_t newPalettes = 0;
+	};
+}
@@ -0,0 +1,287 @@
+#include "gop-cache.h"
+#include "logger.h"
+#include "xxhash64.h"
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+
+extern "C" {
+#include <libavutil\imgutils.h>
+#include <libavutil\pixdesc.h>
+}
+
+namespace Encoder {
+
+	namespace {
+		const char GOP_MAGIC[4] = { 'E', 'V', 'E', 'G' };
+		// Version 2 stores decoding timestamps derived from the reorder delay.
+		const uint32_t GOP_VERSION = 2;
+		const uint32_t MAX_PACKET_SIZE = 256 * 1024 * 1024;
+
+		template<typename T>
+		void writeValue(std::ofstream& file, T value) {
+			file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+		}
+
+		template<typename T>
+		bool readValue(std::ifstream& file, T& value) {
+			return !!file.read(reinterpret_cast<char*>(&value), sizeof(T));
+		}
+	}
+
+	GopCache::GopCache(std::string directory, uint32_t gopSize) :
+		directory(directory),
+		gopSize((std::max)(gopSize, 1u))
+	{
+	}
+
+	GopCache::~GopCache() {
+		for (auto& frame : this->frames) {
+			av_frame_free(&frame);
+		}
+	}
+
+	HRESULT GopCache::open(uint64_t settingsHash, int reorderDelay) {
+		PRE();
+		this->settingsHash = settingsHash;
+		this->reorderDelay = (std::max)(reorderDelay, 0);
+		if (!CreateDirectoryA(this->directory.c_str(), NULL) && (GetLastError() != ERROR_ALREADY_EXISTS)) {
+			LOG(LL_ERR, "Could not create GOP cache directory: ", this->directory);
+			POST();
+			return E_FAIL;
+		}
+		LOG(LL_NFO, "Using GOP cache in ", this->directory, " (", this->gopSize, " frames per GOP, settings ", Logger::hex(settingsHash, 16), ")");
+		POST();
+		return S_OK;
+	}
+
+	uint64_t GopCache::hashFrame(const AVFrame* frame) {
+		const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(static_cast<AVPixelFormat>(frame->format));
+		XXH64 state;
+		for (int plane = 0; (plane < AV_NUM_DATA_POINTERS) && frame->data[plane]; plane++) {
+			// Only the visible part of each row; the padding up to linesize is undefined.
+			int rowLength = av_image_get_linesize(static_cast<AVPixelFormat>(frame->format), frame->width, plane);
+			int rows = ((plane == 1) || (plane == 2)) && desc ? AV_CEIL_RSHIFT(frame->height, desc->log2_chroma_h) : frame->height;
+			if (rowLength <= 0) {
+				break;
+			}
+			for (int y = 0; y < rows; y++) {
+				state.update(frame->data[plane] + y * frame->linesize[plane], rowLength);
+			}
+		}
+		return state.digest();
+	}
+
+	HRESULT GopCache::pushFrame(const AVFrame* frame, const Encode& encode, const Write& write) {
+		AVFrame* copy = av_frame_clone(frame);
+		RET_IF_NULL(copy, "Could not copy frame for the GOP cache", E_FAIL);
+		this->frames.push_back(copy);
+		this->frameHashes.push_back(hashFrame(frame));
+		if (this->frames.size() >= this->gopSize) {
+			return this->completeGop(encode, write);
+		}
+		return S_OK;
+	}
+
+	HRESULT GopCache::flushFrames(const Encode& encode, const Write& write) {
+		if (!this->frames.empty()) {
+			return this->completeGop(encode, write);
+		}
+		return S_OK;
+	}
+
+	HRESULT GopCache::completeGop(const Encode& encode, const Write& write) {
+		XXH64 state(this->settingsHash);
+		state.update(this->frameHashes.data(), this->frameHashes.size() * sizeof(uint64_t));
+
+		Gop gop;
+		gop.start = this->nextGopStart;
+		gop.key = state.digest();
+		gop.frameCount = static_cast<uint32_t>(this->frames.size());
+		this->nextGopStart += gop.frameCount;
+
+		HRESULT result = S_OK;
+		if (this->load(gop)) {
+			this->hitCount++;
+			this->reusedFrameCount += gop.frameCount;
+			this->cachedGops.push_back(std::move(gop));
+			if (this->encodingGops.empty()) {
+				result = this->writeCachedGops(INT64_MAX, write);
+			}
+		} else {
+			this->missCount++;
+			this->encodingGops[gop.start] = std::move(gop);
+			for (size_t i = 0; i < this->frames.size(); i++) {
+				if (i == 0) {
+					// Every GOP starts with a keyframe, so that it can be decoded on its own.
+					this->frames[i]->pict_type = AV_PICTURE_TYPE_I;
+					this->frames[i]->key_frame = 1;
+				}
+				encode(this->frames[i]);
+			}
+		}
+
+		for (auto& frame : this->frames) {
+			av_frame_free(&frame);
+		}
+		this->frames.clear();
+		this->frameHashes.clear();
+		return result;
+	}
+
+	HRESULT GopCache::pushPacket(AVPacket* packet, const Write& write) {
+		// GOPs are closed and encoded in order, so no packet of one GOP comes
+		// out of the encoder after a packet of a later one.
+		auto it = this->encodingGops.upper_bound(packet->pts);
+		if (it != this->encodingGops.begin()) {
+			--it;
+			Gop& gop = it->second;
+			// After a cached GOP the encoder takes decoding timestamps from frames before the gap;
+			// the timestamp it would have given without the gap follows from the packet's place in the GOP.
+			packet->dts = gop.start + static_cast<int64_t>(gop.packets.size()) - this->reorderDelay;
+			Packet cached;
+			cached.pts = packet->pts - gop.start;
+			cached.dts = packet->dts - gop.start;
+			cached.duration = packet->duration;
+			cached.flags = packet->flags;
+			cached.data.assign(packet->data, packet->data + packet->size);
+			gop.packets.push_back(std::move(cached));
+			if (gop.packets.size() >= gop.frameCount) {
+				// Some encoders ignore the forced keyframe; such a GOP cannot be decoded on its own.
+				if (!(gop.packets[0].flags & AV_PKT_FLAG_KEY)) {
+					LOG(LL_WRN, "The GOP at frame ", gop.start, " does not start with a keyframe; it was not cached.");
+					this->skippedCount++;
+				} else {
+					LOG_IF_FAILED(this->store(gop), "Could not store GOP in the cache.");
+				}
+				this->encodingGops.erase(it);
+			}
+		}
+
+		HRESULT result = this->writeCachedGops(packet->pts, write);
+		if (FAILED(result)) {
+			return result;
+		}
+		return this->writePacket(packet, write);
+	}
+
+	HRESULT GopCache::finish(const Write& write) {
+		if (!this->encodingGops.empty()) {
+			LOG(LL_WRN, "The encoder returned fewer packets than frames for ", this->encodingGops.size(), " GOPs; they were not cached.");
+			this->encodingGops.clear();
+		}
+		return this->writeCachedGops(INT64_MAX, write);
+	}
+
+	HRESULT GopCache::writeCachedGops(int64_t before, const Write& write) {
+		while (!this->cachedGops.empty() && (this->cachedGops.front().start < before)) {
+			Gop& gop = this->cachedGops.front();
+			for (auto& cached : gop.packets) {
+				AVPacket packet;
+				av_init_packet(&packet);
+				if (av_new_packet(&packet, static_cast<int>(cached.data.size())) < 0) {
+					LOG(LL_ERR, "Could not allocate packet for a cached GOP.");
+					return E_FAIL;
+				}
+				memcpy(packet.data, cached.data.data(), cached.data.size());
+				packet.pts = cached.pts + gop.start;
+				packet.dts = cached.dts + gop.start;
+				packet.duration = cached.duration;
+				packet.flags = cached.flags;
+				HRESULT result = this->writePacket(&packet, write);
+				av_packet_unref(&packet);
+				if (FAILED(result)) {
+					return result;
+				}
+			}
+			this->cachedGops.pop_front();
+		}
+		return S_OK;
+	}
+
+	HRESULT GopCache::writePacket(AVPacket* packet, const Write& write) {
+		if ((packet->dts != AV_NOPTS_VALUE) && (((this->lastDts != INT64_MIN) && (packet->dts <= this->lastDts))
+			|| ((packet->pts != AV_NOPTS_VALUE) && (packet->pts < packet->dts)))) {
+			LOG(LL_ERR, "GOP cache cannot keep packets in decoding order: pts ", packet->pts, ", dts ", packet->dts, " after dts ", this->lastDts,
+				"; the encoder holds back more frames than its reorder delay of ", this->reorderDelay);
+			return E_FAIL;
+		}
+		if (packet->dts != AV_NOPTS_VALUE) {
+			this->lastDts = packet->dts;
+		}
+		write(packet);
+		return S_OK;
+	}
+
+	std::string GopCache::getPath(uint64_t key) const {
+		std::stringstream stream;
+		stream << this->directory << "\\" << std::hex << std::setw(16) << std::setfill('0') << key << ".gop";
+		return stream.str();
+	}
+
+	bool GopCache::load(Gop& gop) const {
+		std::ifstream file(this->getPath(gop.key), std::ios::binary);
+		if (!file) {
+			return false;
+		}
+
+		char magic[sizeof(GOP_MAGIC)];
+		uint32_t version;
+		uint32_t count;
+		if (!file.read(magic, sizeof(magic)) || memcmp(magic, GOP_MAGIC, sizeof(magic)) || !readValue(file, version) || (version != GOP_VERSION)
+			|| !readValue(file, count) || (count != gop.frameCount)) {
+			return false;
+		}
+
+		std::vector<Packet> packets(count);
+		for (auto& packet : packets) {
+			uint32_t size;
+			if (!readValue(file, packet.pts) || !readValue(file, packet.dts) || !readValue(file, packet.duration)
+				|| !readValue(file, packet.flags) || !readValue(file, size) || (size > MAX_PACKET_SIZE)) {
+				return false;
+			}
+			packet.data.resize(size);
+			if (!file.read(reinterpret_cast<char*>(packet.data.data()), size)) {
+				return false;
+			}
+		}
+		gop.packets = std::move(packets);
+		return true;
+	}
+
+	HRESULT GopCache::store(const Gop& gop) const {
+		std::string path = this->getPath(gop.key);
+		std::string temporaryPath = path + ".tmp";
+		{
+			std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+			file.write(GOP_MAGIC, sizeof(GOP_MAGIC));
+			writeValue(file, GOP_VERSION);
+			writeValue(file, static_cast<uint32_t>(gop.packets.size()));
+			for (auto& packet : gop.packets) {
+				writeValue(file, packet.pts);
+				writeValue(file, packet.dts);
+				writeValue(file, packet.duration);
+				writeValue(file, packet.flags);
+				writeValue(file, static_cast<uint32_t>(packet.data.size()));
+				file.write(reinterpret_cast<const char*>(packet.data.data()), packet.data.size());
+			}
+			if (!file) {
+				LOG(LL_ERR, "Could not write ", temporaryPath);
+				return E_FAIL;
+			}
+		}
+		// A GOP only becomes visible to later exports once it has been written completely.
+		if (!MoveFileExA(temporaryPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+			LOG(LL_ERR, "Could not move ", temporaryPath, " to ", path);
+			DeleteFileA(temporaryPath.c_str());
+			return E_FAIL;
+		}
+		return S_OK;
+	}
+
+	void GopCache::logReport() const {
+		LOG(LL_NFO, "GOP cache: ", this->hitCount, " GOPs reused (", this->reusedFrameCount, " frames), ", this->missCount, " GOPs encoded, ",
+			this->skippedCount, " not cached without a keyframe");
+	}
+}
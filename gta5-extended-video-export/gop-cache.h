@@ -0,0 +1,97 @@
+#pragma once
+
+#include <Windows.h>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <libavcodec\avcodec.h>
+}
+
+namespace Encoder {
+	// Reuses encoded groups of pictures from earlier exports. Frames are collected
+	// until a GOP is complete; its key is the hash of every frame together with the
+	// hash of the encoder settings. If a GOP with that key was stored before, its
+	// packets are spliced into the output instead of encoding the frames again.
+	// Otherwise the frames are encoded, starting with a forced keyframe, and the
+	// packets that come back are stored under the key, unless the first of them is
+	// not a keyframe.
+	//
+	// Frame and packet timestamps are in the codec time base, one tick per frame.
+	// Every GOP is closed, so the n-th packet of a GOP in decoding order is given
+	// the decoding timestamp start + n - reorderDelay, as the encoder would give it
+	// in an uninterrupted stream. Cached GOPs keep their timestamps relative to
+	// their start and are moved to their new start with pts and dts together.
+	class GopCache {
+	public:
+		typedef std::function<void(AVFrame*)> Encode;
+		typedef std::function<void(AVPacket*)> Write;
+
+		GopCache(std::string directory, uint32_t gopSize);
+		~GopCache();
+
+		// The reorder delay is the number of frames the encoder holds back for B-frames (has_b_frames).
+		HRESULT open(uint64_t settingsHash, int reorderDelay);
+		uint32_t getGopSize() const { return this->gopSize; }
+
+		// Takes a copy of the frame; encodes or splices the GOP it completes.
+		// Fails if packets could not be written in decoding order.
+		HRESULT pushFrame(const AVFrame* frame, const Encode& encode, const Write& write);
+		// Encodes or splices the last, incomplete GOP. Call before draining the encoder.
+		HRESULT flushFrames(const Encode& encode, const Write& write);
+		// Handles a packet that came out of the encoder.
+		HRESULT pushPacket(AVPacket* packet, const Write& write);
+		// Writes the GOPs still waiting for earlier packets. Call after draining the encoder.
+		HRESULT finish(const Write& write);
+
+		void logReport() const;
+
+		static uint64_t hashFrame(const AVFrame* frame);
+
+	private:
+		struct Packet {
+			int64_t pts;
+			int64_t dts;
+			int64_t duration;
+			int flags;
+			std::vector<uint8_t> data;
+		};
+
+		struct Gop {
+			int64_t start = 0;
+			uint64_t key = 0;
+			uint32_t frameCount = 0;
+			std::vector<Packet> packets;
+		};
+
+		HRESULT completeGop(const Encode& encode, const Write& write);
+		HRESULT writeCachedGops(int64_t before, const Write& write);
+		HRESULT writePacket(AVPacket* packet, const Write& write);
+		std::string getPath(uint64_t key) const;
+		bool load(Gop& gop) const;
+		HRESULT store(const Gop& gop) const;
+
+		std::string directory;
+		uint32_t gopSize;
+		uint64_t settingsHash = 0;
+		int reorderDelay = 0;
+
+		std::vector<AVFrame*> frames;
+		std::vector<uint64_t> frameHashes;
+		int64_t nextGopStart = 0;
+		// GOPs that are being encoded, by their first frame.
+		std::map<int64_t, Gop> encodingGops;
+		// Cached GOPs that wait until the packets of the frames before them have been written.
+		std::deque<Gop> cachedGops;
+		int64_t lastDts = INT64_MIN;
+
+		uint64_t hitCount = 0;
+		uint64_t missCount = 0;
+		uint64_t reusedFrameCount = 0;
+		uint64_t skippedCount = 0;
+	};
+}
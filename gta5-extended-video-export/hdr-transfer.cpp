@@ -0,0 +1,124 @@
+#include "hdr-transfer.h"
+#include "logger.h"
+#include "task-scheduler.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <emmintrin.h>
+
+namespace Encoder {
+
+	namespace {
+		// The table covers the transfer input from 2^-32 to 1 in steps of the top 10 mantissa bits.
+		const int TABLE_OCTAVES = 32;
+		const int TABLE_MANTISSA_BITS = 10;
+		const uint32_t TABLE_FIRST_INDEX = (127 - TABLE_OCTAVES) << TABLE_MANTISSA_BITS;
+		const size_t TABLE_SIZE = (TABLE_OCTAVES << TABLE_MANTISSA_BITS) + 1;
+
+		// Minimum number of pixels per encoding task.
+		const size_t ENCODE_GRAIN = 16 * 1024;
+
+		// BT.2087 conversion from linear BT.709 to linear BT.2020 RGB.
+		const double BT709_TO_BT2020[3][3] = {
+			{ 0.627403914928699, 0.329283038377884, 0.043313046693417 },
+			{ 0.069097289358232, 0.919540395075459, 0.011362315566309 },
+			{ 0.016391438875150, 0.088013307877226, 0.895595253247624 }
+		};
+
+		// Scene light that HLG encodes at 75%, the reference white of BT.2408.
+		const double HLG_REFERENCE_LIGHT = 0.26496256;
+		const double HLG_REFERENCE_WHITE = 203.0;
+		const double PQ_PEAK = 10000.0;
+
+		double encodePQ(double value) {
+			const double m1 = 2610.0 / 16384;
+			const double m2 = 2523.0 / 4096 * 128;
+			const double c1 = 3424.0 / 4096;
+			const double c2 = 2413.0 / 4096 * 32;
+			const double c3 = 2392.0 / 4096 * 32;
+			double power = std::pow(value, m1);
+			return std::pow((c1 + c2 * power) / (1 + c3 * power), m2);
+		}
+
+		double encodeHLG(double value) {
+			const double a = 0.17883277;
+			const double b = 0.28466892;
+			const double c = 0.55991073;
+			return value <= 1.0 / 12 ? std::sqrt(3 * value) : a * std::log(12 * value - b) + c;
+		}
+	}
+
+	HDRTransfer::HDRTransfer(HDRTransferFunction function, float referenceWhite) :
+		function(function),
+		table(TABLE_SIZE)
+	{
+		double scale = function == HDR_TRANSFER_PQ ? referenceWhite / PQ_PEAK : HLG_REFERENCE_LIGHT * referenceWhite / HLG_REFERENCE_WHITE;
+		for (int input = 0; input < 3; input++) {
+			for (int output = 0; output < 3; output++) {
+				this->matrix[input][output] = static_cast<float>(BT709_TO_BT2020[output][input] * scale);
+			}
+			this->matrix[input][3] = 0;
+		}
+
+		for (size_t i = 0; i < TABLE_SIZE; i++) {
+			// The middle of the range of inputs that share this entry.
+			uint32_t bits = static_cast<uint32_t>((TABLE_FIRST_INDEX + i) << (23 - TABLE_MANTISSA_BITS)) | (1u << (22 - TABLE_MANTISSA_BITS));
+			float value;
+			memcpy(&value, &bits, sizeof(value));
+			double encoded = function == HDR_TRANSFER_PQ ? encodePQ((std::min)(value, 1.0f)) : encodeHLG((std::min)(value, 1.0f));
+			this->table[i] = static_cast<uint16_t>(std::lround((std::min)((std::max)(encoded, 0.0), 1.0) * 65535));
+		}
+		this->table[0] = 0;
+	}
+
+	HRESULT HDRTransfer::parse(std::string definition, HDRTransferFunction& function) {
+		definition.erase(std::remove_if(definition.begin(), definition.end(), ::isspace), definition.end());
+		std::transform(definition.begin(), definition.end(), definition.begin(), ::tolower);
+		if (definition.empty() || (definition == "off")) {
+			function = HDR_TRANSFER_NONE;
+			return S_OK;
+		}
+		if (definition == "pq") {
+			function = HDR_TRANSFER_PQ;
+			return S_OK;
+		}
+		if (definition == "hlg") {
+			function = HDR_TRANSFER_HLG;
+			return S_OK;
+		}
+		LOG(LL_ERR, "Invalid HDR transfer function: ", definition);
+		return E_FAIL;
+	}
+
+	void HDRTransfer::encode(const float* pRGBA, uint16_t* pRGB, size_t pixels) const {
+		const float (*matrix)[4] = this->matrix;
+		const uint16_t* table = this->table.data();
+		TaskScheduler::instance().parallelFor(0, pixels, ENCODE_GRAIN, [=](size_t begin, size_t end) {
+			const __m128 red = _mm_loadu_ps(matrix[0]);
+			const __m128 green = _mm_loadu_ps(matrix[1]);
+			const __m128 blue = _mm_loadu_ps(matrix[2]);
+			const __m128 minimum = _mm_castsi128_ps(_mm_set1_epi32(TABLE_FIRST_INDEX << (23 - TABLE_MANTISSA_BITS)));
+			const __m128 maximum = _mm_set1_ps(1.0f);
+			const __m128i first = _mm_set1_epi32(TABLE_FIRST_INDEX);
+			alignas(16) uint32_t indices[4];
+			for (size_t i = begin; i < end; i++) {
+				__m128 pixel = _mm_loadu_ps(pRGBA + 4 * i);
+				__m128 rgb = _mm_add_ps(_mm_add_ps(
+					_mm_mul_ps(_mm_shuffle_ps(pixel, pixel, _MM_SHUFFLE(0, 0, 0, 0)), red),
+					_mm_mul_ps(_mm_shuffle_ps(pixel, pixel, _MM_SHUFFLE(1, 1, 1, 1)), green)),
+					_mm_mul_ps(_mm_shuffle_ps(pixel, pixel, _MM_SHUFFLE(2, 2, 2, 2)), blue));
+				// Negative values and NaNs end up on the first entry, which encodes black.
+				rgb = _mm_min_ps(_mm_max_ps(rgb, minimum), maximum);
+				__m128i index = _mm_sub_epi32(_mm_srli_epi32(_mm_castps_si128(rgb), 23 - TABLE_MANTISSA_BITS), first);
+				_mm_store_si128(reinterpret_cast<__m128i*>(indices), index);
+				pRGB[3 * i] = table[indices[0]];
+				pRGB[3 * i + 1] = table[indices[1]];
+				pRGB[3 * i + 2] = table[indices[2]];
+			}
+		});
+	}
+
+	AVColorTransferCharacteristic HDRTransfer::getColorTransfer() const {
+		return this->function == HDR_TRANSFER_PQ ? AVCOL_TRC_SMPTE2084 : AVCOL_TRC_ARIB_STD_B67;
+	}
+}
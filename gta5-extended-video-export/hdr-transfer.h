@@ -0,0 +1,43 @@
+#pragma once
+
+#include <Windows.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <libavutil\pixfmt.h>
+}
+
+namespace Encoder {
+	enum HDRTransferFunction {
+		HDR_TRANSFER_NONE,
+		// SMPTE ST 2084, absolute luminance up to 10000 nits.
+		HDR_TRANSFER_PQ,
+		// ARIB STD-B67 hybrid log-gamma, relative to the display's peak.
+		HDR_TRANSFER_HLG
+	};
+
+	// Encodes the game's scene linear HDR colour, which has BT.709 primaries,
+	// as BT.2020 RGB with a PQ or HLG transfer. The result is 16 bit RGB that
+	// swscale turns into 10 bit YUV. The transfer curve is a table indexed by
+	// the exponent and the top 10 mantissa bits of each float.
+	class HDRTransfer {
+	public:
+		// referenceWhite is the luminance in nits that a linear value of 1.0 is shown at.
+		HDRTransfer(HDRTransferFunction function, float referenceWhite);
+
+		static HRESULT parse(std::string definition, HDRTransferFunction& function);
+
+		// Converts RGBA floats to RGB48, dropping alpha.
+		void encode(const float* pRGBA, uint16_t* pRGB, size_t pixels) const;
+
+		AVColorTransferCharacteristic getColorTransfer() const;
+
+	private:
+		HDRTransferFunction function;
+		// Columns of the BT.709 to BT.2020 matrix, scaled to the transfer's input range.
+		float matrix[3][4];
+		std::vector<uint16_t> table;
+	};
+}
@@ -0,0 +1,188 @@
+#include "image-pack.h"
+#include "logger.h"
+#include <cstring>
+
+namespace Encoder {
+
+	namespace {
+		const char ENTRY_MAGIC[4] = { 'E', 'V', 'E', 'P' };
+		const char INDEX_MAGIC[4] = { 'E', 'V', 'E', 'I' };
+		const uint64_t FOOTER_SIZE = sizeof(uint64_t) + sizeof(uint32_t) + sizeof(INDEX_MAGIC);
+		const uint64_t ENTRY_HEADER_SIZE = sizeof(ENTRY_MAGIC) + sizeof(uint32_t) + sizeof(uint64_t);
+
+		template<typename T>
+		bool readValue(std::ifstream& file, T& value) {
+			return !!file.read(reinterpret_cast<char*>(&value), sizeof(T));
+		}
+	}
+
+	ImagePackWriter::~ImagePackWriter() {
+		this->close();
+	}
+
+	HRESULT ImagePackWriter::open(std::string path) {
+		PRE();
+		std::lock_guard<std::mutex> lock(this->mxFile);
+		this->file.open(path, std::ios::binary | std::ios::trunc);
+		if (!this->file) {
+			LOG(LL_ERR, "Could not create image pack: ", path);
+			POST();
+			return E_FAIL;
+		}
+		this->path = path;
+		this->position = 0;
+		this->entries.clear();
+		this->hasher = BlockHasher();
+		POST();
+		return S_OK;
+	}
+
+	HRESULT ImagePackWriter::append(const std::string& name, const uint8_t* pData, uint64_t size) {
+		std::lock_guard<std::mutex> lock(this->mxFile);
+		if (!this->file.is_open()) {
+			return E_FAIL;
+		}
+
+		ImagePackEntry entry;
+		entry.name = name;
+		entry.offset = this->position + ENTRY_HEADER_SIZE + name.size();
+		entry.size = size;
+
+		this->writeBytes(ENTRY_MAGIC, sizeof(ENTRY_MAGIC));
+		this->writeValue(static_cast<uint32_t>(name.size()));
+		this->writeValue(size);
+		this->writeBytes(name.data(), name.size());
+		this->writeBytes(pData, size);
+		if (!this->file) {
+			LOG(LL_ERR, "Could not write ", name, " to the image pack.");
+			return E_FAIL;
+		}
+
+		this->position = entry.offset + size;
+		this->entries.push_back(entry);
+		return S_OK;
+	}
+
+	HRESULT ImagePackWriter::close() {
+		std::lock_guard<std::mutex> lock(this->mxFile);
+		if (!this->file.is_open()) {
+			return S_OK;
+		}
+
+		for (auto& entry : this->entries) {
+			this->writeValue(static_cast<uint32_t>(entry.name.size()));
+			this->writeBytes(entry.name.data(), entry.name.size());
+			this->writeValue(entry.offset);
+			this->writeValue(entry.size);
+		}
+		this->writeValue(this->position);
+		this->writeValue(static_cast<uint32_t>(this->entries.size()));
+		this->writeBytes(INDEX_MAGIC, sizeof(INDEX_MAGIC));
+
+		bool isWritten = !!this->file;
+		this->file.close();
+		// The pack is only ever appended to, so no part of it is read back.
+		this->hasher.finish(this->path, this->digest);
+		return isWritten ? S_OK : E_FAIL;
+	}
+
+	void ImagePackWriter::writeBytes(const void* pData, uint64_t size) {
+		this->file.write(static_cast<const char*>(pData), size);
+		this->hasher.write(this->hasher.getSize(), pData, static_cast<size_t>(size));
+	}
+
+	HRESULT ImagePackReader::open(std::string path) {
+		PRE();
+		this->file.open(path, std::ios::binary);
+		if (!this->file) {
+			LOG(LL_ERR, "Could not open image pack: ", path);
+			POST();
+			return E_FAIL;
+		}
+
+		this->file.seekg(0, std::ios::end);
+		uint64_t fileSize = static_cast<uint64_t>(this->file.tellg());
+		this->entries.clear();
+		this->isIndexed = SUCCEEDED(this->readIndex(fileSize));
+		if (!this->isIndexed) {
+			LOG(LL_WRN, "Image pack has no index, scanning entries: ", path);
+			this->file.clear();
+			RET_IF_FAILED(this->scanEntries(fileSize), "Could not read image pack: " + path, E_FAIL);
+		}
+		POST();
+		return S_OK;
+	}
+
+	HRESULT ImagePackReader::readIndex(uint64_t fileSize) {
+		if (fileSize < FOOTER_SIZE) {
+			return E_FAIL;
+		}
+
+		uint64_t indexOffset;
+		uint32_t count;
+		char magic[sizeof(INDEX_MAGIC)];
+		this->file.seekg(fileSize - FOOTER_SIZE);
+		if (!readValue(this->file, indexOffset) || !readValue(this->file, count)
+			|| !this->file.read(magic, sizeof(magic)) || memcmp(magic, INDEX_MAGIC, sizeof(magic))
+			|| (indexOffset > fileSize - FOOTER_SIZE)) {
+			return E_FAIL;
+		}
+
+		this->file.seekg(indexOffset);
+		for (uint32_t i = 0; i < count; i++) {
+			ImagePackEntry entry;
+			uint32_t nameLength;
+			if (!readValue(this->file, nameLength) || (nameLength > fileSize)) {
+				return E_FAIL;
+			}
+			entry.name.resize(nameLength);
+			if (!this->file.read(&entry.name[0], nameLength) || !readValue(this->file, entry.offset) || !readValue(this->file, entry.size)
+				|| (entry.offset + entry.size > indexOffset)) {
+				return E_FAIL;
+			}
+			this->entries.push_back(entry);
+		}
+		return S_OK;
+	}
+
+	HRESULT ImagePackReader::scanEntries(uint64_t fileSize) {
+		this->entries.clear();
+		uint64_t position = 0;
+		while (position + ENTRY_HEADER_SIZE <= fileSize) {
+			char magic[sizeof(ENTRY_MAGIC)];
+			uint32_t nameLength;
+			ImagePackEntry entry;
+			this->file.seekg(position);
+			if (!this->file.read(magic, sizeof(magic)) || memcmp(magic, ENTRY_MAGIC, sizeof(magic))) {
+				// The index, or the torn end of an interrupted export.
+				break;
+			}
+			if (!readValue(this->file, nameLength) || !readValue(this->file, entry.size)) {
+				break;
+			}
+			entry.offset = position + ENTRY_HEADER_SIZE + nameLength;
+			if (entry.offset + entry.size > fileSize) {
+				LOG(LL_WRN, "Image pack ends in the middle of an entry.");
+				break;
+			}
+			entry.name.resize(nameLength);
+			if (!this->file.read(&entry.name[0], nameLength)) {
+				break;
+			}
+			this->entries.push_back(entry);
+			position = entry.offset + entry.size;
+		}
+		this->file.clear();
+		return S_OK;
+	}
+
+	HRESULT ImagePackReader::read(const ImagePackEntry& entry, std::vector<uint8_t>& data) {
+		data.resize(static_cast<size_t>(entry.size));
+		this->file.seekg(entry.offset);
+		if (!this->file.read(reinterpret_cast<char*>(data.data()), entry.size)) {
+			this->file.clear();
+			return E_FAIL;
+		}
+		return S_OK;
+	}
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <Windows.h>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "block-hasher.h"
+
+namespace Encoder {
+	// Append-only container for image sequences. Every entry is stored as
+	//   "EVEP" | uint32 name length | uint64 data length | name | data
+	// and closing the pack appends the index of all entries, followed by
+	//   uint64 index offset | uint32 entry count | "EVEI".
+	// A pack that was never closed has no index and is read by scanning its entries.
+	struct ImagePackEntry {
+		std::string name;
+		uint64_t offset;
+		uint64_t size;
+	};
+
+	class ImagePackWriter {
+	public:
+		~ImagePackWriter();
+
+		HRESULT open(std::string path);
+		HRESULT append(const std::string& name, const uint8_t* pData, uint64_t size);
+		HRESULT close();
+
+		// Digest of the pack as it was written (see BlockHasher), valid after close().
+		uint64_t getDigest() const { return this->digest; }
+		uint64_t getSize() const { return this->hasher.getSize(); }
+		const std::string& getPath() const { return this->path; }
+		bool isOpen() const { return this->file.is_open(); }
+
+	private:
+		template<typename T>
+		void writeValue(T value) {
+			this->writeBytes(&value, sizeof(T));
+		}
+		void writeBytes(const void* pData, uint64_t size);
+
+		std::mutex mxFile;
+		std::ofstream file;
+		std::string path;
+		uint64_t position = 0;
+		std::vector<ImagePackEntry> entries;
+		BlockHasher hasher;
+		uint64_t digest = 0;
+	};
+
+	class ImagePackReader {
+	public:
+		HRESULT open(std::string path);
+		HRESULT read(const ImagePackEntry& entry, std::vector<uint8_t>& data);
+
+		const std::vector<ImagePackEntry>& getEntries() const { return this->entries; }
+		bool hasIndex() const { return this->isIndexed; }
+
+	private:
+		HRESULT readIndex(uint64_t fileSize);
+		HRESULT scanEntries(uint64_t fileSize);
+
+		std::ifstream file;
+		std::vector<ImagePackEntry> entries;
+		bool isIndexed = false;
+	};
+}
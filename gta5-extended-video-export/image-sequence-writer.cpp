@@ -0,0 +1,197 @@
+#include "image-sequence-writer.h"
+#include "logger.h"
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+namespace Encoder {
+
+	// Number of images that may wait for the I/O thread before producers block.
+	const uint32_t IMAGE_QUEUE_CAPACITY = 32;
+	const int MEMORY_FILE_BUFFER_SIZE = 64 * 1024;
+
+	namespace {
+		// A file the muxer writes into memory; it is handed to the writer when it is closed.
+		struct MemoryFile {
+			std::string name;
+			std::shared_ptr<std::vector<uint8_t>> pData;
+		};
+
+		int writeMemoryFile(void* opaque, uint8_t* buf, int size) {
+			MemoryFile* pFile = static_cast<MemoryFile*>(opaque);
+			pFile->pData->insert(pFile->pData->end(), buf, buf + size);
+			return size;
+		}
+	}
+
+	ImageSequenceWriter::ImageSequenceWriter(std::string directory, std::string packName, ImageSequenceLayout layout, uint32_t shardSize) :
+		directory(directory),
+		packName(packName),
+		layout(layout),
+		shardSize((std::max)(shardSize, 1u)),
+		imageQueue(IMAGE_QUEUE_CAPACITY)
+	{
+	}
+
+	ImageSequenceWriter::~ImageSequenceWriter() {
+		this->finish();
+	}
+
+	HRESULT ImageSequenceWriter::parseLayout(std::string definition, ImageSequenceLayout& layout, uint32_t& shardSize) {
+		definition.erase(std::remove_if(definition.begin(), definition.end(), ::isspace), definition.end());
+		std::transform(definition.begin(), definition.end(), definition.begin(), ::tolower);
+		shardSize = 0;
+		if (definition.empty() || (definition == "flat")) {
+			layout = IMAGE_SEQUENCE_FLAT;
+			return S_OK;
+		}
+		if (definition == "pack") {
+			layout = IMAGE_SEQUENCE_PACKED;
+			return S_OK;
+		}
+		if (definition.compare(0, 6, "shard:") == 0) {
+			try {
+				shardSize = std::stoul(definition.substr(6));
+			} catch (std::exception&) {
+				shardSize = 0;
+			}
+			if (shardSize > 0) {
+				layout = IMAGE_SEQUENCE_SHARDED;
+				return S_OK;
+			}
+		}
+		LOG(LL_ERR, "Invalid image sequence layout: ", definition);
+		return E_FAIL;
+	}
+
+	HRESULT ImageSequenceWriter::open(const ThreadPolicy& policy) {
+		PRE();
+		if (!CreateDirectoryA(this->directory.c_str(), NULL) && (GetLastError() != ERROR_ALREADY_EXISTS)) {
+			LOG(LL_ERR, "Could not create directory: ", this->directory);
+			POST();
+			return E_FAIL;
+		}
+		if (this->layout == IMAGE_SEQUENCE_PACKED) {
+			RET_IF_FAILED(this->pack.open(this->directory + "\\" + this->packName), "Could not create image pack", E_FAIL);
+		}
+		this->thread_io = std::thread(&ImageSequenceWriter::ioThread, this);
+		policy.applyToEXRThread(this->thread_io);
+		POST();
+		return S_OK;
+	}
+
+	void ImageSequenceWriter::write(uint64_t index, std::string name, std::shared_ptr<std::vector<uint8_t>> pData) {
+		this->imageQueue.enqueue(Image(index, name, pData));
+	}
+
+	void ImageSequenceWriter::ioThread() {
+		PRE();
+		try {
+			Image image = this->imageQueue.dequeue();
+			while (!image.isEndOfStream) {
+				this->writeNow(image);
+				image = this->imageQueue.dequeue();
+			}
+		} catch (std::exception& ex) {
+			LOG(LL_ERR, ex.what());
+		}
+		POST();
+	}
+
+	void ImageSequenceWriter::writeNow(const Image& image) {
+		const std::vector<uint8_t>& data = *image.pData;
+		if (this->layout == IMAGE_SEQUENCE_PACKED) {
+			LOG_IF_FAILED(this->pack.append(image.name, data.data(), data.size()), "Could not append image to the pack.");
+			return;
+		}
+
+		std::string path = this->directory;
+		if (this->layout == IMAGE_SEQUENCE_SHARDED) {
+			uint64_t shard = image.index / this->shardSize;
+			std::stringstream shardName;
+			shardName << std::setw(6) << std::setfill('0') << shard * this->shardSize;
+			path += "\\" + shardName.str();
+			if (this->createdShards.insert(shard).second) {
+				if (!CreateDirectoryA(path.c_str(), NULL) && (GetLastError() != ERROR_ALREADY_EXISTS)) {
+					LOG(LL_ERR, "Could not create directory: ", path);
+				}
+			}
+		}
+		path += "\\" + image.name;
+
+		std::ofstream file(path, std::ios::binary | std::ios::trunc);
+		file.write(reinterpret_cast<const char*>(data.data()), data.size());
+		if (!file) {
+			LOG(LL_ERR, "Could not write image: ", path);
+			return;
+		}
+
+		if (this->manifest) {
+			BlockHasher hasher;
+			uint64_t digest;
+			hasher.write(0, data.data(), data.size());
+			hasher.finish(path, digest);
+			this->manifest->add(path, data.size(), digest);
+		}
+	}
+
+	HRESULT ImageSequenceWriter::finish() {
+		PRE();
+		std::lock_guard<std::mutex> lock(this->mxFinish);
+		if (this->thread_io.joinable()) {
+			this->imageQueue.enqueue(Image());
+			this->thread_io.join();
+		}
+		bool isPackOpen = this->pack.isOpen();
+		HRESULT result = this->pack.close();
+		if (isPackOpen && this->manifest) {
+			this->manifest->add(this->pack.getPath(), this->pack.getSize(), this->pack.getDigest());
+		}
+		POST();
+		return result;
+	}
+
+	void ImageSequenceWriter::attach(AVFormatContext* fmtContext) {
+		fmtContext->opaque = this;
+		fmtContext->io_open = &ImageSequenceWriter::openFile;
+		fmtContext->io_close = &ImageSequenceWriter::closeFile;
+	}
+
+	int ImageSequenceWriter::openFile(AVFormatContext* s, AVIOContext** pb, const char* url, int flags, AVDictionary** options) {
+		if (!(flags & AVIO_FLAG_WRITE)) {
+			return AVERROR(EINVAL);
+		}
+
+		std::string name(url);
+		size_t separator = name.find_last_of("\\/");
+		if (separator != std::string::npos) {
+			name = name.substr(separator + 1);
+		}
+
+		MemoryFile* pFile = new MemoryFile();
+		pFile->name = name;
+		pFile->pData = std::make_shared<std::vector<uint8_t>>();
+
+		uint8_t* buffer = static_cast<uint8_t*>(av_malloc(MEMORY_FILE_BUFFER_SIZE));
+		*pb = buffer ? avio_alloc_context(buffer, MEMORY_FILE_BUFFER_SIZE, 1, pFile, NULL, writeMemoryFile, NULL) : NULL;
+		if (!*pb) {
+			av_free(buffer);
+			delete pFile;
+			return AVERROR(ENOMEM);
+		}
+		return 0;
+	}
+
+	void ImageSequenceWriter::closeFile(AVFormatContext* s, AVIOContext* pb) {
+		if (!pb) {
+			return;
+		}
+		avio_flush(pb);
+		MemoryFile* pFile = static_cast<MemoryFile*>(pb->opaque);
+		ImageSequenceWriter* pWriter = static_cast<ImageSequenceWriter*>(s->opaque);
+		pWriter->write(pWriter->nextFileIndex++, pFile->name, pFile->pData);
+		delete pFile;
+		av_freep(&pb->buffer);
+		av_freep(&pb);
+	}
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <Windows.h>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include "image-pack.h"
+#include "output-manifest.h"
+#include "SafeQueue.h"
+#include "thread-policy.h"
+
+extern "C" {
+#include <libavformat\avformat.h>
+}
+
+namespace Encoder {
+	enum ImageSequenceLayout {
+		// Every image in the output directory.
+		IMAGE_SEQUENCE_FLAT,
+		// A subdirectory for every shardSize images.
+		IMAGE_SEQUENCE_SHARDED,
+		// Every image appended to a single indexed pack file.
+		IMAGE_SEQUENCE_PACKED
+	};
+
+	// Writes finished images of a sequence on its own I/O thread, so that
+	// creating files and directories does not hold up the encoder threads.
+	class ImageSequenceWriter {
+	public:
+		ImageSequenceWriter(std::string directory, std::string packName, ImageSequenceLayout layout, uint32_t shardSize);
+		~ImageSequenceWriter();
+
+		// Parses "flat", "shard:<images per directory>" or "pack".
+		static HRESULT parseLayout(std::string definition, ImageSequenceLayout& layout, uint32_t& shardSize);
+
+		HRESULT open(const ThreadPolicy& policy);
+		// Queues an image; blocks while the I/O thread is too far behind.
+		void write(uint64_t index, std::string name, std::shared_ptr<std::vector<uint8_t>> pData);
+		HRESULT finish();
+
+		// Routes the files that an image sequence muxer (image2) creates through this writer.
+		void attach(AVFormatContext* fmtContext);
+
+		// Adds the digest of every file written from now on to the manifest.
+		void setManifest(std::shared_ptr<OutputManifest> manifest) { this->manifest = manifest; }
+
+		ImageSequenceLayout getLayout() const { return this->layout; }
+
+	private:
+		struct Image {
+			Image() :
+				index(0),
+				isEndOfStream(true)
+			{ }
+
+			Image(uint64_t index, std::string name, std::shared_ptr<std::vector<uint8_t>> pData) :
+				index(index),
+				name(name),
+				pData(pData),
+				isEndOfStream(false)
+			{ }
+
+			uint64_t index;
+			std::string name;
+			std::shared_ptr<std::vector<uint8_t>> pData;
+			bool isEndOfStream;
+		};
+
+		static int openFile(AVFormatContext* s, AVIOContext** pb, const char* url, int flags, AVDictionary** options);
+		static void closeFile(AVFormatContext* s, AVIOContext* pb);
+
+		void ioThread();
+		void writeNow(const Image& image);
+
+		std::string directory;
+		std::string packName;
+		ImageSequenceLayout layout;
+		uint32_t shardSize;
+
+		ImagePackWriter pack;
+		std::shared_ptr<OutputManifest> manifest;
+		SafeQueue<Image> imageQueue;
+		std::thread thread_io;
+		std::mutex mxFinish;
+		uint64_t nextFileIndex = 0;
+		std::set<uint64_t> createdShards;
+	};
+}
@@ -0,0 +1,116 @@
+#include "live-stream.h"
+#include "logger.h"
+#include <algorithm>
+
+extern "C" {
+#include <libavutil\opt.h>
+}
+
+namespace Encoder {
+
+	namespace {
+		// Longest the muxer may hold packets back to interleave audio and video.
+		const int64_t MAX_MUX_DELAY = 100000;
+		// A write that takes longer than this fails instead of stalling the encoder.
+		const char* const WRITE_TIMEOUT = "5000000";
+		// Capture times of frames whose packets never showed up are forgotten after this many frames.
+		const size_t MAX_PENDING_FRAMES = 256;
+	}
+
+	LiveStream::LiveStream(std::string url) :
+		url(url)
+	{
+		avformat_network_init();
+	}
+
+	LiveStream::~LiveStream() {
+		avformat_network_deinit();
+	}
+
+	std::string LiveStream::getFormat(std::string url, std::string format) {
+		std::string protocol = url.substr(0, url.find("://"));
+		std::transform(protocol.begin(), protocol.end(), protocol.begin(), ::tolower);
+		if ((protocol == "rtmp") || (protocol == "rtmps")) {
+			return "flv";
+		} else if ((protocol == "srt") || (protocol == "udp") || (protocol == "rtp")) {
+			return "mpegts";
+		}
+		return format;
+	}
+
+	void LiveStream::tuneEncoder(AVCodecContext* context, AVDictionary** options, bool isGopFixed) const {
+		context->max_b_frames = 0;
+		context->flags |= AV_CODEC_FLAG_LOW_DELAY;
+		if (!isGopFixed) {
+			// A viewer that joins or loses packets waits at most a second for the next keyframe.
+			context->gop_size = (std::max)(1, static_cast<int>(av_q2d(context->framerate) + 0.5));
+		}
+
+		std::string name = context->codec->name;
+		const AVClass* privateClass = context->codec->priv_class;
+		if ((name == "libx264") || (name == "libx265")) {
+			av_dict_set(options, "tune", "zerolatency", AV_DICT_DONT_OVERWRITE);
+		} else if (privateClass && av_opt_find(&privateClass, "zerolatency", NULL, 0, AV_OPT_SEARCH_FAKE_OBJ)) {
+			av_dict_set(options, "zerolatency", "1", AV_DICT_DONT_OVERWRITE);
+		}
+		LOG(LL_NFO, "Live stream: encoder tuned for latency, GOP of ", context->gop_size, " frames");
+	}
+
+	void LiveStream::tuneMuxer(AVFormatContext* context) const {
+		context->flags |= AVFMT_FLAG_FLUSH_PACKETS;
+		context->max_delay = MAX_MUX_DELAY;
+		context->max_interleave_delta = MAX_MUX_DELAY;
+	}
+
+	HRESULT LiveStream::open(AVIOContext** ppContext) const {
+		PRE();
+		AVDictionary* options = NULL;
+		av_dict_set(&options, "rw_timeout", WRITE_TIMEOUT, 0);
+		int result = avio_open2(ppContext, this->url.c_str(), AVIO_FLAG_WRITE, NULL, &options);
+		av_dict_free(&options);
+		RET_IF_FAILED_AV(result, "Could not connect to " + this->url, E_FAIL);
+		LOG(LL_NFO, "Streaming to ", this->url);
+		POST();
+		return S_OK;
+	}
+
+	void LiveStream::addFrame(int64_t pts, std::chrono::steady_clock::time_point captureTime) {
+		std::lock_guard<std::mutex> lock(this->mxFrames);
+		this->captureTimes[pts] = captureTime;
+		if (this->captureTimes.size() > MAX_PENDING_FRAMES) {
+			this->captureTimes.erase(this->captureTimes.begin());
+		}
+	}
+
+	void LiveStream::sentPacket(int64_t pts, bool isWritten) {
+		auto now = std::chrono::steady_clock::now();
+		std::lock_guard<std::mutex> lock(this->mxFrames);
+		if (!isWritten) {
+			this->failedWrites++;
+		}
+		auto it = this->captureTimes.find(pts);
+		if (it == this->captureTimes.end()) {
+			return;
+		}
+		uint64_t latency = std::chrono::duration_cast<std::chrono::microseconds>(now - it->second).count();
+		this->captureTimes.erase(it);
+		if (isWritten) {
+			this->sentFrames++;
+			this->totalLatency += latency;
+			this->maxLatency = (std::max)(this->maxLatency, latency);
+		}
+	}
+
+	void LiveStream::dropFrame() {
+		std::lock_guard<std::mutex> lock(this->mxFrames);
+		this->droppedFrames++;
+	}
+
+	void LiveStream::logReport() {
+		std::lock_guard<std::mutex> lock(this->mxFrames);
+		LOG(LL_NFO, "Live stream: ", this->sentFrames, " frames sent, ", this->droppedFrames, " dropped, ",
+			this->failedWrites, " failed writes; capture to wire latency ",
+			this->sentFrames ? this->totalLatency / this->sentFrames / 1000 : 0, " ms average, ",
+			this->maxLatency / 1000, " ms max");
+	}
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <Windows.h>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+
+extern "C" {
+#include <libavcodec\avcodec.h>
+#include <libavformat\avformat.h>
+}
+
+namespace Encoder {
+	// An export streamed to a network endpoint (RTMP, SRT, UDP, ...) instead of a
+	// file. The encoder is set up for latency, packets are flushed as soon as they
+	// are muxed, and the time from capturing a frame to writing its packet out is
+	// measured. Frames the link cannot keep up with are dropped by the session.
+	class LiveStream {
+	public:
+		LiveStream(std::string url);
+		~LiveStream();
+
+		// Container format for the URL's protocol, or the given one if the protocol does not imply any.
+		static std::string getFormat(std::string url, std::string format);
+
+		// Sets no B-frames, one second GOPs and the encoder's low latency options, unless the preset sets them.
+		void tuneEncoder(AVCodecContext* context, AVDictionary** options, bool isGopFixed) const;
+		void tuneMuxer(AVFormatContext* context) const;
+		// Opens the URL; a link that stops taking data fails the writes instead of hanging the export.
+		HRESULT open(AVIOContext** ppContext) const;
+
+		// Capture time of the frame that is encoded with the given timestamp, in the codec time base.
+		void addFrame(int64_t pts, std::chrono::steady_clock::time_point captureTime);
+		// Called once the packet with the given timestamp has been written and flushed.
+		void sentPacket(int64_t pts, bool isWritten);
+		void dropFrame();
+
+		std::string getURL() const { return this->url; }
+		void logReport();
+
+	private:
+		std::string url;
+		std::mutex mxFrames;
+		std::map<int64_t, std::chrono::steady_clock::time_point> captureTimes;
+		uint64_t sentFrames = 0;
+		uint64_t droppedFrames = 0;
+		uint64_t failedWrites = 0;
+		uint64_t totalLatency = 0;
+		uint64_t maxLatency = 0;
+	};
+}
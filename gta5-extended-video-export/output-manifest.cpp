@@ -0,0 +1,163 @@
+#include "output-manifest.h"
+#include "logger.h"
+#include <iomanip>
+#include <sstream>
+
+namespace Encoder {
+
+	const int HASHING_FILE_BUFFER_SIZE = 1024 * 1024;
+
+	namespace {
+		std::string getDirectory(const std::string& path) {
+			size_t separator = path.find_last_of("\\/");
+			return separator == std::string::npos ? std::string() : path.substr(0, separator + 1);
+		}
+	}
+
+	void OutputManifest::add(std::string path, uint64_t size, uint64_t digest) {
+		std::lock_guard<std::mutex> lock(this->mxEntries);
+		Entry entry;
+		entry.path = path;
+		entry.size = size;
+		entry.digest = digest;
+		this->entries.push_back(entry);
+	}
+
+	HRESULT OutputManifest::write(std::string path) {
+		PRE();
+		std::lock_guard<std::mutex> lock(this->mxEntries);
+		std::string directory = getDirectory(path);
+		std::ofstream file(path, std::ios::trunc);
+		for (auto& entry : this->entries) {
+			std::string entryPath = entry.path;
+			if (!directory.empty() && (entryPath.compare(0, directory.size(), directory) == 0)) {
+				entryPath = entryPath.substr(directory.size());
+			}
+			file << std::hex << std::setw(16) << std::setfill('0') << entry.digest << std::dec
+				<< " " << entry.size << " " << entryPath << std::endl;
+		}
+		if (!file) {
+			LOG(LL_ERR, "Could not write manifest: ", path);
+			POST();
+			return E_FAIL;
+		}
+		LOG(LL_NFO, "Wrote digests of ", this->entries.size(), " files to ", path);
+		POST();
+		return S_OK;
+	}
+
+	HRESULT OutputManifest::read(std::string path, std::vector<Entry>& entries) {
+		std::ifstream file(path);
+		if (!file) {
+			return E_FAIL;
+		}
+
+		std::string directory = getDirectory(path);
+		std::string line;
+		while (std::getline(file, line)) {
+			std::stringstream stream(line);
+			Entry entry;
+			if (!(stream >> std::hex >> entry.digest >> std::dec >> entry.size)) {
+				continue;
+			}
+			std::getline(stream >> std::ws, entry.path);
+			bool isAbsolute = (entry.path.size() > 1) && ((entry.path[1] == ':') || (entry.path[0] == '\\'));
+			if (!isAbsolute) {
+				entry.path = directory + entry.path;
+			}
+			entries.push_back(entry);
+		}
+		return S_OK;
+	}
+
+	HashingFile::~HashingFile() {
+		if (this->hFile != INVALID_HANDLE_VALUE) {
+			CloseHandle(this->hFile);
+		}
+	}
+
+	HRESULT HashingFile::open(std::string path, AVIOContext** pb) {
+		PRE();
+		this->path = path;
+		// Muxers such as mp4 with faststart read the file back through a handle of their own.
+		this->hFile = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (this->hFile == INVALID_HANDLE_VALUE) {
+			LOG(LL_ERR, "Could not create file: ", path, " (", GetLastError(), ")");
+			POST();
+			return E_FAIL;
+		}
+
+		uint8_t* buffer = static_cast<uint8_t*>(av_malloc(HASHING_FILE_BUFFER_SIZE));
+		RET_IF_NULL(buffer, "Could not allocate I/O buffer", E_FAIL);
+		*pb = avio_alloc_context(buffer, HASHING_FILE_BUFFER_SIZE, 1, this, NULL, &HashingFile::writePacket, &HashingFile::seek);
+		if (!*pb) {
+			av_free(buffer);
+			LOG(LL_ERR, "Could not allocate I/O context");
+			POST();
+			return E_FAIL;
+		}
+		POST();
+		return S_OK;
+	}
+
+	int HashingFile::writePacket(void* opaque, uint8_t* buf, int size) {
+		HashingFile* pFile = static_cast<HashingFile*>(opaque);
+		DWORD written = 0;
+		if (!WriteFile(pFile->hFile, buf, size, &written, NULL) || (written != static_cast<DWORD>(size))) {
+			return AVERROR(EIO);
+		}
+		pFile->hasher.write(pFile->position, buf, size);
+		pFile->position += size;
+		pFile->size = (std::max)(pFile->size, pFile->position);
+		return size;
+	}
+
+	int64_t HashingFile::seek(void* opaque, int64_t offset, int whence) {
+		HashingFile* pFile = static_cast<HashingFile*>(opaque);
+		switch (whence & ~AVSEEK_FORCE) {
+		case AVSEEK_SIZE:
+			return pFile->size;
+		case SEEK_CUR:
+			offset += pFile->position;
+			break;
+		case SEEK_END:
+			offset += pFile->size;
+			break;
+		case SEEK_SET:
+			break;
+		default:
+			return AVERROR(EINVAL);
+		}
+
+		LARGE_INTEGER distance;
+		distance.QuadPart = offset;
+		if ((offset < 0) || !SetFilePointerEx(pFile->hFile, distance, NULL, FILE_BEGIN)) {
+			return AVERROR(EINVAL);
+		}
+		pFile->position = offset;
+		return offset;
+	}
+
+	HRESULT HashingFile::close(AVIOContext** pb, OutputManifest* pManifest) {
+		PRE();
+		if (*pb) {
+			avio_flush(*pb);
+			av_freep(&(*pb)->buffer);
+			av_freep(pb);
+		}
+		if (this->hFile == INVALID_HANDLE_VALUE) {
+			POST();
+			return S_OK;
+		}
+		CloseHandle(this->hFile);
+		this->hFile = INVALID_HANDLE_VALUE;
+
+		uint64_t digest;
+		RET_IF_FAILED(this->hasher.finish(this->path, digest), "Could not hash " + this->path, E_FAIL);
+		if (pManifest) {
+			pManifest->add(this->path, this->hasher.getSize(), digest);
+		}
+		POST();
+		return S_OK;
+	}
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <Windows.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "block-hasher.h"
+
+extern "C" {
+#include <libavformat\avformat.h>
+}
+
+namespace Encoder {
+	// Sidecar that lists the digest of every file an export wrote, one
+	//   <digest as 16 hex digits> <size in bytes> <path>
+	// per line. Paths below the directory of the manifest are stored relative to it.
+	class OutputManifest {
+	public:
+		struct Entry {
+			std::string path;
+			uint64_t size;
+			uint64_t digest;
+		};
+
+		void add(std::string path, uint64_t size, uint64_t digest);
+		HRESULT write(std::string path);
+
+		// Reads a manifest and resolves the paths of its entries.
+		static HRESULT read(std::string path, std::vector<Entry>& entries);
+
+	private:
+		std::mutex mxEntries;
+		std::vector<Entry> entries;
+	};
+
+	// Output file for a muxer that hashes everything written to it,
+	// so that the file does not need to be read again to be checksummed.
+	class HashingFile {
+	public:
+		~HashingFile();
+
+		HRESULT open(std::string path, AVIOContext** pb);
+		// Flushes and frees pb, closes the file and adds its digest to the manifest.
+		HRESULT close(AVIOContext** pb, OutputManifest* pManifest);
+
+	private:
+		static int writePacket(void* opaque, uint8_t* buf, int size);
+		static int64_t seek(void* opaque, int64_t offset, int whence);
+
+		std::string path;
+		HANDLE hFile = INVALID_HANDLE_VALUE;
+		uint64_t position = 0;
+		uint64_t size = 0;
+		BlockHasher hasher;
+	};
+}
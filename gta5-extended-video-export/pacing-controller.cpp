@@ -0,0 +1,71 @@
+#include "pacing-controller.h"
+#include "logger.h"
+#include <algorithm>
+
+namespace Encoder {
+
+	namespace {
+		// How long a wait past the budget lasts before the queue is asked again.
+		const std::chrono::seconds LIMIT_WAIT_INTERVAL(1);
+		// Longest the game is held past the budget before a queue is taken as stuck.
+		const std::chrono::seconds MAX_LIMIT_WAIT(10);
+	}
+
+	PacingController::PacingController(uint32_t budgetMilliseconds) :
+		budget(budgetMilliseconds),
+		frames(0),
+		heldFrames(0),
+		heldTime(0),
+		longestHold(0),
+		overBudget(0)
+	{
+	}
+
+	void PacingController::addQueue(std::string name, uint32_t capacity, WaitForDepth waitForDepth) {
+		Queue queue;
+		queue.name = name;
+		queue.target = capacity - capacity / 4;
+		queue.limit = 2 * capacity;
+		queue.waitForDepth = waitForDepth;
+		this->queues.push_back(queue);
+		LOG(LL_NFO, "Pacing ", name, " at ", queue.target, " of ", capacity, " frames with a budget of ", this->budget.count(), " ms");
+	}
+
+	void PacingController::pace() {
+		auto start = std::chrono::steady_clock::now();
+		auto deadline = start + this->budget;
+		for (auto& queue : this->queues) {
+			if (queue.waitForDepth(queue.target, deadline)) {
+				continue;
+			}
+			if (!queue.isStuck && !queue.waitForDepth(queue.limit, std::chrono::steady_clock::now())) {
+				LOG(LL_DBG, "Pacing: ", queue.name, " is over twice its capacity, waiting past the budget");
+				auto limitDeadline = std::chrono::steady_clock::now() + MAX_LIMIT_WAIT;
+				while (!queue.waitForDepth(queue.limit, (std::min)(std::chrono::steady_clock::now() + LIMIT_WAIT_INTERVAL, limitDeadline))) {
+					if (std::chrono::steady_clock::now() >= limitDeadline) {
+						// Only the budget applies from now on, so a stuck export cannot freeze the game.
+						LOG(LL_WRN, "Pacing: ", queue.name, " has not drained for ", MAX_LIMIT_WAIT.count(), " s, no longer waiting past the budget");
+						queue.isStuck = true;
+						break;
+					}
+				}
+			}
+			this->overBudget++;
+		}
+
+		this->frames++;
+		uint64_t held = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+		if (held >= 1000) {
+			this->heldFrames++;
+			this->heldTime += held;
+			uint64_t longest = this->longestHold;
+			while ((held > longest) && !this->longestHold.compare_exchange_weak(longest, held)) {
+			}
+		}
+	}
+
+	void PacingController::logReport() {
+		LOG(LL_NFO, "Frame pacing: ", this->heldFrames.load(), " of ", this->frames.load(), " frames held for ",
+			this->heldTime / 1000, " ms, longest ", this->longestHold / 1000, " ms, ", this->overBudget.load(), " over budget");
+	}
+}
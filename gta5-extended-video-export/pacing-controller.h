@@ -0,0 +1,49 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace Encoder {
+	// Holds the game back between frames when the export falls behind, instead of
+	// letting a full queue block the capture inside a D3D11 call. Frames are added
+	// to the paced queues without waiting; at the safe point the game waits until
+	// every queue has a quarter of its capacity free again, for at most the budget.
+	// Past the budget it only waits for queues that hold more than twice their capacity,
+	// so the game slows down gradually and memory stays bounded.
+	class PacingController {
+	public:
+		// Waits until the queue holds at most `depth` items. Returns false if the deadline passed first,
+		// and true right away once the queue will not drain any more (failed or closing).
+		typedef std::function<bool(uint32_t depth, std::chrono::steady_clock::time_point deadline)> WaitForDepth;
+
+		PacingController(uint32_t budgetMilliseconds);
+
+		void addQueue(std::string name, uint32_t capacity, WaitForDepth waitForDepth);
+
+		// Called once per frame at a point where the game can be held without stalling D3D11.
+		void pace();
+
+		void logReport();
+
+	private:
+		struct Queue {
+			std::string name;
+			uint32_t target;
+			uint32_t limit;
+			WaitForDepth waitForDepth;
+			bool isStuck = false;
+		};
+
+		std::chrono::milliseconds budget;
+		std::vector<Queue> queues;
+		std::atomic<uint64_t> frames;
+		std::atomic<uint64_t> heldFrames;
+		std::atomic<uint64_t> heldTime;
+		std::atomic<uint64_t> longestHold;
+		std::atomic<uint64_t> overBudget;
+	};
+}
@@ -0,0 +1,334 @@
+#include "pipeline-stages.h"
+#include "encoder.h"
+#include "logger.h"
+#include <algorithm>
+
+namespace Encoder {
+
+	MotionBlurStage::MotionBlurStage(Session* session) :
+		PipelineStage("motion_blur", FRAME_TYPE_RAW, FRAME_TYPE_RAW, 1),
+		session(session)
+	{
+		// An interpolate stage in front adds sub-frames between the captured ones.
+		uint32_t period = (session->motionBlurSamples + 1) * session->subFrameScale;
+		this->accumulator.addOutput(period, session->getShutterWindow(period));
+		for (auto& pOutput : session->extraOutputs) {
+			period = session->getSubFramePeriod(pOutput->getFrameRate()) * session->subFrameScale;
+			this->accumulator.addOutput(period, SubFrameAccumulator::getShutterWindow(period, pOutput->getShutterAngle()));
+		}
+	}
+
+	void MotionBlurStage::process(Frame& frame, const Emit& emit) {
+		if (this->session->extraOutputs.empty() && this->accumulator.isPassThrough()) {
+			emit(frame);
+			return;
+		}
+
+		AVPixelFormat pixelFormat = this->inputType == FRAME_TYPE_PLANAR ? this->session->outputPixelFormat : this->session->inputPixelFormat;
+		this->droppedBefore += frame.droppedBefore;
+		this->accumulator.push(*frame.data, [&](size_t output, std::shared_ptr<std::valarray<uint8_t>> pResult) {
+			if (output == 0) {
+				Frame result = frame.withData(pResult);
+				result.droppedBefore = this->droppedBefore;
+				this->droppedBefore = 0;
+				emit(result);
+			} else {
+				REQUIRE(this->session->extraOutputs[output - 1]->queueFrame(pResult, pixelFormat), "Failed to write extra output frame.");
+			}
+		});
+	}
+
+	bool MotionBlurStage::accept(FrameType type) {
+		if (type == FRAME_TYPE_PLANAR) {
+			const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(this->session->outputPixelFormat);
+			if (!desc || (desc->flags & (AV_PIX_FMT_FLAG_BITSTREAM | AV_PIX_FMT_FLAG_PAL))) {
+				return false;
+			}
+			for (int i = 0; i < desc->nb_components; i++) {
+				if (desc->comp[i].depth != 8) {
+					return false;
+				}
+			}
+		} else if (type != FRAME_TYPE_RAW) {
+			return false;
+		}
+		this->inputType = type;
+		this->outputType = type;
+		return true;
+	}
+
+	ConvertStage::ConvertStage(Session* session) :
+		PipelineStage("convert", FRAME_TYPE_RAW, FRAME_TYPE_PLANAR, 1),
+		session(session)
+	{
+	}
+
+	void ConvertStage::process(Frame& frame, const Emit& emit) {
+		std::shared_ptr<std::valarray<uint8_t>> pResult;
+		REQUIRE(this->session->convertToOutputFormat(std::begin(*frame.data), frame.data->size(), pResult), "Failed to convert video frame.");
+		emit(frame.withData(pResult));
+	}
+
+	EncodeStage::EncodeStage(Session* session) :
+		PipelineStage("encode", FRAME_TYPE_RAW, FRAME_TYPE_NONE, 1),
+		session(session)
+	{
+	}
+
+	void EncodeStage::process(Frame& frame, const Emit& emit) {
+		// Frames a live stream dropped leave a gap, so the rest stay in time with the audio.
+		this->session->videoPTS += frame.droppedBefore;
+		int64_t pts = this->session->videoPTS++;
+		LOG(LL_NFO, "Encoding frame: ", pts);
+		if (this->session->liveStream) {
+			this->session->liveStream->addFrame(pts, frame.captureTime);
+		}
+		if (this->inputType == FRAME_TYPE_PLANAR) {
+			REQUIRE(this->session->writePlanarVideoFrame(std::begin(*frame.data), frame.data->size(), pts), "Failed to write video frame.");
+		} else {
+			REQUIRE(this->session->writeVideoFrame(std::begin(*frame.data), frame.data->size(), pts), "Failed to write video frame.");
+		}
+	}
+
+	bool EncodeStage::accept(FrameType type) {
+		if ((type != FRAME_TYPE_RAW) && (type != FRAME_TYPE_PLANAR)) {
+			return false;
+		}
+		this->inputType = type;
+		return true;
+	}
+
+	LUTStage::LUTStage(Session* session) :
+		PipelineStage("lut", FRAME_TYPE_RAW, FRAME_TYPE_RAW, 1),
+		session(session)
+	{
+	}
+
+	void LUTStage::process(Frame& frame, const Emit& emit) {
+		// Nothing else holds on to captured frames, so they are graded in place.
+		this->session->lut->apply(std::begin(*frame.data), frame.data->size() / 4);
+		emit(frame);
+	}
+
+	bool LUTStage::accept(FrameType type) {
+		if (this->session->inputPixelFormat != AV_PIX_FMT_BGRA) {
+			LOG(LL_ERR, "The lut stage only grades bgra frames, it cannot be used with HDR video.");
+			return false;
+		}
+		return type == FRAME_TYPE_RAW;
+	}
+
+	GIFQuantizeStage::GIFQuantizeStage(Session* session) :
+		PipelineStage("gif_quantize", FRAME_TYPE_RAW, FRAME_TYPE_PLANAR, 1),
+		session(session),
+		quantizer(session->width, session->height, session->gifDither)
+	{
+	}
+
+	void GIFQuantizeStage::process(Frame& frame, const Emit& emit) {
+		this->quantizer.addToHistogram(std::begin(*frame.data));
+		this->segment.push_back(frame);
+		if (this->segment.size() >= this->session->gifPaletteFrames) {
+			this->emitSegment(emit);
+		}
+	}
+
+	void GIFQuantizeStage::flush(const Emit& emit) {
+		this->emitSegment(emit);
+		this->quantizer.logReport();
+	}
+
+	void GIFQuantizeStage::emitSegment(const Emit& emit) {
+		if (this->segment.empty()) {
+			return;
+		}
+		this->quantizer.endSegment();
+		for (auto& frame : this->segment) {
+			auto pResult = std::make_shared<std::valarray<uint8_t>>(this->quantizer.getFrameSize());
+			this->quantizer.map(std::begin(*frame.data), std::begin(*pResult));
+			emit(frame.withData(pResult));
+		}
+		this->segment.clear();
+	}
+
+	bool GIFQuantizeStage::accept(FrameType type) {
+		if ((this->session->inputPixelFormat != AV_PIX_FMT_BGRA) || (this->session->outputPixelFormat != AV_PIX_FMT_PAL8)) {
+			LOG(LL_ERR, "The gif_quantize stage turns bgra frames into pal8, the preset's pixel_format has to be pal8.");
+			return false;
+		}
+		return type == FRAME_TYPE_RAW;
+	}
+
+	InterpolateStage::InterpolateStage(Session* session) :
+		PipelineStage("interpolate", FRAME_TYPE_RAW, FRAME_TYPE_RAW, 1),
+		session(session),
+		interpolator(session->width, session->height, session->motionBlurSearchRange)
+	{
+	}
+
+	void InterpolateStage::process(Frame& frame, const Emit& emit) {
+		uint32_t count = this->session->motionBlurInterpolation;
+		if (this->previous.data) {
+			// Frames a live stream dropped are missing in between, so the last one is held instead.
+			bool isContinuous = frame.droppedBefore == 0;
+			if (isContinuous) {
+				this->interpolator.estimate(std::begin(*this->previous.data), std::begin(*frame.data));
+			}
+			for (uint32_t i = 1; i <= count; i++) {
+				auto pResult = std::make_shared<std::valarray<uint8_t>>(frame.data->size());
+				if (isContinuous) {
+					this->interpolator.synthesize(std::begin(*this->previous.data), std::begin(*frame.data), static_cast<float>(i) / (count + 1), std::begin(*pResult));
+				} else {
+					*pResult = *this->previous.data;
+				}
+				Frame result = frame.withData(pResult);
+				result.droppedBefore = 0;
+				emit(result);
+			}
+		}
+		this->previous = frame;
+		emit(frame);
+	}
+
+	void InterpolateStage::flush(const Emit& emit) {
+		// The last frame's sub-frames after it are repeats, so its frame is complete.
+		if (this->previous.data) {
+			for (uint32_t i = 0; i < this->session->motionBlurInterpolation; i++) {
+				Frame result = this->previous;
+				result.droppedBefore = 0;
+				emit(result);
+			}
+		}
+		this->interpolator.logReport();
+	}
+
+	bool InterpolateStage::accept(FrameType type) {
+		if (this->session->inputPixelFormat != AV_PIX_FMT_BGRA) {
+			LOG(LL_ERR, "The interpolate stage only works on bgra frames, it cannot be used with HDR video.");
+			return false;
+		}
+		return type == FRAME_TYPE_RAW;
+	}
+
+	SpillStage::SpillStage(Session* session) :
+		PipelineStage("spill", FRAME_TYPE_RAW, FRAME_TYPE_RAW, 1),
+		session(session)
+	{
+	}
+
+	void SpillStage::process(Frame& frame, const Emit& emit) {
+		// Frames on disk are older, so new ones join them until the disk has been read empty.
+		if (!this->file.isEmpty()) {
+			if (this->spill(frame)) {
+				this->drain(emit, false);
+			} else {
+				this->drain(emit, true);
+				emit(frame);
+			}
+			return;
+		}
+
+		Pipeline& pipeline = *this->session->videoPipeline;
+		if (this->isDisabled || (pipeline.getOutputDepth(this) < pipeline.getEdgeCapacity())) {
+			this->isSaturated = false;
+			emit(frame);
+			return;
+		}
+
+		auto now = std::chrono::steady_clock::now();
+		if (!this->isSaturated) {
+			this->isSaturated = true;
+			this->saturatedSince = now;
+		}
+		auto saturated = std::chrono::duration_cast<std::chrono::milliseconds>(now - this->saturatedSince);
+		if ((saturated.count() < this->session->spillAfter) || !this->spill(frame)) {
+			emit(frame);
+			return;
+		}
+		this->spills++;
+		LOG(LL_NFO, "Encoder has been behind for ", saturated.count(), " ms, spilling frames to ", this->file.getPath());
+	}
+
+	void SpillStage::flush(const Emit& emit) {
+		uint64_t remaining = this->file.getFrames();
+		auto start = std::chrono::steady_clock::now();
+		this->drain(emit, true);
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+		this->file.close();
+		LOG(LL_NFO, "Spill: ", this->spilledFrames, " frames written to disk in ", this->spills, " spills, at most ",
+			this->maxBytes / (1024 * 1024), " MB; the last ", remaining, " were passed on in ",
+			static_cast<uint64_t>(elapsed.count()), " ms after the capture ended");
+	}
+
+	bool SpillStage::spill(const Frame& frame) {
+		if (!this->file.isOpen() && FAILED(this->file.open(this->session->spillFolder))) {
+			this->isDisabled = true;
+			return false;
+		}
+		if (FAILED(this->file.write(std::begin(*frame.data), frame.data->size()))) {
+			LOG(LL_WRN, "Frames wait in memory for the encoder again.");
+			this->isDisabled = true;
+			return false;
+		}
+		Frame stored = frame;
+		stored.data.reset();
+		this->storedFrames.push_back(stored);
+		this->spilledFrames++;
+		this->maxBytes = (std::max)(this->maxBytes, this->file.getBytes());
+		return true;
+	}
+
+	void SpillStage::drain(const Emit& emit, bool isWaiting) {
+		Pipeline& pipeline = *this->session->videoPipeline;
+		bool isSpilling = !this->file.isEmpty();
+		while (!this->file.isEmpty() && (isWaiting || (pipeline.getOutputDepth(this) < pipeline.getEdgeCapacity() / 2))) {
+			auto pData = std::make_shared<std::valarray<uint8_t>>();
+			REQUIRE(this->file.read(*pData), "Failed to read spilled frame.");
+			Frame stored = this->storedFrames.front();
+			this->storedFrames.pop_front();
+			emit(stored.withData(pData));
+		}
+		if (isSpilling && this->file.isEmpty()) {
+			this->isSaturated = false;
+			if (!isWaiting) {
+				LOG(LL_NFO, "Encoder has caught up with the spilled frames.");
+			}
+		}
+	}
+
+	bool SpillStage::accept(FrameType type) {
+		if ((type != FRAME_TYPE_RAW) && (type != FRAME_TYPE_PLANAR)) {
+			return false;
+		}
+		this->inputType = type;
+		this->outputType = type;
+		return true;
+	}
+
+	void registerBuiltinStages() {
+		static std::once_flag once;
+		std::call_once(once, []() {
+			PipelineRegistry::add("motion_blur", [](Session* session) {
+				return std::shared_ptr<PipelineStage>(new MotionBlurStage(session));
+			});
+			PipelineRegistry::add("convert", [](Session* session) {
+				return std::shared_ptr<PipelineStage>(new ConvertStage(session));
+			});
+			PipelineRegistry::add("lut", [](Session* session) {
+				return std::shared_ptr<PipelineStage>(new LUTStage(session));
+			});
+			PipelineRegistry::add("interpolate", [](Session* session) {
+				return std::shared_ptr<PipelineStage>(new InterpolateStage(session));
+			});
+			PipelineRegistry::add("gif_quantize", [](Session* session) {
+				return std::shared_ptr<PipelineStage>(new GIFQuantizeStage(session));
+			});
+			PipelineRegistry::add("spill", [](Session* session) {
+				return std::shared_ptr<PipelineStage>(new SpillStage(session));
+			});
+			PipelineRegistry::add("encode", [](Session* session) {
+				return std::shared_ptr<PipelineStage>(new EncodeStage(session));
+			});
+		});
+	}
+}
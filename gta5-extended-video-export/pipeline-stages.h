@@ -0,0 +1,134 @@
+#pragma once
+
+#include <deque>
+#include "frame-interpolator.h"
+#include "gif-quantizer.h"
+#include "pipeline.h"
+#include "spill-file.h"
+#include "subframe-accumulator.h"
+
+namespace Encoder {
+	// Averages motionBlurSamples + 1 captured sub-frames into one frame, over a
+	// window set by the shutter angle that may reach back into earlier frames.
+	// The session's extra video outputs are made from the same sub-frames.
+	// Planar frames are accepted when every component is a single byte and there
+	// is no palette, where averaging the converted frames only differs from converting the average by rounding.
+	class MotionBlurStage : public PipelineStage {
+	public:
+		MotionBlurStage(Session* session);
+
+		void process(Frame& frame, const Emit& emit) override;
+		bool accept(FrameType type) override;
+
+	private:
+		Session* session;
+		SubFrameAccumulator accumulator;
+		// Dropped frames reported by the sub-frames of the frame being blended.
+		uint32_t droppedBefore = 0;
+	};
+
+	// Converts captured frames to the encoder's output pixel format on the pipeline
+	// thread, so the queues that follow hold the compact planar form.
+	class ConvertStage : public PipelineStage {
+	public:
+		ConvertStage(Session* session);
+
+		void process(Frame& frame, const Emit& emit) override;
+
+	private:
+		Session* session;
+	};
+
+	// Converts frames to the output pixel format and sends them to the video encoder.
+	// Planar frames skip the conversion.
+	class EncodeStage : public PipelineStage {
+	public:
+		EncodeStage(Session* session);
+
+		void process(Frame& frame, const Emit& emit) override;
+		bool accept(FrameType type) override;
+
+	private:
+		Session* session;
+	};
+
+	// Grades captured frames with the session's 3D LUT before they are converted,
+	// so the encoder gets the graded image.
+	class LUTStage : public PipelineStage {
+	public:
+		LUTStage(Session* session);
+
+		void process(Frame& frame, const Emit& emit) override;
+		bool accept(FrameType type) override;
+
+	private:
+		Session* session;
+	};
+
+	// Quantizes captured frames to pal8 for the GIF encoder. Frames are held back
+	// until their segment is complete, so the palette is made from all of them.
+	class GIFQuantizeStage : public PipelineStage {
+	public:
+		GIFQuantizeStage(Session* session);
+
+		void process(Frame& frame, const Emit& emit) override;
+		void flush(const Emit& emit) override;
+		bool accept(FrameType type) override;
+
+	private:
+		void emitSegment(const Emit& emit);
+
+		Session* session;
+		GIFQuantizer quantizer;
+		std::vector<Frame> segment;
+	};
+
+	// Synthesizes motionBlurInterpolation sub-frames between every two captured
+	// ones, so the motion_blur stage after it can blend more sub-frames than the
+	// game renders.
+	class InterpolateStage : public PipelineStage {
+	public:
+		InterpolateStage(Session* session);
+
+		void process(Frame& frame, const Emit& emit) override;
+		void flush(const Emit& emit) override;
+		bool accept(FrameType type) override;
+
+	private:
+		Session* session;
+		FrameInterpolator interpolator;
+		Frame previous;
+	};
+
+	// Writes frames to a file in the session's spill folder once the stage after it
+	// has had a full queue for spillAfter milliseconds, so the stages in front never
+	// wait for it. The frames are passed on in order whenever that stage has room
+	// again, and the ones still on disk at the end of the stream before it ends.
+	class SpillStage : public PipelineStage {
+	public:
+		SpillStage(Session* session);
+
+		void process(Frame& frame, const Emit& emit) override;
+		void flush(const Emit& emit) override;
+		bool accept(FrameType type) override;
+
+	private:
+		bool spill(const Frame& frame);
+		// Passes spilled frames on while the next stage has room, or all of them when waiting.
+		void drain(const Emit& emit, bool isWaiting);
+
+		Session* session;
+		SpillFile file;
+		// The frames in the file without their data, so they are passed on with their timing.
+		std::deque<Frame> storedFrames;
+		bool isSaturated = false;
+		std::chrono::steady_clock::time_point saturatedSince;
+		// Set after the file could not be written; frames then wait in memory as before.
+		bool isDisabled = false;
+		uint64_t spilledFrames = 0;
+		uint64_t spills = 0;
+		uint64_t maxBytes = 0;
+	};
+
+	void registerBuiltinStages();
+}
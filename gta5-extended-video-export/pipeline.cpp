@@ -0,0 +1,262 @@
+#include "pipeline.h"
+#include "logger.h"
+#include <algorithm>
+#include <chrono>
+#include <sstream>
+
+namespace Encoder {
+
+	Pipeline::Pipeline(uint32_t edgeCapacity) :
+		edgeCapacity(edgeCapacity),
+		isFailed(false)
+	{
+	}
+
+	Pipeline::~Pipeline() {
+		this->finish();
+	}
+
+	void Pipeline::addStage(std::shared_ptr<PipelineStage> stage) {
+		this->nodes.push_back(std::unique_ptr<Node>(new Node(stage, this->edgeCapacity)));
+	}
+
+	HRESULT Pipeline::start(const ThreadPolicy& policy) {
+		PRE();
+		if (this->nodes.empty()) {
+			LOG(LL_ERR, "Video pipeline has no stages.");
+			POST();
+			return E_FAIL;
+		}
+
+		FrameType expected = FRAME_TYPE_RAW;
+		for (auto& node : this->nodes) {
+			if (!node->stage->accept(expected)) {
+				LOG(LL_ERR, "Video pipeline stage \"", node->stage->getName(), "\" cannot accept the output of the previous stage.");
+				POST();
+				return E_FAIL;
+			}
+			expected = node->stage->getOutputType();
+		}
+
+		if (expected != FRAME_TYPE_NONE) {
+			LOG(LL_ERR, "Video pipeline does not end with an output stage.");
+			POST();
+			return E_FAIL;
+		}
+
+		LOG(LL_NFO, "Starting video pipeline:");
+		for (size_t i = 0; i < this->nodes.size(); i++) {
+			Node& node = *this->nodes[i];
+			uint32_t concurrency = (std::max)(node.stage->getConcurrency(), 1u);
+			LOG(LL_NFO, "  ", node.stage->getName(), " x", concurrency);
+			node.running = concurrency;
+			for (uint32_t t = 0; t < concurrency; t++) {
+				node.threads.push_back(std::thread(&Pipeline::stageThread, this, i));
+				policy.applyToEncoderThread(node.threads.back());
+			}
+		}
+
+		this->isStarted = true;
+		POST();
+		return S_OK;
+	}
+
+	HRESULT Pipeline::push(Frame frame, bool isWaiting) {
+		if (this->isFailed) {
+			return E_FAIL;
+		}
+		if (isWaiting || this->nodes.empty()) {
+			this->deliver(0, frame);
+		} else {
+			Node& node = *this->nodes[0];
+			frame.sequence = node.nextInput++;
+			node.input.enqueueWithoutWaiting(frame);
+		}
+		return S_OK;
+	}
+
+	bool Pipeline::waitForInputDepth(uint32_t depth, std::chrono::steady_clock::time_point deadline) {
+		if (this->isFailed || this->nodes.empty()) {
+			return true;
+		}
+		return this->nodes[0]->input.waitForDepth(depth, deadline);
+	}
+
+	bool Pipeline::isBacklogged() {
+		for (auto& node : this->nodes) {
+			if (node->input.getDepth() >= this->edgeCapacity / 2) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	uint32_t Pipeline::getOutputDepth(const PipelineStage* stage) {
+		for (size_t i = 0; i + 1 < this->nodes.size(); i++) {
+			if (this->nodes[i]->stage.get() == stage) {
+				return static_cast<uint32_t>(this->nodes[i + 1]->input.getDepth());
+			}
+		}
+		return 0;
+	}
+
+	void Pipeline::finish() {
+		std::lock_guard<std::mutex> lock(this->mxFinish);
+		if (!this->isStarted || this->isFinished) {
+			return;
+		}
+
+		this->deliver(0, Frame());
+		for (auto& node : this->nodes) {
+			for (auto& thread : node->threads) {
+				if (thread.joinable()) {
+					thread.join();
+				}
+			}
+		}
+		this->isFinished = true;
+	}
+
+	bool Pipeline::isEmpty() const {
+		return this->nodes.empty();
+	}
+
+	bool Pipeline::hasFailed() const {
+		return this->isFailed;
+	}
+
+	void Pipeline::logReport() {
+		LOG(LL_NFO, "Video pipeline report:");
+		for (auto& node : this->nodes) {
+			LOG(LL_NFO, "  ", node->stage->getName(), ": ",
+				node->processed.load(), " frames, ",
+				node->busyTime.load() / 1000, " ms busy; input queue: ",
+				node->input.getEnqueueCount(), " enqueued, ",
+				node->input.getBlockedCount(), " blocked for ",
+				node->input.getBlockedMicroseconds() / 1000, " ms, max depth ",
+				node->input.getMaxDepth(), "/", node->input.getCapacity(), ", ",
+				node->input.getOverflowCount(), " over capacity");
+		}
+	}
+
+	std::vector<std::string> Pipeline::parseDefinition(const std::string& definition) {
+		std::vector<std::string> names;
+		std::stringstream stream(definition);
+		std::string name;
+		while (std::getline(stream, name, ',')) {
+			size_t first = name.find_first_not_of(" \t");
+			if (first != std::string::npos) {
+				names.push_back(name.substr(first, name.find_last_not_of(" \t") - first + 1));
+			}
+		}
+		return names;
+	}
+
+	void Pipeline::deliver(size_t index, Frame frame) {
+		if (index >= this->nodes.size()) {
+			return;
+		}
+
+		Node& node = *this->nodes[index];
+		if (!frame.isEndOfStream) {
+			frame.sequence = node.nextInput++;
+		}
+		node.input.enqueue(frame);
+	}
+
+	void Pipeline::stageThread(size_t index) {
+		PRE();
+		Node& node = *this->nodes[index];
+		bool isOrdered = node.stage->getConcurrency() <= 1;
+		PipelineStage::Emit emitNext = [this, index](Frame frame) {
+			this->deliver(index + 1, frame);
+		};
+
+		while (true) {
+			Frame frame = node.input.dequeue();
+
+			if (frame.isEndOfStream) {
+				if (--node.running > 0) {
+					// Let the other threads of this stage see the end of the stream too.
+					node.input.enqueue(frame);
+					break;
+				}
+
+				if (!this->isFailed) {
+					try {
+						node.stage->flush(emitNext);
+					} catch (std::exception& ex) {
+						LOG(LL_ERR, "Video pipeline stage \"", node.stage->getName(), "\" failed: ", ex.what());
+						this->isFailed = true;
+					}
+				}
+				this->deliver(index + 1, frame);
+				break;
+			}
+
+			// After a failure frames are drained so that upstream stages never block.
+			if (this->isFailed) {
+				continue;
+			}
+
+			auto start = std::chrono::steady_clock::now();
+			std::vector<Frame> outputs;
+			try {
+				if (isOrdered) {
+					node.stage->process(frame, emitNext);
+				} else {
+					node.stage->process(frame, [&outputs](Frame output) {
+						outputs.push_back(output);
+					});
+				}
+			} catch (std::exception& ex) {
+				LOG(LL_ERR, "Video pipeline stage \"", node.stage->getName(), "\" failed: ", ex.what());
+				this->isFailed = true;
+			}
+			node.busyTime += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+			node.processed++;
+
+			if (!isOrdered) {
+				std::lock_guard<std::mutex> lock(node.mxReorder);
+				node.reorderBuffer[frame.sequence] = std::move(outputs);
+				auto it = node.reorderBuffer.find(node.nextOutput);
+				while (it != node.reorderBuffer.end()) {
+					for (auto& output : it->second) {
+						this->deliver(index + 1, output);
+					}
+					node.reorderBuffer.erase(it);
+					it = node.reorderBuffer.find(++node.nextOutput);
+				}
+			}
+		}
+		POST();
+	}
+
+	void PipelineRegistry::add(std::string name, Factory factory) {
+		std::lock_guard<std::mutex> lock(mutex());
+		factories()[name] = factory;
+	}
+
+	std::shared_ptr<PipelineStage> PipelineRegistry::create(std::string name, Session* session) {
+		Factory factory;
+		{
+			std::lock_guard<std::mutex> lock(mutex());
+			auto it = factories().find(name);
+			if (it == factories().end()) {
+				return nullptr;
+			}
+			factory = it->second;
+		}
+		return factory(session);
+	}
+
+	std::mutex& PipelineRegistry::mutex() {
+		static std::mutex mx;
+		return mx;
+	}
+
+	std::map<std::string, PipelineRegistry::Factory>& PipelineRegistry::factories() {
+		static std::map<std::string, Factory> registry;
+		return registry;
+	}
+}
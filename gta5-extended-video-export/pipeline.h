@@ -0,0 +1,169 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <valarray>
+#include <vector>
+#include "SafeQueue.h"
+#include "thread-policy.h"
+
+namespace Encoder {
+	class Session;
+
+	enum FrameType {
+		// Produced by sink stages, which consume frames without passing anything on.
+		FRAME_TYPE_NONE,
+		// Packed pixels in the session's input pixel format, as captured from the game.
+		FRAME_TYPE_RAW,
+		// Pixels in the encoder's output pixel format, planes stored back to back without padding.
+		FRAME_TYPE_PLANAR
+	};
+
+	struct Frame {
+		Frame() :
+			sequence(0),
+			isEndOfStream(true)
+		{ }
+
+		Frame(std::shared_ptr<std::valarray<uint8_t>> data) :
+			data(data),
+			sequence(0),
+			isEndOfStream(false)
+		{ }
+
+		// A frame with this one's timing, for stages that replace the data.
+		Frame withData(std::shared_ptr<std::valarray<uint8_t>> data) const {
+			Frame frame(data);
+			frame.captureTime = this->captureTime;
+			frame.droppedBefore = this->droppedBefore;
+			return frame;
+		}
+
+		std::shared_ptr<std::valarray<uint8_t>> data;
+		uint64_t sequence;
+		bool isEndOfStream;
+		std::chrono::steady_clock::time_point captureTime;
+		// Encoder frames dropped by a live stream right before this one.
+		uint32_t droppedBefore = 0;
+	};
+
+	class PipelineStage {
+	public:
+		typedef std::function<void(Frame)> Emit;
+
+		PipelineStage(std::string name, FrameType inputType, FrameType outputType, uint32_t concurrency) :
+			name(name),
+			inputType(inputType),
+			outputType(outputType),
+			concurrency(concurrency)
+		{ }
+
+		virtual ~PipelineStage() { }
+
+		// Called once per input frame. A stage may emit any number of frames.
+		// Stages with a concurrency above one are called from several threads at once.
+		virtual void process(Frame& frame, const Emit& emit) = 0;
+
+		// Called once after the last frame, before the end of the stream is passed on.
+		virtual void flush(const Emit& emit) { }
+
+		// Called while the pipeline is checked, with the output type of the previous stage.
+		// Stages that handle more than one type override this and adopt the type they are given.
+		virtual bool accept(FrameType type) { return type == this->inputType; }
+
+		const std::string& getName() const { return this->name; }
+		FrameType getInputType() const { return this->inputType; }
+		FrameType getOutputType() const { return this->outputType; }
+		uint32_t getConcurrency() const { return this->concurrency; }
+
+	protected:
+		std::string name;
+		FrameType inputType;
+		FrameType outputType;
+		uint32_t concurrency;
+	};
+
+	// Linear chain of stages connected by bounded queues. Every stage runs on
+	// its own threads; the output of parallel stages is put back in input order.
+	class Pipeline {
+	public:
+		Pipeline(uint32_t edgeCapacity);
+		~Pipeline();
+
+		void addStage(std::shared_ptr<PipelineStage> stage);
+		HRESULT start(const ThreadPolicy& policy);
+
+		// Frames pushed without waiting go in even when the first queue is full; the
+		// caller holds its producer back with waitForInputDepth at a better time.
+		HRESULT push(Frame frame, bool isWaiting = true);
+		// Waits until the first stage has at most `depth` frames queued, or the pipeline has failed.
+		// Returns false if the deadline passed first.
+		bool waitForInputDepth(uint32_t depth, std::chrono::steady_clock::time_point deadline);
+		uint32_t getEdgeCapacity() const { return this->edgeCapacity; }
+		// Whether any stage has at least half of its queue filled, so new frames would wait.
+		bool isBacklogged();
+		// Frames queued in front of the stage that follows the given one, or 0 for the last stage.
+		uint32_t getOutputDepth(const PipelineStage* stage);
+		void finish();
+
+		bool isEmpty() const;
+		bool hasFailed() const;
+		void logReport();
+
+		// Splits a "video_pipeline" definition into its stage names.
+		static std::vector<std::string> parseDefinition(const std::string& definition);
+
+	private:
+		struct Node {
+			Node(std::shared_ptr<PipelineStage> stage, uint32_t capacity) :
+				stage(stage),
+				input(capacity),
+				nextInput(0),
+				nextOutput(0),
+				running(0),
+				processed(0),
+				busyTime(0)
+			{ }
+
+			std::shared_ptr<PipelineStage> stage;
+			SafeQueue<Frame> input;
+			std::vector<std::thread> threads;
+			std::atomic<uint64_t> nextInput;
+			std::mutex mxReorder;
+			std::map<uint64_t, std::vector<Frame>> reorderBuffer;
+			uint64_t nextOutput;
+			std::atomic<uint32_t> running;
+			std::atomic<uint64_t> processed;
+			std::atomic<uint64_t> busyTime;
+		};
+
+		void stageThread(size_t index);
+		void deliver(size_t index, Frame frame);
+
+		uint32_t edgeCapacity;
+		std::vector<std::unique_ptr<Node>> nodes;
+		std::atomic<bool> isFailed;
+		bool isStarted = false;
+		bool isFinished = false;
+		std::mutex mxFinish;
+	};
+
+	// Stages that can be named in the "video_pipeline" option.
+	class PipelineRegistry {
+	public:
+		typedef std::function<std::shared_ptr<PipelineStage>(Session*)> Factory;
+
+		static void add(std::string name, Factory factory);
+		static std::shared_ptr<PipelineStage> create(std::string name, Session* session);
+
+	private:
+		static std::mutex& mutex();
+		static std::map<std::string, Factory>& factories();
+	};
+}
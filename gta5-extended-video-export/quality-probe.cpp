@@ -0,0 +1,321 @@
+#include "quality-probe.h"
+#include "logger.h"
+#include <algorithm>
+#include <cmath>
+#include <emmintrin.h>
+
+extern "C" {
+#include <libavutil\imgutils.h>
+#include <libavutil\pixdesc.h>
+}
+
+namespace Encoder {
+
+	namespace {
+		// Reported for frames that decode to exactly the reference.
+		const double MAX_PSNR = 100.0;
+
+		struct BlockSums {
+			int64_t a = 0;
+			int64_t b = 0;
+			int64_t squares = 0;
+			int64_t products = 0;
+		};
+
+		void sumBlock(const uint8_t* a, int strideA, const uint8_t* b, int strideB, BlockSums& sums) {
+			sums = BlockSums();
+			for (int y = 0; y < 4; y++) {
+				for (int x = 0; x < 4; x++) {
+					int va = a[y * strideA + x];
+					int vb = b[y * strideB + x];
+					sums.a += va;
+					sums.b += vb;
+					sums.squares += va * va + vb * vb;
+					sums.products += va * vb;
+				}
+			}
+		}
+
+		// Sums of four horizontally adjacent 4x4 blocks. Each 32 bit lane collects a pair of columns.
+		void sumBlocks4(const uint8_t* a, int strideA, const uint8_t* b, int strideB, BlockSums* sums) {
+			const __m128i zero = _mm_setzero_si128();
+			const __m128i ones = _mm_set1_epi16(1);
+			__m128i sa[2] = { zero, zero };
+			__m128i sb[2] = { zero, zero };
+			__m128i ss[2] = { zero, zero };
+			__m128i sp[2] = { zero, zero };
+			for (int y = 0; y < 4; y++) {
+				__m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + y * strideA));
+				__m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + y * strideB));
+				for (int half = 0; half < 2; half++) {
+					__m128i wa = half == 0 ? _mm_unpacklo_epi8(va, zero) : _mm_unpackhi_epi8(va, zero);
+					__m128i wb = half == 0 ? _mm_unpacklo_epi8(vb, zero) : _mm_unpackhi_epi8(vb, zero);
+					sa[half] = _mm_add_epi32(sa[half], _mm_madd_epi16(wa, ones));
+					sb[half] = _mm_add_epi32(sb[half], _mm_madd_epi16(wb, ones));
+					ss[half] = _mm_add_epi32(ss[half], _mm_add_epi32(_mm_madd_epi16(wa, wa), _mm_madd_epi16(wb, wb)));
+					sp[half] = _mm_add_epi32(sp[half], _mm_madd_epi16(wa, wb));
+				}
+			}
+
+			alignas(16) int32_t lanes[4][8];
+			for (int half = 0; half < 2; half++) {
+				_mm_store_si128(reinterpret_cast<__m128i*>(lanes[0] + 4 * half), sa[half]);
+				_mm_store_si128(reinterpret_cast<__m128i*>(lanes[1] + 4 * half), sb[half]);
+				_mm_store_si128(reinterpret_cast<__m128i*>(lanes[2] + 4 * half), ss[half]);
+				_mm_store_si128(reinterpret_cast<__m128i*>(lanes[3] + 4 * half), sp[half]);
+			}
+			for (int block = 0; block < 4; block++) {
+				sums[block].a = lanes[0][2 * block] + lanes[0][2 * block + 1];
+				sums[block].b = lanes[1][2 * block] + lanes[1][2 * block + 1];
+				sums[block].squares = lanes[2][2 * block] + lanes[2][2 * block + 1];
+				sums[block].products = lanes[3][2 * block] + lanes[3][2 * block + 1];
+			}
+		}
+
+		void addBlock(BlockSums& window, const BlockSums& block) {
+			window.a += block.a;
+			window.b += block.b;
+			window.squares += block.squares;
+			window.products += block.products;
+		}
+
+		// SSIM of an 8x8 window from the sums of its four blocks, with the constants of the original paper.
+		double windowSSIM(const BlockSums& sums) {
+			const double c1 = 0.01 * 0.01 * 255 * 255 * 64;
+			const double c2 = 0.03 * 0.03 * 255 * 255 * 64 * 63;
+			double a = static_cast<double>(sums.a);
+			double b = static_cast<double>(sums.b);
+			double variances = sums.squares * 64.0 - a * a - b * b;
+			double covariance = sums.products * 64.0 - a * b;
+			return ((2 * a * b + c1) * (2 * covariance + c2)) / ((a * a + b * b + c1) * (variances + c2));
+		}
+	}
+
+	QualityProbe::QualityProbe(uint32_t interval) :
+		interval((std::max)(interval, 1u)),
+		strand(TaskScheduler::PRIORITY_LOW)
+	{
+	}
+
+	QualityProbe::~QualityProbe() {
+		PRE();
+		this->strand.wait();
+		for (auto& entry : this->references) {
+			av_frame_free(&entry.second);
+		}
+		avcodec_free_context(&this->decoderContext);
+		POST();
+	}
+
+	HRESULT QualityProbe::open(const AVCodecContext* encoder) {
+		PRE();
+		const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(encoder->pix_fmt);
+		RET_IF_NULL(desc, "Unknown pixel format for the quality probe", E_FAIL);
+		if (desc->flags & (AV_PIX_FMT_FLAG_BITSTREAM | AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_HWACCEL)) {
+			LOG(LL_WRN, "The quality probe does not support pixel format ", desc->name);
+			POST();
+			return E_FAIL;
+		}
+		for (int i = 0; i < desc->nb_components; i++) {
+			if (desc->comp[i].depth != 8) {
+				LOG(LL_WRN, "The quality probe only supports 8 bit components, not ", desc->name);
+				POST();
+				return E_FAIL;
+			}
+		}
+		this->hasSSIM = (desc->flags & AV_PIX_FMT_FLAG_PLANAR) && (desc->comp[0].step == 1);
+
+		AVCodec* decoder = avcodec_find_decoder(encoder->codec_id);
+		RET_IF_NULL(decoder, "Could not find a decoder for the quality probe", E_FAIL);
+		this->decoderContext = avcodec_alloc_context3(decoder);
+		RET_IF_NULL(this->decoderContext, "Could not allocate the quality probe decoder", E_FAIL);
+
+		AVCodecParameters* parameters = avcodec_parameters_alloc();
+		RET_IF_NULL(parameters, "Could not allocate codec parameters", E_FAIL);
+		avcodec_parameters_from_context(parameters, encoder);
+		int result = avcodec_parameters_to_context(this->decoderContext, parameters);
+		avcodec_parameters_free(&parameters);
+		RET_IF_FAILED_AV(result, "Could not copy codec parameters", E_FAIL);
+		this->decoderContext->time_base = encoder->time_base;
+		this->decoderContext->pkt_timebase = encoder->time_base;
+		// A single decoding thread keeps the probe out of the encoder's way.
+		this->decoderContext->thread_count = 1;
+		RET_IF_FAILED_AV(avcodec_open2(this->decoderContext, decoder, NULL), "Could not open the quality probe decoder", E_FAIL);
+
+		LOG(LL_NFO, "Quality probe: comparing every ", this->interval, " frames with the ", decoder->name, " decoder");
+		POST();
+		return S_OK;
+	}
+
+	void QualityProbe::pushReference(const AVFrame* frame) {
+		if ((frame->pts == AV_NOPTS_VALUE) || (frame->pts % this->interval != 0)) {
+			return;
+		}
+		AVFrame* copy = av_frame_clone(frame);
+		if (!copy) {
+			LOG(LL_WRN, "Could not copy frame for the quality probe.");
+			return;
+		}
+		std::lock_guard<std::mutex> lock(this->mxResults);
+		this->references[frame->pts] = copy;
+	}
+
+	void QualityProbe::pushPacket(const AVPacket* packet) {
+		std::shared_ptr<AVPacket> pCopy(av_packet_clone(packet), [](AVPacket* p) { av_packet_free(&p); });
+		if (!pCopy) {
+			LOG(LL_WRN, "Could not copy packet for the quality probe.");
+			return;
+		}
+		this->strand.post([this, pCopy]() {
+			this->decode(pCopy.get());
+		});
+	}
+
+	void QualityProbe::finish() {
+		PRE();
+		this->strand.post([this]() {
+			this->decode(NULL);
+		});
+		this->strand.wait();
+		std::lock_guard<std::mutex> lock(this->mxResults);
+		for (auto& entry : this->references) {
+			av_frame_free(&entry.second);
+		}
+		this->references.clear();
+		POST();
+	}
+
+	void QualityProbe::decode(const AVPacket* packet) {
+		if (!this->decoderContext) {
+			return;
+		}
+		if (avcodec_send_packet(this->decoderContext, packet) < 0) {
+			LOG(LL_WRN, "The quality probe could not decode a packet.");
+			return;
+		}
+
+		AVFrame* decoded = av_frame_alloc();
+		if (!decoded) {
+			return;
+		}
+		while (avcodec_receive_frame(this->decoderContext, decoded) >= 0) {
+			int64_t pts = av_frame_get_best_effort_timestamp(decoded);
+			AVFrame* reference = NULL;
+			{
+				std::lock_guard<std::mutex> lock(this->mxResults);
+				auto entry = this->references.find(pts);
+				if (entry != this->references.end()) {
+					reference = entry->second;
+					this->references.erase(entry);
+				}
+			}
+			if (reference) {
+				this->compare(reference, decoded);
+				av_frame_free(&reference);
+			}
+			av_frame_unref(decoded);
+		}
+		av_frame_free(&decoded);
+	}
+
+	void QualityProbe::compare(const AVFrame* reference, const AVFrame* decoded) {
+		if ((reference->format != decoded->format) || (reference->width != decoded->width) || (reference->height != decoded->height)) {
+			std::lock_guard<std::mutex> lock(this->mxResults);
+			this->mismatchCount++;
+			return;
+		}
+
+		AVPixelFormat format = static_cast<AVPixelFormat>(reference->format);
+		const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(format);
+		uint64_t errors = 0;
+		uint64_t samples = 0;
+		for (int plane = 0; plane < av_pix_fmt_count_planes(format); plane++) {
+			int rowLength = av_image_get_linesize(format, reference->width, plane);
+			int rows = (plane == 1) || (plane == 2) ? AV_CEIL_RSHIFT(reference->height, desc->log2_chroma_h) : reference->height;
+			for (int y = 0; y < rows; y++) {
+				errors += sumSquaredErrors(reference->data[plane] + y * reference->linesize[plane], decoded->data[plane] + y * decoded->linesize[plane], rowLength);
+			}
+			samples += static_cast<uint64_t>(rowLength) * rows;
+		}
+		double psnr = errors == 0 ? MAX_PSNR : (std::min)(MAX_PSNR, 10.0 * std::log10(255.0 * 255.0 * samples / errors));
+		double ssim = this->hasSSIM ? computeSSIM(reference->data[0], reference->linesize[0], decoded->data[0], decoded->linesize[0], reference->width, reference->height) : 0;
+		LOG(LL_NFO, "Quality probe frame ", reference->pts, ": PSNR ", psnr, " dB", this->hasSSIM ? ", SSIM " + std::to_string(ssim) : "");
+
+		std::lock_guard<std::mutex> lock(this->mxResults);
+		this->psnrMin = this->frameCount == 0 ? psnr : (std::min)(this->psnrMin, psnr);
+		this->ssimMin = this->frameCount == 0 ? ssim : (std::min)(this->ssimMin, ssim);
+		this->psnrSum += psnr;
+		this->ssimSum += ssim;
+		this->frameCount++;
+	}
+
+	uint64_t QualityProbe::sumSquaredErrors(const uint8_t* a, const uint8_t* b, int length) {
+		const __m128i zero = _mm_setzero_si128();
+		__m128i sum = zero;
+		int x = 0;
+		// 16 bit differences squared and added in pairs; a row of 64K samples stays within 32 bits per lane.
+		for (; x + 16 <= length; x += 16) {
+			__m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + x));
+			__m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + x));
+			__m128i low = _mm_sub_epi16(_mm_unpacklo_epi8(va, zero), _mm_unpacklo_epi8(vb, zero));
+			__m128i high = _mm_sub_epi16(_mm_unpackhi_epi8(va, zero), _mm_unpackhi_epi8(vb, zero));
+			sum = _mm_add_epi32(sum, _mm_add_epi32(_mm_madd_epi16(low, low), _mm_madd_epi16(high, high)));
+		}
+		alignas(16) uint32_t lanes[4];
+		_mm_store_si128(reinterpret_cast<__m128i*>(lanes), sum);
+		uint64_t result = static_cast<uint64_t>(lanes[0]) + lanes[1] + lanes[2] + lanes[3];
+		for (; x < length; x++) {
+			int difference = a[x] - b[x];
+			result += difference * difference;
+		}
+		return result;
+	}
+
+	double QualityProbe::computeSSIM(const uint8_t* a, int strideA, const uint8_t* b, int strideB, int width, int height) {
+		int blocksX = width / 4;
+		int blocksY = height / 4;
+		if ((blocksX < 2) || (blocksY < 2)) {
+			return 1.0;
+		}
+
+		// Two rows of block sums; each window adds up 2x2 neighbouring blocks.
+		std::vector<BlockSums> rows[2] = { std::vector<BlockSums>(blocksX), std::vector<BlockSums>(blocksX) };
+		double total = 0;
+		for (int by = 0; by < blocksY; by++) {
+			std::vector<BlockSums>& row = rows[by & 1];
+			const uint8_t* pa = a + by * 4 * strideA;
+			const uint8_t* pb = b + by * 4 * strideB;
+			int bx = 0;
+			for (; bx + 4 <= blocksX; bx += 4) {
+				sumBlocks4(pa + bx * 4, strideA, pb + bx * 4, strideB, &row[bx]);
+			}
+			for (; bx < blocksX; bx++) {
+				sumBlock(pa + bx * 4, strideA, pb + bx * 4, strideB, row[bx]);
+			}
+			if (by == 0) {
+				continue;
+			}
+
+			const std::vector<BlockSums>& above = rows[(by - 1) & 1];
+			for (bx = 0; bx + 1 < blocksX; bx++) {
+				BlockSums window;
+				addBlock(window, above[bx]);
+				addBlock(window, above[bx + 1]);
+				addBlock(window, row[bx]);
+				addBlock(window, row[bx + 1]);
+				total += windowSSIM(window);
+			}
+		}
+		return total / (static_cast<double>(blocksX - 1) * (blocksY - 1));
+	}
+
+	void QualityProbe::logReport() const {
+		std::lock_guard<std::mutex> lock(this->mxResults);
+		if (this->frameCount == 0) {
+			LOG(LL_NFO, "Quality probe: no frames compared (", this->mismatchCount, " decoded in another format)");
+			return;
+		}
+		LOG(LL_NFO, "Quality probe: ", this->frameCount, " frames, PSNR mean ", this->psnrSum / this->frameCount, " dB, min ", this->psnrMin, " dB",
+			this->hasSSIM ? ", SSIM mean " + std::to_string(this->ssimSum / this->frameCount) + ", min " + std::to_string(this->ssimMin) : "");
+	}
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <Windows.h>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <vector>
+#include "task-scheduler.h"
+
+extern "C" {
+#include <libavcodec\avcodec.h>
+}
+
+namespace Encoder {
+	// Measures what the encoder gives up on a sample of the frames. Every
+	// interval-th frame is kept before it is encoded; the encoded packets are
+	// decoded on a low priority strand and the decoded frame is compared with
+	// the kept one. PSNR covers every plane, SSIM the first plane of planar
+	// formats. Only formats with one byte per component can be probed.
+	class QualityProbe {
+	public:
+		QualityProbe(uint32_t interval);
+		~QualityProbe();
+
+		HRESULT open(const AVCodecContext* encoder);
+
+		// Keeps a copy of the frame if it is one of the probed frames.
+		void pushReference(const AVFrame* frame);
+		// Takes a packet in the codec time base, in decoding order.
+		void pushPacket(const AVPacket* packet);
+		// Decodes the delayed frames and waits until every packet has been compared.
+		void finish();
+
+		void logReport() const;
+
+		// Sum of squared differences between two rows of bytes.
+		static uint64_t sumSquaredErrors(const uint8_t* a, const uint8_t* b, int length);
+		// Mean SSIM of two 8 bit planes over 8x8 windows spaced 4 samples apart.
+		static double computeSSIM(const uint8_t* a, int strideA, const uint8_t* b, int strideB, int width, int height);
+
+	private:
+		void decode(const AVPacket* packet);
+		void compare(const AVFrame* reference, const AVFrame* decoded);
+
+		uint32_t interval;
+		AVCodecContext* decoderContext = NULL;
+		bool hasSSIM = false;
+		TaskScheduler::Strand strand;
+
+		mutable std::mutex mxResults;
+		std::map<int64_t, AVFrame*> references;
+		uint64_t frameCount = 0;
+		uint64_t mismatchCount = 0;
+		double psnrSum = 0;
+		double psnrMin = 0;
+		double ssimSum = 0;
+		double ssimMin = 0;
+	};
+}
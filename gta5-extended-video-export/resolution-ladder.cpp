@@ -0,0 +1,199 @@
+#include "resolution-ladder.h"
+#include "logger.h"
+#include "task-scheduler.h"
+#include <algorithm>
+#include <emmintrin.h>
+#include <sstream>
+
+extern "C" {
+#include <libavutil\pixdesc.h>
+}
+
+namespace Encoder {
+
+	namespace {
+		// Averages the 2x2 blocks of 16 samples from two rows into 8 words.
+		__m128i averageBlocks(const uint8_t* top, const uint8_t* bottom) {
+			const __m128i lowBytes = _mm_set1_epi16(0x00FF);
+			__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(top));
+			__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bottom));
+			__m128i sum = _mm_add_epi16(_mm_add_epi16(_mm_and_si128(a, lowBytes), _mm_srli_epi16(a, 8)),
+				_mm_add_epi16(_mm_and_si128(b, lowBytes), _mm_srli_epi16(b, 8)));
+			return _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(2)), 2);
+		}
+
+		void halveRows(const uint8_t* src, int srcStride, uint8_t* dst, int dstStride, int width, size_t firstRow, size_t lastRow) {
+			for (size_t y = firstRow; y < lastRow; y++) {
+				const uint8_t* top = src + 2 * y * srcStride;
+				const uint8_t* bottom = top + srcStride;
+				uint8_t* out = dst + y * dstStride;
+				int x = 0;
+				for (; x + 16 <= width; x += 16) {
+					__m128i first = averageBlocks(top + 2 * x, bottom + 2 * x);
+					__m128i second = averageBlocks(top + 2 * x + 16, bottom + 2 * x + 16);
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), _mm_packus_epi16(first, second));
+				}
+				for (; x < width; x++) {
+					out[x] = static_cast<uint8_t>((top[2 * x] + top[2 * x + 1] + bottom[2 * x] + bottom[2 * x + 1] + 2) >> 2);
+				}
+			}
+		}
+	}
+
+	ResolutionLadder::ResolutionLadder(AVRational frameRate, float shutterAngle) :
+		frameRate(frameRate),
+		shutterAngle(shutterAngle)
+	{
+	}
+
+	ResolutionLadder::~ResolutionLadder() {
+		PRE();
+		LOG_CALL(LL_DBG, this->finish());
+		for (auto& rung : this->rungs) {
+			LOG_CALL(LL_DBG, av_frame_free(&rung.frame));
+			LOG_CALL(LL_DBG, sws_freeContext(rung.pSwsContext));
+		}
+		POST();
+	}
+
+	HRESULT ResolutionLadder::parse(std::string definition, std::vector<uint32_t>& heights) {
+		heights.clear();
+		std::stringstream stream(definition);
+		std::string entry;
+		while (std::getline(stream, entry, ',')) {
+			entry.erase(std::remove_if(entry.begin(), entry.end(), ::isspace), entry.end());
+			if (entry.empty()) {
+				continue;
+			}
+			if ((entry.back() == 'p') || (entry.back() == 'P')) {
+				entry.pop_back();
+			}
+			uint32_t height = 0;
+			try {
+				height = std::stoul(entry);
+			} catch (std::exception&) {
+				height = 0;
+			}
+			if (height < 2) {
+				LOG(LL_ERR, "Invalid resolution ladder height: ", entry);
+				return E_FAIL;
+			}
+			heights.push_back(height);
+		}
+		std::sort(heights.begin(), heights.end(), std::greater<uint32_t>());
+		heights.erase(std::unique(heights.begin(), heights.end()), heights.end());
+		return S_OK;
+	}
+
+	HRESULT ResolutionLadder::open(std::string definition, std::string stem, std::string extension, AVOutputFormat* oformat, uint32_t width, uint32_t height, AVPixelFormat pixelFormat, std::string vcodec, std::string voptions, int threadCount, std::shared_ptr<OutputManifest> manifest) {
+		PRE();
+		std::vector<uint32_t> heights;
+		RET_IF_FAILED(parse(definition, heights), "Could not parse the resolution ladder", E_FAIL);
+		const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(pixelFormat);
+		RET_IF_NULL(desc, "Unknown pixel format for the resolution ladder", E_FAIL);
+		this->pixelFormat = pixelFormat;
+
+		// Keep every rung a whole number of chroma samples wide and high.
+		uint32_t alignment = (std::max)(2u, 1u << (std::max)(desc->log2_chroma_w, desc->log2_chroma_h));
+		uint32_t aboveWidth = width;
+		uint32_t aboveHeight = height;
+		for (uint32_t rungHeight : heights) {
+			if (rungHeight >= height) {
+				LOG(LL_WRN, "Skipping resolution ladder rung ", rungHeight, "p, it is not smaller than the export.");
+				continue;
+			}
+
+			Rung rung;
+			rung.height = rungHeight / alignment * alignment;
+			rung.width = static_cast<uint32_t>(av_rescale(width, rung.height, height)) / alignment * alignment;
+			if ((rung.width == 0) || (rung.height == 0)) {
+				LOG(LL_WRN, "Skipping resolution ladder rung ", rungHeight, "p, it is too small.");
+				continue;
+			}
+
+			rung.frame = av_frame_alloc();
+			RET_IF_NULL(rung.frame, "Could not allocate video frame", E_FAIL);
+			rung.frame->format = pixelFormat;
+			rung.frame->width = rung.width;
+			rung.frame->height = rung.height;
+			RET_IF_FAILED_AV(av_frame_get_buffer(rung.frame, 32), "Could not allocate video frame buffer", E_FAIL);
+
+			if (!this->canHalve(aboveWidth, aboveHeight, rung.width, rung.height)) {
+				rung.pSwsContext = sws_getContext(aboveWidth, aboveHeight, pixelFormat, rung.width, rung.height, pixelFormat, SWS_AREA, NULL, NULL, NULL);
+				RET_IF_NULL(rung.pSwsContext, "Could not create scaling context", E_FAIL);
+			}
+
+			rung.output = std::make_shared<AuxVideoOutput>(this->frameRate, this->shutterAngle);
+			rung.output->setManifest(manifest);
+			std::string filename = stem + "." + std::to_string(rungHeight) + "p" + extension;
+			RET_IF_FAILED(rung.output->open(filename, oformat, rung.width, rung.height, pixelFormat, vcodec, voptions, threadCount), "Could not create resolution ladder output " + filename, E_FAIL);
+			LOG(LL_NFO, "Resolution ladder: ", rung.width, "x", rung.height, rung.pSwsContext ? " (area scaled from " : " (halved from ", aboveWidth, "x", aboveHeight, ")");
+
+			aboveWidth = rung.width;
+			aboveHeight = rung.height;
+			this->rungs.push_back(rung);
+		}
+
+		POST();
+		return S_OK;
+	}
+
+	bool ResolutionLadder::canHalve(uint32_t width, uint32_t height, uint32_t targetWidth, uint32_t targetHeight) const {
+		if ((targetWidth * 2 != width) || (targetHeight * 2 != height)) {
+			return false;
+		}
+		// Every component in its own plane, one byte per sample.
+		const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(this->pixelFormat);
+		if (!desc || !(desc->flags & AV_PIX_FMT_FLAG_PLANAR) || (desc->flags & (AV_PIX_FMT_FLAG_BITSTREAM | AV_PIX_FMT_FLAG_PAL))) {
+			return false;
+		}
+		for (int i = 0; i < desc->nb_components; i++) {
+			if ((desc->comp[i].depth != 8) || (desc->comp[i].step != 1)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void ResolutionLadder::halve(const AVFrame* source, AVFrame* target) const {
+		const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(this->pixelFormat);
+		int planes = av_pix_fmt_count_planes(this->pixelFormat);
+		for (int p = 0; p < planes; p++) {
+			bool isChroma = (p == 1) || (p == 2);
+			int width = target->width >> (isChroma ? desc->log2_chroma_w : 0);
+			int height = target->height >> (isChroma ? desc->log2_chroma_h : 0);
+			const uint8_t* src = source->data[p];
+			int srcStride = source->linesize[p];
+			uint8_t* dst = target->data[p];
+			int dstStride = target->linesize[p];
+			TaskScheduler::instance().parallelFor(0, height, 32, [&](size_t begin, size_t end) {
+				halveRows(src, srcStride, dst, dstStride, width, begin, end);
+			});
+		}
+	}
+
+	HRESULT ResolutionLadder::pushFrame(const AVFrame* frame) {
+		const AVFrame* above = frame;
+		for (auto& rung : this->rungs) {
+			// The encoder may still hold a reference to the previous frame.
+			RET_IF_FAILED_AV(av_frame_make_writable(rung.frame), "Could not make the ladder frame writable", E_FAIL);
+			if (rung.pSwsContext) {
+				sws_scale(rung.pSwsContext, above->data, above->linesize, 0, above->height, rung.frame->data, rung.frame->linesize);
+			} else {
+				this->halve(above, rung.frame);
+			}
+			RET_IF_FAILED(rung.output->writeFrame(rung.frame), "Could not encode resolution ladder frame", E_FAIL);
+			above = rung.frame;
+		}
+		return S_OK;
+	}
+
+	HRESULT ResolutionLadder::finish() {
+		PRE();
+		for (auto& rung : this->rungs) {
+			LOG_IF_FAILED(rung.output->finish(), "Could not finish resolution ladder output.");
+		}
+		POST();
+		return S_OK;
+	}
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <Windows.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include "aux-video-output.h"
+#include "output-manifest.h"
+
+extern "C" {
+#include <libavcodec\avcodec.h>
+#include <libavformat\avformat.h>
+#include <libswscale\swscale.h>
+}
+
+namespace Encoder {
+	// Lower resolution renditions of the main export, each with its own encoder.
+	// Every rung is scaled from the one above it rather than from the full
+	// frame: rungs of exactly half the size are box filtered, the others go
+	// through an area scaler.
+	class ResolutionLadder {
+	public:
+		ResolutionLadder(AVRational frameRate, float shutterAngle);
+		~ResolutionLadder();
+
+		// Parses a comma separated list of heights such as "1440, 1080p, 720p", largest first.
+		static HRESULT parse(std::string definition, std::vector<uint32_t>& heights);
+
+		// Opens "<stem>.<height>p<extension>" for every rung smaller than the main export.
+		HRESULT open(std::string definition, std::string stem, std::string extension, AVOutputFormat* oformat, uint32_t width, uint32_t height, AVPixelFormat pixelFormat, std::string vcodec, std::string voptions, int threadCount, std::shared_ptr<OutputManifest> manifest);
+		// Scales a frame of the main export down the ladder and encodes every rendition.
+		HRESULT pushFrame(const AVFrame* frame);
+		HRESULT finish();
+
+	private:
+		struct Rung {
+			uint32_t width = 0;
+			uint32_t height = 0;
+			AVFrame* frame = NULL;
+			// Not set when the rung is half the size of the one above it.
+			SwsContext* pSwsContext = NULL;
+			std::shared_ptr<AuxVideoOutput> output;
+		};
+
+		bool canHalve(uint32_t width, uint32_t height, uint32_t targetWidth, uint32_t targetHeight) const;
+		void halve(const AVFrame* source, AVFrame* target) const;
+
+		AVRational frameRate;
+		float shutterAngle;
+		AVPixelFormat pixelFormat = AV_PIX_FMT_NONE;
+		std::vector<Rung> rungs;
+	};
+}
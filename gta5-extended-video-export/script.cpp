@@ -25,6 +25,8 @@
 
 #include "..\DirectXTex\DirectXTex\DirectXTex.h"
 #include "hook-def.h"
+#include <condition_variable>
+#include <deque>
 
 using namespace Microsoft::WRL;
 using namespace DirectX;
@@ -79,7 +81,10 @@ namespace {
 	//std::shared_ptr<PLH::X64Detour> hkGetTexture(new PLH::X64Detour);
 	bool isCustomFrameRateSupported = false;
 
-	std::unique_ptr<Encoder::Session> session;
+	// Both handles are published with std::atomic_store and every hook pins its own
+	// reference with std::atomic_load, so capture and audio never wait on each other.
+	// mxSession only serializes creating and retiring sessions.
+	std::shared_ptr<Encoder::Session> session;
 	std::mutex mxSession;
 
 	void *pGlobalUnk01 = NULL;
@@ -128,6 +133,57 @@ namespace {
 
 	std::shared_ptr<ExportContext> exportContext;
 
+	// Sessions whose last reference is gone are deleted on releaseThread, so that
+	// ~Session, which flushes the pipeline and joins its threads, never runs on
+	// the render or audio thread that happened to let go last.
+	std::deque<Encoder::Session*> releasedSessions;
+	std::mutex mxReleasedSessions;
+	std::condition_variable cvReleasedSessions;
+	std::thread releaseThread;
+	bool isReleaseThreadRunning = false;
+
+	void releaseSessions() {
+		std::unique_lock<std::mutex> lock(mxReleasedSessions);
+		while (true) {
+			cvReleasedSessions.wait(lock, []() { return !releasedSessions.empty() || !isReleaseThreadRunning; });
+			if (releasedSessions.empty()) {
+				break;
+			}
+			Encoder::Session* pSession = releasedSessions.front();
+			releasedSessions.pop_front();
+			lock.unlock();
+			LOG_CALL(LL_DBG, delete pSession);
+			lock.lock();
+		}
+	}
+
+	// Deleter of every session the hooks share.
+	void deleteSession(Encoder::Session* pSession) {
+		std::unique_lock<std::mutex> lock(mxReleasedSessions);
+		if (!isReleaseThreadRunning) {
+			// Only after finalize, when no hook runs any more.
+			lock.unlock();
+			delete pSession;
+			return;
+		}
+		releasedSessions.push_back(pSession);
+		cvReleasedSessions.notify_one();
+	}
+
+	// Must be called with mxSession held.
+	void retireSession() {
+		std::atomic_store(&::session, std::shared_ptr<Encoder::Session>());
+		std::atomic_store(&::exportContext, std::shared_ptr<ExportContext>());
+	}
+
+	// Drops a failed session, unless it has been replaced in the meantime.
+	void abandonSession(const std::shared_ptr<Encoder::Session>& pSession) {
+		std::lock_guard<std::mutex> sessionLock(mxSession);
+		if (std::atomic_load(&::session) == pSession) {
+			retireSession();
+		}
+	}
+
 	std::shared_ptr<YaraHelper> pYaraHelper;
 
 }
@@ -234,12 +290,21 @@ void onPresent(IDXGISwapChain *swapChain) {
 			LOG(LL_ERR, ex.what());
 		}
 	}
+
+	// The frame is complete here, so holding the game back for the export
+	// does not stall it in the middle of a D3D11 call.
+	std::shared_ptr<Encoder::Session> pSession = std::atomic_load(&::session);
+	if (pSession && pSession->isCapturing) {
+		pSession->pace();
+	}
 }
 
 void initialize() {
 	PRE();
 	try {
 		mainThreadId = std::this_thread::get_id();
+		isReleaseThreadRunning = true;
+		releaseThread = std::thread(releaseSessions);
 
 		/*REQUIRE(CoInitializeEx(NULL, COINIT_MULTITHREADED), "Failed to initialize COM");
 
@@ -441,7 +506,8 @@ static void Hook_OMSetRenderTargets(
 	ID3D11DepthStencilView        *pDepthStencilView
 	) {
 
-	if (::exportContext) {
+	std::shared_ptr<ExportContext> pContext = std::atomic_load(&::exportContext);
+	if (pContext) {
 		for (uint32_t i = 0; i < NumViews; i++) {
 			if (ppRenderTargetViews[i]) {
 				ComPtr<ID3D11Resource> pResource;
@@ -469,9 +535,10 @@ static void Hook_OMSetRenderTargets(
 		pOldRTV->GetResource(pOldRTVTexture.GetAddressOf());
 	}
 
-	if ((::exportContext != NULL) && (::exportContext->pExportRenderTarget != NULL) && (::exportContext->pExportRenderTarget == pRTVTexture)) {
-		std::lock_guard<std::mutex> sessionLock(mxSession);
-		if ((session != NULL) && (session->isCapturing)) {
+	if ((pContext != NULL) && (pContext->pExportRenderTarget != NULL) && (pContext->pExportRenderTarget == pRTVTexture)) {
+		std::shared_ptr<Encoder::Session> pSession = std::atomic_load(&::session);
+		// Nothing is read back for audio-only sessions or for frames outside of the selected ranges.
+		if ((pSession != NULL) && (pSession->isCapturing) && (pSession->isVideoConsumed() || pSession->isEXRConsumed()) && (pSession->selectNextFrame())) {
 
 			// Time to capture rendered frame
 			try {
@@ -482,8 +549,9 @@ static void Hook_OMSetRenderTargets(
 				ComPtr<ID3D11Texture2D> pBackBufferCopy = nullptr;
 				ComPtr<ID3D11Texture2D> pStencilBufferCopy = nullptr;
 
-				if (config::export_openexr) {
-					{
+				// Sub-frames outside of the OpenEXR shutter are not read back at all.
+				if (pSession->isEXRConsumed() && pSession->isEXRSubFrameUsed()) {
+					if (pSession->exrChannels.depth) {
 						D3D11_TEXTURE2D_DESC desc;
 						pLinearDepthTexture->GetDesc(&desc);
 
@@ -496,7 +564,7 @@ static void Hook_OMSetRenderTargets(
 
 						pThis->CopyResource(pDepthBufferCopy.Get(), pLinearDepthTexture.Get());
 					}
-					{
+					if (pSession->exrChannels.hasColor()) {
 						D3D11_TEXTURE2D_DESC desc;
 						pGameBackBufferResolved->GetDesc(&desc);
 						desc.CPUAccessFlags = D3D11_CPU_ACCESS_FLAG::D3D11_CPU_ACCESS_READ;
@@ -508,7 +576,7 @@ static void Hook_OMSetRenderTargets(
 
 						pThis->CopyResource(pBackBufferCopy.Get(), pGameBackBufferResolved.Get());
 					}
-					{
+					if (pSession->exrChannels.objectID) {
 						D3D11_TEXTURE2D_DESC desc;
 						pStencilTexture->GetDesc(&desc);
 						desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
@@ -521,30 +589,48 @@ static void Hook_OMSetRenderTargets(
 						//pThis->ResolveSubresource(pStencilBufferCopy.Get(), 0, pGameDepthBuffer.Get(), 0, DXGI_FORMAT::DXGI_FORMAT_R32G8X24_TYPELESS);
 						pThis->CopyResource(pStencilBufferCopy.Get(), pGameEdgeCopy.Get());
 					}
-					session->enqueueEXRImage(pThis, pBackBufferCopy, pDepthBufferCopy, pStencilBufferCopy);
+					pSession->enqueueEXRImage(pThis, pBackBufferCopy, pDepthBufferCopy, pStencilBufferCopy);
 				}
-				LOG_CALL(LL_DBG, ::exportContext->pSwapChain->Present(0, DXGI_PRESENT_TEST)); // IMPORTANT: This call makes ENB and ReShade effects to be applied to the render target
+				// EXR-only sessions do not need the swap chain at all. HDR video is read from
+				// the game's HDR buffer instead, before tone mapping and post effects.
+				if (pSession->isVideoConsumed() && pSession->isHDRVideo()) {
+					if (pSession->isHDRSubFrameUsed()) {
+						ComPtr<ID3D11Texture2D> pHDRBufferCopy = nullptr;
+						D3D11_TEXTURE2D_DESC desc;
+						pGameBackBufferResolved->GetDesc(&desc);
+						desc.CPUAccessFlags = D3D11_CPU_ACCESS_FLAG::D3D11_CPU_ACCESS_READ;
+						desc.BindFlags = 0;
+						desc.MiscFlags = 0;
+						desc.Usage = D3D11_USAGE::D3D11_USAGE_STAGING;
+
+						REQUIRE(pDevice->CreateTexture2D(&desc, NULL, pHDRBufferCopy.GetAddressOf()), "Failed to create HDR buffer copy texture");
 
-				ComPtr<ID3D11Texture2D> pSwapChainBuffer;
-				REQUIRE(::exportContext->pSwapChain->GetBuffer(0, __uuidof(ID3D11Texture2D), (void**)pSwapChainBuffer.GetAddressOf()), "Failed to get swap chain's buffer");
+						pThis->CopyResource(pHDRBufferCopy.Get(), pGameBackBufferResolved.Get());
+						REQUIRE(pSession->enqueueHDRVideoFrame(pThis, pHDRBufferCopy), "Failed to enqueue HDR frame");
+					}
+				} else if (pSession->isVideoConsumed()) {
+					LOG_CALL(LL_DBG, pContext->pSwapChain->Present(0, DXGI_PRESENT_TEST)); // IMPORTANT: This call makes ENB and ReShade effects to be applied to the render target
+
+					ComPtr<ID3D11Texture2D> pSwapChainBuffer;
+					REQUIRE(pContext->pSwapChain->GetBuffer(0, __uuidof(ID3D11Texture2D), (void**)pSwapChainBuffer.GetAddressOf()), "Failed to get swap chain's buffer");
 								
-				auto& image_ref = *(::exportContext->capturedImage);
-				LOG_CALL(LL_DBG, DirectX::CaptureTexture(::exportContext->pDevice.Get(), ::exportContext->pDeviceContext.Get(), pSwapChainBuffer.Get(), image_ref));
-				if (::exportContext->capturedImage->GetImageCount() == 0) {
-					LOG(LL_ERR, "There is no image to capture.");
-					throw std::exception();
-				}
-				const DirectX::Image* image = ::exportContext->capturedImage->GetImage(0, 0, 0);
-				NOT_NULL(image, "Could not get current frame.");
-				NOT_NULL(image->pixels, "Could not get current frame.");
+					auto& image_ref = *(pContext->capturedImage);
+					LOG_CALL(LL_DBG, DirectX::CaptureTexture(pContext->pDevice.Get(), pContext->pDeviceContext.Get(), pSwapChainBuffer.Get(), image_ref));
+					if (pContext->capturedImage->GetImageCount() == 0) {
+						LOG(LL_ERR, "There is no image to capture.");
+						throw std::exception();
+					}
+					const DirectX::Image* image = pContext->capturedImage->GetImage(0, 0, 0);
+					NOT_NULL(image, "Could not get current frame.");
+					NOT_NULL(image->pixels, "Could not get current frame.");
 
-				REQUIRE(session->enqueueVideoFrame(image->pixels, (int)(image->width * image->height * 4)), "Failed to enqueue frame");
-				::exportContext->capturedImage->Release();
+					REQUIRE(pSession->enqueueVideoFrame(image->pixels, (int)(image->width * image->height * 4)), "Failed to enqueue frame");
+					pContext->capturedImage->Release();
+				}
 			} catch (std::exception&) {
 				LOG(LL_ERR, "Reading video frame from D3D Device failed.");
-				::exportContext->capturedImage->Release();
-				LOG_CALL(LL_DBG, session.reset());
-				LOG_CALL(LL_DBG, ::exportContext.reset());
+				pContext->capturedImage->Release();
+				LOG_CALL(LL_DBG, abandonSession(pSession));
 			}
 		}
 	}
@@ -594,21 +680,23 @@ static HRESULT IMFSinkWriter_SetInputMediaType(
 	LOG(LL_NFO, "IMFSinkWriter::SetInputMediaType: ", GetMediaTypeDescription(pInputMediaType).c_str());
 
 	GUID majorType;
-	if (SUCCEEDED(pInputMediaType->GetMajorType(&majorType))) {
+	std::lock_guard<std::mutex> sessionLock(mxSession);
+	std::shared_ptr<Encoder::Session> pSession = std::atomic_load(&::session);
+	std::shared_ptr<ExportContext> pContext = std::atomic_load(&::exportContext);
+	if ((pSession != NULL) && (pContext != NULL) && SUCCEEDED(pInputMediaType->GetMajorType(&majorType))) {
 		if (IsEqualGUID(majorType, MFMediaType_Video)) {
-			::exportContext->videoMediaType = pInputMediaType;
+			pContext->videoMediaType = pInputMediaType;
 		} else if (IsEqualGUID(majorType, MFMediaType_Audio)) {
 			try {
-				std::lock_guard<std::mutex> sessionLock(mxSession);
 				UINT width, height, fps_num, fps_den;
-				MFGetAttribute2UINT32asUINT64(::exportContext->videoMediaType.Get(), MF_MT_FRAME_SIZE, &width, &height);
-				MFGetAttributeRatio(::exportContext->videoMediaType.Get(), MF_MT_FRAME_RATE, &fps_num, &fps_den);
+				MFGetAttribute2UINT32asUINT64(pContext->videoMediaType.Get(), MF_MT_FRAME_SIZE, &width, &height);
+				MFGetAttributeRatio(pContext->videoMediaType.Get(), MF_MT_FRAME_RATE, &fps_num, &fps_den);
 
 				GUID pixelFormat;
-				::exportContext->videoMediaType->GetGUID(MF_MT_SUBTYPE, &pixelFormat);
+				pContext->videoMediaType->GetGUID(MF_MT_SUBTYPE, &pixelFormat);
 
 				DXGI_SWAP_CHAIN_DESC desc;
-				::exportContext->pSwapChain->GetDesc(&desc);
+				pContext->pSwapChain->GetDesc(&desc);
 
 
 					
@@ -623,13 +711,13 @@ static HRESULT IMFSinkWriter_SetInputMediaType(
 						LOG(LL_NON, "fps * (motion_blur_samples + 1) > 60.0!!!");
 						LOG(LL_NON, "Audio export will be disabled!!!");
 
-						//::exportContext->audioSkip = gameFrameRate / 60;
-						//::exportContext->audioSkipCounter = ::exportContext->audioSkip;
-						::exportContext->isAudioExportDisabled = true;
+						//pContext->audioSkip = gameFrameRate / 60;
+						//pContext->audioSkipCounter = pContext->audioSkip;
+						pContext->isAudioExportDisabled = true;
 					}
 				}
 
-				//REQUIRE(session->createVideoContext(desc.BufferDesc.Width, desc.BufferDesc.Height, "bgra", fps_num, fps_den, config::motion_blur_samples,  config::video_fmt, config::video_enc, config::video_cfg), "Failed to create video context");
+				//REQUIRE(pSession->createVideoContext(desc.BufferDesc.Width, desc.BufferDesc.Height, "bgra", fps_num, fps_den, config::motion_blur_samples,  config::video_fmt, config::video_enc, config::video_cfg), "Failed to create video context");
 
 				UINT32 blockAlignment, numChannels, sampleRate, bitsPerSample;
 				GUID subType;
@@ -641,7 +729,7 @@ static HRESULT IMFSinkWriter_SetInputMediaType(
 				pInputMediaType->GetGUID(MF_MT_SUBTYPE, &subType);
 
 				/*if (IsEqualGUID(subType, MFAudioFormat_PCM)) {
-					REQUIRE(session->createAudioContext(numChannels, sampleRate, bitsPerSample, "s16", blockAlignment, config::audio_fmt, config::audio_enc, config::audio_cfg), "Failed to create audio context.");
+					REQUIRE(pSession->createAudioContext(numChannels, sampleRate, bitsPerSample, "s16", blockAlignment, config::audio_fmt, config::audio_enc, config::audio_cfg), "Failed to create audio context.");
 				} else {
 					char buffer[64];
 					GUIDToString(subType, buffer, 64);
@@ -667,7 +755,7 @@ static HRESULT IMFSinkWriter_SetInputMediaType(
 
 				LOG(LL_NFO, "Output file: ", filename);
 
-				REQUIRE(session->createContext(config::container_format,
+				REQUIRE(pSession->createContext(config::container_format,
 					filename.c_str(),
 					exrOutputPath,
 					config::format_cfg,
@@ -691,8 +779,7 @@ static HRESULT IMFSinkWriter_SetInputMediaType(
 					config::audio_cfg), "Failed to create encoding context.");
 			} catch (std::exception& ex) {
 				LOG(LL_ERR, ex.what());
-				LOG_CALL(LL_DBG, session.reset());
-				LOG_CALL(LL_DBG, ::exportContext.reset());
+				LOG_CALL(LL_DBG, retireSession());
 			}
 		}
 	}
@@ -706,9 +793,17 @@ static HRESULT Hook_IMFSinkWriter_WriteSample(
 	DWORD         dwStreamIndex,
 	IMFSample     *pSample
 	) {
-	std::lock_guard<std::mutex> sessionLock(mxSession);
+	std::shared_ptr<Encoder::Session> pSession = std::atomic_load(&::session);
+	std::shared_ptr<ExportContext> pContext = std::atomic_load(&::exportContext);
+
+	if ((pSession != NULL) && (pSession->isCapturing) && (dwStreamIndex == 0)) {
+		LONGLONG sampleTime;
+		if (SUCCEEDED(pSample->GetSampleTime(&sampleTime))) {
+			pSession->setVideoStartTime(sampleTime);
+		}
+	}
 
-	if ((session != NULL) && (dwStreamIndex == 1) && (!::exportContext->isAudioExportDisabled)) {
+	if ((pSession != NULL) && (pContext != NULL) && (pSession->isCapturing) && (dwStreamIndex == 1) && (!pContext->isAudioExportDisabled)) {
 
 		ComPtr<IMFMediaBuffer> pBuffer = NULL;
 		try {
@@ -720,13 +815,13 @@ static HRESULT Hook_IMFSinkWriter_WriteSample(
 			pBuffer->GetCurrentLength(&length);
 			BYTE *buffer;
 			if (SUCCEEDED(pBuffer->Lock(&buffer, NULL, NULL))) {
-				LOG_CALL(LL_DBG, session->writeAudioFrame(buffer, length, sampleTime));
+				LOG_CALL(LL_DBG, pSession->enqueueAudioFrame(buffer, length, sampleTime));
+				pBuffer->Unlock();
 			}
 			
 		} catch (std::exception& ex) {
 			LOG(LL_ERR, ex.what());
-			LOG_CALL(LL_DBG, session.reset());
-			LOG_CALL(LL_DBG, ::exportContext.reset());
+			LOG_CALL(LL_DBG, abandonSession(pSession));
 			if (pBuffer != NULL) {
 				pBuffer->Unlock();
 			}
@@ -743,18 +838,19 @@ static HRESULT Hook_IMFSinkWriter_Finalize(
 	) {
 	PRE();
 	std::lock_guard<std::mutex> sessionLock(mxSession);
+	std::shared_ptr<Encoder::Session> pSession = std::atomic_load(&::session);
 	try {
-		if (session != NULL) {
-			LOG_CALL(LL_DBG, session->finishAudio());
-			LOG_CALL(LL_DBG, session->finishVideo());
-			LOG_CALL(LL_DBG, session->endSession());
+		if (pSession != NULL) {
+			LOG_CALL(LL_DBG, pSession->finishAudio());
+			LOG_CALL(LL_DBG, pSession->finishVideo());
+			LOG_CALL(LL_DBG, pSession->endSession());
 		}
 	} catch (std::exception& ex) {
 		LOG(LL_ERR, ex.what());
 	}
 
-	LOG_CALL(LL_DBG, session.reset());
-	LOG_CALL(LL_DBG, ::exportContext.reset());
+	// The session itself is deleted on the release thread once the last hook still using it lets go.
+	LOG_CALL(LL_DBG, retireSession());
 	POST();
 	return S_OK;
 }
@@ -767,6 +863,19 @@ void finalize() {
 	hkIMFSinkWriter_SetInputMediaType->UnHook();
 	hkIMFSinkWriter_WriteSample->UnHook();
 	hkIMFSinkWriter_Finalize->UnHook();
+	{
+		std::lock_guard<std::mutex> sessionLock(mxSession);
+		retireSession();
+	}
+	{
+		std::lock_guard<std::mutex> lock(mxReleasedSessions);
+		isReleaseThreadRunning = false;
+	}
+	cvReleasedSessions.notify_all();
+	// Sessions released before this are deleted before the thread ends.
+	if (releaseThread.joinable()) {
+		releaseThread.join();
+	}
 	POST();
 }
 
@@ -985,8 +1094,7 @@ static void* Detour_CreateTexture(void* rcx, char* name, uint32_t r8d, uint32_t
 				" w:", desc.Width,
 				" h:", desc.Height);
 			std::lock_guard<std::mutex> sessionLock(mxSession);
-			LOG_CALL(LL_DBG, ::exportContext.reset());
-			LOG_CALL(LL_DBG, session.reset());
+			LOG_CALL(LL_DBG, retireSession());
 			try {
 				LOG(LL_NFO, "Creating session...");
 
@@ -994,20 +1102,53 @@ static void* Detour_CreateTexture(void* rcx, char* name, uint32_t r8d, uint32_t
 					LOG_CALL(LL_DBG, config::reload());
 				}
 
-				session.reset(new Encoder::Session());
-				NOT_NULL(session, "Could not create the session");
-				::exportContext.reset(new ExportContext());
-				NOT_NULL(::exportContext, "Could not create export context");
-				::exportContext->pSwapChain = mainSwapChain;
-				::exportContext->pExportRenderTarget = pExportTexture;
+				std::shared_ptr<Encoder::Session> pSession(new Encoder::Session(), deleteSession);
+				NOT_NULL(pSession, "Could not create the session");
+				pSession->threadPolicy.reservedCores = config::reserved_cores;
+				pSession->threadPolicy.encoderAffinityMask = config::encoder_thread_affinity;
+				pSession->threadPolicy.encoderPriority = config::encoder_thread_priority;
+				pSession->threadPolicy.exrAffinityMask = config::exr_thread_affinity;
+				pSession->threadPolicy.exrPriority = config::exr_thread_priority;
+				pSession->threadPolicy.codecThreads = config::codec_threads;
+				pSession->pacingBudget = config::frame_pacing_budget;
+				pSession->spillFolder = config::spill_folder;
+				pSession->spillAfter = config::spill_after;
+				pSession->pipelineDefinition = config::video_pipeline;
+				pSession->frameRangeDefinition = config::frame_ranges;
+				pSession->exportEXR = config::export_openexr;
+				pSession->shutterAngle = config::shutter_angle;
+				pSession->extraOutputDefinition = config::extra_outputs;
+				pSession->imageSequenceLayout = config::image_sequence_layout;
+				pSession->writeManifest = config::output_manifest;
+				pSession->writeJournal = config::export_journal;
+				pSession->gopCacheDirectory = config::gop_cache;
+				pSession->gopCacheLength = config::gop_cache_length;
+				pSession->ladderDefinition = config::resolution_ladder;
+				pSession->qualityProbeInterval = config::quality_probe_interval;
+				pSession->exrShutterDefinition = config::openexr_shutter;
+				pSession->exrChannelDefinition = config::openexr_channels;
+				pSession->hdrDefinition = config::hdr_video;
+				pSession->hdrReferenceWhite = config::hdr_reference_white;
+				pSession->gifDitherDefinition = config::gif_dither;
+				pSession->gifPaletteFrames = config::gif_palette_frames;
+				pSession->lutFile = config::lut_file;
+				pSession->liveURL = config::live_url;
+				pSession->motionBlurInterpolation = config::motion_blur_interpolation;
+				pSession->motionBlurSearchRange = config::motion_blur_search_range;
+				std::shared_ptr<ExportContext> pContext(new ExportContext());
+				NOT_NULL(pContext, "Could not create export context");
+				pContext->pSwapChain = mainSwapChain;
+				pContext->pExportRenderTarget = pExportTexture;
 
 				
-				pExportTexture->GetDevice(::exportContext->pDevice.GetAddressOf());
-				::exportContext->pDevice->GetImmediateContext(::exportContext->pDeviceContext.GetAddressOf());
+				pExportTexture->GetDevice(pContext->pDevice.GetAddressOf());
+				pContext->pDevice->GetImmediateContext(pContext->pDeviceContext.GetAddressOf());
+
+				std::atomic_store(&::exportContext, pContext);
+				std::atomic_store(&::session, pSession);
 			} catch (std::exception& ex) {
 				LOG(LL_ERR, ex.what());
-				LOG_CALL(LL_DBG, session.reset());
-				LOG_CALL(LL_DBG, ::exportContext.reset());
+				LOG_CALL(LL_DBG, retireSession());
 			}
 			//}
 		}
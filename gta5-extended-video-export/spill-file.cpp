@@ -0,0 +1,100 @@
+#include "spill-file.h"
+#include "logger.h"
+#include <sstream>
+
+namespace Encoder {
+
+	namespace {
+		// Positional I/O on a synchronous handle, so reads and writes keep their own offsets.
+		OVERLAPPED at(uint64_t offset) {
+			OVERLAPPED overlapped = {};
+			overlapped.Offset = static_cast<DWORD>(offset);
+			overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+			return overlapped;
+		}
+	}
+
+	SpillFile::~SpillFile() {
+		this->close();
+	}
+
+	HRESULT SpillFile::open(std::string folder) {
+		PRE();
+		std::stringstream name;
+		name << folder;
+		if (!folder.empty() && (folder.back() != '\\') && (folder.back() != '/')) {
+			name << '\\';
+		}
+		name << "EVE-spill-" << GetCurrentProcessId() << "-" << GetTickCount64() << ".tmp";
+		this->path = name.str();
+
+		// Temporary files stay in the file cache as long as there is memory for them.
+		this->hFile = CreateFileA(this->path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (this->hFile == INVALID_HANDLE_VALUE) {
+			LOG(LL_ERR, "Could not create spill file: ", this->path, " (", GetLastError(), ")");
+			POST();
+			return E_FAIL;
+		}
+		this->readOffset = 0;
+		this->writeOffset = 0;
+		this->frames = 0;
+		POST();
+		return S_OK;
+	}
+
+	HRESULT SpillFile::write(const uint8_t* pData, uint64_t size) {
+		if ((this->hFile == INVALID_HANDLE_VALUE) || (size > MAXDWORD)) {
+			return E_FAIL;
+		}
+
+		OVERLAPPED header = at(this->writeOffset);
+		OVERLAPPED body = at(this->writeOffset + sizeof(size));
+		DWORD written = 0;
+		if (!WriteFile(this->hFile, &size, sizeof(size), &written, &header) || (written != sizeof(size))
+			|| !WriteFile(this->hFile, pData, static_cast<DWORD>(size), &written, &body) || (written != size)) {
+			LOG(LL_ERR, "Could not write to spill file: ", this->path, " (", GetLastError(), ")");
+			return E_FAIL;
+		}
+		this->writeOffset += sizeof(size) + size;
+		this->frames++;
+		return S_OK;
+	}
+
+	HRESULT SpillFile::read(std::valarray<uint8_t>& data) {
+		if ((this->hFile == INVALID_HANDLE_VALUE) || (this->frames == 0)) {
+			return E_FAIL;
+		}
+
+		uint64_t size = 0;
+		OVERLAPPED header = at(this->readOffset);
+		DWORD read = 0;
+		if (!ReadFile(this->hFile, &size, sizeof(size), &read, &header) || (read != sizeof(size)) || (size > MAXDWORD)) {
+			LOG(LL_ERR, "Could not read from spill file: ", this->path, " (", GetLastError(), ")");
+			return E_FAIL;
+		}
+		if (data.size() != size) {
+			data.resize(static_cast<size_t>(size));
+		}
+		OVERLAPPED body = at(this->readOffset + sizeof(size));
+		if (!ReadFile(this->hFile, std::begin(data), static_cast<DWORD>(size), &read, &body) || (read != size)) {
+			LOG(LL_ERR, "Could not read from spill file: ", this->path, " (", GetLastError(), ")");
+			return E_FAIL;
+		}
+		this->readOffset += sizeof(size) + size;
+		if (--this->frames == 0) {
+			this->readOffset = 0;
+			this->writeOffset = 0;
+		}
+		return S_OK;
+	}
+
+	void SpillFile::close() {
+		if (this->hFile != INVALID_HANDLE_VALUE) {
+			CloseHandle(this->hFile);
+			this->hFile = INVALID_HANDLE_VALUE;
+		}
+		this->readOffset = 0;
+		this->writeOffset = 0;
+		this->frames = 0;
+	}
+}
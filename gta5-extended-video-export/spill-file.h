@@ -0,0 +1,38 @@
+#pragma once
+
+#include <Windows.h>
+#include <cstdint>
+#include <string>
+#include <valarray>
+
+namespace Encoder {
+	// First in, first out queue of frames in a temporary file, for frames that
+	// would otherwise wait in memory for a busy encoder. Every frame is stored as
+	//   uint64 size | data
+	// and read back in the order it was written. The file is filled from the start
+	// again whenever it has been read empty, and is deleted when it is closed.
+	class SpillFile {
+	public:
+		~SpillFile();
+
+		// Creates the file in the folder.
+		HRESULT open(std::string folder);
+		HRESULT write(const uint8_t* pData, uint64_t size);
+		// Reads the oldest frame that has not been read yet.
+		HRESULT read(std::valarray<uint8_t>& data);
+		void close();
+
+		bool isOpen() const { return this->hFile != INVALID_HANDLE_VALUE; }
+		bool isEmpty() const { return this->frames == 0; }
+		uint64_t getFrames() const { return this->frames; }
+		uint64_t getBytes() const { return this->writeOffset - this->readOffset; }
+		const std::string& getPath() const { return this->path; }
+
+	private:
+		HANDLE hFile = INVALID_HANDLE_VALUE;
+		std::string path;
+		uint64_t readOffset = 0;
+		uint64_t writeOffset = 0;
+		uint64_t frames = 0;
+	};
+}
@@ -0,0 +1,129 @@
+#include "subframe-accumulator.h"
+#include "bulk-copy.h"
+#include "task-scheduler.h"
+#include <algorithm>
+#include <cmath>
+
+namespace Encoder {
+
+	// Minimum number of bytes per accumulation task.
+	const size_t ACCUMULATE_GRAIN = 256 * 1024;
+
+	size_t SubFrameAccumulator::addOutput(uint32_t period, uint32_t window) {
+		Output output;
+		output.period = (std::max)(period, 1u);
+		output.window = (std::max)(window, 1u);
+		this->outputs.push_back(output);
+		return this->outputs.size() - 1;
+	}
+
+	uint32_t SubFrameAccumulator::getShutterWindow(uint32_t period, float angle) {
+		return (std::max)(static_cast<uint32_t>(std::lround(period * angle / 360.0f)), 1u);
+	}
+
+	uint32_t SubFrameAccumulator::getPositionWindow(uint32_t period, float shutterPosition) {
+		uint32_t window = 1;
+		for (uint32_t r = 0; r + 1 < period; r++) {
+			if ((float)r / (float)period >= shutterPosition) {
+				window++;
+			}
+		}
+		return window;
+	}
+
+	bool SubFrameAccumulator::isPassThrough() const {
+		for (auto& output : this->outputs) {
+			if ((output.period != 1) || (output.window != 1)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void SubFrameAccumulator::push(const std::valarray<uint8_t>& subFrame, const Emit& emit) {
+		if (this->sum.size() != subFrame.size()) {
+			// Also the first sub-frame: nothing accumulated so far can be reused.
+			this->sum = std::valarray<uint32_t>(subFrame.size());
+			this->snapshots.clear();
+			this->position = 0;
+		}
+
+		const uint8_t* pSource = std::begin(subFrame);
+		uint32_t* pSum = std::begin(this->sum);
+		TaskScheduler::instance().parallelFor(0, subFrame.size(), ACCUMULATE_GRAIN, [=](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++) {
+				pSum[i] += pSource[i];
+			}
+		});
+		this->position++;
+
+		for (size_t o = 0; o < this->outputs.size(); o++) {
+			const Output& output = this->outputs[o];
+			if (this->position % output.period != 0) {
+				continue;
+			}
+
+			if (output.window == 1) {
+				auto pCopy = std::make_shared<std::valarray<uint8_t>>(subFrame.size());
+				bulkCopy(std::begin(*pCopy), std::begin(subFrame), subFrame.size());
+				emit(o, pCopy);
+				continue;
+			}
+
+			uint64_t start = this->position > output.window ? this->position - output.window : 0;
+			uint32_t count = static_cast<uint32_t>(this->position - start);
+			const uint32_t* pStart = NULL;
+			if (start > 0) {
+				auto it = this->snapshots.find(start);
+				if (it != this->snapshots.end()) {
+					pStart = std::begin(*it->second);
+				}
+			}
+
+			auto pResult = std::make_shared<std::valarray<uint8_t>>(subFrame.size());
+			uint8_t* pDest = std::begin(*pResult);
+			TaskScheduler::instance().parallelFor(0, subFrame.size(), ACCUMULATE_GRAIN, [=](size_t begin, size_t end) {
+				for (size_t i = begin; i < end; i++) {
+					uint32_t windowSum = pSum[i] - (pStart ? pStart[i] : 0);
+					pDest[i] = static_cast<uint8_t>((windowSum + count / 2) / count);
+				}
+			});
+			emit(o, pResult);
+		}
+
+		if (this->isWindowStart(this->position)) {
+			auto pSnapshot = std::make_shared<std::valarray<uint32_t>>(this->sum.size());
+			bulkCopy(std::begin(*pSnapshot), std::begin(this->sum), this->sum.size() * sizeof(uint32_t));
+			this->snapshots[this->position] = pSnapshot;
+		}
+		this->releaseSnapshots();
+	}
+
+	bool SubFrameAccumulator::isWindowStart(uint64_t position) const {
+		// Single sub-frame windows are copied as they come and need no snapshot.
+		for (auto& output : this->outputs) {
+			if ((output.window > 1) && ((position + output.window) % output.period == 0) && (position + output.window > this->position)) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void SubFrameAccumulator::releaseSnapshots() {
+		for (auto it = this->snapshots.begin(); it != this->snapshots.end();) {
+			if (this->isWindowStart(it->first)) {
+				++it;
+			} else {
+				it = this->snapshots.erase(it);
+			}
+		}
+	}
+
+	uint64_t SubFrameAccumulator::getPosition() const {
+		return this->position;
+	}
+
+	size_t SubFrameAccumulator::getSnapshotCount() const {
+		return this->snapshots.size();
+	}
+}
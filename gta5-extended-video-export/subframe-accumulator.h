@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <valarray>
+#include <vector>
+
+namespace Encoder {
+	// Averages a sequence of sub-frames into one or more output streams.
+	// Every sub-frame is added once to a running sum; an output frame is the
+	// difference between the running sum at the end of its window and a snapshot
+	// taken at the start of it. Windows may be longer than the output interval,
+	// so shutters above 360 degrees overlap the previous frames.
+	class SubFrameAccumulator {
+	public:
+		typedef std::function<void(size_t, std::shared_ptr<std::valarray<uint8_t>>)> Emit;
+
+		// Adds an output that completes a frame every `period` sub-frames. Each frame
+		// averages the last `window` sub-frames up to the end of its interval.
+		size_t addOutput(uint32_t period, uint32_t window);
+		// Number of sub-frames a shutter of `angle` degrees stays open for, out of `period`.
+		static uint32_t getShutterWindow(uint32_t period, float angle);
+		// Number of sub-frames blended for a shutter position (1 - motion_blur_strength): those at
+		// or after it within the frame, plus the last one, as motion blur always counted them.
+		static uint32_t getPositionWindow(uint32_t period, float shutterPosition);
+
+		// Returns true if every output passes each sub-frame through unchanged.
+		bool isPassThrough() const;
+
+		// Accumulates one sub-frame and emits the frames of every output that completes with it.
+		void push(const std::valarray<uint8_t>& subFrame, const Emit& emit);
+
+		uint64_t getPosition() const;
+		size_t getSnapshotCount() const;
+
+	private:
+		struct Output {
+			uint32_t period;
+			uint32_t window;
+		};
+
+		bool isWindowStart(uint64_t position) const;
+		void releaseSnapshots();
+
+		std::vector<Output> outputs;
+		uint64_t position = 0;
+		// Sum of every sub-frame so far, modulo 2^32. Differences stay exact
+		// as long as a single window adds up to less than 2^32.
+		std::valarray<uint32_t> sum;
+		// Running sums at the positions where upcoming windows start.
+		std::map<uint64_t, std::shared_ptr<std::valarray<uint32_t>>> snapshots;
+	};
+}
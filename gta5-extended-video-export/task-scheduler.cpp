@@ -0,0 +1,235 @@
+#include "task-scheduler.h"
+#include "logger.h"
+#include <algorithm>
+
+namespace Encoder {
+
+	namespace {
+		const size_t NO_WORKER = static_cast<size_t>(-1);
+		thread_local size_t currentWorker = NO_WORKER;
+	}
+
+	TaskScheduler::TaskScheduler() :
+		isConfigured(false),
+		nextWorker(0),
+		pendingTasks(0)
+	{
+	}
+
+	TaskScheduler& TaskScheduler::instance() {
+		// Intentionally never destroyed: joining worker threads while the
+		// loader lock is held on DLL unload would deadlock.
+		static TaskScheduler* scheduler = new TaskScheduler();
+		return *scheduler;
+	}
+
+	void TaskScheduler::configure(const ThreadPolicy& policy) {
+		PRE();
+		std::lock_guard<std::mutex> lock(this->mxConfigure);
+
+		if (!this->isConfigured) {
+			uint32_t count = policy.getCodecThreadCount();
+			LOG(LL_NFO, "Starting task scheduler with ", count, " workers");
+			for (uint32_t i = 0; i < count; i++) {
+				this->workers.push_back(std::unique_ptr<Worker>(new Worker()));
+			}
+			for (size_t i = 0; i < this->workers.size(); i++) {
+				this->workers[i]->thread = std::thread(&TaskScheduler::workerLoop, this, i);
+			}
+			this->isConfigured = true;
+		} else if (policy.getCodecThreadCount() != this->workers.size()) {
+			LOG(LL_NFO, "Keeping ", this->workers.size(), " task scheduler workers; codec_threads = ", policy.getCodecThreadCount(), " takes effect after restarting the game");
+		}
+
+		// The worker count is fixed for the lifetime of the process; only the
+		// placement of the workers follows the policy of the current session.
+		for (auto& worker : this->workers) {
+			policy.applyToEncoderThread(worker->thread);
+		}
+		POST();
+	}
+
+	uint32_t TaskScheduler::getWorkerCount() {
+		if (!this->isConfigured) {
+			this->configure(ThreadPolicy());
+		}
+		return static_cast<uint32_t>(this->workers.size());
+	}
+
+	void TaskScheduler::post(Priority priority, Task task) {
+		size_t count = this->getWorkerCount();
+		size_t index = currentWorker < count ? currentWorker : (this->nextWorker++ % count);
+
+		{
+			std::lock_guard<std::mutex> lock(this->mxIdle);
+			this->pendingTasks++;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(this->workers[index]->mx);
+			this->workers[index]->queues[priority].push_back(std::move(task));
+		}
+		this->cvIdle.notify_one();
+	}
+
+	std::future<void> TaskScheduler::submit(Priority priority, Task task) {
+		auto packaged = std::make_shared<std::packaged_task<void()>>(std::move(task));
+		std::future<void> result = packaged->get_future();
+		this->post(priority, [packaged]() { (*packaged)(); });
+		return result;
+	}
+
+	void TaskScheduler::parallelFor(size_t begin, size_t end, size_t grain, std::function<void(size_t, size_t)> body, Priority priority) {
+		if (end <= begin) {
+			return;
+		}
+
+		size_t count = end - begin;
+		size_t workerCount = this->getWorkerCount();
+		grain = (std::max)(grain, (size_t)1);
+		size_t chunks = (std::min)((count + grain - 1) / grain, workerCount * 4);
+
+		if (chunks <= 1) {
+			body(begin, end);
+			return;
+		}
+
+		struct State {
+			std::atomic<size_t> next;
+			std::atomic<size_t> done;
+			std::mutex mx;
+			std::condition_variable cvDone;
+			std::exception_ptr exception;
+		};
+
+		auto state = std::make_shared<State>();
+		state->next = 0;
+		state->done = 0;
+
+		auto run = [state, begin, count, chunks, body]() {
+			size_t i;
+			while ((i = state->next++) < chunks) {
+				try {
+					body(begin + count * i / chunks, begin + count * (i + 1) / chunks);
+				} catch (...) {
+					std::lock_guard<std::mutex> lock(state->mx);
+					state->exception = std::current_exception();
+				}
+				if (++state->done == chunks) {
+					std::lock_guard<std::mutex> lock(state->mx);
+					state->cvDone.notify_all();
+				}
+			}
+		};
+
+		size_t helpers = (std::min)(workerCount, chunks - 1);
+		for (size_t i = 0; i < helpers; i++) {
+			this->post(priority, run);
+		}
+
+		run();
+
+		std::unique_lock<std::mutex> lock(state->mx);
+		state->cvDone.wait(lock, [&state, chunks]() { return state->done == chunks; });
+		if (state->exception) {
+			std::rethrow_exception(state->exception);
+		}
+	}
+
+	void TaskScheduler::workerLoop(size_t index) {
+		currentWorker = index;
+		while (true) {
+			Task task;
+			if (this->tryPop(index, task) || this->trySteal(index, task)) {
+				this->pendingTasks--;
+				try {
+					task();
+				} catch (std::exception& ex) {
+					LOG(LL_ERR, "Task failed: ", ex.what());
+				} catch (...) {
+					LOG(LL_ERR, "Task failed.");
+				}
+				continue;
+			}
+
+			std::unique_lock<std::mutex> lock(this->mxIdle);
+			this->cvIdle.wait(lock, [this]() { return this->pendingTasks > 0; });
+		}
+	}
+
+	bool TaskScheduler::tryPop(size_t index, Task& task) {
+		Worker& worker = *this->workers[index];
+		std::lock_guard<std::mutex> lock(worker.mx);
+		for (int p = 0; p < PRIORITY_COUNT; p++) {
+			if (!worker.queues[p].empty()) {
+				task = std::move(worker.queues[p].back());
+				worker.queues[p].pop_back();
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool TaskScheduler::trySteal(size_t thief, Task& task) {
+		size_t count = this->workers.size();
+		for (int p = 0; p < PRIORITY_COUNT; p++) {
+			for (size_t k = 1; k < count; k++) {
+				Worker& victim = *this->workers[(thief + k) % count];
+				std::lock_guard<std::mutex> lock(victim.mx);
+				if (!victim.queues[p].empty()) {
+					task = std::move(victim.queues[p].front());
+					victim.queues[p].pop_front();
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+
+	TaskScheduler::Strand::Strand(Priority priority) :
+		priority(priority)
+	{
+	}
+
+	TaskScheduler::Strand::~Strand() {
+		this->wait();
+	}
+
+	void TaskScheduler::Strand::post(Task task) {
+		std::lock_guard<std::mutex> lock(this->mx);
+		this->tasks.push_back(std::move(task));
+		if (!this->isRunning) {
+			this->isRunning = true;
+			TaskScheduler::instance().post(this->priority, [this]() { this->drain(); });
+		}
+	}
+
+	void TaskScheduler::Strand::wait() {
+		std::unique_lock<std::mutex> lock(this->mx);
+		this->cvIdle.wait(lock, [this]() { return !this->isRunning && this->tasks.empty(); });
+	}
+
+	void TaskScheduler::Strand::drain() {
+		while (true) {
+			Task task;
+			{
+				std::lock_guard<std::mutex> lock(this->mx);
+				if (this->tasks.empty()) {
+					this->isRunning = false;
+					this->cvIdle.notify_all();
+					return;
+				}
+				task = std::move(this->tasks.front());
+				this->tasks.pop_front();
+			}
+
+			try {
+				task();
+			} catch (std::exception& ex) {
+				LOG(LL_ERR, "Strand task failed: ", ex.what());
+			} catch (...) {
+				LOG(LL_ERR, "Strand task failed.");
+			}
+		}
+	}
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "thread-policy.h"
+
+namespace Encoder {
+	// Process-wide work-stealing scheduler shared by every session stage.
+	// Each worker owns one deque per priority. Owners pop from the back and
+	// idle workers steal from the front of other workers' deques.
+	class TaskScheduler {
+	public:
+		enum Priority {
+			PRIORITY_HIGH = 0,
+			PRIORITY_NORMAL = 1,
+			PRIORITY_LOW = 2,
+			PRIORITY_COUNT = 3
+		};
+
+		typedef std::function<void()> Task;
+
+		// Runs posted tasks one at a time, in posting order, on the shared workers.
+		class Strand {
+		public:
+			Strand(Priority priority);
+			~Strand();
+
+			void post(Task task);
+			void wait();
+
+		private:
+			void drain();
+
+			Priority priority;
+			std::mutex mx;
+			std::condition_variable cvIdle;
+			std::deque<Task> tasks;
+			bool isRunning = false;
+		};
+
+		static TaskScheduler& instance();
+
+		// Starts one worker per codec thread of the first policy. Workers are never added or
+		// removed later, so the codec thread count of later sessions does not change their number.
+		// Tasks must not wait for other threads or for I/O; that would hold up every session.
+		void configure(const ThreadPolicy& policy);
+		uint32_t getWorkerCount();
+
+		void post(Priority priority, Task task);
+		std::future<void> submit(Priority priority, Task task);
+
+		// Splits [begin, end) into chunks of at least `grain` items and runs them on the workers.
+		// The calling thread takes part in the work, so this is safe to call from a task.
+		void parallelFor(size_t begin, size_t end, size_t grain, std::function<void(size_t, size_t)> body, Priority priority = PRIORITY_HIGH);
+
+		TaskScheduler(TaskScheduler const&) = delete;
+		void operator=(TaskScheduler const&) = delete;
+
+	private:
+		struct Worker {
+			std::mutex mx;
+			std::deque<Task> queues[PRIORITY_COUNT];
+			std::thread thread;
+		};
+
+		TaskScheduler();
+
+		void workerLoop(size_t index);
+		bool tryPop(size_t index, Task& task);
+		bool trySteal(size_t thief, Task& task);
+
+		std::mutex mxConfigure;
+		std::atomic<bool> isConfigured;
+		std::vector<std::unique_ptr<Worker>> workers;
+		std::atomic<size_t> nextWorker;
+		std::atomic<size_t> pendingTasks;
+		std::mutex mxIdle;
+		std::condition_variable cvIdle;
+	};
+}
@@ -0,0 +1,107 @@
+#include "thread-policy.h"
+#include "logger.h"
+#include <algorithm>
+
+namespace Encoder {
+
+	uint64_t ThreadPolicy::getProcessMask() const {
+		DWORD_PTR processMask = 0;
+		DWORD_PTR systemMask = 0;
+		if (!GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask) || !processMask) {
+			return 1;
+		}
+		return static_cast<uint64_t>(processMask);
+	}
+
+	uint64_t ThreadPolicy::getAvailableMask() const {
+		uint64_t mask = this->getProcessMask();
+		uint32_t reserved = 0;
+		for (uint32_t i = 0; (i < 64) && (reserved < this->reservedCores); i++) {
+			if (mask & (1ULL << i)) {
+				mask &= ~(1ULL << i);
+				reserved++;
+			}
+		}
+
+		if (mask == 0) {
+			// Never leave our own threads without a processor to run on.
+			return this->getProcessMask();
+		}
+		return mask;
+	}
+
+	uint64_t ThreadPolicy::getEncoderMask() const {
+		uint64_t mask = this->encoderAffinityMask & this->getProcessMask();
+		return mask ? mask : this->getAvailableMask();
+	}
+
+	uint64_t ThreadPolicy::getEXRMask() const {
+		uint64_t mask = this->exrAffinityMask & this->getProcessMask();
+		return mask ? mask : this->getAvailableMask();
+	}
+
+	uint32_t ThreadPolicy::getCodecThreadCount() const {
+		if (this->codecThreads) {
+			return this->codecThreads;
+		}
+		return (std::max)(1u, countBits(this->getAvailableMask()));
+	}
+
+	void ThreadPolicy::applyToEncoderThread(std::thread& thread) const {
+		this->apply(thread.native_handle(), this->getEncoderMask(), this->encoderPriority);
+	}
+
+	void ThreadPolicy::applyToEXRThread(std::thread& thread) const {
+		this->apply(thread.native_handle(), this->getEXRMask(), this->exrPriority);
+	}
+
+	void ThreadPolicy::applyToCurrentThread(uint64_t mask, int priority) const {
+		this->apply(GetCurrentThread(), mask, priority);
+	}
+
+	void ThreadPolicy::apply(HANDLE hThread, uint64_t mask, int priority) const {
+		if (!SetThreadAffinityMask(hThread, static_cast<DWORD_PTR>(mask))) {
+			LOG(LL_WRN, "Failed to set thread affinity mask: ", Logger::hex(mask, 16), " ### error code: ", GetLastError());
+		}
+		if (!SetThreadPriority(hThread, priority)) {
+			LOG(LL_WRN, "Failed to set thread priority: ", priorityToString(priority), " ### error code: ", GetLastError());
+		}
+	}
+
+	void ThreadPolicy::log() const {
+		LOG(LL_NFO, "Thread policy:");
+		LOG(LL_NFO, "  process mask:   ", Logger::hex(this->getProcessMask(), 16));
+		LOG(LL_NFO, "  reserved cores: ", this->reservedCores);
+		LOG(LL_NFO, "  encoder thread: ", Logger::hex(this->getEncoderMask(), 16), " ", priorityToString(this->encoderPriority));
+		LOG(LL_NFO, "  exr thread:     ", Logger::hex(this->getEXRMask(), 16), " ", priorityToString(this->exrPriority));
+		LOG(LL_NFO, "  codec threads:  ", this->getCodecThreadCount());
+	}
+
+	std::string ThreadPolicy::priorityToString(int priority) {
+		switch (priority) {
+		case THREAD_PRIORITY_IDLE:
+			return "idle";
+		case THREAD_PRIORITY_LOWEST:
+			return "lowest";
+		case THREAD_PRIORITY_BELOW_NORMAL:
+			return "below_normal";
+		case THREAD_PRIORITY_NORMAL:
+			return "normal";
+		case THREAD_PRIORITY_ABOVE_NORMAL:
+			return "above_normal";
+		case THREAD_PRIORITY_HIGHEST:
+			return "highest";
+		default:
+			return std::to_string(priority);
+		}
+	}
+
+	uint32_t ThreadPolicy::countBits(uint64_t mask) {
+		uint32_t count = 0;
+		while (mask) {
+			mask &= mask - 1;
+			count++;
+		}
+		return count;
+	}
+}
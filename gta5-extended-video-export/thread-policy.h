@@ -0,0 +1,36 @@
+#pragma once
+
+#include <Windows.h>
+#include <thread>
+#include <string>
+
+namespace Encoder {
+	// Scheduling policy for the threads owned by a session.
+	// A mask of zero means "every processor that is not reserved for the game".
+	struct ThreadPolicy {
+		uint32_t reservedCores = 0;
+		uint64_t encoderAffinityMask = 0;
+		int encoderPriority = THREAD_PRIORITY_NORMAL;
+		uint64_t exrAffinityMask = 0;
+		int exrPriority = THREAD_PRIORITY_NORMAL;
+		uint32_t codecThreads = 0;
+
+		uint64_t getProcessMask() const;
+		uint64_t getAvailableMask() const;
+		uint64_t getEncoderMask() const;
+		uint64_t getEXRMask() const;
+		uint32_t getCodecThreadCount() const;
+
+		void applyToEncoderThread(std::thread& thread) const;
+		void applyToEXRThread(std::thread& thread) const;
+		void applyToCurrentThread(uint64_t mask, int priority) const;
+
+		void log() const;
+
+		static std::string priorityToString(int priority);
+		static uint32_t countBits(uint64_t mask);
+
+	private:
+		void apply(HANDLE hThread, uint64_t mask, int priority) const;
+	};
+}
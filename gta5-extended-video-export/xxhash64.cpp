@@ -0,0 +1,131 @@
+#include "xxhash64.h"
+#include <cstring>
+
+namespace Encoder {
+
+	namespace {
+		const uint64_t PRIME1 = 11400714785074694791ULL;
+		const uint64_t PRIME2 = 14029467366897019727ULL;
+		const uint64_t PRIME3 = 1609587929392839161ULL;
+		const uint64_t PRIME4 = 9650029242287828579ULL;
+		const uint64_t PRIME5 = 2870177450012600261ULL;
+
+		inline uint64_t rotl(uint64_t value, int bits) {
+			return (value << bits) | (value >> (64 - bits));
+		}
+
+		inline uint64_t read64(const uint8_t* p) {
+			uint64_t value;
+			memcpy(&value, p, sizeof(value));
+			return value;
+		}
+
+		inline uint32_t read32(const uint8_t* p) {
+			uint32_t value;
+			memcpy(&value, p, sizeof(value));
+			return value;
+		}
+
+		inline uint64_t round(uint64_t acc, uint64_t input) {
+			acc += input * PRIME2;
+			acc = rotl(acc, 31);
+			return acc * PRIME1;
+		}
+
+		inline uint64_t mergeRound(uint64_t acc, uint64_t value) {
+			acc ^= round(0, value);
+			return acc * PRIME1 + PRIME4;
+		}
+	}
+
+	XXH64::XXH64(uint64_t seed) {
+		this->reset(seed);
+	}
+
+	void XXH64::reset(uint64_t seed) {
+		this->seed = seed;
+		this->acc[0] = seed + PRIME1 + PRIME2;
+		this->acc[1] = seed + PRIME2;
+		this->acc[2] = seed;
+		this->acc[3] = seed - PRIME1;
+		this->bufferSize = 0;
+		this->totalLength = 0;
+	}
+
+	void XXH64::update(const void* pData, size_t length) {
+		const uint8_t* p = static_cast<const uint8_t*>(pData);
+		const uint8_t* end = p + length;
+		this->totalLength += length;
+
+		if (this->bufferSize + length < sizeof(this->buffer)) {
+			memcpy(this->buffer + this->bufferSize, p, length);
+			this->bufferSize += static_cast<uint32_t>(length);
+			return;
+		}
+
+		if (this->bufferSize > 0) {
+			size_t fill = sizeof(this->buffer) - this->bufferSize;
+			memcpy(this->buffer + this->bufferSize, p, fill);
+			p += fill;
+			for (int i = 0; i < 4; i++) {
+				this->acc[i] = round(this->acc[i], read64(this->buffer + i * 8));
+			}
+			this->bufferSize = 0;
+		}
+
+		while (p + 32 <= end) {
+			this->acc[0] = round(this->acc[0], read64(p));
+			this->acc[1] = round(this->acc[1], read64(p + 8));
+			this->acc[2] = round(this->acc[2], read64(p + 16));
+			this->acc[3] = round(this->acc[3], read64(p + 24));
+			p += 32;
+		}
+
+		memcpy(this->buffer, p, end - p);
+		this->bufferSize = static_cast<uint32_t>(end - p);
+	}
+
+	uint64_t XXH64::digest() const {
+		uint64_t h;
+		if (this->totalLength >= 32) {
+			h = rotl(this->acc[0], 1) + rotl(this->acc[1], 7) + rotl(this->acc[2], 12) + rotl(this->acc[3], 18);
+			for (int i = 0; i < 4; i++) {
+				h = mergeRound(h, this->acc[i]);
+			}
+		} else {
+			h = this->seed + PRIME5;
+		}
+		h += this->totalLength;
+
+		const uint8_t* p = this->buffer;
+		const uint8_t* end = p + this->bufferSize;
+		while (p + 8 <= end) {
+			h ^= round(0, read64(p));
+			h = rotl(h, 27) * PRIME1 + PRIME4;
+			p += 8;
+		}
+		if (p + 4 <= end) {
+			h ^= static_cast<uint64_t>(read32(p)) * PRIME1;
+			h = rotl(h, 23) * PRIME2 + PRIME3;
+			p += 4;
+		}
+		while (p < end) {
+			h ^= (*p) * PRIME5;
+			h = rotl(h, 11) * PRIME1;
+			p++;
+		}
+
+		h ^= h >> 33;
+		h *= PRIME2;
+		h ^= h >> 29;
+		h *= PRIME3;
+		h ^= h >> 32;
+		return h;
+	}
+
+	uint64_t XXH64::hash(const void* pData, size_t length, uint64_t seed) {
+		XXH64 state(seed);
+		state.update(pData, length);
+		return state.digest();
+	}
+}
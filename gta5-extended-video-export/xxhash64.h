@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Encoder {
+	// Streaming XXH64 (https://github.com/Cyan4973/xxHash), so that data can be
+	// hashed in whatever pieces it is written.
+	class XXH64 {
+	public:
+		explicit XXH64(uint64_t seed = 0);
+
+		void reset(uint64_t seed = 0);
+		void update(const void* pData, size_t length);
+		uint64_t digest() const;
+
+		static uint64_t hash(const void* pData, size_t length, uint64_t seed = 0);
+
+	private:
+		uint64_t acc[4];
+		uint8_t buffer[32];
+		uint32_t bufferSize;
+		uint64_t totalLength;
+		uint64_t seed;
+	};
+}